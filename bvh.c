@@ -0,0 +1,477 @@
+/*
+ * Bounding volume hierarchy, see bvh.h.
+ */
+
+#include <assert.h>
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bvh.h"
+
+// Number of bins evaluated per axis when searching for a split.
+#define BVH_BINS 12
+// Nodes this small become leaves. Culling accepts or rejects leaves whole so
+// there is little to gain from going finer.
+#define BVH_MAX_LEAF 8
+// Deeper nodes are forced to be leaves, bounding the traversal stacks.
+#define BVH_MAX_DEPTH 64
+
+static void aabb_empty(struct bvh_aabb *a) {
+	for (int i = 0; i < 3; i++) {
+		a->min[i] = FLT_MAX;
+		a->max[i] = -FLT_MAX;
+	}
+}
+
+static void aabb_grow(struct bvh_aabb *a, const float min[3],
+		const float max[3]) {
+	for (int i = 0; i < 3; i++) {
+		if (min[i] < a->min[i])
+			a->min[i] = min[i];
+		if (max[i] > a->max[i])
+			a->max[i] = max[i];
+	}
+}
+
+// Half the surface area, which is all the SAH needs.
+static float aabb_area(const struct bvh_aabb *a) {
+	float dx = a->max[0] - a->min[0];
+	float dy = a->max[1] - a->min[1];
+	float dz = a->max[2] - a->min[2];
+
+	if (dx < 0.0f)
+		return 0.0f;
+	return dx * dy + dy * dz + dz * dx;
+}
+
+static void node_set_bounds(struct bvh_node *node, const struct bvh_aabb *a) {
+	memcpy(node->min, a->min, sizeof(node->min));
+	memcpy(node->max, a->max, sizeof(node->max));
+}
+
+static uint32_t bin_index(float c, float cmin, float scale) {
+	int b = (int)((c - cmin) * scale);
+
+	if (b < 0)
+		return 0;
+	if (b >= BVH_BINS)
+		return BVH_BINS - 1;
+	return b;
+}
+
+/*
+ * Find the cheapest binned split of prims[first, first + count). Returns
+ * false if every centroid lies in the same place on every axis.
+ */
+static bool find_split(const uint32_t *prims, uint32_t count,
+		const struct bvh_aabb *bounds, const float (*centroids)[3],
+		const struct bvh_aabb *cbounds, int *best_axis,
+		uint32_t *best_bin, float *best_cost) {
+	bool found = false;
+
+	*best_cost = FLT_MAX;
+
+	for (int axis = 0; axis < 3; axis++) {
+		const float cmin = cbounds->min[axis];
+		const float extent = cbounds->max[axis] - cmin;
+		struct bvh_aabb bin_bounds[BVH_BINS], acc;
+		uint32_t bin_count[BVH_BINS] = {0};
+		float left_area[BVH_BINS];
+		uint32_t left_count[BVH_BINS], n;
+		float scale;
+
+		if (extent <= 0.0f)
+			continue;
+		scale = BVH_BINS / extent;
+
+		for (int b = 0; b < BVH_BINS; b++)
+			aabb_empty(&bin_bounds[b]);
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t prim = prims[i];
+			uint32_t b = bin_index(centroids[prim][axis], cmin, scale);
+
+			bin_count[b]++;
+			aabb_grow(&bin_bounds[b], bounds[prim].min,
+				bounds[prim].max);
+		}
+
+		// Sweep from the left, then evaluate each plane from the right.
+		aabb_empty(&acc);
+		n = 0;
+		for (int b = 0; b < BVH_BINS - 1; b++) {
+			aabb_grow(&acc, bin_bounds[b].min, bin_bounds[b].max);
+			n += bin_count[b];
+			left_area[b] = aabb_area(&acc);
+			left_count[b] = n;
+		}
+
+		aabb_empty(&acc);
+		n = 0;
+		for (int b = BVH_BINS - 1; b > 0; b--) {
+			float cost;
+
+			aabb_grow(&acc, bin_bounds[b].min, bin_bounds[b].max);
+			n += bin_count[b];
+			if (n == 0 || left_count[b - 1] == 0)
+				continue;
+
+			cost = left_area[b - 1] * left_count[b - 1] +
+				aabb_area(&acc) * n;
+			if (cost < *best_cost) {
+				*best_cost = cost;
+				*best_axis = axis;
+				*best_bin = b;
+				found = true;
+			}
+		}
+	}
+
+	return found;
+}
+
+void bvh_build(struct bvh *bvh, const struct bvh_aabb *bounds, uint32_t count) {
+	struct {
+		uint32_t node;
+		uint32_t depth;
+	} *stack;
+	float (*centroids)[3];
+	uint32_t sp = 0, max_nodes = count > 0 ? 2 * count - 1 : 1;
+	size_t node_bytes;
+
+	memset(bvh, 0, sizeof(*bvh));
+
+	// Children start at 2, slot 1 being padding, so every pair of siblings
+	// begins on an even index and shares a 64 byte line.
+	node_bytes = (max_nodes + 1) * sizeof(struct bvh_node);
+	node_bytes = (node_bytes + 63) & ~(size_t)63;
+	bvh->nodes = aligned_alloc(64, node_bytes);
+	bvh->ranges = malloc((max_nodes + 1) * sizeof(*bvh->ranges));
+	bvh->prims = malloc(count * sizeof(*bvh->prims));
+	centroids = malloc(count * sizeof(*centroids));
+	stack = malloc(max_nodes * sizeof(*stack));
+	assert(bvh->nodes && bvh->ranges && stack);
+	assert(count == 0 || (bvh->prims && centroids));
+
+	bvh->prim_count = count;
+	for (uint32_t i = 0; i < count; i++) {
+		bvh->prims[i] = i;
+		for (int axis = 0; axis < 3; axis++)
+			centroids[i][axis] = 0.5f * (bounds[i].min[axis] +
+						bounds[i].max[axis]);
+	}
+
+	bvh->nodes[0].first = 0;
+	bvh->nodes[0].count = count;
+	bvh->ranges[0].first = 0;
+	bvh->ranges[0].count = count;
+	// The padding slot is an empty leaf nothing points at.
+	memset(&bvh->nodes[1], 0, sizeof(bvh->nodes[1]));
+	bvh->ranges[1].first = 0;
+	bvh->ranges[1].count = 0;
+	bvh->node_count = 2;
+	stack[sp].node = 0;
+	stack[sp].depth = 0;
+	sp++;
+
+	while (sp > 0) {
+		uint32_t index = stack[--sp].node;
+		uint32_t depth = stack[sp].depth;
+		struct bvh_node *node = &bvh->nodes[index];
+		uint32_t *prims = &bvh->prims[node->first];
+		struct bvh_aabb nb, cb;
+		uint32_t split_bin = 0, left = 0, children;
+		int axis = 0;
+		float cost;
+
+		aabb_empty(&nb);
+		aabb_empty(&cb);
+		for (uint32_t i = 0; i < node->count; i++) {
+			aabb_grow(&nb, bounds[prims[i]].min, bounds[prims[i]].max);
+			aabb_grow(&cb, centroids[prims[i]], centroids[prims[i]]);
+		}
+		if (node->count == 0)
+			memset(&nb, 0, sizeof(nb));
+		node_set_bounds(node, &nb);
+
+		if (node->count <= BVH_MAX_LEAF || depth + 1 >= BVH_MAX_DEPTH)
+			continue;
+
+		if (find_split(prims, node->count, bounds,
+				(const float (*)[3])centroids, &cb, &axis,
+				&split_bin, &cost)) {
+			const float scale = BVH_BINS /
+				(cb.max[axis] - cb.min[axis]);
+			uint32_t i = 0, j = node->count;
+
+			while (i < j) {
+				uint32_t b = bin_index(centroids[prims[i]][axis],
+						cb.min[axis], scale);
+
+				if (b < split_bin) {
+					i++;
+				} else {
+					uint32_t tmp = prims[i];
+
+					prims[i] = prims[--j];
+					prims[j] = tmp;
+				}
+			}
+			left = i;
+		}
+
+		// Coincident centroids, fall back to splitting the list in two.
+		if (left == 0 || left == node->count)
+			left = node->count / 2;
+
+		children = bvh->node_count;
+		bvh->node_count += 2;
+
+		bvh->nodes[children].first = node->first;
+		bvh->nodes[children].count = left;
+		bvh->nodes[children + 1].first = node->first + left;
+		bvh->nodes[children + 1].count = node->count - left;
+		bvh->ranges[children].first = node->first;
+		bvh->ranges[children].count = left;
+		bvh->ranges[children + 1].first = node->first + left;
+		bvh->ranges[children + 1].count = node->count - left;
+
+		node->first = children;
+		node->count = 0;
+
+		stack[sp].node = children + 1;
+		stack[sp].depth = depth + 1;
+		sp++;
+		stack[sp].node = children;
+		stack[sp].depth = depth + 1;
+		sp++;
+	}
+
+	free(stack);
+	free(centroids);
+}
+
+void bvh_refit(struct bvh *bvh, const struct bvh_aabb *bounds) {
+	// Children always come after their parent.
+	for (uint32_t i = bvh->node_count; i-- > 0;) {
+		struct bvh_node *node = &bvh->nodes[i];
+		struct bvh_aabb a;
+
+		aabb_empty(&a);
+		if (node->count > 0) {
+			const uint32_t *prims = &bvh->prims[node->first];
+
+			for (uint32_t j = 0; j < node->count; j++)
+				aabb_grow(&a, bounds[prims[j]].min,
+					bounds[prims[j]].max);
+		} else if (bvh->ranges[i].count > 0) {
+			const struct bvh_node *l = &bvh->nodes[node->first];
+			const struct bvh_node *r = l + 1;
+
+			aabb_grow(&a, l->min, l->max);
+			aabb_grow(&a, r->min, r->max);
+		} else {
+			memset(&a, 0, sizeof(a));
+		}
+		node_set_bounds(node, &a);
+	}
+}
+
+void bvh_destroy(struct bvh *bvh) {
+	free(bvh->nodes);
+	free(bvh->ranges);
+	free(bvh->prims);
+	memset(bvh, 0, sizeof(*bvh));
+}
+
+uint32_t bvh_split(const struct bvh *bvh, struct bvh_task *tasks,
+		uint32_t max_tasks) {
+	uint32_t n = 1;
+
+	if (max_tasks == 0 || bvh->node_count == 0)
+		return 0;
+
+	tasks[0].node = 0;
+	tasks[0].range = bvh->ranges[0];
+
+	// Keep opening the largest internal node while there is room.
+	while (n < max_tasks) {
+		uint32_t best = UINT32_MAX, best_count = 0, children;
+
+		for (uint32_t i = 0; i < n; i++) {
+			const struct bvh_node *node = &bvh->nodes[tasks[i].node];
+
+			if (node->count == 0 && tasks[i].range.count > best_count) {
+				best = i;
+				best_count = tasks[i].range.count;
+			}
+		}
+		if (best == UINT32_MAX)
+			break;
+
+		children = bvh->nodes[tasks[best].node].first;
+		tasks[best].node = children;
+		tasks[best].range = bvh->ranges[children];
+		tasks[n].node = children + 1;
+		tasks[n].range = bvh->ranges[children + 1];
+		n++;
+	}
+
+	return n;
+}
+
+uint32_t bvh_cull(const struct bvh *bvh, uint32_t node,
+		const float planes[6][4], uint32_t *out) {
+	struct {
+		uint32_t node;
+		uint32_t mask;
+	} stack[2 * BVH_MAX_DEPTH];
+	uint32_t sp = 0, n = 0;
+
+	stack[sp].node = node;
+	stack[sp].mask = 0x3f;
+	sp++;
+
+	while (sp > 0) {
+		const uint32_t index = stack[--sp].node;
+		const struct bvh_node *nd = &bvh->nodes[index];
+		uint32_t mask = stack[sp].mask;
+		bool outside = false;
+
+		// Only test the planes the parent was not already inside of.
+		for (int p = 0; p < 6; p++) {
+			const float *pl = planes[p];
+			float d;
+
+			if (!(mask & (1u << p)))
+				continue;
+
+			d = pl[0] * (pl[0] > 0.0f ? nd->max[0] : nd->min[0]) +
+				pl[1] * (pl[1] > 0.0f ? nd->max[1] : nd->min[1]) +
+				pl[2] * (pl[2] > 0.0f ? nd->max[2] : nd->min[2]) +
+				pl[3];
+			if (d < 0.0f) {
+				outside = true;
+				break;
+			}
+
+			d = pl[0] * (pl[0] > 0.0f ? nd->min[0] : nd->max[0]) +
+				pl[1] * (pl[1] > 0.0f ? nd->min[1] : nd->max[1]) +
+				pl[2] * (pl[2] > 0.0f ? nd->min[2] : nd->max[2]) +
+				pl[3];
+			if (d >= 0.0f)
+				mask &= ~(1u << p);
+		}
+		if (outside)
+			continue;
+
+		// Leaves are small enough to accept whole, and subtrees entirely
+		// inside the frustum are emitted without visiting them.
+		if (nd->count > 0 || mask == 0) {
+			const struct bvh_range *range = &bvh->ranges[index];
+
+			memcpy(out + n, bvh->prims + range->first,
+				range->count * sizeof(*out));
+			n += range->count;
+			continue;
+		}
+
+		stack[sp].node = nd->first + 1;
+		stack[sp].mask = mask;
+		sp++;
+		stack[sp].node = nd->first;
+		stack[sp].mask = mask;
+		sp++;
+	}
+
+	return n;
+}
+
+/*
+ * Slab test, returning the entry distance along the ray or FLT_MAX on a miss.
+ */
+static float ray_aabb(const float origin[3], const float inv_dir[3],
+		const float min[3], const float max[3], float tmax) {
+	float tmin = 0.0f;
+
+	for (int axis = 0; axis < 3; axis++) {
+		float t0 = (min[axis] - origin[axis]) * inv_dir[axis];
+		float t1 = (max[axis] - origin[axis]) * inv_dir[axis];
+
+		if (t0 > t1) {
+			float tmp = t0;
+
+			t0 = t1;
+			t1 = tmp;
+		}
+		if (t0 > tmin)
+			tmin = t0;
+		if (t1 < tmax)
+			tmax = t1;
+		if (tmin > tmax)
+			return FLT_MAX;
+	}
+
+	return tmin;
+}
+
+bool bvh_raycast(const struct bvh *bvh, const struct bvh_aabb *bounds,
+		const float origin[3], const float dir[3], uint32_t *hit,
+		float *t) {
+	uint32_t stack[2 * BVH_MAX_DEPTH + 1];
+	uint32_t sp = 0;
+	float inv_dir[3], best = FLT_MAX;
+	bool found = false;
+
+	if (bvh->node_count == 0 || bvh->prim_count == 0)
+		return false;
+
+	for (int axis = 0; axis < 3; axis++)
+		inv_dir[axis] = 1.0f / dir[axis];
+
+	stack[sp++] = 0;
+	while (sp > 0) {
+		const struct bvh_node *nd = &bvh->nodes[stack[--sp]];
+		const struct bvh_node *l, *r;
+		float tl, tr;
+
+		if (ray_aabb(origin, inv_dir, nd->min, nd->max, best) == FLT_MAX)
+			continue;
+
+		if (nd->count > 0) {
+			for (uint32_t i = 0; i < nd->count; i++) {
+				uint32_t prim = bvh->prims[nd->first + i];
+				float tp = ray_aabb(origin, inv_dir,
+						bounds[prim].min,
+						bounds[prim].max, best);
+
+				if (tp < best) {
+					best = tp;
+					*hit = prim;
+					found = true;
+				}
+			}
+			continue;
+		}
+
+		// Visit the nearer child first so the far one is usually pruned.
+		l = &bvh->nodes[nd->first];
+		r = l + 1;
+		tl = ray_aabb(origin, inv_dir, l->min, l->max, best);
+		tr = ray_aabb(origin, inv_dir, r->min, r->max, best);
+		if (tl <= tr) {
+			if (tr != FLT_MAX)
+				stack[sp++] = nd->first + 1;
+			if (tl != FLT_MAX)
+				stack[sp++] = nd->first;
+		} else {
+			if (tl != FLT_MAX)
+				stack[sp++] = nd->first;
+			stack[sp++] = nd->first + 1;
+		}
+	}
+
+	if (found)
+		*t = best;
+	return found;
+}
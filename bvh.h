@@ -0,0 +1,81 @@
+/*
+ * Bounding volume hierarchy over axis aligned bounding boxes.
+ *
+ * The tree is built with the binned surface area heuristic and stored as a
+ * flat array of 32 byte nodes with siblings adjacent from an even index, so a
+ * pair of children shares a cache line; slot 1 is left empty to line them up.
+ * Children always follow their parent in the array which lets bvh_refit()
+ * update bounds in a single reverse sweep when objects move.
+ */
+
+#ifndef BVH_H
+#define BVH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct bvh_aabb {
+	float min[3];
+	float max[3];
+};
+
+/*
+ * Leaves have count > 0 and reference prims[first, first + count). Internal
+ * nodes have count == 0 and their children at first and first + 1.
+ */
+struct bvh_node {
+	float min[3];
+	uint32_t first;
+	float max[3];
+	uint32_t count;
+};
+
+// The range of prims covered by a node's subtree.
+struct bvh_range {
+	uint32_t first;
+	uint32_t count;
+};
+
+struct bvh {
+	struct bvh_node *nodes;
+	struct bvh_range *ranges;
+	uint32_t node_count;
+	// Object indices, reordered so every subtree is contiguous.
+	uint32_t *prims;
+	uint32_t prim_count;
+};
+
+// A subtree handed to one culling worker, see bvh_split().
+struct bvh_task {
+	uint32_t node;
+	struct bvh_range range;
+};
+
+void bvh_build(struct bvh *bvh, const struct bvh_aabb *bounds, uint32_t count);
+void bvh_refit(struct bvh *bvh, const struct bvh_aabb *bounds);
+void bvh_destroy(struct bvh *bvh);
+
+/*
+ * Cut the top of the tree into at most max_tasks independent subtrees which
+ * together cover every prim. Returns the number of tasks.
+ */
+uint32_t bvh_split(const struct bvh *bvh, struct bvh_task *tasks,
+		uint32_t max_tasks);
+
+/*
+ * Append the objects of the given subtree whose bounds intersect the frustum
+ * described by six inward facing planes to out. Returns the number written,
+ * which never exceeds the subtree's prim count.
+ */
+uint32_t bvh_cull(const struct bvh *bvh, uint32_t node,
+		const float planes[6][4], uint32_t *out);
+
+/*
+ * Find the nearest object whose bounds are hit by the ray. Returns false if
+ * nothing is hit.
+ */
+bool bvh_raycast(const struct bvh *bvh, const struct bvh_aabb *bounds,
+		const float origin[3], const float dir[3], uint32_t *hit,
+		float *t);
+
+#endif
@@ -30,19 +30,58 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <X11/Xutil.h>
 
 #include <vulkan/vk_sdk_platform.h>
 #include <vulkan/vulkan.h>
 
 #include "linmath.h"
-
-#define DEMO_TEXTURE_COUNT 1
+#include "bvh.h"
+#include "mesh.h"
+#include "scene.h"
+#include "xform.h"
+#include "ecs.h"
+#include "desc.h"
+#include "graph.h"
+#include "job.h"
+// Generated by the Makefile, see shaders.h there.
+#include "shaders.h"
+
+// Size of the bindless texture array, if the device allows that many.
+#define DEMO_MAX_TEXTURES 4096
 #define APP_SHORT_NAME "cube"
 #define APP_LONG_NAME "The Vulkan Cube Demo Program"
 
 // Allow a maximum of two outstanding presentation operations.
 #define FRAME_LAG 2
+// Entries a present ring holds, a power of two above FRAME_LAG and a marker.
+#define DEMO_PRESENT_RING 8
+// Not an image: the swapchain must be recreated, or has been.
+#define DEMO_PRESENT_OUTDATED UINT32_MAX
+// Steps a second of the update thread, and the bit marking a snapshot not
+// yet taken in demo->snapshot_middle.
+#define DEMO_UPDATE_HZ 60
+#define DEMO_SNAPSHOT_FRESH 0x4u
+
+// Views rendered at once with VK_KHR_multiview. Every implementation of the
+// extension supports at least this many.
+#define DEMO_MAX_VIEWS 6
+// Distance between neighbouring cameras of the multiview rig.
+#define DEMO_VIEW_BASELINE 1.0f
+
+// With --contexts, the most renderers at once, and the frames each draws
+// unless --c says otherwise.
+#define DEMO_MAX_CONTEXTS 64
+#define DEMO_CONTEXT_FRAMES 1000
+// With --split, the most bands a frame is cut into.
+#define DEMO_MAX_BANDS 32
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 
@@ -97,6 +136,31 @@ struct texture_object {
 	int32_t tex_width, tex_height;
 };
 
+/*
+ * A texture file decoded to tightly packed RGBA ahead of the device, see
+ * demo_decode_texture_job(). pixels is NULL if it failed to load.
+ */
+struct demo_texture_data {
+	int32_t width, height;
+	uint8_t *pixels;
+};
+
+// A --shader_dir file read ahead, see demo_read_shader_job().
+struct demo_shader_file {
+	void *code;
+	size_t size;
+};
+
+/*
+ * structure to track all objects related to a buffer.
+ */
+struct buffer_object {
+	VkBuffer buf;
+	VkMemoryAllocateInfo mem_alloc;
+	VkDeviceMemory mem;
+	VkDescriptorBufferInfo buffer_info;
+};
+
 static char *tex_files[] = {"lunarg.ppm"};
 
 static int validation_error = 0;
@@ -111,8 +175,185 @@ struct vkcube_vs_uniform {
 struct vktexcube_vs_uniform {
 	// Must start with MVP
 	float mvp[4][4];
-	float position[12 * 3][4];
-	float attr[12 * 3][4];
+	// Frustum planes in model space, consumed by the culling pass
+	float planes[6][4];
+	uint32_t instance_count;
+	uint32_t pad[3];
+	// One per view, indexed by gl_ViewIndex
+	float view_mvp[DEMO_MAX_VIEWS][4][4];
+};
+
+/*
+ * Per-instance data, laid out to match the std430 Instance struct in
+ * cube.vert and cull.comp.
+ */
+struct demo_instance {
+	float model[4][4];
+	// Bounding sphere: xyz is the centre in object space, w is the radius
+	// after the instance's scale has been applied.
+	float sphere[4];
+	// Index into the texture array, see cube.frag
+	uint32_t texture;
+	// std430 rounds the struct up to its vec4 alignment.
+	uint32_t pad[3];
+};
+
+/*
+ * Per-swapchain-image slot of the indirect buffer, matching the Slot struct in
+ * cull.comp. The culling pass fills in draw.instanceCount and draw_count.
+ */
+struct demo_cull_slot {
+	VkDrawIndexedIndirectCommand draw;
+	uint32_t draw_count;
+};
+
+// Workgroup size of cull.comp.
+#define CULL_GROUP_SIZE 64
+
+// Culling phases, matching PHASE_* in cull.comp.
+#define CULL_PHASE_FRUSTUM 0
+#define CULL_PHASE_EARLY 1
+#define CULL_PHASE_LATE 2
+#define CULL_PHASE_COUNT 3
+
+// Push constants shared by cube.vert and cull.comp.
+struct demo_cull_push {
+	uint32_t slot;
+};
+
+// Most passes in a frame graph, see demo_frame_graph().
+#define DEMO_GRAPH_PASSES 12
+
+struct demo;
+
+// What one pass of a frame graph records.
+struct demo_graph_pass {
+	struct demo *demo;
+	VkRenderPass render_pass;
+	uint32_t slot;
+	uint32_t phase;
+};
+
+// Workgroup size of hiz.comp along each axis.
+#define HIZ_GROUP_SIZE 8
+// Enough depth pyramid levels for a 32768 pixel wide window.
+#define HIZ_MAX_LEVELS 16
+
+// BVH subtrees handed out per culling thread, for load balancing.
+#define CULL_TASKS_PER_THREAD 4
+
+// With --dynamic_record, the fewest draws worth a secondary command buffer,
+// and the most secondaries per job worker, for load balancing.
+#define RECORD_SLICE_DRAWS 256
+#define RECORD_SLICES_PER_WORKER 4
+
+/*
+ * With --hierarchy the instances form articulated objects: trees with
+ * HIERARCHY_FANOUT children per node, HIERARCHY_DEPTH levels deep, whose
+ * inner joints swing about Y.
+ */
+#define HIERARCHY_FANOUT 4
+#define HIERARCHY_DEPTH 3
+// Transform batches claimed by a thread at a time.
+#define HIERARCHY_TASK_BATCHES 64
+
+/*
+ * Components of the instances in the entity store used with --ecs, registered
+ * in this order.
+ */
+enum demo_component {
+	DEMO_PLACEMENT,	// mat4x4 placing the fitted mesh in the world
+	DEMO_SPIN,	// struct demo_spin
+	DEMO_MODEL,	// mat4x4 model matrix
+	DEMO_SPHERE,	// float[4], as in struct demo_instance
+	DEMO_GPU_INDEX,	// uint32_t index into the instance buffer
+	DEMO_COMPONENT_COUNT,
+};
+
+// The cull system only runs with --cpu_cull, so it comes last.
+enum demo_system {
+	DEMO_SYSTEM_SPIN,
+	DEMO_SYSTEM_PACK,
+	DEMO_SYSTEM_CULL,
+	DEMO_SYSTEM_COUNT,
+};
+
+struct demo_spin {
+	// Degrees about the placement's Y axis.
+	float angle;
+	// Multiple of the demo's spin speed.
+	float rate;
+};
+
+// Entities timed by --ecs_bench.
+#define ECS_BENCH_ENTITIES 1000000
+#define ECS_BENCH_ITERATIONS 10
+
+/*
+ * Draw sort keys, most significant first: pipeline, material, then the
+ * quantised view depth so that draws sharing state go front to back. The demo
+ * has a single pipeline, and a single material unless a scene file assigns
+ * them.
+ */
+#define DRAW_KEY_PIPELINE_SHIFT 56
+#define DRAW_KEY_MATERIAL_SHIFT 24
+#define DRAW_KEY_DEPTH_BITS 24
+#define DRAW_KEY_PIPELINE 0
+#define DRAW_KEY_MATERIAL 0
+// Radix sort digits of 8 bits.
+#define DRAW_SORT_DIGITS 8
+#define DRAW_SORT_BUCKETS 256
+
+/*
+ * State shared by the jobs of CPU culling and draw sorting, which split their
+ * work into one piece per job worker, see demo_cull_pool_run(). A job's thread
+ * index names its piece, not the worker running it.
+ *
+ * For culling the BVH is cut into independent subtrees which the threads claim
+ * through next_cull. Each subtree is culled into scratch at the offset of its
+ * own prims, then after the main thread has computed where each result lands
+ * in the compacted visible list, the results are copied out in parallel
+ * through next_copy.
+ *
+ * Sorting splits the visible list into one chunk per thread, and each radix
+ * pass counts and then scatters every chunk between keys[0] and keys[1].
+ *
+ * Transform hierarchy updates run one level at a time, with the threads
+ * claiming runs of the level's dirty batches through next_batch. Entity
+ * systems likewise run one phase at a time, claiming a chunk's job at a time
+ * through next_job.
+ */
+struct demo_cull_pool {
+	// One less than the number of pieces
+	uint32_t thread_count;
+	void (*job)(struct demo *demo, uint32_t thread);
+
+	struct bvh_task *tasks;
+	uint32_t *task_counts;
+	uint32_t *task_offsets;
+	uint32_t task_count;
+	uint32_t *scratch;
+	uint32_t *out;
+	atomic_uint next_cull;
+	atomic_uint next_copy;
+	uint32_t visible_count;
+
+	mat4x4 view_model;
+	uint64_t *keys[2];
+	uint32_t *ids[2];
+	// Per thread counts of each digit, turned into scatter offsets in place
+	uint32_t (*histograms)[DRAW_SORT_DIGITS][DRAW_SORT_BUCKETS];
+	uint32_t sort_digit;
+	uint32_t sort_src;
+
+	struct xform_output xform_out;
+	uint32_t xform_level;
+	atomic_uint next_batch;
+	uint32_t batch_end;
+
+	const struct ecs_job *ecs_jobs;
+	uint32_t ecs_job_count;
+	atomic_uint next_job;
 };
 
 //--------------------------------------------------------------------------------------
@@ -240,9 +481,137 @@ typedef struct {
 	VkImage image;
 	VkCommandBuffer cmd;
 	VkCommandBuffer graphics_to_present_cmd;
+	// With async compute, the culling passes of cmd's frames, and the
+	// graphics timeline value of the last frame drawn to this image
+	VkCommandBuffer compute_cmd;
+	uint64_t graphics_value;
 	VkImageView view;
+	// cmd was recorded with a pipeline variant no longer wanted, or with
+	// the fallback while the wanted one was building
+	bool outdated;
+	bool fallback;
+	// The instances moved since this image's copy of them was written
+	bool instances_stale;
 } SwapchainBuffers;
 
+/*
+ * The spin as of an update step, published by the update thread. The model
+ * turned by spin degrees over the step to reach angle at time, in ms.
+ */
+struct demo_snapshot {
+	double time;
+	float angle;
+	float spin;
+};
+
+struct demo_present_frame {
+	uint32_t image;
+	uint32_t frame_index;
+};
+
+/*
+ * Frames passed one way between the main thread and the present thread.
+ * Only the one pushing moves tail and only the one popping moves head.
+ */
+struct demo_present_ring {
+	_Alignas(64) atomic_uint head;
+	_Alignas(64) atomic_uint tail;
+	struct demo_present_frame frames[DEMO_PRESENT_RING];
+};
+
+/*
+ * A job worker's command pool for one swapchain image, reset as a whole each
+ * time the image comes round, and the secondary command buffers allocated
+ * from it so far.
+ */
+struct demo_record_pool {
+	VkCommandPool pool;
+	VkCommandBuffer *cmds;
+	uint32_t count;
+	uint32_t used;
+};
+
+enum demo_blend {
+	DEMO_BLEND_OPAQUE,
+	DEMO_BLEND_ALPHA,
+	DEMO_BLEND_ADDITIVE,
+	DEMO_BLEND_COUNT,
+};
+
+/*
+ * What varies between graphics pipeline variants. The fields are bytes so
+ * there is no padding to compare, and demo_pipeline_hash() takes them one by
+ * one, so a state hashes the same on every run and build.
+ */
+struct demo_pipeline_state {
+	uint8_t polygon_mode; // VkPolygonMode
+	uint8_t cull_mode; // VkCullModeFlags
+	uint8_t blend; // enum demo_blend
+	uint8_t depth_write;
+	uint8_t textured;
+};
+
+// Most specialization constants any one shader stage takes.
+#define DEMO_MAX_SPEC_CONSTANTS 4
+
+/*
+ * Specialization constants for one shader stage, with constant_id i taking
+ * data[i]. Every constant is 32 bits, including bools.
+ */
+struct demo_specialization {
+	VkSpecializationMapEntry entries[DEMO_MAX_SPEC_CONSTANTS];
+	uint32_t data[DEMO_MAX_SPEC_CONSTANTS];
+	VkSpecializationInfo info;
+};
+
+// A power of two, and more than the variants there are.
+#define DEMO_PIPELINE_MAP_SIZE 64
+#define DEMO_PIPELINE_WORKERS 2
+
+enum demo_pipeline_status {
+	DEMO_PIPELINE_EMPTY,
+	DEMO_PIPELINE_BUILDING,
+	DEMO_PIPELINE_READY,
+};
+
+struct demo_pipeline_entry {
+	// Published after the fields it covers: hash and state once building,
+	// pipeline once ready.
+	atomic_uint status;
+	uint64_t hash;
+	struct demo_pipeline_state state;
+	VkPipeline pipeline;
+};
+
+/*
+ * Open addressed map from pipeline state to pipeline. Lookups of built
+ * variants take no lock. Entries are only claimed and completed under lock,
+ * and never removed until the whole map is cleared with the device idle.
+ *
+ * Claimed entries are queued for the worker threads to build, so an entry
+ * doubles as the future of its pipeline.
+ */
+struct demo_pipeline_map {
+	struct demo_pipeline_entry entries[DEMO_PIPELINE_MAP_SIZE];
+	uint32_t count;
+	pthread_mutex_t lock;
+	pthread_cond_t built;
+
+	pthread_t workers[DEMO_PIPELINE_WORKERS];
+	pthread_cond_t queued;
+	struct demo_pipeline_entry *queue[DEMO_PIPELINE_MAP_SIZE];
+	uint32_t head;
+	uint32_t tail;
+	// Builds taken off the queue and not yet done
+	uint32_t building;
+	bool quit;
+};
+
+static inline bool demo_pipeline_ready(struct demo_pipeline_entry *entry) {
+	return atomic_load_explicit(&entry->status, memory_order_acquire) ==
+		DEMO_PIPELINE_READY;
+}
+
 struct demo {
 	Display* display;
 	xcb_connection_t *connection;
@@ -260,8 +629,19 @@ struct demo {
 	VkDevice device;
 	VkQueue graphics_queue;
 	VkQueue present_queue;
+	VkQueue compute_queue;
 	uint32_t graphics_queue_family_index;
 	uint32_t present_queue_family_index;
+	uint32_t compute_queue_family_index;
+	// With --async_compute, culling goes to a queue family without
+	// graphics, see demo_submit_compute(). Each queue counts its frames
+	// on a timeline semaphore the other waits on.
+	bool async_compute;
+	VkSemaphore compute_timeline;
+	VkSemaphore graphics_timeline;
+	uint64_t compute_value;
+	uint64_t graphics_value;
+	VkCommandPool compute_cmd_pool;
 	VkSemaphore image_acquired_semaphores[FRAME_LAG];
 	VkSemaphore draw_complete_semaphores[FRAME_LAG];
 	VkSemaphore image_ownership_semaphores[FRAME_LAG];
@@ -297,6 +677,25 @@ struct demo {
 	VkPresentModeKHR presentMode;
 	VkFence fences[FRAME_LAG];
 	int frame_index;
+	// Unless --no_present_thread, acquire and present run on a thread of
+	// their own, see demo_present_thread(), so neither blocks the main
+	// thread behind vblank. It acquires up to present_lag images ahead,
+	// which the main thread takes from acquired_frames, draws and hands
+	// back through completed_frames, leaving the submit to it as well, so
+	// it is the only thread using the queues. Either sleeps on
+	// present_wake when its ring is empty.
+	bool present_thread;
+	uint32_t present_lag;
+	pthread_t present_tid;
+	struct demo_present_ring acquired_frames;
+	struct demo_present_ring completed_frames;
+	atomic_uint present_sleepers;
+	pthread_mutex_t present_lock;
+	pthread_cond_t present_wake;
+	atomic_bool present_quit;
+	atomic_bool swapchain_outdated;
+	uint64_t frames_submitted;
+	atomic_ullong frames_presented;
 
 	VkCommandPool cmd_pool;
 	VkCommandPool present_cmd_pool;
@@ -310,35 +709,223 @@ struct demo {
 		VkImageView view;
 	} depth;
 
-	struct texture_object textures[DEMO_TEXTURE_COUNT];
-	struct texture_object staging_texture;
-
+	// Without bindless textures only the first is used.
+	bool bindless;
+	uint32_t texture_capacity;
+	const char **texture_files;
+	uint32_t texture_count;
+	struct texture_object *textures;
+	struct texture_object *staging_textures;
+	struct demo_texture_data *decoded_textures;
+	struct job_counter textures_decoded;
+	// One per embedded shader, with --shader_dir
+	struct demo_shader_file *shader_files;
+	struct job_counter shaders_read;
+
+	struct buffer_object uniform_data;
+
+	// Instanced scene and GPU culling state
+	uint32_t instance_count;
+	bool gpu_cull;
+	bool draw_indirect_count;
+	// One copy of the instances per swapchain image, instance_stride bytes
+	// apart, so updating one never touches what frames in flight read.
+	// Bound at the image's copy with a dynamic offset.
+	struct buffer_object instance_data;
+	VkDeviceSize instance_stride;
+	struct buffer_object vertex_data;
+	struct buffer_object index_data;
+	struct buffer_object visible_data;
+	struct buffer_object indirect_data;
+	// Indexed by phase, built for the phases in use
+	VkPipeline cull_pipelines[CULL_PHASE_COUNT];
+	// Two phase occlusion culling, see cull.comp
+	bool occlusion_cull;
+	struct buffer_object visibility_data;
+	VkRenderPass late_render_pass;
 	struct {
-		VkBuffer buf;
+		VkImage image;
 		VkMemoryAllocateInfo mem_alloc;
 		VkDeviceMemory mem;
-		VkDescriptorBufferInfo buffer_info;
-	} uniform_data;
+		// Every level, as sampled by cull.comp
+		VkImageView view;
+		VkImageView level_views[HIZ_MAX_LEVELS];
+		uint32_t level_count;
+		VkSampler sampler;
+
+		VkDescriptorSetLayout desc_layout;
+		VkPipelineLayout pipeline_layout;
+		VkPipeline pipeline;
+		struct desc_allocator desc_alloc;
+		// Set i reduces level i - 1, or the depth buffer, into level i
+		VkDescriptorSet desc_sets[HIZ_MAX_LEVELS];
+	} hiz;
+#ifdef VK_KHR_draw_indirect_count
+	PFN_vkCmdDrawIndexedIndirectCountKHR fpCmdDrawIndexedIndirectCountKHR;
+#endif
+
+	// CPU copy of the scene, its spatial index and CPU culling state
+	char *mesh_file;
+	struct mesh mesh;
+	char *scene_file;
+	struct scene scene;
+	// Maps the mesh into the [-1, 1] box.
+	mat4x4 mesh_fit;
+	bool hierarchy;
+	struct xform xform;
+	uint32_t hierarchy_object_size;
+	float joint_angle;
+	double hierarchy_time;
+	uint32_t hierarchy_frames;
+	// Entity store spinning the instances with --ecs, see demo_init_ecs()
+	bool ecs;
+	struct ecs_world world;
+	struct ecs_system systems[DEMO_SYSTEM_COUNT];
+	uint32_t system_count;
+	uint32_t system_phases[DEMO_SYSTEM_COUNT];
+	uint32_t phase_count;
+	struct ecs_job *ecs_jobs;
+	uint32_t ecs_chunk_count;
+	uint32_t ecs_chunk_capacity;
+	// The instance buffer, mapped while the pack system runs
+	struct demo_instance *ecs_instances;
+	// Each chunk's visible list, and its length, from the cull system
+	uint32_t *ecs_visible;
+	uint32_t *ecs_visible_counts;
+	double ecs_time;
+	uint32_t ecs_frames;
+	// Runs the CPU side of each frame: updates, culling and recording
+	struct job_system jobs;
+	bool numa;
+	// Startup work overlapping the main thread, see demo_init(). With
+	// --startup-report the main thread's phases are printed as they end,
+	// then the time taken by the work alongside them, in microseconds,
+	// and each pipeline variant's build time as it finishes.
+	struct job_counter window_ready;
+	bool startup_report;
+	double startup_start;
+	double startup_last;
+	atomic_ullong startup_window_us;
+	atomic_ullong startup_shaders_us;
+	atomic_ullong startup_textures_us;
+	atomic_ullong startup_pipelines_us;
+	// With --dynamic_record the draw pass is recorded every frame, as one
+	// secondary command buffer per slice of the visible list. Pools are
+	// per swapchain image and job worker, image major.
+	bool dynamic_record;
+	struct demo_record_pool *record_pools;
+	VkCommandBuffer *record_slices;
+	uint32_t record_slice_count;
+	uint32_t record_slice_max;
+	VkPipeline record_pipeline;
+	double record_time;
+	uint32_t record_frames;
+	uint64_t record_draws;
+	// With --contexts, that many independent renderers run offscreen on
+	// threads of their own, sharing this one's instance, device, pipelines
+	// and read-only buffers and textures, and there is no window. A
+	// context's state is its own; the queue and descriptor allocator they
+	// share are taken under their locks.
+	uint32_t context_count;
+	struct demo_context *contexts;
+	pthread_mutex_t queue_lock;
+	pthread_mutex_t desc_lock;
+	pthread_barrier_t contexts_ready;
+	// With --split, the frame is cut into band_count horizontal bands, each
+	// drawn by a single context in a process of its own, with its own
+	// instance and device, and copied into the final image in memory shared
+	// between them. See demo_run_split(). This process draws rows
+	// [band_top, band_top + band_height), all of them without --split.
+	uint32_t band_count;
+	uint32_t band;
+	uint32_t band_top;
+	uint32_t band_height;
+	struct demo_split *split;
+	bool cpu_cull;
+	struct demo_instance *instances;
+	struct bvh_aabb *instance_bounds;
+	bool *instance_lifted;
+	struct bvh bvh;
+	float cull_planes[6][4];
+	struct demo_cull_pool cull_pool;
+	double cull_time;
+	uint32_t cull_frames;
+	bool sort_draws;
+	double sort_time;
+
+	// Fragment shader invocations per frame, one query per swapchain image
+	bool overdraw_stats;
+	VkQueryPool query_pool;
+	uint64_t fragment_invocations;
+	uint32_t overdraw_frames;
 
 	VkCommandBuffer cmd; // Buffer for initialization commands
 	VkPipelineLayout pipeline_layout;
 	VkDescriptorSetLayout desc_layout;
+	// Load shaders from here rather than those built in
+	char *shader_dir;
+	// Created once per device and kept in a file between runs, see
+	// demo_init_pipeline_cache()
 	VkPipelineCache pipelineCache;
+	char pipeline_cache_path[4096];
+	size_t pipeline_cache_loaded;
+	bool pipeline_cache_reported;
 	VkRenderPass render_pass;
-	VkPipeline pipeline;
+	// Graphics pipeline variants, derived from the first one built, and the
+	// one the command buffers draw with. The base is always built and is
+	// drawn with until the wanted variant is ready.
+	struct demo_pipeline_map pipelines;
+	VkPipeline base_pipeline;
+	struct demo_pipeline_state pipeline_state;
+	struct demo_pipeline_entry *pipeline_entry;
+	bool wireframe_supported;
 
 	mat4x4 projection_matrix;
 	mat4x4 view_matrix;
 	mat4x4 model_matrix;
 
+	// A row of cameras centred on view_matrix. With more than one view the
+	// frame is rendered once with VK_KHR_multiview into the layers of
+	// view_target, which are then tiled across the swapchain image.
+	uint32_t view_count;
+	bool multiview;
+	mat4x4 view_matrices[DEMO_MAX_VIEWS];
+	struct {
+		VkImage image;
+		VkMemoryAllocateInfo mem_alloc;
+		VkDeviceMemory mem;
+		VkImageView view;
+	} view_target;
+
 	float spin_angle;
 	float spin_increment;
 	bool pause;
+	// Unless --no_update_thread, the spin is stepped DEMO_UPDATE_HZ times
+	// a second on a thread of its own, see demo_update_thread(), rather
+	// than once a frame. Snapshots pass through a triple buffer: the
+	// update thread fills snapshot_back and swaps it with snapshot_middle,
+	// marking it fresh, and each frame swaps a fresh one out for its
+	// snapshot_front and interpolates. update_spin carries the spin per
+	// step the other way, 0 while paused.
+	bool update_thread;
+	pthread_t update_tid;
+	atomic_bool update_quit;
+	_Atomic float update_spin;
+	struct demo_snapshot snapshots[3];
+	uint32_t snapshot_back;
+	atomic_uint snapshot_middle;
+	uint32_t snapshot_front;
+	uint32_t update_steps;
 
 	VkShaderModule vert_shader_module;
 	VkShaderModule frag_shader_module;
 
-	VkDescriptorPool desc_pool;
+	// Set layouts and their allocators last until cleanup; a resize just
+	// frees the sets.
+	bool update_templates;
+	struct desc_allocator desc_alloc;
+	// VK_KHR_synchronization2, which the graphs' barriers use if enabled.
+	bool sync2;
 	VkDescriptorSet desc_set;
 
 	VkFramebuffer *framebuffers;
@@ -358,6 +945,54 @@ struct demo {
 	uint32_t queue_family_count;
 };
 
+struct demo_context_target {
+	VkImage image;
+	VkDeviceMemory mem;
+	VkImageView view;
+};
+
+/*
+ * One of the renderers run by --contexts, see demo_run_contexts(). Only its
+ * own thread touches it.
+ */
+struct demo_context {
+	struct demo *demo;
+	uint32_t index;
+	pthread_t thread;
+
+	struct demo_context_target color;
+	struct demo_context_target depth;
+	VkFramebuffer framebuffer;
+	VkCommandPool cmd_pool;
+	// One of each per frame in flight
+	VkCommandBuffer cmds[FRAME_LAG];
+	VkFence fences[FRAME_LAG];
+	struct buffer_object uniforms[FRAME_LAG];
+	VkDescriptorSet desc_sets[FRAME_LAG];
+	// With --split, where the band is read back to
+	struct buffer_object readbacks[FRAME_LAG];
+	uint32_t frame_index;
+
+	mat4x4 model_matrix;
+	uint32_t frames;
+	double time;
+};
+
+/*
+ * Shared between the processes of a --split run, see demo_run_split().
+ */
+struct demo_split {
+	// Every band starts drawing at once, and each finished frame waits for
+	// the others to copy theirs in, so no band gets ahead.
+	pthread_barrier_t started;
+	pthread_barrier_t composited;
+	// Each band's frame loop, on CLOCK_MONOTONIC.
+	double starts[DEMO_MAX_BANDS];
+	double ends[DEMO_MAX_BANDS];
+	// The final image, width by height pixels of demo->format.
+	uint8_t pixels[];
+};
+
 VKAPI_ATTR VkBool32 VKAPI_CALL
 dbgFunc(VkFlags msgFlags, VkDebugReportObjectTypeEXT objType,
 	uint64_t srcObject, size_t location, int32_t msgCode,
@@ -469,73 +1104,142 @@ static void demo_flush_init_cmd(struct demo *demo) {
 	demo->cmd = VK_NULL_HANDLE;
 }
 
-static void demo_set_image_layout(struct demo *demo, VkImage image,
-				VkImageAspectFlags aspectMask,
-				VkImageLayout old_image_layout,
-				VkImageLayout new_image_layout,
-				VkAccessFlagBits srcAccessMask,
-				VkPipelineStageFlags src_stages,
-				VkPipelineStageFlags dest_stages) {
-	assert(demo->cmd);
+// Reset the slot's draw for a culling phase to fill in.
+static void demo_draw_build_reset_cmd(struct demo *demo, VkCommandBuffer cmd_buf,
+				uint32_t slot) {
+	const struct demo_cull_slot reset = {
+		.draw = {
+			.indexCount = demo->mesh.index_count,
+			.instanceCount = 0,
+			.firstIndex = 0,
+			.vertexOffset = 0,
+			.firstInstance = 0,
+		},
+		.draw_count = 0,
+	};
 
-	VkImageMemoryBarrier image_memory_barrier = {
-		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-		.pNext = NULL,
-		.srcAccessMask = srcAccessMask,
-		.dstAccessMask = 0,
-		.oldLayout = old_image_layout,
-		.newLayout = new_image_layout,
-		.image = image,
-		.subresourceRange = {aspectMask, 0, 1, 0, 1}};
-
-	switch (new_image_layout) {
-	case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
-		/* Make sure anything that was copying from this image has completed */
-		image_memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		break;
+	vkCmdUpdateBuffer(cmd_buf, demo->indirect_data.buf,
+			slot * sizeof(struct demo_cull_slot), sizeof(reset),
+			&reset);
+}
 
-	case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-		image_memory_barrier.dstAccessMask =
-			VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-		break;
+// Where the copy of the instances for a culling slot's image starts.
+static uint32_t demo_instance_offset(const struct demo *demo, uint32_t slot) {
+	return (uint32_t)(slot % demo->swapchainImageCount *
+			demo->instance_stride);
+}
 
-	case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-		image_memory_barrier.dstAccessMask =
-			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-		break;
+/*
+ * Record one culling phase for the given slot: test every instance's bounding
+ * sphere and append the survivors to the slot's visible list, bumping the
+ * indirect instance count as we go.
+ */
+static void demo_draw_build_cull_cmd(struct demo *demo, VkCommandBuffer cmd_buf,
+				uint32_t slot, uint32_t phase) {
+	const struct demo_cull_push push = {
+		.slot = slot,
+	};
+	const uint32_t instance_offset = demo_instance_offset(demo, slot);
+
+	vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+			demo->cull_pipelines[phase]);
+	vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+				demo->pipeline_layout, 0, 1, &demo->desc_set, 1,
+				&instance_offset);
+	vkCmdPushConstants(cmd_buf, demo->pipeline_layout,
+			VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+			0, sizeof(push), &push);
+	vkCmdDispatch(cmd_buf,
+		(demo->instance_count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE,
+		1, 1);
+}
 
-	case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-		image_memory_barrier.dstAccessMask =
-			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
-		break;
+/*
+ * Reduce the depth buffer into the depth pyramid sampled by the late culling
+ * phase.
+ */
+static void demo_draw_build_hiz_cmd(struct demo *demo, VkCommandBuffer cmd_buf) {
+	uint32_t i;
 
-	case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
-		image_memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		break;
+	vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+			demo->hiz.pipeline);
 
-	case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
-		image_memory_barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-		break;
+	for (i = 0; i < demo->hiz.level_count; i++) {
+		uint32_t width = demo->width >> i, height = demo->height >> i;
+		// Each level is reduced from the one before.
+		VkImageMemoryBarrier level_barrier = {
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.pNext = NULL,
+			.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+			.oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+			.newLayout = VK_IMAGE_LAYOUT_GENERAL,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = demo->hiz.image,
+			.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1},
+		};
 
-	default:
-		image_memory_barrier.dstAccessMask = 0;
-		break;
+		width = width > 0 ? width : 1;
+		height = height > 0 ? height : 1;
+
+		vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_COMPUTE,
+					demo->hiz.pipeline_layout, 0, 1,
+					&demo->hiz.desc_sets[i], 0, NULL);
+		vkCmdDispatch(cmd_buf,
+			(width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE,
+			(height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+		if (i + 1 < demo->hiz.level_count)
+			vkCmdPipelineBarrier(cmd_buf,
+					VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+					VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+					0, NULL, 0, NULL, 1, &level_barrier);
 	}
+}
 
+/*
+ * Bind everything the draws of a slot need. Secondary command buffers inherit
+ * none of it, so each does this itself.
+ */
+static void demo_draw_bind_state(struct demo *demo, VkCommandBuffer cmd_buf,
+				VkPipeline pipeline, VkDescriptorSet desc_set,
+				uint32_t slot) {
+	const VkDeviceSize vertex_offset = 0;
+	const uint32_t instance_offset = demo_instance_offset(demo, slot);
+	VkViewport viewport;
+	VkRect2D scissor;
 
-	VkImageMemoryBarrier *pmemory_barrier = &image_memory_barrier;
+	vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS,
+				demo->pipeline_layout, 0, 1, &desc_set, 1,
+				&instance_offset);
+	vkCmdPushConstants(cmd_buf, demo->pipeline_layout,
+			VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT,
+			0, sizeof(slot), &slot);
+	vkCmdBindVertexBuffers(cmd_buf, 0, 1, &demo->vertex_data.buf,
+			&vertex_offset);
+	vkCmdBindIndexBuffer(cmd_buf, demo->index_data.buf, 0,
+			VK_INDEX_TYPE_UINT32);
+	memset(&viewport, 0, sizeof(viewport));
+	viewport.height = (float)demo->height;
+	viewport.width = (float)demo->width;
+	viewport.minDepth = (float)0.0f;
+	viewport.maxDepth = (float)1.0f;
+	vkCmdSetViewport(cmd_buf, 0, 1, &viewport);
 
-	vkCmdPipelineBarrier(demo->cmd, src_stages, dest_stages, 0, 0, NULL, 0,
-			NULL, 1, pmemory_barrier);
+	memset(&scissor, 0, sizeof(scissor));
+	scissor.extent.width = demo->width;
+	scissor.extent.height = demo->height;
+	scissor.offset.x = 0;
+	scissor.offset.y = 0;
+	vkCmdSetScissor(cmd_buf, 0, 1, &scissor);
 }
 
-static void demo_draw_build_cmd(struct demo *demo, VkCommandBuffer cmd_buf) {
-	const VkCommandBufferBeginInfo cmd_buf_info = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-		.pNext = NULL,
-		.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
-		.pInheritanceInfo = NULL,
-	};
+/*
+ * Record a render pass drawing the instances in the given slot's visible list.
+ */
+static void demo_draw_build_pass_cmd(struct demo *demo, VkCommandBuffer cmd_buf,
+				VkRenderPass render_pass, uint32_t slot) {
 	const VkClearValue clear_values[2] = {
 		[0] = {.color.float32 = {0.2f, 0.2f, 0.2f, 0.2f}},
 		[1] = {.depthStencil = {1.0f, 0}},
@@ -543,7 +1247,7 @@ static void demo_draw_build_cmd(struct demo *demo, VkCommandBuffer cmd_buf) {
 	const VkRenderPassBeginInfo rp_begin = {
 		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
 		.pNext = NULL,
-		.renderPass = demo->render_pass,
+		.renderPass = render_pass,
 		.framebuffer = demo->framebuffers[demo->current_buffer],
 		.renderArea.offset.x = 0,
 		.renderArea.offset.y = 0,
@@ -552,179 +1256,1572 @@ static void demo_draw_build_cmd(struct demo *demo, VkCommandBuffer cmd_buf) {
 		.clearValueCount = 2,
 		.pClearValues = clear_values,
 	};
-	VkResult U_ASSERT_ONLY err;
+	const VkDeviceSize slot_offset = slot * sizeof(struct demo_cull_slot);
+	const bool ready = demo_pipeline_ready(demo->pipeline_entry);
+
+	demo->buffers[demo->current_buffer].fallback = !ready;
+	if (demo->dynamic_record) {
+		// The slices were recorded for this frame, see
+		// demo_record_draws().
+		vkCmdBeginRenderPass(cmd_buf, &rp_begin,
+				VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		if (demo->record_slice_count > 0)
+			vkCmdExecuteCommands(cmd_buf, demo->record_slice_count,
+					demo->record_slices);
+		vkCmdEndRenderPass(cmd_buf);
+		return;
+	}
 
-	err = vkBeginCommandBuffer(cmd_buf, &cmd_buf_info);
-	assert(!err);
 	vkCmdBeginRenderPass(cmd_buf, &rp_begin, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdBindPipeline(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS, demo->pipeline);
-	vkCmdBindDescriptorSets(cmd_buf, VK_PIPELINE_BIND_POINT_GRAPHICS,
-				demo->pipeline_layout, 0, 1, &demo->desc_set, 0,
-				NULL);
-	VkViewport viewport;
-	memset(&viewport, 0, sizeof(viewport));
-	viewport.height = (float)demo->height;
-	viewport.width = (float)demo->width;
-	viewport.minDepth = (float)0.0f;
-	viewport.maxDepth = (float)1.0f;
-	vkCmdSetViewport(cmd_buf, 0, 1, &viewport);
-
-	VkRect2D scissor;
-	memset(&scissor, 0, sizeof(scissor));
-	scissor.extent.width = demo->width;
-	scissor.extent.height = demo->height;
-	scissor.offset.x = 0;
-	scissor.offset.y = 0;
-	vkCmdSetScissor(cmd_buf, 0, 1, &scissor);
-	vkCmdDraw(cmd_buf, 12 * 3, 1, 0, 0);
-	// Note that ending the renderpass changes the image's layout from
-	// COLOR_ATTACHMENT_OPTIMAL to PRESENT_SRC_KHR
+	demo_draw_bind_state(demo, cmd_buf, ready ?
+			demo->pipeline_entry->pipeline : demo->base_pipeline,
+			demo->desc_set, slot);
+#ifdef VK_KHR_draw_indirect_count
+	if (demo->draw_indirect_count) {
+		// Lets the device skip the draw entirely when nothing survived
+		// culling.
+		demo->fpCmdDrawIndexedIndirectCountKHR(cmd_buf,
+			demo->indirect_data.buf, slot_offset,
+			demo->indirect_data.buf,
+			slot_offset + offsetof(struct demo_cull_slot, draw_count),
+			1, sizeof(struct demo_cull_slot));
+	} else
+#endif
+	{
+		vkCmdDrawIndexedIndirect(cmd_buf, demo->indirect_data.buf,
+					slot_offset, 1,
+					sizeof(struct demo_cull_slot));
+	}
 	vkCmdEndRenderPass(cmd_buf);
+}
 
-	if (demo->separate_present_queue) {
-		// We have to transfer ownership from the graphics queue family to the
-		// present queue family to be able to present.  Note that we don't have
-		// to transfer from present queue family back to graphics queue family at
-		// the start of the next frame because we don't care about the image's
-		// contents at that point.
-		VkImageMemoryBarrier image_ownership_barrier = {
-			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+// Views are tiled across the swapchain image in rows of this many.
+static uint32_t demo_view_columns(const struct demo *demo) {
+	uint32_t columns = 1;
+
+	while (columns * columns < demo->view_count)
+		columns++;
+	return columns;
+}
+
+// Tile the views rendered into the layers of the view target across the
+// swapchain image.
+static void demo_draw_build_composite_cmd(struct demo *demo,
+					VkCommandBuffer cmd_buf) {
+	const uint32_t columns = demo_view_columns(demo);
+	const uint32_t rows = (demo->view_count + columns - 1) / columns;
+	const VkImage image = demo->buffers[demo->current_buffer].image;
+	const VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1,
+					0, 1};
+	const VkClearColorValue clear = {.float32 = {0.2f, 0.2f, 0.2f, 0.2f}};
+	uint32_t i;
+
+	// Clear the tiles left empty when the views don't fill the grid.
+	if (columns * rows > demo->view_count) {
+		const VkMemoryBarrier cleared = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
 			.pNext = NULL,
-			.srcAccessMask = 0,
-			.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-			.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-			.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-			.srcQueueFamilyIndex = demo->graphics_queue_family_index,
-			.dstQueueFamilyIndex = demo->present_queue_family_index,
-			.image = demo->buffers[demo->current_buffer].image,
-			.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}};
-
-		vkCmdPipelineBarrier(cmd_buf,
-				VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-				VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
-				0, NULL, 0, NULL, 1, &image_ownership_barrier);
+			.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		};
+
+		vkCmdClearColorImage(cmd_buf, image,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clear, 1,
+				&range);
+		vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &cleared,
+				0, NULL, 0, NULL);
+	}
+
+	for (i = 0; i < demo->view_count; i++) {
+		const uint32_t column = i % columns, row = i / columns;
+		const VkImageBlit blit = {
+			.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, i, 1},
+			.srcOffsets = {{0, 0, 0}, {demo->width, demo->height, 1}},
+			.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+			.dstOffsets = {
+				{demo->width * column / columns,
+				 demo->height * row / rows, 0},
+				{demo->width * (column + 1) / columns,
+				 demo->height * (row + 1) / rows, 1},
+			},
+		};
+
+		vkCmdBlitImage(cmd_buf, demo->view_target.image,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+			VK_FILTER_LINEAR);
 	}
-	err = vkEndCommandBuffer(cmd_buf);
-	assert(!err);
 }
 
-void demo_build_image_ownership_cmd(struct demo *demo, int i) {
-	VkResult U_ASSERT_ONLY err;
+static void demo_graph_query_begin(VkCommandBuffer cmd_buf, void *ctx) {
+	const struct demo_graph_pass *pass = ctx;
 
-	const VkCommandBufferBeginInfo cmd_buf_info = {
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-		.pNext = NULL,
-		.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
-		.pInheritanceInfo = NULL,
-	};
-	err = vkBeginCommandBuffer(demo->buffers[i].graphics_to_present_cmd,
-				&cmd_buf_info);
-	assert(!err);
+	vkCmdResetQueryPool(cmd_buf, pass->demo->query_pool, pass->slot, 1);
+	vkCmdBeginQuery(cmd_buf, pass->demo->query_pool, pass->slot, 0);
+}
 
-	VkImageMemoryBarrier image_ownership_barrier = {
-		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-		.pNext = NULL,
-		.srcAccessMask = 0,
-		.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-		.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-		.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-		.srcQueueFamilyIndex = demo->graphics_queue_family_index,
-		.dstQueueFamilyIndex = demo->present_queue_family_index,
-		.image = demo->buffers[i].image,
-		.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}};
-
-	vkCmdPipelineBarrier(demo->buffers[i].graphics_to_present_cmd,
-			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0,
-			NULL, 0, NULL, 1, &image_ownership_barrier);
-	err = vkEndCommandBuffer(demo->buffers[i].graphics_to_present_cmd);
-	assert(!err);
+static void demo_graph_query_end(VkCommandBuffer cmd_buf, void *ctx) {
+	const struct demo_graph_pass *pass = ctx;
+
+	vkCmdEndQuery(cmd_buf, pass->demo->query_pool, pass->slot);
 }
 
-void demo_update_data_buffer(struct demo *demo) {
-	mat4x4 MVP, Model, VP;
-	int matrixSize = sizeof(MVP);
-	uint8_t *pData;
-	VkResult U_ASSERT_ONLY err;
+static void demo_graph_reset(VkCommandBuffer cmd_buf, void *ctx) {
+	const struct demo_graph_pass *pass = ctx;
 
-	mat4x4_mul(VP, demo->projection_matrix, demo->view_matrix);
+	demo_draw_build_reset_cmd(pass->demo, cmd_buf, pass->slot);
+}
 
-	// Rotate 22.5 degrees around the Y axis
-	mat4x4_dup(Model, demo->model_matrix);
-	mat4x4_rotate(demo->model_matrix, Model, 0.0f, 1.0f, 0.0f,
-		(float)degreesToRadians(demo->spin_angle));
-	mat4x4_mul(MVP, VP, demo->model_matrix);
+static void demo_graph_cull(VkCommandBuffer cmd_buf, void *ctx) {
+	const struct demo_graph_pass *pass = ctx;
 
-	err = vkMapMemory(demo->device, demo->uniform_data.mem, 0,
-			demo->uniform_data.mem_alloc.allocationSize, 0,
-			(void **)&pData);
-	assert(!err);
+	demo_draw_build_cull_cmd(pass->demo, cmd_buf, pass->slot, pass->phase);
+}
 
-	memcpy(pData, (const void *)&MVP[0][0], matrixSize);
+static void demo_graph_hiz(VkCommandBuffer cmd_buf, void *ctx) {
+	const struct demo_graph_pass *pass = ctx;
 
-	vkUnmapMemory(demo->device, demo->uniform_data.mem);
+	demo_draw_build_hiz_cmd(pass->demo, cmd_buf);
 }
 
-static void demo_draw(struct demo *demo) {
-	VkResult U_ASSERT_ONLY err;
+static void demo_graph_draw(VkCommandBuffer cmd_buf, void *ctx) {
+	const struct demo_graph_pass *pass = ctx;
 
-	// Ensure no more than FRAME_LAG presentations are outstanding
-	vkWaitForFences(demo->device, 1, &demo->fences[demo->frame_index], VK_TRUE, UINT64_MAX);
-	vkResetFences(demo->device, 1, &demo->fences[demo->frame_index]);
+	demo_draw_build_pass_cmd(pass->demo, cmd_buf, pass->render_pass,
+				pass->slot);
+}
 
-	// Get the index of the next available swapchain image:
-	err = demo->fpAcquireNextImageKHR(demo->device, demo->swapchain, UINT64_MAX,
-					demo->image_acquired_semaphores[demo->frame_index], demo->fences[demo->frame_index],
-					&demo->current_buffer);
+static void demo_graph_composite(VkCommandBuffer cmd_buf, void *ctx) {
+	const struct demo_graph_pass *pass = ctx;
 
-	if (err == VK_ERROR_OUT_OF_DATE_KHR) {
-		// demo->swapchain is out of date (e.g. the window was resized) and
-		// must be recreated:
-		demo->frame_index += 1;
-		demo->frame_index %= FRAME_LAG;
+	demo_draw_build_composite_cmd(pass->demo, cmd_buf);
+}
+
+static void demo_graph_use(struct graph *graph, uint32_t pass,
+			uint32_t resource, VkPipelineStageFlags stages,
+			VkAccessFlags access, VkImageLayout layout) {
+	const struct graph_access use = {
+		.resource = resource,
+		.stages = stages,
+		.access = access,
+		.layout = layout,
+		.final_layout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.discard = false,
+	};
+
+	graph_use(graph, pass, &use);
+}
+
+// The resources of a slot, see demo_draw_build_cmd().
+struct demo_graph_slot {
+	uint32_t indirect;
+	uint32_t visible;
+};
+
+static struct demo_graph_slot demo_graph_import_slot(struct demo *demo,
+						struct graph *graph,
+						uint32_t slot) {
+	const struct graph_state unused = {
+		.layout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.queue_family = VK_QUEUE_FAMILY_IGNORED,
+	};
+	const VkDeviceSize list_size = demo->instance_count * sizeof(uint32_t);
+	struct demo_graph_slot resources;
+
+	resources.indirect = graph_import_buffer(graph,
+				demo->indirect_data.buf,
+				slot * sizeof(struct demo_cull_slot),
+				sizeof(struct demo_cull_slot), &unused, true);
+	resources.visible = graph_import_buffer(graph, demo->visible_data.buf,
+						slot * list_size, list_size,
+						&unused, true);
+	return resources;
+}
+
+/*
+ * Add a culling phase filling in a slot: reset its draw, then run the culling
+ * pass over every instance.
+ */
+static void demo_graph_add_cull(struct demo *demo, struct graph *graph,
+				struct demo_graph_pass *ctxs,
+				const struct demo_graph_slot *slot,
+				uint32_t visibility, uint32_t hiz) {
+	const struct graph_access reset = {
+		.resource = slot->indirect,
+		.stages = VK_PIPELINE_STAGE_TRANSFER_BIT,
+		.access = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.discard = true,
+	};
+	const struct graph_access list = {
+		.resource = slot->visible,
+		.stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		.access = VK_ACCESS_SHADER_WRITE_BIT,
+		.discard = true,
+	};
+	const uint32_t family = demo->async_compute ?
+		demo->compute_queue_family_index :
+		demo->graphics_queue_family_index;
+	uint32_t pass;
+
+	pass = graph_add_pass(graph, family, demo_graph_reset, &ctxs[0]);
+	graph_use(graph, pass, &reset);
+
+	pass = graph_add_pass(graph, family, demo_graph_cull, &ctxs[1]);
+	demo_graph_use(graph, pass, slot->indirect,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, 0);
+	graph_use(graph, pass, &list);
+	// Earlier phases and frames read and write the visibility buffer.
+	demo_graph_use(graph, pass, visibility,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, 0);
+	if (ctxs[1].phase == CULL_PHASE_LATE)
+		demo_graph_use(graph, pass, hiz,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL);
+}
+
+/*
+ * Add a render pass drawing a slot. The first render pass of the frame clears
+ * the attachments, which go from layout to final_layout.
+ */
+static void demo_graph_add_draw(struct demo *demo, struct graph *graph,
+				struct demo_graph_pass *ctx,
+				const struct demo_graph_slot *slot,
+				uint32_t color, uint32_t depth, bool first,
+				VkImageLayout final_layout) {
+	const struct graph_access color_use = {
+		.resource = color,
+		.stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		.access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+			(first ? 0 : VK_ACCESS_COLOR_ATTACHMENT_READ_BIT),
+		.layout = first ? VK_IMAGE_LAYOUT_UNDEFINED :
+			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+		.final_layout = final_layout,
+		.discard = first,
+	};
+	const struct graph_access depth_use = {
+		.resource = depth,
+		.stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+			VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		.layout = first ? VK_IMAGE_LAYOUT_UNDEFINED :
+			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		.final_layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		.discard = first,
+	};
+	const uint32_t pass = graph_add_pass(graph,
+					demo->graphics_queue_family_index,
+					demo_graph_draw, ctx);
+
+	graph_use(graph, pass, &color_use);
+	graph_use(graph, pass, &depth_use);
+	if (slot) {
+		demo_graph_use(graph, pass, slot->indirect,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+			VK_ACCESS_INDIRECT_COMMAND_READ_BIT, 0);
+		demo_graph_use(graph, pass, slot->visible,
+			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT, 0);
+	}
+}
+
+/*
+ * Declare the passes of a frame drawing to the given swapchain image, in the
+ * order they run, from the overdraw query to the present. The barriers
+ * between them, and the hand over to the present queue, come from the graph.
+ */
+static void demo_frame_graph(struct demo *demo, struct graph *graph,
+			uint32_t image,
+			struct demo_graph_pass ctxs[DEMO_GRAPH_PASSES]) {
+	const struct graph_state unused = {
+		.layout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.queue_family = VK_QUEUE_FAMILY_IGNORED,
+	};
+	// The submit waits for the swapchain image at the color attachment
+	// output stage, so its first use has to be ordered after that stage.
+	const struct graph_state acquired = {
+		.layout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.queue_family = VK_QUEUE_FAMILY_IGNORED,
+		.write_stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+	};
+	const struct graph_state hiz_initial = {
+		.layout = VK_IMAGE_LAYOUT_GENERAL,
+		.queue_family = VK_QUEUE_FAMILY_IGNORED,
+	};
+	const VkImageSubresourceRange color_range = {
+		VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+	const VkImageSubresourceRange view_range = {
+		VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, demo->view_count};
+	const VkImageSubresourceRange depth_range = {
+		VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1};
+	const VkImageSubresourceRange hiz_range = {
+		VK_IMAGE_ASPECT_COLOR_BIT, 0, demo->hiz.level_count, 0, 1};
+	const uint32_t late_slot = image + demo->swapchainImageCount;
+	// Where the render passes leave the color attachment.
+	const VkImageLayout rendered = demo->multiview ?
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL :
+		VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	struct demo_graph_slot slots[2];
+	uint32_t swapchain, color, depth, visibility = 0, hiz = 0;
+	uint32_t n = 0, pass;
+
+	memset(ctxs, 0, DEMO_GRAPH_PASSES * sizeof(*ctxs));
+	for (uint32_t i = 0; i < DEMO_GRAPH_PASSES; i++) {
+		ctxs[i].demo = demo;
+		ctxs[i].slot = image;
+	}
+
+	swapchain = graph_import_image(graph, demo->buffers[image].image,
+				&color_range, &acquired, false);
+	color = demo->multiview ?
+		graph_import_image(graph, demo->view_target.image,
+				&view_range, &unused, true) : swapchain;
+	depth = graph_import_image(graph, demo->depth.image, &depth_range,
+				&unused, true);
+	if (demo->gpu_cull) {
+		slots[0] = demo_graph_import_slot(demo, graph, image);
+		visibility = graph_import_buffer(graph,
+					demo->visibility_data.buf, 0,
+					VK_WHOLE_SIZE, &unused, true);
+	}
+	if (demo->occlusion_cull) {
+		slots[1] = demo_graph_import_slot(demo, graph, late_slot);
+		hiz = graph_import_image(graph, demo->hiz.image, &hiz_range,
+					&hiz_initial, true);
+	}
+
+	if (demo->overdraw_stats)
+		graph_add_pass(graph, demo->graphics_queue_family_index,
+			demo_graph_query_begin, &ctxs[n++]);
+
+	if (demo->occlusion_cull) {
+		const struct graph_access depth_read = {
+			.resource = depth,
+			.stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			.access = VK_ACCESS_SHADER_READ_BIT,
+			.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+		};
+		const struct graph_access hiz_write = {
+			.resource = hiz,
+			.stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			.access = VK_ACCESS_SHADER_READ_BIT |
+				VK_ACCESS_SHADER_WRITE_BIT,
+			.layout = VK_IMAGE_LAYOUT_GENERAL,
+			.discard = true,
+		};
+
+		ctxs[n + 1].phase = CULL_PHASE_EARLY;
+		demo_graph_add_cull(demo, graph, &ctxs[n], &slots[0],
+				visibility, hiz);
+		n += 2;
+		ctxs[n].render_pass = demo->render_pass;
+		demo_graph_add_draw(demo, graph, &ctxs[n++], &slots[0], color,
+				depth, true,
+				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+		pass = graph_add_pass(graph, demo->graphics_queue_family_index,
+				demo_graph_hiz, &ctxs[n++]);
+		graph_use(graph, pass, &depth_read);
+		graph_use(graph, pass, &hiz_write);
+
+		ctxs[n].slot = ctxs[n + 1].slot = late_slot;
+		ctxs[n + 1].phase = CULL_PHASE_LATE;
+		demo_graph_add_cull(demo, graph, &ctxs[n], &slots[1],
+				visibility, hiz);
+		n += 2;
+		ctxs[n].render_pass = demo->late_render_pass;
+		ctxs[n].slot = late_slot;
+		demo_graph_add_draw(demo, graph, &ctxs[n++], &slots[1], color,
+				depth, false, rendered);
+	} else {
+		if (demo->gpu_cull) {
+			ctxs[n + 1].phase = CULL_PHASE_FRUSTUM;
+			demo_graph_add_cull(demo, graph, &ctxs[n], &slots[0],
+					visibility, hiz);
+			n += 2;
+		}
+		ctxs[n].render_pass = demo->render_pass;
+		demo_graph_add_draw(demo, graph, &ctxs[n++],
+				demo->gpu_cull ? &slots[0] : NULL, color,
+				depth, true, rendered);
+	}
+
+	if (demo->overdraw_stats)
+		graph_add_pass(graph, demo->graphics_queue_family_index,
+			demo_graph_query_end, &ctxs[n++]);
+
+	if (demo->multiview) {
+		const struct graph_access blit_dst = {
+			.resource = swapchain,
+			.stages = VK_PIPELINE_STAGE_TRANSFER_BIT,
+			.access = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.discard = true,
+		};
+
+		pass = graph_add_pass(graph, demo->graphics_queue_family_index,
+				demo_graph_composite, &ctxs[n++]);
+		demo_graph_use(graph, pass, color,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_TRANSFER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+		graph_use(graph, pass, &blit_dst);
+	}
+
+	// Presentation, which with a separate present queue makes the graph
+	// hand the image over to that queue's family. The present queue's
+	// submit waits at the color attachment output stage.
+	pass = graph_add_pass(graph, demo->present_queue_family_index, NULL,
+			NULL);
+	demo_graph_use(graph, pass, swapchain,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+		VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+	assert(n <= DEMO_GRAPH_PASSES);
+	graph_compile(graph);
+}
+
+static void demo_draw_build_cmd(struct demo *demo, VkCommandBuffer cmd_buf) {
+	const VkCommandBufferBeginInfo cmd_buf_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = NULL,
+		.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
+		.pInheritanceInfo = NULL,
+	};
+	struct demo_graph_pass ctxs[DEMO_GRAPH_PASSES];
+	struct graph graph;
+	VkResult U_ASSERT_ONLY err;
+
+	err = vkBeginCommandBuffer(cmd_buf, &cmd_buf_info);
+	assert(!err);
+
+	// Each swapchain image owns a slot of the visible list and the indirect
+	// buffer, so the command buffers can be recorded once and never touched
+	// again as visibility changes. The late occlusion phase gets a second
+	// set of slots after the first.
+	graph_init(&graph, demo->device, &demo->memory_properties, demo->sync2);
+	demo_frame_graph(demo, &graph, demo->current_buffer, ctxs);
+	graph_record(&graph, demo->graphics_queue_family_index, cmd_buf);
+
+	err = vkEndCommandBuffer(cmd_buf);
+	assert(!err);
+
+	if (demo->async_compute) {
+		// The culling passes, and the releases of what they wrote to
+		// the graphics queue.
+		const VkCommandBuffer compute_cmd =
+			demo->buffers[demo->current_buffer].compute_cmd;
+
+		err = vkBeginCommandBuffer(compute_cmd, &cmd_buf_info);
+		assert(!err);
+		graph_record(&graph, demo->compute_queue_family_index,
+			compute_cmd);
+		err = vkEndCommandBuffer(compute_cmd);
+		assert(!err);
+	}
+	graph_destroy(&graph);
+}
+
+/*
+ * Record the present queue's side of a frame, acquiring the swapchain image
+ * the graphics queue released to it.
+ */
+void demo_build_image_ownership_cmd(struct demo *demo, int i) {
+	const VkCommandBufferBeginInfo cmd_buf_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = NULL,
+		.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
+		.pInheritanceInfo = NULL,
+	};
+	struct demo_graph_pass ctxs[DEMO_GRAPH_PASSES];
+	struct graph graph;
+	VkResult U_ASSERT_ONLY err;
+
+	err = vkBeginCommandBuffer(demo->buffers[i].graphics_to_present_cmd,
+				&cmd_buf_info);
+	assert(!err);
+
+	graph_init(&graph, demo->device, &demo->memory_properties, demo->sync2);
+	demo_frame_graph(demo, &graph, i, ctxs);
+	graph_record(&graph, demo->present_queue_family_index,
+		demo->buffers[i].graphics_to_present_cmd);
+	graph_destroy(&graph);
+
+	err = vkEndCommandBuffer(demo->buffers[i].graphics_to_present_cmd);
+	assert(!err);
+}
+
+/*
+ * Extract the six clip planes of the given matrix, normalised so that the
+ * signed distance of a point can be compared against a sphere radius. Planes
+ * face inwards. The near plane is at z = 0 as Vulkan clips depth to [0, 1].
+ */
+static void demo_frustum_planes(mat4x4 M, float planes[6][4]) {
+	int i, j;
+
+	for (j = 0; j < 4; j++) {
+		planes[0][j] = M[j][3] + M[j][0]; // left
+		planes[1][j] = M[j][3] - M[j][0]; // right
+		planes[2][j] = M[j][3] + M[j][1]; // bottom
+		planes[3][j] = M[j][3] - M[j][1]; // top
+		planes[4][j] = M[j][2];		  // near
+		planes[5][j] = M[j][3] - M[j][2]; // far
+	}
+
+	for (i = 0; i < 6; i++) {
+		float len = sqrtf(planes[i][0] * planes[i][0] +
+				planes[i][1] * planes[i][1] +
+				planes[i][2] * planes[i][2]);
+
+		for (j = 0; j < 4; j++)
+			planes[i][j] /= len;
+	}
+}
+
+/*
+ * Model-view-projection matrices of every view, and frustum planes enclosing
+ * all of them for culling. The cameras are translated copies of each other
+ * along their x axis, so their frusta differ only in the left and right planes
+ * and the outermost two bound the rest.
+ */
+static void demo_view_mvps(struct demo *demo, mat4x4 *mvps,
+			float planes[6][4]) {
+	float right[6][4];
+	uint32_t i;
+
+	for (i = 0; i < demo->view_count; i++) {
+		mat4x4 VP;
+
+		mat4x4_mul(VP, demo->projection_matrix, demo->view_matrices[i]);
+		mat4x4_mul(mvps[i], VP, demo->model_matrix);
+	}
+	demo_frustum_planes(mvps[0], planes);
+	demo_frustum_planes(mvps[demo->view_count - 1], right);
+	memcpy(planes[1], right[1], sizeof(planes[1]));
+}
+
+static double demo_time_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// With --startup-report, print how long the main thread took over a phase.
+static void demo_startup_phase(struct demo *demo, const char *name) {
+	const double now = demo_time_ms();
+
+	if (demo->startup_report && demo->startup_last > 0.0)
+		printf("Startup: %-28s %8.2f ms\n", name,
+			now - demo->startup_last);
+	demo->startup_last = now;
+}
+
+static void demo_cull_pool_piece(void *ctx, uint32_t first, uint32_t last,
+				uint32_t worker UNUSED) {
+	struct demo *demo = ctx;
+
+	for (uint32_t i = first; i < last; i++)
+		demo->cull_pool.job(demo, i);
+}
+
+/*
+ * Run job once for every piece across the job workers, returning once all of
+ * them are done. Safe to call from any worker.
+ */
+static void demo_cull_pool_run(struct demo *demo,
+			void (*job)(struct demo *demo, uint32_t thread)) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+
+	pool->job = job;
+	job_parallel_for(&demo->jobs, demo_cull_pool_piece, demo, 0,
+			pool->thread_count + 1, 1);
+}
+
+static void demo_cull_job(struct demo *demo, uint32_t thread UNUSED) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+	uint32_t t;
+
+	while ((t = atomic_fetch_add(&pool->next_cull, 1)) < pool->task_count) {
+		const struct bvh_task *task = &pool->tasks[t];
+
+		pool->task_counts[t] = bvh_cull(&demo->bvh, task->node,
+					(const float (*)[4])demo->cull_planes,
+					pool->scratch + task->range.first);
+	}
+}
+
+static void demo_copy_job(struct demo *demo, uint32_t thread UNUSED) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+	uint32_t t;
+
+	while ((t = atomic_fetch_add(&pool->next_copy, 1)) < pool->task_count)
+		memcpy(pool->out + pool->task_offsets[t],
+			pool->scratch + pool->tasks[t].range.first,
+			pool->task_counts[t] * sizeof(uint32_t));
+}
+
+static void demo_hierarchy_job(struct demo *demo, uint32_t thread UNUSED) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+	uint32_t b;
+
+	while ((b = atomic_fetch_add(&pool->next_batch,
+					HIERARCHY_TASK_BATCHES)) < pool->batch_end)
+		xform_update_batches(&demo->xform, pool->xform_level, b,
+				b + HIERARCHY_TASK_BATCHES < pool->batch_end ?
+				b + HIERARCHY_TASK_BATCHES : pool->batch_end,
+				&pool->xform_out);
+}
+
+static void demo_ecs_job(struct demo *demo, uint32_t thread UNUSED) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+	uint32_t j;
+
+	while ((j = atomic_fetch_add(&pool->next_job, 1)) < pool->ecs_job_count)
+		ecs_job_run(&pool->ecs_jobs[j]);
+}
+
+/*
+ * The per entity work of each system, shared with the array of structs
+ * baseline in demo_ecs_bench(). Callers pass the demo's state in locals, which
+ * the compiler can keep in registers while the entities are written.
+ */
+static void demo_spin_entity(float speed, mat4x4 fit, mat4x4 placement,
+			struct demo_spin *spin, mat4x4 model) {
+	mat4x4 rotated;
+
+	spin->angle += spin->rate * speed;
+	mat4x4_rotate_Y(rotated, placement,
+			(float)degreesToRadians(spin->angle));
+	mat4x4_mul(model, rotated, fit);
+}
+
+static bool demo_sphere_visible(const float planes[6][4], mat4x4 model,
+				const float sphere[4]) {
+	vec4 local = {sphere[0], sphere[1], sphere[2], 1.0f}, centre;
+
+	mat4x4_mul_vec4(centre, model, local);
+	for (int i = 0; i < 6; i++) {
+		const float *pl = planes[i];
+
+		if (pl[0] * centre[0] + pl[1] * centre[1] + pl[2] * centre[2] +
+				pl[3] < -sphere[3])
+			return false;
+	}
+	return true;
+}
+
+static void demo_pack_entity(struct demo_instance *instance, mat4x4 model,
+			const float sphere[4]) {
+	memcpy(instance->model, model, sizeof(instance->model));
+	memcpy(instance->sphere, sphere, sizeof(instance->sphere));
+}
+
+static void demo_spin_system(struct ecs_chunk *chunk, uint32_t index UNUSED,
+			void *ctx) {
+	const struct demo *demo = ctx;
+	const float speed = demo->spin_angle;
+	mat4x4 *placements = ecs_column(chunk, DEMO_PLACEMENT);
+	struct demo_spin *spins = ecs_column(chunk, DEMO_SPIN);
+	mat4x4 *models = ecs_column(chunk, DEMO_MODEL);
+	mat4x4 fit;
+
+	memcpy(fit, demo->mesh_fit, sizeof(fit));
+	for (uint32_t i = 0; i < chunk->count; i++)
+		demo_spin_entity(speed, fit, placements[i], &spins[i],
+				models[i]);
+}
+
+static void demo_cull_system(struct ecs_chunk *chunk, uint32_t index,
+			void *ctx) {
+	struct demo *demo = ctx;
+	mat4x4 *models = ecs_column(chunk, DEMO_MODEL);
+	const float (*spheres)[4] = ecs_column(chunk, DEMO_SPHERE);
+	const uint32_t *gpu_indices = ecs_column(chunk, DEMO_GPU_INDEX);
+	uint32_t *visible = demo->ecs_visible + index * demo->ecs_chunk_capacity;
+	uint32_t count = 0;
+	float planes[6][4];
+
+	memcpy(planes, demo->cull_planes, sizeof(planes));
+	for (uint32_t i = 0; i < chunk->count; i++) {
+		if (demo_sphere_visible((const float (*)[4])planes, models[i],
+					spheres[i]))
+			visible[count++] = gpu_indices[i];
+	}
+	demo->ecs_visible_counts[index] = count;
+}
+
+static void demo_pack_system(struct ecs_chunk *chunk, uint32_t index UNUSED,
+			void *ctx) {
+	struct demo *demo = ctx;
+	mat4x4 *models = ecs_column(chunk, DEMO_MODEL);
+	const float (*spheres)[4] = ecs_column(chunk, DEMO_SPHERE);
+	const uint32_t *gpu_indices = ecs_column(chunk, DEMO_GPU_INDEX);
+
+	for (uint32_t i = 0; i < chunk->count; i++)
+		demo_pack_entity(&demo->ecs_instances[gpu_indices[i]],
+				models[i], spheres[i]);
+}
+
+// The part of the visible list a thread handles when sorting.
+static void demo_sort_chunk(struct demo *demo, uint32_t thread,
+			uint32_t *first, uint32_t *last) {
+	const uint64_t count = demo->cull_pool.visible_count;
+	const uint64_t threads = demo->cull_pool.thread_count + 1;
+
+	*first = count * thread / threads;
+	*last = count * (thread + 1) / threads;
+}
+
+/*
+ * Build the sort key of every visible instance, and histograms of every digit
+ * of them for the thread's chunk. The keys order draws by pipeline, then
+ * material, then front to back.
+ */
+static void demo_sort_key_job(struct demo *demo, uint32_t thread) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+	uint32_t (*histograms)[DRAW_SORT_BUCKETS] = pool->histograms[thread];
+	uint32_t first, last, i;
+	int d;
+
+	demo_sort_chunk(demo, thread, &first, &last);
+	memset(histograms, 0, sizeof(pool->histograms[thread]));
+
+	for (i = first; i < last; i++) {
+		const uint32_t id = pool->ids[0][i];
+		const struct bvh_aabb *bounds = &demo->instance_bounds[id];
+		const float (*vm)[4] = (const float (*)[4])pool->view_model;
+		float pos[3], depth;
+		int c;
+
+		for (c = 0; c < 3; c++)
+			pos[c] = (bounds->min[c] + bounds->max[c]) * 0.5f;
+		// The camera looks down -Z.
+		depth = -(vm[0][2] * pos[0] + vm[1][2] * pos[1] +
+			vm[2][2] * pos[2] + vm[3][2]);
+		uint64_t material = demo->scene.material_ids ?
+			demo->scene.material_ids[id] : DRAW_KEY_MATERIAL;
+		uint32_t bits;
+		uint64_t key;
+
+		// Positive floats order the same as their bit patterns, so the
+		// depth is quantised by keeping the top bits.
+		if (!(depth > 0.0f))
+			depth = 0.0f;
+		memcpy(&bits, &depth, sizeof(bits));
+
+		key = (uint64_t)DRAW_KEY_PIPELINE << DRAW_KEY_PIPELINE_SHIFT |
+			material << DRAW_KEY_MATERIAL_SHIFT |
+			bits >> (32 - DRAW_KEY_DEPTH_BITS);
+		pool->keys[0][i] = key;
+
+		for (d = 0; d < DRAW_SORT_DIGITS; d++)
+			histograms[d][(key >> (d * 8)) & 0xff]++;
+	}
+}
+
+static void demo_sort_histogram_job(struct demo *demo, uint32_t thread) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+	uint32_t *histogram = pool->histograms[thread][pool->sort_digit];
+	const uint64_t *keys = pool->keys[pool->sort_src];
+	const uint32_t shift = pool->sort_digit * 8;
+	uint32_t first, last, i;
+
+	demo_sort_chunk(demo, thread, &first, &last);
+	memset(histogram, 0, DRAW_SORT_BUCKETS * sizeof(*histogram));
+
+	for (i = first; i < last; i++)
+		histogram[(keys[i] >> shift) & 0xff]++;
+}
+
+// Stable scatter of the thread's chunk into the other buffer.
+static void demo_sort_scatter_job(struct demo *demo, uint32_t thread) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+	uint32_t *offsets = pool->histograms[thread][pool->sort_digit];
+	const uint64_t *src_keys = pool->keys[pool->sort_src];
+	const uint32_t *src_ids = pool->ids[pool->sort_src];
+	uint64_t *dst_keys = pool->keys[pool->sort_src ^ 1];
+	uint32_t *dst_ids = pool->ids[pool->sort_src ^ 1];
+	const uint32_t shift = pool->sort_digit * 8;
+	uint32_t first, last, i;
+
+	demo_sort_chunk(demo, thread, &first, &last);
+
+	for (i = first; i < last; i++) {
+		uint32_t j = offsets[(src_keys[i] >> shift) & 0xff]++;
+
+		dst_keys[j] = src_keys[i];
+		dst_ids[j] = src_ids[i];
+	}
+}
+
+static void demo_sort_output_job(struct demo *demo, uint32_t thread) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+	uint32_t first, last;
+
+	demo_sort_chunk(demo, thread, &first, &last);
+	memcpy(pool->out + first, pool->ids[pool->sort_src] + first,
+		(last - first) * sizeof(uint32_t));
+}
+
+/*
+ * Least significant digit first radix sort of the visible list by key, eight
+ * bits at a time. Digits that are the same for every key, such as the
+ * pipeline and material bits while the demo has only one of each, are
+ * skipped.
+ */
+static void demo_sort_draws(struct demo *demo, uint32_t *out) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+	const uint32_t threads = pool->thread_count + 1;
+	bool first_pass = true;
+	int d;
+
+	mat4x4_mul(pool->view_model, demo->view_matrix, demo->model_matrix);
+	pool->sort_src = 0;
+	demo_cull_pool_run(demo, demo_sort_key_job);
+
+	for (d = 0; d < DRAW_SORT_DIGITS; d++) {
+		uint32_t offset = 0, b, t;
+		bool constant = false;
+
+		for (b = 0; b < DRAW_SORT_BUCKETS && !constant; b++) {
+			uint32_t total = 0;
+
+			for (t = 0; t < threads; t++)
+				total += pool->histograms[t][d][b];
+			constant = total == pool->visible_count;
+		}
+		if (constant)
+			continue;
+
+		// The histograms from the key pass describe the original order
+		// only.
+		pool->sort_digit = d;
+		if (!first_pass)
+			demo_cull_pool_run(demo, demo_sort_histogram_job);
+		first_pass = false;
+
+		for (b = 0; b < DRAW_SORT_BUCKETS; b++) {
+			for (t = 0; t < threads; t++) {
+				uint32_t count = pool->histograms[t][d][b];
+
+				pool->histograms[t][d][b] = offset;
+				offset += count;
+			}
+		}
+
+		demo_cull_pool_run(demo, demo_sort_scatter_job);
+		pool->sort_src ^= 1;
+	}
+
+	pool->out = out;
+	demo_cull_pool_run(demo, demo_sort_output_job);
+}
+
+static void demo_cull_pool_init(struct demo *demo) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+	uint32_t i, max_tasks;
+
+	pool->thread_count = demo->jobs.worker_count - 1;
+
+	max_tasks = (pool->thread_count + 1) * CULL_TASKS_PER_THREAD;
+	pool->tasks = malloc(max_tasks * sizeof(*pool->tasks));
+	pool->task_counts = malloc(max_tasks * sizeof(*pool->task_counts));
+	pool->task_offsets = malloc(max_tasks * sizeof(*pool->task_offsets));
+	pool->scratch = malloc(demo->instance_count * sizeof(*pool->scratch));
+	assert(pool->tasks && pool->task_counts && pool->task_offsets &&
+		pool->scratch);
+
+	if (demo->sort_draws) {
+		for (i = 0; i < 2; i++) {
+			pool->keys[i] = malloc(demo->instance_count *
+					sizeof(*pool->keys[i]));
+			pool->ids[i] = malloc(demo->instance_count *
+					sizeof(*pool->ids[i]));
+			assert(pool->keys[i] && pool->ids[i]);
+		}
+		pool->histograms = malloc((pool->thread_count + 1) *
+					sizeof(*pool->histograms));
+		assert(pool->histograms);
+	}
+
+	// Refitting never changes the tree's shape, so neither do the tasks.
+	pool->task_count = bvh_split(&demo->bvh, pool->tasks, max_tasks);
+}
+
+static void demo_cull_pool_destroy(struct demo *demo) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+	uint32_t i;
+
+	free(pool->tasks);
+	free(pool->task_counts);
+	free(pool->task_offsets);
+	free(pool->scratch);
+	for (i = 0; i < 2; i++) {
+		free(pool->keys[i]);
+		free(pool->ids[i]);
+	}
+	free(pool->histograms);
+}
+
+/*
+ * Cull the scene on the CPU against the current frustum and write the visible
+ * list and draw arguments of the given slot, sorted if asked to. The slot must
+ * not be in use by the GPU.
+ */
+static void demo_cpu_cull(struct demo *demo, uint32_t slot) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+	const double start = demo_time_ms();
+	struct demo_cull_slot *args;
+	uint32_t *visible;
+	uint32_t t, total = 0;
+	VkResult U_ASSERT_ONLY err;
+
+	err = vkMapMemory(demo->device, demo->visible_data.mem,
+			slot * demo->instance_count * sizeof(uint32_t),
+			demo->instance_count * sizeof(uint32_t), 0,
+			(void **)&visible);
+	assert(!err);
+
+	// Sorting gathers the list somewhere cached first.
+	pool->out = demo->sort_draws ? pool->ids[0] : visible;
+
+	if (demo->ecs) {
+		// The cull system has already run, gather its lists.
+		for (t = 0; t < demo->ecs_chunk_count; t++) {
+			memcpy(pool->out + total, demo->ecs_visible +
+				t * demo->ecs_chunk_capacity,
+				demo->ecs_visible_counts[t] * sizeof(uint32_t));
+			total += demo->ecs_visible_counts[t];
+		}
+	} else {
+		atomic_store(&pool->next_cull, 0);
+		atomic_store(&pool->next_copy, 0);
+
+		demo_cull_pool_run(demo, demo_cull_job);
+
+		for (t = 0; t < pool->task_count; t++) {
+			pool->task_offsets[t] = total;
+			total += pool->task_counts[t];
+		}
+		demo_cull_pool_run(demo, demo_copy_job);
+	}
+	pool->visible_count = total;
+
+	if (demo->sort_draws) {
+		const double sort_start = demo_time_ms();
+
+		demo_sort_draws(demo, visible);
+		demo->sort_time += demo_time_ms() - sort_start;
+	}
+
+	vkUnmapMemory(demo->device, demo->visible_data.mem);
+
+	err = vkMapMemory(demo->device, demo->indirect_data.mem,
+			slot * sizeof(*args), sizeof(*args), 0, (void **)&args);
+	assert(!err);
+	args->draw.instanceCount = total;
+	args->draw_count = total > 0 ? 1 : 0;
+	vkUnmapMemory(demo->device, demo->indirect_data.mem);
+
+	demo->cull_time += demo_time_ms() - start;
+	demo->cull_frames++;
+}
+
+static void demo_prepare_record_pools(struct demo *demo) {
+	const uint32_t count = demo->swapchainImageCount *
+		demo->jobs.worker_count;
+	const VkCommandPoolCreateInfo pool_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+		.queueFamilyIndex = demo->graphics_queue_family_index,
+	};
+	VkResult U_ASSERT_ONLY err;
+
+	demo->record_pools = calloc(count, sizeof(*demo->record_pools));
+	demo->record_slice_max = demo->jobs.worker_count *
+		RECORD_SLICES_PER_WORKER;
+	demo->record_slices = malloc(demo->record_slice_max *
+				sizeof(*demo->record_slices));
+	assert(demo->record_pools && demo->record_slices);
+	demo->record_slice_count = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		err = vkCreateCommandPool(demo->device, &pool_info, NULL,
+					&demo->record_pools[i].pool);
+		assert(!err);
+	}
+}
+
+static void demo_destroy_record_pools(struct demo *demo) {
+	const uint32_t count = demo->swapchainImageCount *
+		demo->jobs.worker_count;
+
+	// Destroying a pool frees its command buffers.
+	for (uint32_t i = 0; i < count; i++) {
+		vkDestroyCommandPool(demo->device, demo->record_pools[i].pool,
+				NULL);
+		free(demo->record_pools[i].cmds);
+	}
+	free(demo->record_pools);
+	free(demo->record_slices);
+	demo->record_pools = NULL;
+	demo->record_slices = NULL;
+}
+
+// The next unused secondary command buffer of a pool, allocating more as needed.
+static VkCommandBuffer demo_record_pool_next(struct demo *demo,
+					struct demo_record_pool *pool) {
+	VkResult U_ASSERT_ONLY err;
+
+	if (pool->used == pool->count) {
+		const uint32_t count = pool->count > 0 ? pool->count * 2 : 4;
+		const VkCommandBufferAllocateInfo info = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.pNext = NULL,
+			.commandPool = pool->pool,
+			.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+			.commandBufferCount = count - pool->count,
+		};
+
+		pool->cmds = realloc(pool->cmds, count * sizeof(*pool->cmds));
+		assert(pool->cmds);
+		err = vkAllocateCommandBuffers(demo->device, &info,
+					pool->cmds + pool->count);
+		assert(!err);
+		pool->count = count;
+	}
+	return pool->cmds[pool->used++];
+}
+
+/*
+ * Record slices [first, last) of the draw pass, each into a secondary command
+ * buffer from the recording worker's own pool. A slice draws its part of the
+ * visible list one instance at a time, as a renderer with per object state
+ * would.
+ */
+static void demo_record_slice_job(void *ctx, uint32_t first, uint32_t last,
+				uint32_t worker) {
+	struct demo *demo = ctx;
+	struct demo_record_pool *pool = &demo->record_pools[
+		demo->current_buffer * demo->jobs.worker_count + worker];
+	const uint64_t visible = demo->cull_pool.visible_count;
+	const VkCommandBufferInheritanceInfo inheritance = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+		.pNext = NULL,
+		.renderPass = demo->render_pass,
+		.subpass = 0,
+		.framebuffer = demo->framebuffers[demo->current_buffer],
+	};
+	const VkCommandBufferBeginInfo begin = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = NULL,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+			VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+		.pInheritanceInfo = &inheritance,
+	};
+	VkResult U_ASSERT_ONLY err;
+
+	for (uint32_t s = first; s < last; s++) {
+		const VkCommandBuffer cmd_buf = demo_record_pool_next(demo, pool);
+		const uint32_t begin_draw = visible * s / demo->record_slice_count;
+		const uint32_t end_draw = visible * (s + 1) /
+			demo->record_slice_count;
+
+		err = vkBeginCommandBuffer(cmd_buf, &begin);
+		assert(!err);
+		demo_draw_bind_state(demo, cmd_buf, demo->record_pipeline,
+				demo->desc_set, demo->current_buffer);
+		// The instance index picks the entry of the visible list.
+		for (uint32_t i = begin_draw; i < end_draw; i++)
+			vkCmdDrawIndexed(cmd_buf, demo->mesh.index_count, 1, 0,
+					0, i);
+		err = vkEndCommandBuffer(cmd_buf);
+		assert(!err);
+		demo->record_slices[s] = cmd_buf;
+	}
+}
+
+/*
+ * Record this frame's draw pass contents across the job workers, from the
+ * visible list demo_cpu_cull() just wrote. The image's pools are free as its
+ * previous frame is done with.
+ */
+static void demo_record_draws(struct demo *demo) {
+	const uint32_t visible = demo->cull_pool.visible_count;
+	const double start = demo_time_ms();
+	uint32_t slices = (visible + RECORD_SLICE_DRAWS - 1) /
+		RECORD_SLICE_DRAWS;
+	VkResult U_ASSERT_ONLY err;
+
+	for (uint32_t i = 0; i < demo->jobs.worker_count; i++) {
+		struct demo_record_pool *pool = &demo->record_pools[
+			demo->current_buffer * demo->jobs.worker_count + i];
+
+		err = vkResetCommandPool(demo->device, pool->pool, 0);
+		assert(!err);
+		pool->used = 0;
+	}
+
+	if (slices > demo->record_slice_max)
+		slices = demo->record_slice_max;
+	demo->record_slice_count = slices;
+	demo->record_pipeline = demo_pipeline_ready(demo->pipeline_entry) ?
+		demo->pipeline_entry->pipeline : demo->base_pipeline;
+	job_parallel_for(&demo->jobs, demo_record_slice_job, demo, 0, slices,
+			1);
+
+	demo->record_time += demo_time_ms() - start;
+	demo->record_frames++;
+	demo->record_draws += visible;
+}
+
+/*
+ * Swing every articulated object's joints, then update the dirty parts of the
+ * hierarchy level by level across the worker threads, then copy the instances
+ * into the current image's part of the instance buffer and refit the BVH
+ * around the new bounds.
+ */
+static void demo_update_hierarchy(struct demo *demo) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+	struct xform *xform = &demo->xform;
+	const uint32_t object_size = demo->hierarchy_object_size;
+	const double start = demo_time_ms();
+	const float half = (float)degreesToRadians(demo->joint_angle) * 0.5f;
+	const float rotation[4] = {0.0f, sinf(half), 0.0f, cosf(half)};
+	uint8_t *pData;
+	uint32_t i, l, first, last;
+	VkResult U_ASSERT_ONLY err;
+
+	demo->joint_angle += demo->spin_angle;
+	for (i = 1; i < demo->instance_count; i++) {
+		const uint32_t k = i % object_size, slot = xform->slots[i];
+		float translation[3];
+
+		// Only the roots' children are joints.
+		if (k == 0 || k > HIERARCHY_FANOUT)
+			continue;
+		translation[0] = xform->translation[0][slot];
+		translation[1] = xform->translation[1][slot];
+		translation[2] = xform->translation[2][slot];
+		xform_set_local(xform, i, translation, rotation, 1.0f);
+	}
+
+	// Only what changed is written, so it goes to the instances kept here
+	// and the image's copy is refreshed from them afterwards.
+	pool->xform_out.models = (uint8_t *)demo->instances;
+	pool->xform_out.stride = sizeof(struct demo_instance);
+	memcpy(pool->xform_out.post, demo->mesh_fit, sizeof(demo->mesh_fit));
+	pool->xform_out.bounds = demo->instance_bounds;
+
+	xform_update_begin(xform);
+	for (l = 0; l < xform->level_count; l++) {
+		xform_dirty_batches(xform, l, &first, &last);
+		// Small levels are not worth waking the workers for.
+		if (last - first <= HIERARCHY_TASK_BATCHES) {
+			xform_update_batches(xform, l, first, last,
+					&pool->xform_out);
+			continue;
+		}
+		pool->xform_level = l;
+		pool->batch_end = last;
+		atomic_store(&pool->next_batch, first);
+		demo_cull_pool_run(demo, demo_hierarchy_job);
+	}
+	xform_update_done(xform);
+
+	err = vkMapMemory(demo->device, demo->instance_data.mem,
+			demo->current_buffer * demo->instance_stride,
+			demo->instance_count * sizeof(struct demo_instance), 0,
+			(void **)&pData);
+	assert(!err);
+	memcpy(pData, demo->instances,
+		demo->instance_count * sizeof(struct demo_instance));
+	vkUnmapMemory(demo->device, demo->instance_data.mem);
+	bvh_refit(&demo->bvh, demo->instance_bounds);
+
+	demo->hierarchy_time += demo_time_ms() - start;
+	demo->hierarchy_frames++;
+}
+
+/*
+ * Run the entity systems phase by phase across the worker threads, packing
+ * the instances straight into the current image's part of the instance
+ * buffer.
+ */
+static void demo_update_ecs(struct demo *demo) {
+	struct demo_cull_pool *pool = &demo->cull_pool;
+	const double start = demo_time_ms();
+	VkResult U_ASSERT_ONLY err;
+
+	// Every entity is packed each frame, so the current image's copy is
+	// written whole and the copies frames in flight read are left alone.
+	err = vkMapMemory(demo->device, demo->instance_data.mem,
+			demo->current_buffer * demo->instance_stride,
+			demo->instance_count * sizeof(struct demo_instance), 0,
+			(void **)&demo->ecs_instances);
+	assert(!err);
+
+	for (uint32_t phase = 0; phase < demo->phase_count; phase++) {
+		pool->ecs_jobs = demo->ecs_jobs;
+		pool->ecs_job_count = ecs_phase_jobs(&demo->world, demo->systems,
+					demo->system_phases, demo->system_count,
+					phase, demo->ecs_jobs,
+					demo->system_count *
+					demo->ecs_chunk_count);
+		atomic_store(&pool->next_job, 0);
+		demo_cull_pool_run(demo, demo_ecs_job);
+	}
+
+	vkUnmapMemory(demo->device, demo->instance_data.mem);
+	demo->ecs_instances = NULL;
+
+	demo->ecs_time += demo_time_ms() - start;
+	demo->ecs_frames++;
+}
+
+/*
+ * Step the spin at a fixed rate, whatever the frame rate, publishing each
+ * step's snapshot without waiting for anyone to take it. A thread falling
+ * far behind, as when suspended, skips the steps it missed.
+ */
+static void *demo_update_thread(void *arg) {
+	struct demo *demo = arg;
+	const double step = 1000.0 / DEMO_UPDATE_HZ;
+	double next = demo_time_ms();
+	float angle = 0.0f;
+
+	while (!atomic_load(&demo->update_quit)) {
+		struct demo_snapshot *back =
+			&demo->snapshots[demo->snapshot_back];
+		const float spin = atomic_load(&demo->update_spin);
+		struct timespec ts;
+		double now;
+
+		angle = fmodf(angle + spin, 360.0f);
+		back->time = next;
+		back->angle = angle;
+		back->spin = spin;
+		demo->snapshot_back = atomic_exchange(&demo->snapshot_middle,
+				demo->snapshot_back | DEMO_SNAPSHOT_FRESH) &
+			~DEMO_SNAPSHOT_FRESH;
+		demo->update_steps++;
+
+		next += step;
+		now = demo_time_ms();
+		if (now > next + 4 * step)
+			next = now;
+		ts.tv_sec = (time_t)(next / 1000.0);
+		ts.tv_nsec = (long)((next - ts.tv_sec * 1000.0) * 1000000.0);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+	return NULL;
+}
+
+/*
+ * Turn the model to where the latest snapshot puts it now, between the step
+ * before and its own, so it moves smoothly at any frame rate.
+ */
+static void demo_take_snapshot(struct demo *demo) {
+	const struct demo_snapshot *snapshot;
+	mat4x4 identity;
+	float alpha;
+
+	if (atomic_load(&demo->snapshot_middle) & DEMO_SNAPSHOT_FRESH)
+		demo->snapshot_front = atomic_exchange(&demo->snapshot_middle,
+					demo->snapshot_front) &
+			~DEMO_SNAPSHOT_FRESH;
+	snapshot = &demo->snapshots[demo->snapshot_front];
+
+	alpha = (demo_time_ms() - snapshot->time) * DEMO_UPDATE_HZ / 1000.0;
+	if (alpha > 1.0f)
+		alpha = 1.0f;
+	else if (alpha < 0.0f)
+		alpha = 0.0f;
+	mat4x4_identity(identity);
+	mat4x4_rotate(demo->model_matrix, identity, 0.0f, 1.0f, 0.0f,
+		(float)degreesToRadians(snapshot->angle -
+					snapshot->spin * (1.0f - alpha)));
+}
+
+void demo_update_data_buffer(struct demo *demo) {
+	mat4x4 MVP, Model, VP;
+	mat4x4 view_mvps[DEMO_MAX_VIEWS];
+	int matrixSize = sizeof(MVP);
+	float planes[6][4];
+	uint8_t *pData;
+	VkResult U_ASSERT_ONLY err;
+
+	mat4x4_mul(VP, demo->projection_matrix, demo->view_matrix);
+
+	// Rotate 22.5 degrees around the Y axis
+	if (demo->update_thread) {
+		demo_take_snapshot(demo);
+	} else {
+		mat4x4_dup(Model, demo->model_matrix);
+		mat4x4_rotate(demo->model_matrix, Model, 0.0f, 1.0f, 0.0f,
+			(float)degreesToRadians(demo->spin_angle));
+	}
+	mat4x4_mul(MVP, VP, demo->model_matrix);
+	demo_view_mvps(demo, view_mvps, planes);
+	memcpy(demo->cull_planes, planes, sizeof(planes));
+
+	err = vkMapMemory(demo->device, demo->uniform_data.mem, 0,
+			demo->uniform_data.mem_alloc.allocationSize, 0,
+			(void **)&pData);
+	assert(!err);
+
+	memcpy(pData, (const void *)&MVP[0][0], matrixSize);
+	memcpy(pData + offsetof(struct vktexcube_vs_uniform, planes), planes,
+		sizeof(planes));
+	memcpy(pData + offsetof(struct vktexcube_vs_uniform, view_mvp),
+		view_mvps, demo->view_count * sizeof(view_mvps[0]));
+
+	vkUnmapMemory(demo->device, demo->uniform_data.mem);
+
+	if (demo->hierarchy)
+		demo_update_hierarchy(demo);
+	else if (demo->ecs)
+		demo_update_ecs(demo);
+}
+
+/*
+ * Accumulate the fragment shader invocations of the given swapchain image's
+ * previous frame, if it has had one.
+ */
+static void demo_read_overdraw(struct demo *demo, uint32_t slot) {
+	uint64_t result[2];
+
+	vkGetQueryPoolResults(demo->device, demo->query_pool, slot, 1,
+			sizeof(result), result, sizeof(result),
+			VK_QUERY_RESULT_64_BIT |
+			VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+	if (!result[1])
+		return;
+
+	demo->fragment_invocations += result[0];
+	demo->overdraw_frames++;
+}
+
+static void demo_update_job(void *ctx, uint32_t first UNUSED,
+			uint32_t last UNUSED, uint32_t worker UNUSED) {
+	demo_update_data_buffer(ctx);
+}
 
-		demo_resize(demo);
-		demo_draw(demo);
-		return;
-	} else if (err == VK_SUBOPTIMAL_KHR) {
-		// demo->swapchain is not as optimal as it could be, but the platform's
-		// presentation engine will still present the image correctly.
-	} else {
+static void demo_record_job(void *ctx, uint32_t first UNUSED,
+			uint32_t last UNUSED, uint32_t worker UNUSED) {
+	struct demo *demo = ctx;
+
+	demo_draw_build_cmd(demo, demo->buffers[demo->current_buffer].cmd);
+}
+
+#ifdef VK_KHR_timeline_semaphore
+/*
+ * Submit the culling of the current frame to the compute queue. It only waits
+ * for the last frame drawn from the same slot, so it overlaps whatever the
+ * graphics queue is still drawing.
+ */
+static void demo_submit_compute(struct demo *demo, uint32_t image) {
+	const SwapchainBuffers *buffer = &demo->buffers[image];
+	const VkPipelineStageFlags stages = VK_PIPELINE_STAGE_TRANSFER_BIT |
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	const uint64_t signal = ++demo->compute_value;
+	const VkTimelineSemaphoreSubmitInfoKHR values = {
+		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+		.pNext = NULL,
+		.waitSemaphoreValueCount = 1,
+		.pWaitSemaphoreValues = &buffer->graphics_value,
+		.signalSemaphoreValueCount = 1,
+		.pSignalSemaphoreValues = &signal,
+	};
+	const VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = &values,
+		.waitSemaphoreCount = 1,
+		.pWaitSemaphores = &demo->graphics_timeline,
+		.pWaitDstStageMask = &stages,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &buffer->compute_cmd,
+		.signalSemaphoreCount = 1,
+		.pSignalSemaphores = &demo->compute_timeline,
+	};
+	VkResult U_ASSERT_ONLY err;
+
+	err = vkQueueSubmit(demo->compute_queue, 1, &submit_info,
+			VK_NULL_HANDLE);
+	assert(!err);
+}
+#endif
+
+/*
+ * Wait until the frame slot's last image was acquired and acquire the next
+ * one with it.
+ */
+static VkResult demo_acquire_image(struct demo *demo, uint32_t frame_index,
+				uint32_t *image) {
+	// Ensure no more than FRAME_LAG presentations are outstanding
+	vkWaitForFences(demo->device, 1, &demo->fences[frame_index], VK_TRUE, UINT64_MAX);
+	vkResetFences(demo->device, 1, &demo->fences[frame_index]);
+
+	// Get the index of the next available swapchain image:
+	return demo->fpAcquireNextImageKHR(demo->device, demo->swapchain,
+					UINT64_MAX,
+					demo->image_acquired_semaphores[frame_index],
+					demo->fences[frame_index], image);
+}
+
+/*
+ * Update, cull and record the frame for demo->current_buffer, ready for
+ * demo_submit_frame().
+ */
+static void demo_render(struct demo *demo) {
+	struct job_counter updated = {0}, recorded = {0};
+	uint8_t *pData;
+	VkResult U_ASSERT_ONLY err;
+
+	// The acquire fence signals once the image's previous frame is done
+	// with, which is also when its culling slot is free to rewrite and its
+	// query results are in.
+	if (demo->buffers[demo->current_buffer].fallback &&
+			demo_pipeline_ready(demo->pipeline_entry))
+		demo->buffers[demo->current_buffer].outdated = true;
+	if (demo->cpu_cull || demo->overdraw_stats || demo->hierarchy ||
+			demo->ecs ||
+			demo->buffers[demo->current_buffer].outdated ||
+			demo->buffers[demo->current_buffer].instances_stale ||
+			desc_allocator_frame_used(&demo->desc_alloc,
+						demo->current_buffer))
+		vkWaitForFences(demo->device, 1, &demo->fences[demo->frame_index],
+				VK_TRUE, UINT64_MAX);
+	if (demo->buffers[demo->current_buffer].instances_stale) {
+		err = vkMapMemory(demo->device, demo->instance_data.mem,
+				demo->current_buffer * demo->instance_stride,
+				demo->instance_count * sizeof(*demo->instances),
+				0, (void **)&pData);
 		assert(!err);
+		memcpy(pData, demo->instances,
+			demo->instance_count * sizeof(*demo->instances));
+		vkUnmapMemory(demo->device, demo->instance_data.mem);
+		demo->buffers[demo->current_buffer].instances_stale = false;
+	}
+	// Sets allocated for a frame live until its image comes round again.
+	desc_allocator_begin_frame(&demo->desc_alloc, demo->current_buffer);
+
+	// The update and any rerecording touch nothing of each other's, so
+	// they go to the job system together. Culling needs the new frustum.
+	job_add(&demo->jobs, demo_update_job, demo, 0, 1, 1, &updated);
+	if (demo->buffers[demo->current_buffer].outdated &&
+			!demo->dynamic_record)
+		job_add(&demo->jobs, demo_record_job, demo, 0, 1, 1, &recorded);
+	if (demo->overdraw_stats)
+		demo_read_overdraw(demo, demo->current_buffer);
+	job_wait(&demo->jobs, &updated);
+	if (demo->cpu_cull)
+		demo_cpu_cull(demo, demo->current_buffer);
+	if (demo->dynamic_record) {
+		// The draws depend on what culling left, so the whole frame
+		// is recorded again around them.
+		demo_record_draws(demo);
+		demo_draw_build_cmd(demo,
+				demo->buffers[demo->current_buffer].cmd);
 	}
+	job_wait(&demo->jobs, &recorded);
+	demo->buffers[demo->current_buffer].outdated = false;
+}
+
+/*
+ * Submit the frame demo_render() recorded for image, signalling the frame
+ * slot's draw complete semaphore. With the present thread, only it submits.
+ */
+static void demo_submit_frame(struct demo *demo, uint32_t image,
+			uint32_t frame_index) {
+	VkResult U_ASSERT_ONLY err;
+
+#ifdef VK_KHR_timeline_semaphore
+	if (demo->async_compute)
+		demo_submit_compute(demo, image);
+#endif
+
 	// Wait for the image acquired semaphore to be signaled to ensure
 	// that the image won't be rendered to until the presentation
 	// engine has fully released ownership to the application, and it is
-	// okay to render to the image.
+	// okay to render to the image. With async compute, the draws also
+	// wait for this frame's culling, and the frame is counted on the
+	// graphics timeline; binary semaphores ignore their values.
 	VkFence nullFence = VK_NULL_HANDLE;
-	VkPipelineStageFlags pipe_stage_flags;
+	const VkPipelineStageFlags wait_stages[2] = {
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+		VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+	};
+	const VkSemaphore wait_semaphores[2] = {
+		demo->image_acquired_semaphores[frame_index],
+		demo->compute_timeline,
+	};
+	const VkSemaphore signal_semaphores[2] = {
+		demo->draw_complete_semaphores[frame_index],
+		demo->graphics_timeline,
+	};
+#ifdef VK_KHR_timeline_semaphore
+	const uint64_t wait_values[2] = {0, demo->compute_value};
+	const uint64_t signal_values[2] = {0, demo->graphics_value + 1};
+	const VkTimelineSemaphoreSubmitInfoKHR timeline_values = {
+		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+		.pNext = NULL,
+		.waitSemaphoreValueCount = 2,
+		.pWaitSemaphoreValues = wait_values,
+		.signalSemaphoreValueCount = 2,
+		.pSignalSemaphoreValues = signal_values,
+	};
+#endif
+	const uint32_t semaphore_count = demo->async_compute ? 2 : 1;
 	VkSubmitInfo submit_info;
 	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	submit_info.pNext = NULL;
-	submit_info.pWaitDstStageMask = &pipe_stage_flags;
-	pipe_stage_flags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	submit_info.waitSemaphoreCount = 1;
-	submit_info.pWaitSemaphores = &demo->image_acquired_semaphores[demo->frame_index];
+#ifdef VK_KHR_timeline_semaphore
+	if (demo->async_compute)
+		submit_info.pNext = &timeline_values;
+#endif
+	submit_info.pWaitDstStageMask = wait_stages;
+	submit_info.waitSemaphoreCount = semaphore_count;
+	submit_info.pWaitSemaphores = wait_semaphores;
 	submit_info.commandBufferCount = 1;
-	submit_info.pCommandBuffers = &demo->buffers[demo->current_buffer].cmd;
-	submit_info.signalSemaphoreCount = 1;
-	submit_info.pSignalSemaphores = &demo->draw_complete_semaphores[demo->frame_index];
+	submit_info.pCommandBuffers = &demo->buffers[image].cmd;
+	submit_info.signalSemaphoreCount = semaphore_count;
+	submit_info.pSignalSemaphores = signal_semaphores;
 	err = vkQueueSubmit(demo->graphics_queue, 1, &submit_info, nullFence);
 	assert(!err);
+	if (demo->async_compute)
+		demo->buffers[image].graphics_value = ++demo->graphics_value;
+}
+
+static VkResult demo_present_image(struct demo *demo, uint32_t frame_index,
+				uint32_t image) {
+	VkPipelineStageFlags pipe_stage_flags;
+	VkSubmitInfo submit_info;
+	VkResult err;
 
 	if (demo->separate_present_queue) {
 		// If we are using separate queues, change image ownership to the
 		// present queue before presenting, waiting for the draw complete
 		// semaphore and signalling the ownership released semaphore when finished
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.pNext = NULL;
+		submit_info.pWaitDstStageMask = &pipe_stage_flags;
 		pipe_stage_flags = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 		submit_info.waitSemaphoreCount = 1;
-		submit_info.pWaitSemaphores = &demo->draw_complete_semaphores[demo->frame_index];
+		submit_info.pWaitSemaphores = &demo->draw_complete_semaphores[frame_index];
 		submit_info.commandBufferCount = 1;
 		submit_info.pCommandBuffers =
-			&demo->buffers[demo->current_buffer].graphics_to_present_cmd;
+			&demo->buffers[image].graphics_to_present_cmd;
 		submit_info.signalSemaphoreCount = 1;
-		submit_info.pSignalSemaphores = &demo->image_ownership_semaphores[demo->frame_index];
-		err = vkQueueSubmit(demo->present_queue, 1, &submit_info, nullFence);
+		submit_info.pSignalSemaphores = &demo->image_ownership_semaphores[frame_index];
+		err = vkQueueSubmit(demo->present_queue, 1, &submit_info,
+				VK_NULL_HANDLE);
 		assert(!err);
 	}
 
@@ -735,14 +2832,186 @@ static void demo_draw(struct demo *demo) {
 		.pNext = NULL,
 		.waitSemaphoreCount = 1,
 		.pWaitSemaphores = (demo->separate_present_queue)
-		? &demo->image_ownership_semaphores[demo->frame_index]
-		: &demo->draw_complete_semaphores[demo->frame_index],
+		? &demo->image_ownership_semaphores[frame_index]
+		: &demo->draw_complete_semaphores[frame_index],
 		.swapchainCount = 1,
 		.pSwapchains = &demo->swapchain,
-		.pImageIndices = &demo->current_buffer,
+		.pImageIndices = &image,
 	};
 
 	err = demo->fpQueuePresentKHR(demo->present_queue, &present);
+	return err;
+}
+
+static bool demo_present_pop(struct demo_present_ring *ring,
+			struct demo_present_frame *frame) {
+	const uint32_t head = atomic_load_explicit(&ring->head,
+						memory_order_relaxed);
+
+	if (head == atomic_load_explicit(&ring->tail, memory_order_acquire))
+		return false;
+	*frame = ring->frames[head % DEMO_PRESENT_RING];
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return true;
+}
+
+static void demo_present_push(struct demo *demo, struct demo_present_ring *ring,
+			uint32_t image, uint32_t frame_index) {
+	const uint32_t tail = atomic_load_explicit(&ring->tail,
+						memory_order_relaxed);
+
+	assert(tail - atomic_load_explicit(&ring->head, memory_order_acquire) <
+		DEMO_PRESENT_RING);
+	ring->frames[tail % DEMO_PRESENT_RING].image = image;
+	ring->frames[tail % DEMO_PRESENT_RING].frame_index = frame_index;
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+	// Pairs with the sleeper counting itself before looking at the ring.
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&demo->present_sleepers) == 0)
+		return;
+	pthread_mutex_lock(&demo->present_lock);
+	pthread_cond_broadcast(&demo->present_wake);
+	pthread_mutex_unlock(&demo->present_lock);
+}
+
+// Sleep until something is pushed to the ring, or the thread is to quit.
+static void demo_present_sleep(struct demo *demo,
+			struct demo_present_ring *ring) {
+	pthread_mutex_lock(&demo->present_lock);
+	atomic_fetch_add(&demo->present_sleepers, 1);
+	while (atomic_load(&ring->head) == atomic_load(&ring->tail) &&
+			!atomic_load(&demo->present_quit))
+		pthread_cond_wait(&demo->present_wake, &demo->present_lock);
+	atomic_fetch_sub(&demo->present_sleepers, 1);
+	pthread_mutex_unlock(&demo->present_lock);
+}
+
+/*
+ * Submit and present completed frames as soon as they come, and in between
+ * acquire images ahead of the main thread. Once the swapchain is out of date, the
+ * thread stops acquiring and says so through acquired_frames, presenting
+ * whatever was drawn before, until the main thread has recreated it and
+ * says so through completed_frames.
+ */
+static void *demo_present_thread(void *arg) {
+	struct demo *demo = arg;
+	struct demo_present_frame frame;
+	uint32_t frame_index = demo->frame_index;
+	uint64_t acquired = 0, presented = 0;
+	bool stopped = false;
+	uint32_t image;
+	VkResult err;
+
+	for (;;) {
+		if (demo_present_pop(&demo->completed_frames, &frame)) {
+			if (frame.image == DEMO_PRESENT_OUTDATED) {
+				stopped = false;
+				continue;
+			}
+			demo_submit_frame(demo, frame.image,
+					frame.frame_index);
+			err = demo_present_image(demo, frame.frame_index,
+						frame.image);
+			atomic_store(&demo->frames_presented, ++presented);
+			if (err == VK_ERROR_OUT_OF_DATE_KHR)
+				atomic_store(&demo->swapchain_outdated, true);
+			else if (err != VK_SUBOPTIMAL_KHR)
+				assert(!err);
+			continue;
+		}
+		if (atomic_load(&demo->present_quit))
+			break;
+		if (stopped || acquired - presented >= demo->present_lag) {
+			demo_present_sleep(demo, &demo->completed_frames);
+			continue;
+		}
+
+		if (atomic_load(&demo->swapchain_outdated)) {
+			demo_present_push(demo, &demo->acquired_frames,
+					DEMO_PRESENT_OUTDATED, 0);
+			stopped = true;
+			continue;
+		}
+		err = demo_acquire_image(demo, frame_index, &image);
+		if (err == VK_ERROR_OUT_OF_DATE_KHR) {
+			frame_index = (frame_index + 1) % FRAME_LAG;
+			atomic_store(&demo->swapchain_outdated, true);
+			continue;
+		} else if (err != VK_SUBOPTIMAL_KHR) {
+			assert(!err);
+		}
+		demo_present_push(demo, &demo->acquired_frames, image,
+				frame_index);
+		frame_index = (frame_index + 1) % FRAME_LAG;
+		acquired++;
+	}
+	return NULL;
+}
+
+/*
+ * Record the next frame to an image the present thread acquired and hand it
+ * back to be submitted and presented. When the thread has stopped on an
+ * outdated swapchain, wait for it to present what was drawn, recreate the
+ * swapchain and start it again.
+ */
+static void demo_draw_threaded(struct demo *demo) {
+	struct demo_present_frame frame;
+
+	while (!demo_present_pop(&demo->acquired_frames, &frame))
+		demo_present_sleep(demo, &demo->acquired_frames);
+
+	if (frame.image == DEMO_PRESENT_OUTDATED) {
+		while (atomic_load(&demo->frames_presented) !=
+				demo->frames_submitted)
+			sched_yield();
+		atomic_store(&demo->swapchain_outdated, false);
+		demo_resize(demo);
+		demo_present_push(demo, &demo->completed_frames,
+				DEMO_PRESENT_OUTDATED, 0);
+		demo_draw_threaded(demo);
+		return;
+	}
+
+	demo->frame_index = frame.frame_index;
+	demo->current_buffer = frame.image;
+	demo_render(demo);
+	demo->frames_submitted++;
+	demo_present_push(demo, &demo->completed_frames, frame.image,
+			frame.frame_index);
+}
+
+static void demo_draw(struct demo *demo) {
+	VkResult U_ASSERT_ONLY err;
+
+	if (demo->present_thread) {
+		demo_draw_threaded(demo);
+		return;
+	}
+
+	err = demo_acquire_image(demo, demo->frame_index,
+				&demo->current_buffer);
+
+	if (err == VK_ERROR_OUT_OF_DATE_KHR) {
+		// demo->swapchain is out of date (e.g. the window was resized) and
+		// must be recreated:
+		demo->frame_index += 1;
+		demo->frame_index %= FRAME_LAG;
+
+		demo_resize(demo);
+		demo_draw(demo);
+		return;
+	} else if (err == VK_SUBOPTIMAL_KHR) {
+		// demo->swapchain is not as optimal as it could be, but the platform's
+		// presentation engine will still present the image correctly.
+	} else {
+		assert(!err);
+	}
+
+	demo_render(demo);
+	demo_submit_frame(demo, demo->current_buffer, demo->frame_index);
+
+	err = demo_present_image(demo, demo->frame_index, demo->current_buffer);
 	demo->frame_index += 1;
 	demo->frame_index %= FRAME_LAG;
 
@@ -852,8 +3121,10 @@ static void demo_prepare_buffers(struct demo *demo) {
 
 	// Determine the number of VkImage's to use in the swap chain.
 	// Application desires to only acquire 1 image at a time (which is
-	// "surfCapabilities.minImageCount").
-	uint32_t desiredNumOfSwapchainImages = surfCapabilities.minImageCount;
+	// "surfCapabilities.minImageCount"), or with the present thread, as
+	// many as it may acquire ahead.
+	uint32_t desiredNumOfSwapchainImages = surfCapabilities.minImageCount +
+		(demo->present_thread ? FRAME_LAG - 1 : 0);
 	// If maxImageCount is 0, we can ask for as many images as we want;
 	// otherwise we're limited to maxImageCount
 	if ((surfCapabilities.maxImageCount > 0) &&
@@ -862,6 +3133,13 @@ static void demo_prepare_buffers(struct demo *demo) {
 		desiredNumOfSwapchainImages = surfCapabilities.maxImageCount;
 	}
 
+	if (demo->multiview && !(surfCapabilities.supportedUsageFlags &
+				VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+		ERR_EXIT("Swapchain images can't be blitted to, which multiview "
+			"needs to tile its views.\n",
+			"Multiview Failure");
+	}
+
 	VkSurfaceTransformFlagsKHR preTransform;
 	if (surfCapabilities.supportedTransforms &
 		VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR) {
@@ -881,7 +3159,9 @@ static void demo_prepare_buffers(struct demo *demo) {
 		{
 			.width = swapchainExtent.width, .height = swapchainExtent.height,
 		},
-		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+		// Multiview blits its views into the image.
+		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+			(demo->multiview ? VK_IMAGE_USAGE_TRANSFER_DST_BIT : 0),
 		.preTransform = preTransform,
 		.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
 		.imageArrayLayers = 1,
@@ -908,6 +3188,11 @@ static void demo_prepare_buffers(struct demo *demo) {
 	err = demo->fpGetSwapchainImagesKHR(demo->device, demo->swapchain,
 					&demo->swapchainImageCount, NULL);
 	assert(!err);
+	// Holding more images than the surface needs to spare would block.
+	demo->present_lag = demo->swapchainImageCount + 1 -
+		surfCapabilities.minImageCount;
+	if (demo->present_lag > FRAME_LAG)
+		demo->present_lag = FRAME_LAG;
 
 	VkImage *swapchainImages =
 		(VkImage *)malloc(demo->swapchainImageCount * sizeof(VkImage));
@@ -958,7 +3243,7 @@ static void demo_prepare_buffers(struct demo *demo) {
 }
 
 static void demo_prepare_depth(struct demo *demo) {
-	const VkFormat depth_format = VK_FORMAT_D16_UNORM;
+	const VkFormat depth_format = demo->depth.format;
 	const VkImageCreateInfo image = {
 		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
 		.pNext = NULL,
@@ -966,10 +3251,13 @@ static void demo_prepare_depth(struct demo *demo) {
 		.format = depth_format,
 		.extent = {demo->width, demo->height, 1},
 		.mipLevels = 1,
-		.arrayLayers = 1,
+		// A layer per view
+		.arrayLayers = demo->view_count,
 		.samples = VK_SAMPLE_COUNT_1_BIT,
 		.tiling = VK_IMAGE_TILING_OPTIMAL,
-		.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+		// Sampled when building the depth pyramid
+		.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+			(demo->gpu_cull ? VK_IMAGE_USAGE_SAMPLED_BIT : 0),
 		.flags = 0,
 	};
 
@@ -982,48 +3270,322 @@ static void demo_prepare_depth(struct demo *demo) {
 				     .baseMipLevel = 0,
 				     .levelCount = 1,
 				     .baseArrayLayer = 0,
-				     .layerCount = 1},
+				     .layerCount = demo->view_count},
 		.flags = 0,
-		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.viewType = demo->multiview ? VK_IMAGE_VIEW_TYPE_2D_ARRAY :
+			VK_IMAGE_VIEW_TYPE_2D,
+	};
+
+	VkMemoryRequirements mem_reqs;
+	VkResult U_ASSERT_ONLY err;
+	bool U_ASSERT_ONLY pass;
+
+	/* create image */
+	err = vkCreateImage(demo->device, &image, NULL, &demo->depth.image);
+	assert(!err);
+
+	vkGetImageMemoryRequirements(demo->device, demo->depth.image, &mem_reqs);
+	assert(!err);
+
+	demo->depth.mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	demo->depth.mem_alloc.pNext = NULL;
+	demo->depth.mem_alloc.allocationSize = mem_reqs.size;
+	demo->depth.mem_alloc.memoryTypeIndex = 0;
+
+	pass = memory_type_from_properties(demo, mem_reqs.memoryTypeBits,
+					0, /* No requirements */
+					&demo->depth.mem_alloc.memoryTypeIndex);
+	assert(pass);
+
+	/* allocate memory */
+	err = vkAllocateMemory(demo->device, &demo->depth.mem_alloc, NULL,
+			&demo->depth.mem);
+	assert(!err);
+
+	/* bind memory */
+	err =
+		vkBindImageMemory(demo->device, demo->depth.image, demo->depth.mem, 0);
+	assert(!err);
+
+	/* create image view */
+	view.image = demo->depth.image;
+	err = vkCreateImageView(demo->device, &view, NULL, &demo->depth.view);
+	assert(!err);
+}
+
+/*
+ * Create the layered color target multiview renders into, one layer per view.
+ * The layers are blitted onto the swapchain image at the end of the frame.
+ */
+static void demo_prepare_view_target(struct demo *demo) {
+	const VkImageCreateInfo image = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.pNext = NULL,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = demo->format,
+		.extent = {demo->width, demo->height, 1},
+		.mipLevels = 1,
+		.arrayLayers = demo->view_count,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+			VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		.flags = 0,
+	};
+	VkImageViewCreateInfo view = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.pNext = NULL,
+		.image = VK_NULL_HANDLE,
+		.format = demo->format,
+		.subresourceRange = {.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				     .baseMipLevel = 0,
+				     .levelCount = 1,
+				     .baseArrayLayer = 0,
+				     .layerCount = demo->view_count},
+		.flags = 0,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+	};
+	VkMemoryRequirements mem_reqs;
+	VkResult U_ASSERT_ONLY err;
+	bool U_ASSERT_ONLY pass;
+
+	err = vkCreateImage(demo->device, &image, NULL,
+			&demo->view_target.image);
+	assert(!err);
+
+	vkGetImageMemoryRequirements(demo->device, demo->view_target.image,
+				&mem_reqs);
+	demo->view_target.mem_alloc.sType =
+		VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	demo->view_target.mem_alloc.pNext = NULL;
+	demo->view_target.mem_alloc.allocationSize = mem_reqs.size;
+	demo->view_target.mem_alloc.memoryTypeIndex = 0;
+	pass = memory_type_from_properties(demo, mem_reqs.memoryTypeBits, 0,
+				&demo->view_target.mem_alloc.memoryTypeIndex);
+	assert(pass);
+
+	err = vkAllocateMemory(demo->device, &demo->view_target.mem_alloc, NULL,
+			&demo->view_target.mem);
+	assert(!err);
+	err = vkBindImageMemory(demo->device, demo->view_target.image,
+				demo->view_target.mem, 0);
+	assert(!err);
+
+	view.image = demo->view_target.image;
+	err = vkCreateImageView(demo->device, &view, NULL,
+				&demo->view_target.view);
+	assert(!err);
+}
+
+static void demo_destroy_view_target(struct demo *demo) {
+	vkDestroyImageView(demo->device, demo->view_target.view, NULL);
+	vkDestroyImage(demo->device, demo->view_target.image, NULL);
+	vkFreeMemory(demo->device, demo->view_target.mem, NULL);
+}
+
+/*
+ * One set per level of the depth pyramid, reading the level above and writing
+ * this one.
+ */
+static void demo_init_hiz_layout(struct demo *demo) {
+	const VkDescriptorSetLayoutBinding layout_bindings[2] = {
+		[0] =
+		{
+			.binding = 0,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = NULL,
+		},
+		[1] =
+		{
+			.binding = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = NULL,
+		},
+	};
+	const VkDescriptorSetLayoutCreateInfo descriptor_layout = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.pNext = NULL,
+		.bindingCount = 2,
+		.pBindings = layout_bindings,
 	};
+	VkResult U_ASSERT_ONLY err;
+
+	err = vkCreateDescriptorSetLayout(demo->device, &descriptor_layout, NULL,
+					&demo->hiz.desc_layout);
+	assert(!err);
+	// Sets for every level normally fit the first pool.
+	desc_allocator_init(&demo->hiz.desc_alloc, demo->device,
+			demo->hiz.desc_layout, layout_bindings, 2, 0x3, 0,
+			HIZ_MAX_LEVELS, demo->update_templates);
+}
 
+/*
+ * Create the depth pyramid: a full mip chain of R32_SFLOAT over the depth
+ * buffer, kept in the GENERAL layout as hiz.comp writes it as a storage image
+ * and cull.comp samples it. Also creates what hiz.comp needs to reduce each
+ * level into the next.
+ */
+static void demo_prepare_hiz(struct demo *demo) {
+	const VkFormat hiz_format = VK_FORMAT_R32_SFLOAT;
+	uint32_t size = demo->width > demo->height ? demo->width : demo->height;
 	VkMemoryRequirements mem_reqs;
 	VkResult U_ASSERT_ONLY err;
 	bool U_ASSERT_ONLY pass;
+	uint32_t i;
+
+	demo->hiz.level_count = 1;
+	while ((size >>= 1) > 0 && demo->hiz.level_count < HIZ_MAX_LEVELS)
+		demo->hiz.level_count++;
 
-	demo->depth.format = depth_format;
+	const VkImageCreateInfo image = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.pNext = NULL,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = hiz_format,
+		.extent = {demo->width, demo->height, 1},
+		.mipLevels = demo->hiz.level_count,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		.flags = 0,
+	};
+	VkImageViewCreateInfo view = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.pNext = NULL,
+		.image = VK_NULL_HANDLE,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.format = hiz_format,
+		.components =
+		{
+			VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G,
+			VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A,
+		},
+		.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0,
+				demo->hiz.level_count, 0, 1},
+		.flags = 0,
+	};
+	const VkSamplerCreateInfo sampler = {
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.pNext = NULL,
+		.magFilter = VK_FILTER_NEAREST,
+		.minFilter = VK_FILTER_NEAREST,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.mipLodBias = 0.0f,
+		.anisotropyEnable = VK_FALSE,
+		.maxAnisotropy = 1,
+		.compareOp = VK_COMPARE_OP_NEVER,
+		.minLod = 0.0f,
+		.maxLod = (float)demo->hiz.level_count,
+		.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
+		.unnormalizedCoordinates = VK_FALSE,
+	};
+	const VkImageMemoryBarrier barrier = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.pNext = NULL,
+		.srcAccessMask = 0,
+		.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.newLayout = VK_IMAGE_LAYOUT_GENERAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = VK_NULL_HANDLE,
+		.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0,
+				demo->hiz.level_count, 0, 1},
+	};
 
-	/* create image */
-	err = vkCreateImage(demo->device, &image, NULL, &demo->depth.image);
+	err = vkCreateImage(demo->device, &image, NULL, &demo->hiz.image);
 	assert(!err);
 
-	vkGetImageMemoryRequirements(demo->device, demo->depth.image, &mem_reqs);
-	assert(!err);
+	vkGetImageMemoryRequirements(demo->device, demo->hiz.image, &mem_reqs);
 
-	demo->depth.mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	demo->depth.mem_alloc.pNext = NULL;
-	demo->depth.mem_alloc.allocationSize = mem_reqs.size;
-	demo->depth.mem_alloc.memoryTypeIndex = 0;
+	demo->hiz.mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	demo->hiz.mem_alloc.pNext = NULL;
+	demo->hiz.mem_alloc.allocationSize = mem_reqs.size;
+	demo->hiz.mem_alloc.memoryTypeIndex = 0;
 
 	pass = memory_type_from_properties(demo, mem_reqs.memoryTypeBits,
-					0, /* No requirements */
-					&demo->depth.mem_alloc.memoryTypeIndex);
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					&demo->hiz.mem_alloc.memoryTypeIndex);
 	assert(pass);
 
-	/* allocate memory */
-	err = vkAllocateMemory(demo->device, &demo->depth.mem_alloc, NULL,
-			&demo->depth.mem);
+	err = vkAllocateMemory(demo->device, &demo->hiz.mem_alloc, NULL,
+			&demo->hiz.mem);
 	assert(!err);
 
-	/* bind memory */
-	err =
-		vkBindImageMemory(demo->device, demo->depth.image, demo->depth.mem, 0);
+	err = vkBindImageMemory(demo->device, demo->hiz.image, demo->hiz.mem, 0);
 	assert(!err);
 
-	/* create image view */
-	view.image = demo->depth.image;
-	err = vkCreateImageView(demo->device, &view, NULL, &demo->depth.view);
+	view.image = demo->hiz.image;
+	err = vkCreateImageView(demo->device, &view, NULL, &demo->hiz.view);
+	assert(!err);
+
+	view.subresourceRange.levelCount = 1;
+	for (i = 0; i < demo->hiz.level_count; i++) {
+		view.subresourceRange.baseMipLevel = i;
+		err = vkCreateImageView(demo->device, &view, NULL,
+					&demo->hiz.level_views[i]);
+		assert(!err);
+	}
+
+	err = vkCreateSampler(demo->device, &sampler, NULL, &demo->hiz.sampler);
+	assert(!err);
+
+	VkImageMemoryBarrier general = barrier;
+
+	general.image = demo->hiz.image;
+	vkCmdPipelineBarrier(demo->cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL,
+			1, &general);
+
+	const VkPipelineLayoutCreateInfo pipeline_layout = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.pNext = NULL,
+		.setLayoutCount = 1,
+		.pSetLayouts = &demo->hiz.desc_layout,
+		.pushConstantRangeCount = 0,
+		.pPushConstantRanges = NULL,
+	};
+	err = vkCreatePipelineLayout(demo->device, &pipeline_layout, NULL,
+				&demo->hiz.pipeline_layout);
 	assert(!err);
+
+	for (i = 0; i < demo->hiz.level_count; i++) {
+		union desc_info infos[2];
+
+		memset(infos, 0, sizeof(infos));
+		infos[0].image.sampler = demo->hiz.sampler;
+		infos[0].image.imageView = i == 0 ? demo->depth.view :
+			demo->hiz.level_views[i - 1];
+		infos[0].image.imageLayout = i == 0 ?
+			VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL :
+			VK_IMAGE_LAYOUT_GENERAL;
+		infos[1].image.imageView = demo->hiz.level_views[i];
+		infos[1].image.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+		demo->hiz.desc_sets[i] = desc_get(&demo->hiz.desc_alloc,
+						DESC_PERSISTENT, infos);
+	}
+}
+
+static void demo_destroy_hiz(struct demo *demo) {
+	uint32_t i;
+
+	vkDestroyPipeline(demo->device, demo->hiz.pipeline, NULL);
+	desc_allocator_reset(&demo->hiz.desc_alloc);
+	vkDestroyPipelineLayout(demo->device, demo->hiz.pipeline_layout, NULL);
+	vkDestroySampler(demo->device, demo->hiz.sampler, NULL);
+	for (i = 0; i < demo->hiz.level_count; i++)
+		vkDestroyImageView(demo->device, demo->hiz.level_views[i], NULL);
+	vkDestroyImageView(demo->device, demo->hiz.view, NULL);
+	vkDestroyImage(demo->device, demo->hiz.image, NULL);
+	vkFreeMemory(demo->device, demo->hiz.mem, NULL);
 }
 
 /* Load a ppm file into memory */
@@ -1075,18 +3637,50 @@ bool loadTexture(const char *filename, uint8_t *rgba_data,
 	return true;
 }
 
-static void demo_prepare_texture_image(struct demo *demo, const char *filename,
+/*
+ * Decode texture files [first, last) into demo->decoded_textures while the
+ * device is created, see demo_prepare_textures().
+ */
+static void demo_decode_texture_job(void *ctx, uint32_t first, uint32_t last,
+				uint32_t worker UNUSED) {
+	struct demo *demo = ctx;
+	const double start = demo_time_ms();
+
+	for (uint32_t i = first; i < last; i++) {
+		struct demo_texture_data *tex = &demo->decoded_textures[i];
+		const char *filename = demo->texture_files[i];
+		VkSubresourceLayout layout;
+
+		if (!loadTexture(filename, NULL, NULL, &tex->width,
+					&tex->height) ||
+				tex->width <= 0 || tex->height <= 0)
+			continue;
+		memset(&layout, 0, sizeof(layout));
+		layout.rowPitch = tex->width * 4;
+		tex->pixels = malloc(layout.rowPitch * tex->height);
+		if (tex->pixels && !loadTexture(filename, tex->pixels, &layout,
+						&tex->width, &tex->height)) {
+			free(tex->pixels);
+			tex->pixels = NULL;
+		}
+	}
+	atomic_fetch_add(&demo->startup_textures_us,
+			(demo_time_ms() - start) * 1000.0);
+}
+
+static void demo_prepare_texture_image(struct demo *demo,
+				const struct demo_texture_data *decoded,
 				struct texture_object *tex_obj,
 				VkImageTiling tiling,
 				VkImageUsageFlags usage,
 				VkFlags required_props) {
 	const VkFormat tex_format = VK_FORMAT_R8G8B8A8_UNORM;
-	int32_t tex_width;
-	int32_t tex_height;
+	const int32_t tex_width = decoded->width;
+	const int32_t tex_height = decoded->height;
 	VkResult U_ASSERT_ONLY err;
 	bool U_ASSERT_ONLY pass;
 
-	if (!loadTexture(filename, NULL, NULL, &tex_width, &tex_height)) {
+	if (!decoded->pixels) {
 		ERR_EXIT("Failed to load textures", "Load Texture Failure");
 	}
 
@@ -1151,9 +3745,11 @@ static void demo_prepare_texture_image(struct demo *demo, const char *filename,
 				tex_obj->mem_alloc.allocationSize, 0, &data);
 		assert(!err);
 
-		if (!loadTexture(filename, data, &layout, &tex_width, &tex_height)) {
-			fprintf(stderr, "Error loading texture: %s\n", filename);
-		}
+		for (int32_t y = 0; y < tex_height; y++)
+			memcpy((uint8_t *)data + layout.offset +
+				y * layout.rowPitch,
+				decoded->pixels + (size_t)y * tex_width * 4,
+				(size_t)tex_width * 4);
 
 		vkUnmapMemory(demo->device, tex_obj->mem);
 	}
@@ -1168,14 +3764,104 @@ static void demo_destroy_texture_image(struct demo *demo,
 	vkDestroyImage(demo->device, tex_objs->image, NULL);
 }
 
+// Copy the staged textures into their optimally tiled images.
+static void demo_graph_copy_textures(VkCommandBuffer cmd_buf, void *ctx) {
+	struct demo *demo = ctx;
+
+	for (uint32_t i = 0; i < demo->texture_count; i++) {
+		const struct texture_object *staging = &demo->staging_textures[i];
+		const VkImageCopy copy_region = {
+			.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+			.srcOffset = {0, 0, 0},
+			.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+			.dstOffset = {0, 0, 0},
+			.extent = {staging->tex_width, staging->tex_height, 1},
+		};
+
+		if (!staging->image)
+			continue;
+		vkCmdCopyImage(cmd_buf, staging->image,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			demo->textures[i].image,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
+	}
+}
+
+/*
+ * Record the copies out of the staging textures and the transitions leaving
+ * every texture ready to sample, all with one batch of barriers either side.
+ */
+static void demo_upload_textures(struct demo *demo) {
+	// Written by the host before the setup commands are submitted.
+	const struct graph_state host_written = {
+		.layout = VK_IMAGE_LAYOUT_PREINITIALIZED,
+		.queue_family = VK_QUEUE_FAMILY_IGNORED,
+		.write_stages = VK_PIPELINE_STAGE_HOST_BIT,
+		.write_access = VK_ACCESS_HOST_WRITE_BIT,
+	};
+	const VkImageSubresourceRange range = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1,
+					0, 1};
+	uint32_t *ids = malloc(demo->texture_count * sizeof(*ids));
+	struct graph graph;
+	uint32_t pass, i;
+
+	assert(ids);
+	graph_init(&graph, demo->device, &demo->memory_properties, demo->sync2);
+	for (i = 0; i < demo->texture_count; i++)
+		ids[i] = graph_import_image(&graph, demo->textures[i].image,
+					&range, &host_written, false);
+
+	pass = graph_add_pass(&graph, demo->graphics_queue_family_index,
+			demo_graph_copy_textures, demo);
+	for (i = 0; i < demo->texture_count; i++) {
+		const struct graph_access copy_dst = {
+			.resource = ids[i],
+			.stages = VK_PIPELINE_STAGE_TRANSFER_BIT,
+			.access = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			.discard = true,
+		};
+
+		if (!demo->staging_textures[i].image)
+			continue;
+		demo_graph_use(&graph, pass, graph_import_image(&graph,
+					demo->staging_textures[i].image,
+					&range, &host_written, false),
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_TRANSFER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+		graph_use(&graph, pass, &copy_dst);
+	}
+
+	// Stands for the draws sampling them.
+	pass = graph_add_pass(&graph, demo->graphics_queue_family_index, NULL,
+			NULL);
+	for (i = 0; i < demo->texture_count; i++)
+		demo_graph_use(&graph, pass, ids[i],
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT,
+			demo->textures[i].imageLayout);
+
+	graph_compile(&graph);
+	graph_record(&graph, demo->graphics_queue_family_index, demo->cmd);
+	graph_destroy(&graph);
+	free(ids);
+}
+
 static void demo_prepare_textures(struct demo *demo) {
 	const VkFormat tex_format = VK_FORMAT_R8G8B8A8_UNORM;
 	VkFormatProperties props;
 	uint32_t i;
 
 	vkGetPhysicalDeviceFormatProperties(demo->gpu, tex_format, &props);
+	job_wait(&demo->jobs, &demo->textures_decoded);
+
+	demo->staging_textures = calloc(demo->texture_count,
+					sizeof(*demo->staging_textures));
+	assert(demo->staging_textures);
 
-	for (i = 0; i < DEMO_TEXTURE_COUNT; i++) {
+	for (i = 0; i < demo->texture_count; i++) {
+		struct texture_object *staging = &demo->staging_textures[i];
 		VkResult U_ASSERT_ONLY err;
 
 		if ((props.linearTilingFeatures &
@@ -1183,70 +3869,25 @@ static void demo_prepare_textures(struct demo *demo) {
 			!demo->use_staging_buffer) {
 			/* Device can texture using linear textures */
 			demo_prepare_texture_image(
-				demo, tex_files[i], &demo->textures[i], VK_IMAGE_TILING_LINEAR,
-				VK_IMAGE_USAGE_SAMPLED_BIT,
+				demo, &demo->decoded_textures[i], &demo->textures[i],
+				VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_SAMPLED_BIT,
 				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
 				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-			// Nothing in the pipeline needs to be complete to start, and don't allow fragment
-			// shader to run until layout transition completes
-			demo_set_image_layout(demo, demo->textures[i].image, VK_IMAGE_ASPECT_COLOR_BIT,
-					VK_IMAGE_LAYOUT_PREINITIALIZED, demo->textures[i].imageLayout,
-					VK_ACCESS_HOST_WRITE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-					VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
-			demo->staging_texture.image = 0;
 		} else if (props.optimalTilingFeatures &
 			VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) {
 			/* Must use staging buffer to copy linear texture to optimized */
 
-			memset(&demo->staging_texture, 0, sizeof(demo->staging_texture));
 			demo_prepare_texture_image(
-				demo, tex_files[i], &demo->staging_texture, VK_IMAGE_TILING_LINEAR,
+				demo, &demo->decoded_textures[i], staging, VK_IMAGE_TILING_LINEAR,
 				VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
 				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
 				VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
 			demo_prepare_texture_image(
-				demo, tex_files[i], &demo->textures[i], VK_IMAGE_TILING_OPTIMAL,
+				demo, &demo->decoded_textures[i], &demo->textures[i],
+				VK_IMAGE_TILING_OPTIMAL,
 				(VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT),
 				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-			demo_set_image_layout(demo, demo->staging_texture.image,
-					VK_IMAGE_ASPECT_COLOR_BIT,
-					VK_IMAGE_LAYOUT_PREINITIALIZED,
-					VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-					VK_ACCESS_HOST_WRITE_BIT,
-					VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-					VK_PIPELINE_STAGE_TRANSFER_BIT);
-
-			demo_set_image_layout(demo, demo->textures[i].image,
-					VK_IMAGE_ASPECT_COLOR_BIT,
-					VK_IMAGE_LAYOUT_PREINITIALIZED,
-					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-					VK_ACCESS_HOST_WRITE_BIT,
-					VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-					VK_PIPELINE_STAGE_TRANSFER_BIT);
-
-			VkImageCopy copy_region = {
-				.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
-				.srcOffset = {0, 0, 0},
-				.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
-				.dstOffset = {0, 0, 0},
-				.extent = {demo->staging_texture.tex_width,
-					   demo->staging_texture.tex_height, 1},
-			};
-			vkCmdCopyImage(
-				demo->cmd, demo->staging_texture.image,
-				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, demo->textures[i].image,
-				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
-
-			demo_set_image_layout(demo, demo->textures[i].image,
-					VK_IMAGE_ASPECT_COLOR_BIT,
-					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-					demo->textures[i].imageLayout,
-					VK_ACCESS_TRANSFER_WRITE_BIT,
-					VK_PIPELINE_STAGE_TRANSFER_BIT,
-					VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
-
 		} else {
 			/* Can't support VK_FORMAT_R8G8B8A8_UNORM !? */
 			assert(!"No support for R8G8B8A8_UNORM as texture image format");
@@ -1291,120 +3932,952 @@ static void demo_prepare_textures(struct demo *demo) {
 				&demo->textures[i].sampler);
 		assert(!err);
 
-		/* create image view */
-		view.image = demo->textures[i].image;
-		err = vkCreateImageView(demo->device, &view, NULL,
-					&demo->textures[i].view);
-		assert(!err);
+		/* create image view */
+		view.image = demo->textures[i].image;
+		err = vkCreateImageView(demo->device, &view, NULL,
+					&demo->textures[i].view);
+		assert(!err);
+	}
+
+	demo_upload_textures(demo);
+}
+
+/*
+ * With async compute, a buffer the host fills and both queues only read is
+ * shared by their families, rather than handed back and forth every frame.
+ * families must outlive the buffer's creation.
+ */
+static void demo_share_buffer(const struct demo *demo,
+			VkBufferCreateInfo *buf_info, uint32_t families[2]) {
+	if (!demo->async_compute)
+		return;
+	families[0] = demo->graphics_queue_family_index;
+	families[1] = demo->compute_queue_family_index;
+	buf_info->sharingMode = VK_SHARING_MODE_CONCURRENT;
+	buf_info->queueFamilyIndexCount = 2;
+	buf_info->pQueueFamilyIndices = families;
+}
+
+void demo_prepare_cube_data_buffer(struct demo *demo) {
+	VkBufferCreateInfo buf_info;
+	VkMemoryRequirements mem_reqs;
+	uint32_t families[2];
+	uint8_t *pData;
+	mat4x4 MVP, VP;
+	VkResult U_ASSERT_ONLY err;
+	bool U_ASSERT_ONLY pass;
+	struct vktexcube_vs_uniform data;
+
+	mat4x4_mul(VP, demo->projection_matrix, demo->view_matrix);
+	mat4x4_mul(MVP, VP, demo->model_matrix);
+	memcpy(data.mvp, MVP, sizeof(MVP));
+	//	dumpMatrix("MVP", MVP);
+	memset(data.view_mvp, 0, sizeof(data.view_mvp));
+	demo_view_mvps(demo, (mat4x4 *)data.view_mvp, data.planes);
+	data.instance_count = demo->instance_count;
+
+	memset(&buf_info, 0, sizeof(buf_info));
+	buf_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buf_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	buf_info.size = sizeof(data);
+	demo_share_buffer(demo, &buf_info, families);
+	err =
+		vkCreateBuffer(demo->device, &buf_info, NULL, &demo->uniform_data.buf);
+	assert(!err);
+
+	vkGetBufferMemoryRequirements(demo->device, demo->uniform_data.buf,
+				&mem_reqs);
+
+	demo->uniform_data.mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	demo->uniform_data.mem_alloc.pNext = NULL;
+	demo->uniform_data.mem_alloc.allocationSize = mem_reqs.size;
+	demo->uniform_data.mem_alloc.memoryTypeIndex = 0;
+
+	pass = memory_type_from_properties(
+		demo, mem_reqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&demo->uniform_data.mem_alloc.memoryTypeIndex);
+	assert(pass);
+
+	err = vkAllocateMemory(demo->device, &demo->uniform_data.mem_alloc, NULL,
+			&(demo->uniform_data.mem));
+	assert(!err);
+
+	err = vkMapMemory(demo->device, demo->uniform_data.mem, 0,
+			demo->uniform_data.mem_alloc.allocationSize, 0,
+			(void **)&pData);
+	assert(!err);
+
+	memcpy(pData, &data, sizeof data);
+
+	vkUnmapMemory(demo->device, demo->uniform_data.mem);
+
+	err = vkBindBufferMemory(demo->device, demo->uniform_data.buf,
+				demo->uniform_data.mem, 0);
+	assert(!err);
+
+	demo->uniform_data.buffer_info.buffer = demo->uniform_data.buf;
+	demo->uniform_data.buffer_info.offset = 0;
+	demo->uniform_data.buffer_info.range = sizeof(data);
+}
+
+/*
+ * A host visible buffer, filled from data if not NULL. A shared buffer is
+ * read by the async compute queue as well, see demo_share_buffer().
+ */
+static void demo_prepare_buffer_object(struct demo *demo,
+				struct buffer_object *buf_obj,
+				VkDeviceSize size, VkBufferUsageFlags usage,
+				const void *data, bool shared) {
+	VkBufferCreateInfo buf_info;
+	VkMemoryRequirements mem_reqs;
+	uint32_t families[2];
+	VkResult U_ASSERT_ONLY err;
+	bool U_ASSERT_ONLY pass;
+
+	memset(&buf_info, 0, sizeof(buf_info));
+	buf_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	buf_info.usage = usage;
+	buf_info.size = size;
+	if (shared)
+		demo_share_buffer(demo, &buf_info, families);
+	err = vkCreateBuffer(demo->device, &buf_info, NULL, &buf_obj->buf);
+	assert(!err);
+
+	vkGetBufferMemoryRequirements(demo->device, buf_obj->buf, &mem_reqs);
+
+	buf_obj->mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	buf_obj->mem_alloc.pNext = NULL;
+	buf_obj->mem_alloc.allocationSize = mem_reqs.size;
+	buf_obj->mem_alloc.memoryTypeIndex = 0;
+
+	pass = memory_type_from_properties(
+		demo, mem_reqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&buf_obj->mem_alloc.memoryTypeIndex);
+	assert(pass);
+
+	err = vkAllocateMemory(demo->device, &buf_obj->mem_alloc, NULL,
+			&buf_obj->mem);
+	assert(!err);
+
+	if (data) {
+		void *pData;
+
+		err = vkMapMemory(demo->device, buf_obj->mem, 0, size, 0, &pData);
+		assert(!err);
+
+		memcpy(pData, data, size);
+
+		vkUnmapMemory(demo->device, buf_obj->mem);
+	}
+
+	err = vkBindBufferMemory(demo->device, buf_obj->buf, buf_obj->mem, 0);
+	assert(!err);
+
+	buf_obj->buffer_info.buffer = buf_obj->buf;
+	buf_obj->buffer_info.offset = 0;
+	buf_obj->buffer_info.range = size;
+}
+
+static void demo_destroy_buffer_object(struct demo *demo,
+				struct buffer_object *buf_obj) {
+	vkDestroyBuffer(demo->device, buf_obj->buf, NULL);
+	vkFreeMemory(demo->device, buf_obj->mem, NULL);
+}
+
+/*
+ * World space bounds of an instance, found by transforming the mesh's bounding
+ * box and keeping the result axis aligned.
+ */
+static void demo_instance_bounds(const struct mesh *mesh,
+				const struct demo_instance *instance,
+				struct bvh_aabb *bounds) {
+	for (int i = 0; i < 3; i++) {
+		float centre = instance->model[3][i], extent = 0.0f;
+
+		for (int j = 0; j < 3; j++) {
+			centre += instance->model[j][i] *
+				(mesh->min[j] + mesh->max[j]) * 0.5f;
+			extent += fabsf(instance->model[j][i]) *
+				(mesh->max[j] - mesh->min[j]) * 0.5f;
+		}
+		bounds->min[i] = centre - extent;
+		bounds->max[i] = centre + extent;
+	}
+}
+
+/*
+ * Group the instances into articulated objects, each node placed relative to
+ * its parent so the objects start out where the instances are. Scene
+ * rotations and scales are dropped, the joints supplying the rotation.
+ */
+static void demo_init_hierarchy(struct demo *demo) {
+	const uint32_t fanout = HIERARCHY_FANOUT;
+	uint32_t object_size = 0, level_size = 1, *parents, i;
+	const float identity[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+
+	for (i = 0; i < HIERARCHY_DEPTH; i++, level_size *= fanout)
+		object_size += level_size;
+	if (object_size > demo->instance_count)
+		object_size = demo->instance_count;
+	demo->hierarchy_object_size = object_size;
+
+	parents = malloc(demo->instance_count * sizeof(*parents));
+	assert(parents);
+	for (i = 0; i < demo->instance_count; i++) {
+		const uint32_t k = i % object_size;
+
+		// Children of the object's k-th node are at k * fanout + 1 on.
+		parents[i] = k == 0 ? XFORM_ROOT : i - k + (k - 1) / fanout;
+	}
+	xform_build(&demo->xform, parents, demo->instance_count);
+
+	for (i = 0; i < demo->instance_count; i++) {
+		const struct bvh_aabb *bounds = &demo->instance_bounds[i];
+		const struct bvh_aabb *above = parents[i] != XFORM_ROOT ?
+			&demo->instance_bounds[parents[i]] : NULL;
+		float translation[3];
+
+		for (int c = 0; c < 3; c++) {
+			translation[c] = (bounds->min[c] + bounds->max[c]) * 0.5f;
+			if (above)
+				translation[c] -= (above->min[c] +
+						above->max[c]) * 0.5f;
+		}
+		xform_set_local(&demo->xform, i, translation, identity, 1.0f);
+		// The joints never scale, so neither does the bounding sphere.
+		demo->instances[i].sphere[3] = sqrtf(3.0f);
+	}
+	free(parents);
+}
+
+/*
+ * Make every instance an entity which spins about its own Y axis at its own
+ * rate. Entity IDs match instance indices. Spinning leaves the bounding
+ * spheres alone, so GPU culling stays exact, but the BVH bounds only follow
+ * picking.
+ */
+static void demo_init_ecs(struct demo *demo) {
+	static const size_t sizes[DEMO_COMPONENT_COUNT] = {
+		[DEMO_PLACEMENT] = sizeof(mat4x4),
+		[DEMO_SPIN] = sizeof(struct demo_spin),
+		[DEMO_MODEL] = sizeof(mat4x4),
+		[DEMO_SPHERE] = 4 * sizeof(float),
+		[DEMO_GPU_INDEX] = sizeof(uint32_t),
+	};
+	const ecs_mask mask = ECS_BIT(DEMO_COMPONENT_COUNT) - 1;
+	const ecs_mask matrices = ECS_BIT(DEMO_MODEL) | ECS_BIT(DEMO_SPHERE) |
+		ECS_BIT(DEMO_GPU_INDEX);
+	struct ecs_world *world = &demo->world;
+	mat4x4 unfit;
+	uint32_t c, i;
+
+	ecs_init(world);
+	for (c = 0; c < DEMO_COMPONENT_COUNT; c++) {
+		uint32_t U_ASSERT_ONLY component = ecs_register(world, sizes[c]);
+
+		assert(component == c);
+	}
+
+	mat4x4_invert(unfit, demo->mesh_fit);
+	for (i = 0; i < demo->instance_count; i++) {
+		const struct demo_instance *instance = &demo->instances[i];
+		const ecs_entity entity = ecs_create(world, mask);
+		struct demo_spin *spin = ecs_get(world, entity, DEMO_SPIN);
+
+		// Undo the fit to recover where the instance was placed.
+		mat4x4_mul(ecs_get(world, entity, DEMO_PLACEMENT),
+			(vec4 *)instance->model, unfit);
+		memcpy(ecs_get(world, entity, DEMO_MODEL), instance->model,
+			sizeof(mat4x4));
+		memcpy(ecs_get(world, entity, DEMO_SPHERE), instance->sphere,
+			sizeof(instance->sphere));
+		*(uint32_t *)ecs_get(world, entity, DEMO_GPU_INDEX) = i;
+		// Rates from 0.5 to 1.5, scattered by a multiplicative hash.
+		spin->rate = 0.5f + ((i * 2654435761u) >> 24) / 255.0f;
+	}
+
+	demo->systems[DEMO_SYSTEM_SPIN] = (struct ecs_system){
+		.name = "spin",
+		.reads = ECS_BIT(DEMO_PLACEMENT),
+		.writes = ECS_BIT(DEMO_SPIN) | ECS_BIT(DEMO_MODEL),
+		.run = demo_spin_system,
+		.ctx = demo,
+	};
+	demo->systems[DEMO_SYSTEM_PACK] = (struct ecs_system){
+		.name = "pack",
+		.reads = matrices,
+		.run = demo_pack_system,
+		.ctx = demo,
+	};
+	demo->systems[DEMO_SYSTEM_CULL] = (struct ecs_system){
+		.name = "cull",
+		.reads = matrices,
+		.run = demo_cull_system,
+		.ctx = demo,
+	};
+	demo->system_count = demo->cpu_cull ? DEMO_SYSTEM_COUNT :
+		DEMO_SYSTEM_CULL;
+	demo->phase_count = ecs_schedule(demo->systems, demo->system_count,
+					demo->system_phases);
+
+	demo->ecs_chunk_count = ecs_query(world, mask, NULL, 0);
+	demo->ecs_chunk_capacity = world->archetypes[0]->capacity;
+	demo->ecs_jobs = malloc(demo->system_count * demo->ecs_chunk_count *
+				sizeof(*demo->ecs_jobs));
+	demo->ecs_visible = malloc(demo->ecs_chunk_count *
+				demo->ecs_chunk_capacity * sizeof(uint32_t));
+	demo->ecs_visible_counts = malloc(demo->ecs_chunk_count *
+					sizeof(uint32_t));
+	assert(demo->ecs_jobs && demo->ecs_visible &&
+		demo->ecs_visible_counts);
+}
+
+// The array of structs baseline for demo_ecs_bench().
+struct demo_object {
+	mat4x4 placement;
+	struct demo_spin spin;
+	mat4x4 model;
+	float sphere[4];
+	uint32_t gpu_index;
+};
+
+/*
+ * Time each system over ECS_BENCH_ENTITIES entities on one thread, against
+ * the same work over an array of structs holding the same components.
+ */
+static void demo_ecs_bench(void) {
+	static const char *names[DEMO_SYSTEM_COUNT] = {"spin", "pack", "cull"};
+	const uint32_t count = ECS_BENCH_ENTITIES;
+	const float side = 100.0f;
+	struct demo *demo = calloc(1, sizeof(*demo));
+	struct demo_object *objects = malloc(count * sizeof(*objects));
+	struct demo_instance *instances = malloc(count * sizeof(*instances));
+	uint32_t *visible = malloc(count * sizeof(*visible));
+	double aos[DEMO_SYSTEM_COUNT] = {0}, ecs[DEMO_SYSTEM_COUNT] = {0};
+	mat4x4 projection, view, vp, fit;
+	float planes[6][4];
+	vec3 eye = {0.0f, 0.0f, side}, origin = {0, 0, 0}, up = {0.0f, 1.0f, 0.0f};
+	uint32_t i, s, n;
+
+	assert(demo && objects && instances && visible);
+	demo->instance_count = count;
+	demo->instances = instances;
+	demo->spin_angle = 4.0f;
+	demo->cpu_cull = true;
+	mat4x4_identity(demo->mesh_fit);
+	mat4x4_perspective(projection, (float)degreesToRadians(45.0f), 1.0f,
+			0.1f, 1000.0f);
+	mat4x4_look_at(view, eye, origin, up);
+	mat4x4_mul(vp, projection, view);
+	demo_frustum_planes(vp, demo->cull_planes);
+	memcpy(fit, demo->mesh_fit, sizeof(fit));
+	memcpy(planes, demo->cull_planes, sizeof(planes));
+
+	// Scatter the entities through a cube around the origin, about half of
+	// them in view.
+	for (i = 0; i < count; i++) {
+		mat4x4_translate(instances[i].model,
+				((i * 2654435761u) >> 8) / 16777216.0f * side -
+				side * 0.5f,
+				((i * 2246822519u) >> 8) / 16777216.0f * side -
+				side * 0.5f,
+				((i * 3266489917u) >> 8) / 16777216.0f * side -
+				side * 0.5f);
+		memcpy(instances[i].sphere, (float[4]){0, 0, 0, sqrtf(3.0f)},
+			sizeof(instances[i].sphere));
+	}
+	demo_init_ecs(demo);
+	for (i = 0; i < count; i++) {
+		struct demo_object *object = &objects[i];
+
+		memcpy(object->placement, instances[i].model,
+			sizeof(object->placement));
+		object->spin = *(struct demo_spin *)ecs_get(&demo->world, i,
+							DEMO_SPIN);
+		memcpy(object->model, instances[i].model, sizeof(object->model));
+		memcpy(object->sphere, instances[i].sphere,
+			sizeof(object->sphere));
+		object->gpu_index = i;
+	}
+	demo->ecs_instances = instances;
+
+	for (n = 0; n < ECS_BENCH_ITERATIONS; n++) {
+		for (s = 0; s < DEMO_SYSTEM_COUNT; s++) {
+			double start = demo_time_ms();
+			struct demo_object *object = objects;
+			uint32_t visible_count = 0;
+
+			switch (s) {
+			case DEMO_SYSTEM_SPIN:
+				for (i = 0; i < count; i++, object++)
+					demo_spin_entity(demo->spin_angle, fit,
+							object->placement,
+							&object->spin,
+							object->model);
+				break;
+			case DEMO_SYSTEM_PACK:
+				for (i = 0; i < count; i++, object++)
+					demo_pack_entity(
+						&instances[object->gpu_index],
+						object->model, object->sphere);
+				break;
+			default:
+				for (i = 0; i < count; i++, object++) {
+					if (demo_sphere_visible(
+						(const float (*)[4])planes,
+						object->model, object->sphere))
+						visible[visible_count++] =
+							object->gpu_index;
+				}
+				break;
+			}
+			aos[s] += demo_time_ms() - start;
+
+			start = demo_time_ms();
+			ecs_run(&demo->world, &demo->systems[s], 1);
+			ecs[s] += demo_time_ms() - start;
+		}
+	}
+
+	printf("ECS bench: %u entities, %u per %u byte chunk, %u phases\n",
+		count, demo->ecs_chunk_capacity, ECS_CHUNK_SIZE,
+		demo->phase_count);
+	printf("  system   AoS ns/entity   ECS ns/entity\n");
+	for (s = 0; s < DEMO_SYSTEM_COUNT; s++)
+		printf("  %-6s %15.2f %15.2f\n", names[s],
+			aos[s] * 1e6 / ((double)count * ECS_BENCH_ITERATIONS),
+			ecs[s] * 1e6 / ((double)count * ECS_BENCH_ITERATIONS));
+
+	ecs_destroy(&demo->world);
+	free(demo->ecs_jobs);
+	free(demo->ecs_visible);
+	free(demo->ecs_visible_counts);
+	free(demo);
+	free(objects);
+	free(instances);
+	free(visible);
+}
+
+/*
+ * Load the mesh, or build the original cube, then lay instances of it out on
+ * a cube-shaped grid centred on the origin and index them with a BVH. Each
+ * instance scales the mesh to fit a [-1, 1] box, so a single cube instance
+ * sits at the origin with an identity transform.
+ *
+ * A scene file instead supplies the instance transforms, applied after the
+ * fit, and their bounds, which the BVH indexes straight from the mapping.
+ *
+ * The scene lives on the CPU for the life of the demo so that picking edits
+ * survive the swapchain being recreated.
+ */
+static void demo_init_scene(struct demo *demo) {
+	const float spacing = 3.0f;
+	// The fitted mesh spans at most [-1, 1] on each axis.
+	const float radius = sqrtf(3.0f);
+	float centre[3], extent = 0.0f;
+	mat4x4 centred;
+	float (*fit)[4] = demo->mesh_fit;
+	uint32_t side = 1, mesh, i;
+
+	if (demo->scene_file) {
+		const char *error;
+
+		if (!scene_open(&demo->scene, demo->scene_file, &error))
+			ERR_EXIT(error, "Scene Load Failure");
+		if (demo->scene.instance_count == 0)
+			ERR_EXIT("Scene has no instances", "Scene Load Failure");
+		demo->instance_count = demo->scene.instance_count;
+		// Every instance is drawn with one mesh, so they must agree.
+		mesh = demo->scene.mesh_ids[0];
+		for (i = 1; i < demo->instance_count; i++) {
+			if (demo->scene.mesh_ids[i] != mesh)
+				ERR_EXIT("Scene instances use more than one mesh, "
+					"which the demo cannot draw",
+					"Scene Load Failure");
+		}
+		if (!demo->mesh_file && demo->scene.mesh_count > 0)
+			demo->mesh_file = (char *)scene_mesh_path(&demo->scene,
+								mesh);
+		if (demo->scene.texture_count > 0 && !demo->bindless)
+			tex_files[0] = (char *)scene_texture_path(&demo->scene,
+					demo->scene.material_textures[0]);
+		if (demo->scene.texture_count > 1 && !demo->bindless)
+			printf("Scene: drawing every instance with %s\n",
+				tex_files[0]);
+	}
+
+	// Every texture the scene has, as far as the array goes.
+	demo->texture_count = 1;
+	demo->texture_files = (const char **)tex_files;
+	if (demo->bindless && demo->scene.texture_count > 0) {
+		demo->texture_count = demo->scene.texture_count;
+		if (demo->texture_count > demo->texture_capacity) {
+			printf("Scene: only the first %u of %u textures fit the "
+				"texture array\n", demo->texture_capacity,
+				demo->texture_count);
+			demo->texture_count = demo->texture_capacity;
+		}
+		demo->texture_files = malloc(demo->texture_count *
+					sizeof(*demo->texture_files));
+		assert(demo->texture_files);
+		for (i = 0; i < demo->texture_count; i++)
+			demo->texture_files[i] =
+				scene_texture_path(&demo->scene, i);
+	}
+	demo->textures = calloc(demo->texture_count, sizeof(*demo->textures));
+	assert(demo->textures);
+
+	if (demo->mesh_file) {
+		const char *error;
+
+		if (!mesh_load(&demo->mesh, demo->mesh_file, &error))
+			ERR_EXIT(error, "Mesh Load Failure");
+	} else {
+		struct mesh_vertex corners[12 * 3];
+
+		for (i = 0; i < 12 * 3; i++) {
+			memcpy(corners[i].position, &g_vertex_buffer_data[i * 3],
+				sizeof(corners[i].position));
+			memcpy(corners[i].uv, &g_uv_buffer_data[i * 2],
+				sizeof(corners[i].uv));
+		}
+		mesh_build(&demo->mesh, corners, 12 * 3);
+	}
+
+	for (i = 0; i < 3; i++) {
+		centre[i] = (demo->mesh.min[i] + demo->mesh.max[i]) * 0.5f;
+		if (demo->mesh.max[i] - demo->mesh.min[i] > extent)
+			extent = demo->mesh.max[i] - demo->mesh.min[i];
+	}
+	if (extent <= 0.0f)
+		extent = 2.0f;
+	mat4x4_translate(centred, -centre[0], -centre[1], -centre[2]);
+	mat4x4_identity(fit);
+	mat4x4_scale_aniso(fit, fit, 2.0f / extent, 2.0f / extent,
+			2.0f / extent);
+	mat4x4_mul(fit, fit, centred);
+
+	while (side * side * side < demo->instance_count)
+		side++;
+
+	demo->instances = malloc(demo->instance_count * sizeof(*demo->instances));
+	demo->instance_bounds = demo->scene_file ? demo->scene.bounds :
+		malloc(demo->instance_count * sizeof(*demo->instance_bounds));
+	demo->instance_lifted =
+		calloc(demo->instance_count, sizeof(*demo->instance_lifted));
+	assert(demo->instances && demo->instance_bounds &&
+		demo->instance_lifted);
+
+	for (i = 0; demo->scene_file && i < demo->instance_count; i++) {
+		struct demo_instance *instance = &demo->instances[i];
+		mat4x4 transform;
+		float scale = 0.0f;
+
+		memcpy(transform, demo->scene.transforms[i], sizeof(transform));
+		mat4x4_mul(instance->model, transform, fit);
+		for (int c = 0; c < 3; c++)
+			scale = fmaxf(scale, vec3_len(transform[c]));
+		instance->sphere[0] = centre[0];
+		instance->sphere[1] = centre[1];
+		instance->sphere[2] = centre[2];
+		instance->sphere[3] = radius * scale;
+		instance->texture = 0;
+		if (demo->scene.material_count > 0 &&
+				demo->scene.material_textures[
+				demo->scene.material_ids[i]] < demo->texture_count)
+			instance->texture = demo->scene.material_textures[
+				demo->scene.material_ids[i]];
+	}
+
+	for (i = 0; !demo->scene_file && i < demo->instance_count; i++) {
+		struct demo_instance *instance = &demo->instances[i];
+		const float half = (side - 1) * 0.5f;
+		float x = ((i % side) - half) * spacing;
+		float y = (((i / side) % side) - half) * spacing;
+		float z = ((i / (side * side)) - half) * spacing;
+		mat4x4 translation;
+
+		mat4x4_translate(translation, x, y, z);
+		mat4x4_mul(instance->model, translation, fit);
+		// The centre is in mesh space, the radius in world space.
+		instance->sphere[0] = centre[0];
+		instance->sphere[1] = centre[1];
+		instance->sphere[2] = centre[2];
+		instance->sphere[3] = radius;
+		instance->texture = 0;
+		demo_instance_bounds(&demo->mesh, instance,
+				&demo->instance_bounds[i]);
+	}
+
+	// The hierarchy starts from the bounds, before anything refits them.
+	if (demo->hierarchy)
+		demo_init_hierarchy(demo);
+	else if (demo->ecs)
+		demo_init_ecs(demo);
+
+	bvh_build(&demo->bvh, demo->instance_bounds, demo->instance_count);
+
+	if (demo->cpu_cull || demo->hierarchy || demo->ecs)
+		demo_cull_pool_init(demo);
+}
+
+static void demo_destroy_scene(struct demo *demo) {
+	if (demo->cpu_cull) {
+		if (demo->cull_frames > 0)
+			printf("CPU cull: %.3f ms/frame over %u frames, "
+				"%u instances, %u threads\n",
+				demo->cull_time / demo->cull_frames,
+				demo->cull_frames, demo->instance_count,
+				demo->cull_pool.thread_count + 1);
+		if (demo->sort_draws && demo->cull_frames > 0)
+			printf("Draw sort: %.3f ms/frame\n",
+				demo->sort_time / demo->cull_frames);
+	}
+	if (demo->hierarchy && demo->hierarchy_frames > 0)
+		printf("Hierarchy: %.3f ms/frame over %u frames, %u nodes, "
+			"%u levels\n",
+			demo->hierarchy_time / demo->hierarchy_frames,
+			demo->hierarchy_frames, demo->xform.count,
+			demo->xform.level_count);
+	if (demo->ecs && demo->ecs_frames > 0)
+		printf("ECS: %.3f ms/frame over %u frames, %u entities in %u "
+			"chunks, %u phases\n",
+			demo->ecs_time / demo->ecs_frames, demo->ecs_frames,
+			demo->instance_count, demo->ecs_chunk_count,
+			demo->phase_count);
+	if (demo->cpu_cull || demo->hierarchy || demo->ecs)
+		demo_cull_pool_destroy(demo);
+
+	ecs_destroy(&demo->world);
+	free(demo->ecs_jobs);
+	free(demo->ecs_visible);
+	free(demo->ecs_visible_counts);
+	xform_destroy(&demo->xform);
+	bvh_destroy(&demo->bvh);
+	mesh_destroy(&demo->mesh);
+	free(demo->instances);
+	if (!demo->scene_file)
+		free(demo->instance_bounds);
+	free(demo->instance_lifted);
+	free(demo->textures);
+	for (uint32_t i = 0; demo->decoded_textures &&
+			i < demo->texture_count; i++)
+		free(demo->decoded_textures[i].pixels);
+	free(demo->decoded_textures);
+	if (demo->texture_files != (const char **)tex_files)
+		free(demo->texture_files);
+	scene_close(&demo->scene);
+	if (demo->shader_files) {
+		for (size_t i = 0; i < ARRAY_SIZE(embedded_shaders); i++)
+			free(demo->shader_files[i].code);
+		free(demo->shader_files);
+	}
+}
+
+/*
+ * Raise a picked instance, or drop it back if it was raised already, and refit
+ * the BVH around its new bounds. In a hierarchy the whole subtree moves.
+ */
+static void demo_move_instance(struct demo *demo, uint32_t index) {
+	struct demo_instance *instance = &demo->instances[index];
+	const float lift = demo->instance_lifted[index] ? -1.0f : 1.0f;
+
+	instance->model[3][1] += lift;
+	demo->instance_lifted[index] = !demo->instance_lifted[index];
+
+	// The node's subtree follows it on the next hierarchy update.
+	if (demo->hierarchy) {
+		struct xform *xform = &demo->xform;
+		const uint32_t slot = xform->slots[index];
+		const float translation[3] = {
+			xform->translation[0][slot],
+			xform->translation[1][slot] + lift,
+			xform->translation[2][slot],
+		};
+		const float rotation[4] = {
+			xform->rotation[0][slot], xform->rotation[1][slot],
+			xform->rotation[2][slot], xform->rotation[3][slot],
+		};
+
+		xform_set_local(xform, index, translation, rotation,
+				xform->scale[slot]);
+		return;
+	}
+
+	demo_instance_bounds(&demo->mesh, instance,
+			&demo->instance_bounds[index]);
+	bvh_refit(&demo->bvh, demo->instance_bounds);
+
+	// The pack system writes the instance buffer on the next frame.
+	if (demo->ecs) {
+		float (*placement)[4] = ecs_get(&demo->world, index,
+						DEMO_PLACEMENT);
+
+		placement[3][1] += lift;
+		return;
 	}
+
+	// Frames in flight may still be reading the instance buffer, so each
+	// image's copy is brought up to date once its image comes round.
+	for (uint32_t i = 0; i < demo->swapchainImageCount; i++)
+		demo->buffers[i].instances_stale = true;
 }
 
-void demo_prepare_cube_data_buffer(struct demo *demo) {
-	VkBufferCreateInfo buf_info;
-	VkMemoryRequirements mem_reqs;
-	uint8_t *pData;
-	int i;
-	mat4x4 MVP, VP;
-	VkResult U_ASSERT_ONLY err;
-	bool U_ASSERT_ONLY pass;
-	struct vktexcube_vs_uniform data;
+/*
+ * Cast a ray through the given window coordinates by unprojecting the near and
+ * far planes, and move the first instance it hits.
+ */
+static void demo_pick(struct demo *demo, int x, int y) {
+	const uint32_t columns = demo_view_columns(demo);
+	const uint32_t rows = (demo->view_count + columns - 1) / columns;
+	// Find the view under the cursor and the cursor's place within it.
+	const float tile_x = (x + 0.5f) * columns / demo->width;
+	const float tile_y = (y + 0.5f) * rows / demo->height;
+	const uint32_t view = (uint32_t)tile_y * columns + (uint32_t)tile_x;
+	mat4x4 VP, MVP, inverse;
+	vec4 near_point = {
+		2.0f * (tile_x - (uint32_t)tile_x) - 1.0f,
+		2.0f * (tile_y - (uint32_t)tile_y) - 1.0f,
+		0.0f,
+		1.0f,
+	};
+	vec4 far_point = {near_point[0], near_point[1], 1.0f, 1.0f};
+	vec4 near_world, far_world;
+	float origin[3], dir[3], t;
+	uint32_t hit;
 
-	mat4x4_mul(VP, demo->projection_matrix, demo->view_matrix);
+	if (view >= demo->view_count)
+		return;
+
+	mat4x4_mul(VP, demo->projection_matrix, demo->view_matrices[view]);
 	mat4x4_mul(MVP, VP, demo->model_matrix);
-	memcpy(data.mvp, MVP, sizeof(MVP));
-	//	dumpMatrix("MVP", MVP);
+	mat4x4_invert(inverse, MVP);
+	mat4x4_mul_vec4(near_world, inverse, near_point);
+	mat4x4_mul_vec4(far_world, inverse, far_point);
 
-	for (i = 0; i < 12 * 3; i++) {
-		data.position[i][0] = g_vertex_buffer_data[i * 3];
-		data.position[i][1] = g_vertex_buffer_data[i * 3 + 1];
-		data.position[i][2] = g_vertex_buffer_data[i * 3 + 2];
-		data.position[i][3] = 1.0f;
-		data.attr[i][0] = g_uv_buffer_data[2 * i];
-		data.attr[i][1] = g_uv_buffer_data[2 * i + 1];
-		data.attr[i][2] = 0;
-		data.attr[i][3] = 0;
+	for (int i = 0; i < 3; i++) {
+		origin[i] = near_world[i] / near_world[3];
+		dir[i] = far_world[i] / far_world[3] - origin[i];
 	}
 
-	memset(&buf_info, 0, sizeof(buf_info));
-	buf_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	buf_info.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-	buf_info.size = sizeof(data);
-	err =
-		vkCreateBuffer(demo->device, &buf_info, NULL, &demo->uniform_data.buf);
-	assert(!err);
-
-	vkGetBufferMemoryRequirements(demo->device, demo->uniform_data.buf,
-				&mem_reqs);
-
-	demo->uniform_data.mem_alloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	demo->uniform_data.mem_alloc.pNext = NULL;
-	demo->uniform_data.mem_alloc.allocationSize = mem_reqs.size;
-	demo->uniform_data.mem_alloc.memoryTypeIndex = 0;
+	if (!bvh_raycast(&demo->bvh, demo->instance_bounds, origin, dir, &hit,
+				&t))
+		return;
 
-	pass = memory_type_from_properties(
-		demo, mem_reqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&demo->uniform_data.mem_alloc.memoryTypeIndex);
-	assert(pass);
+	printf("Picked instance %u\n", hit);
+	fflush(stdout);
+	demo_move_instance(demo, hit);
+}
 
-	err = vkAllocateMemory(demo->device, &demo->uniform_data.mem_alloc, NULL,
-			&(demo->uniform_data.mem));
-	assert(!err);
+static void demo_prepare_instances(struct demo *demo) {
+	const VkDeviceSize size = demo->instance_count *
+		sizeof(*demo->instances);
+	const VkDeviceSize align =
+		demo->gpu_props.limits.minStorageBufferOffsetAlignment;
+	uint8_t *pData;
+	VkResult U_ASSERT_ONLY err;
 
-	err = vkMapMemory(demo->device, demo->uniform_data.mem, 0,
-			demo->uniform_data.mem_alloc.allocationSize, 0,
+	demo->instance_stride = (size + align - 1) / align * align;
+	demo_prepare_buffer_object(demo, &demo->instance_data,
+				demo->instance_stride *
+				demo->swapchainImageCount,
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, NULL, true);
+	err = vkMapMemory(demo->device, demo->instance_data.mem, 0,
+			demo->instance_data.mem_alloc.allocationSize, 0,
 			(void **)&pData);
 	assert(!err);
+	for (uint32_t i = 0; i < demo->swapchainImageCount; i++)
+		memcpy(pData + i * demo->instance_stride, demo->instances, size);
+	vkUnmapMemory(demo->device, demo->instance_data.mem);
+	// Each binding sees one copy, picked by the dynamic offset.
+	demo->instance_data.buffer_info.range = size;
+
+	demo_prepare_buffer_object(demo, &demo->vertex_data,
+				demo->mesh.vertex_count *
+				sizeof(*demo->mesh.vertices),
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+				demo->mesh.vertices, false);
+	demo_prepare_buffer_object(demo, &demo->index_data,
+				demo->mesh.index_count *
+				sizeof(*demo->mesh.indices),
+				VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+				demo->mesh.indices, false);
+}
 
-	memcpy(pData, &data, sizeof data);
+/*
+ * The culling outputs: a visible list and an indirect draw slot for each
+ * swapchain image. Without GPU culling every slot simply draws every instance.
+ */
+static void demo_prepare_cull_buffers(struct demo *demo) {
+	// The late occlusion phase needs slots of its own.
+	const uint32_t slot_count = demo->swapchainImageCount *
+		(demo->occlusion_cull ? 2 : 1);
+	struct demo_cull_slot *slots;
+	uint32_t *visible, *visibility;
+	uint32_t i;
 
-	vkUnmapMemory(demo->device, demo->uniform_data.mem);
+	slots = calloc(slot_count, sizeof(*slots));
+	visible = malloc(slot_count * demo->instance_count * sizeof(*visible));
+	assert(slots && visible);
 
-	err = vkBindBufferMemory(demo->device, demo->uniform_data.buf,
-				demo->uniform_data.mem, 0);
-	assert(!err);
+	for (i = 0; i < slot_count; i++) {
+		slots[i].draw.indexCount = demo->mesh.index_count;
+		slots[i].draw.instanceCount = demo->instance_count;
+		slots[i].draw_count = 1;
+	}
+	for (i = 0; i < slot_count * demo->instance_count; i++)
+		visible[i] = i % demo->instance_count;
+
+	demo_prepare_buffer_object(demo, &demo->indirect_data,
+				slot_count * sizeof(*slots),
+				VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+				VK_BUFFER_USAGE_TRANSFER_DST_BIT, slots, false);
+	demo_prepare_buffer_object(demo, &demo->visible_data,
+				slot_count * demo->instance_count *
+				sizeof(*visible),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, visible, false);
+	free(visible);
+	free(slots);
+
+	if (!demo->gpu_cull)
+		return;
 
-	demo->uniform_data.buffer_info.buffer = demo->uniform_data.buf;
-	demo->uniform_data.buffer_info.offset = 0;
-	demo->uniform_data.buffer_info.range = sizeof(data);
+	// Nothing was visible last frame, so the first late phase draws it all.
+	visibility = calloc(demo->instance_count, sizeof(*visibility));
+	assert(visibility);
+	demo_prepare_buffer_object(demo, &demo->visibility_data,
+				demo->instance_count * sizeof(*visibility),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, visibility,
+				false);
+	free(visibility);
 }
 
-static void demo_prepare_descriptor_layout(struct demo *demo) {
-	const VkDescriptorSetLayoutBinding layout_bindings[2] = {
+static void demo_init_descriptor_layout(struct demo *demo) {
+	const VkDescriptorSetLayoutBinding layout_bindings[7] = {
 		[0] =
 		{
 			.binding = 0,
 			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
 			.descriptorCount = 1,
-			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+				VK_SHADER_STAGE_COMPUTE_BIT,
 			.pImmutableSamplers = NULL,
 		},
 		[1] =
 		{
 			.binding = 1,
 			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-			.descriptorCount = DEMO_TEXTURE_COUNT,
+			.descriptorCount = demo->bindless ?
+				demo->texture_capacity : 1,
 			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
 			.pImmutableSamplers = NULL,
 		},
+		[2] =
+		{
+			.binding = 2,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+				VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = NULL,
+		},
+		[3] =
+		{
+			.binding = 3,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+				VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = NULL,
+		},
+		[4] =
+		{
+			.binding = 4,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = NULL,
+		},
+		[5] =
+		{
+			.binding = 5,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = NULL,
+		},
+		[6] =
+		{
+			.binding = 6,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+			.pImmutableSamplers = NULL,
+		},
 	};
-	const VkDescriptorSetLayoutCreateInfo descriptor_layout = {
+	VkDescriptorSetLayoutCreateInfo descriptor_layout = {
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
 		.pNext = NULL,
-		.bindingCount = 2,
+		.bindingCount = 7,
 		.pBindings = layout_bindings,
 	};
+#ifdef VK_EXT_descriptor_indexing
+	// The texture array need not be filled, and can be written while the
+	// set is bound, so adding a texture touches no command buffer.
+	const VkDescriptorBindingFlagsEXT binding_flags[7] = {
+		[1] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+			VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT,
+	};
+	const VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flags_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT,
+		.pNext = NULL,
+		.bindingCount = 7,
+		.pBindingFlags = binding_flags,
+	};
+	if (demo->bindless) {
+		descriptor_layout.pNext = &flags_info;
+		descriptor_layout.flags =
+			VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+	}
+#endif
+	VkDescriptorPoolCreateFlags pool_flags = 0;
 	VkResult U_ASSERT_ONLY err;
 
 	err = vkCreateDescriptorSetLayout(demo->device, &descriptor_layout, NULL,
 					&demo->desc_layout);
 	assert(!err);
 
+#ifdef VK_EXT_descriptor_indexing
+	if (demo->bindless)
+		pool_flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+#endif
+	// The texture array is written by demo_update_texture_descriptors(),
+	// and only the culling pass reads bindings 5 and 6.
+	desc_allocator_init(&demo->desc_alloc, demo->device, demo->desc_layout,
+			layout_bindings, 7, demo->gpu_cull ? 0x7d : 0x1d,
+			pool_flags, 1, demo->update_templates);
+}
+
+static void demo_prepare_descriptor_layout(struct demo *demo) {
+	// The slot being drawn and the culling phase, see demo_draw_build_cmd().
+	const VkPushConstantRange push_constant_range = {
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+			VK_SHADER_STAGE_COMPUTE_BIT,
+		.offset = 0,
+		.size = sizeof(struct demo_cull_push),
+	};
+	VkResult U_ASSERT_ONLY err;
+
 	const VkPipelineLayoutCreateInfo pPipelineLayoutCreateInfo = {
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
 		.pNext = NULL,
 		.setLayoutCount = 1,
 		.pSetLayouts = &demo->desc_layout,
+		.pushConstantRangeCount = 1,
+		.pPushConstantRanges = &push_constant_range,
 	};
 
 	err = vkCreatePipelineLayout(demo->device, &pPipelineLayoutCreateInfo, NULL,
@@ -1412,7 +4885,11 @@ static void demo_prepare_descriptor_layout(struct demo *demo) {
 	assert(!err);
 }
 
-static void demo_prepare_render_pass(struct demo *demo) {
+/*
+ * With a non-zero view_mask the subpass is broadcast to every view in it, each
+ * rendering into its own layer of the attachments.
+ */
+static void demo_prepare_render_pass(struct demo *demo, uint32_t view_mask) {
 	// The initial layout for the color and depth attachments will be LAYOUT_UNDEFINED
 	// because at the start of the renderpass, we don't care about their contents.
 	// At the start of the subpass, the color attachment's layout will be transitioned
@@ -1420,8 +4897,13 @@ static void demo_prepare_render_pass(struct demo *demo) {
 	// will be transitioned to LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL.  At the end of
 	// the renderpass, the color attachment's layout will be transitioned to
 	// LAYOUT_PRESENT_SRC_KHR to be ready to present.  This is all done as part of
-	// the renderpass, no barriers are necessary.
-	const VkAttachmentDescription attachments[2] = {
+	// the renderpass, the frame graph only orders it against the passes
+	// around it.
+	//
+	// With occlusion culling the frame is split across this and a second,
+	// late render pass which picks up the attachments where the first left
+	// them, after the depth buffer has been read to build the depth pyramid.
+	VkAttachmentDescription attachments[2] = {
 		[0] =
 		{
 			.format = demo->format,
@@ -1468,7 +4950,7 @@ static void demo_prepare_render_pass(struct demo *demo) {
 		.preserveAttachmentCount = 0,
 		.pPreserveAttachments = NULL,
 	};
-	const VkRenderPassCreateInfo rp_info = {
+	VkRenderPassCreateInfo rp_info = {
 		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
 		.pNext = NULL,
 		.flags = 0,
@@ -1479,10 +4961,57 @@ static void demo_prepare_render_pass(struct demo *demo) {
 		.dependencyCount = 0,
 		.pDependencies = NULL,
 	};
+#ifdef VK_KHR_multiview
+	// Views are close together, so let the implementation render them
+	// concurrently.
+	const VkRenderPassMultiviewCreateInfoKHR multiview = {
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO_KHR,
+		.pNext = NULL,
+		.subpassCount = 1,
+		.pViewMasks = &view_mask,
+		.dependencyCount = 0,
+		.pViewOffsets = NULL,
+		.correlationMaskCount = 1,
+		.pCorrelationMasks = &view_mask,
+	};
+#endif
 	VkResult U_ASSERT_ONLY err;
 
+	if (view_mask) {
+#ifdef VK_KHR_multiview
+		rp_info.pNext = &multiview;
+#endif
+		attachments[0].finalLayout =
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	}
+
+	if (demo->occlusion_cull) {
+		attachments[0].finalLayout =
+			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	}
+	// Contexts render offscreen, ready to be read back.
+	if (demo->context_count > 0)
+		attachments[0].finalLayout =
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
 	err = vkCreateRenderPass(demo->device, &rp_info, NULL, &demo->render_pass);
 	assert(!err);
+
+	if (demo->occlusion_cull) {
+		attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		attachments[0].initialLayout =
+			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachments[1].initialLayout =
+			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+		err = vkCreateRenderPass(demo->device, &rp_info, NULL,
+					&demo->late_render_pass);
+		assert(!err);
+	}
 }
 
 static VkShaderModule
@@ -1505,7 +5034,6 @@ demo_prepare_shader_module(struct demo *demo, const void *code, size_t size) {
 
 char *demo_read_spv(const char *filename, size_t *psize) {
 	long int size;
-	size_t U_ASSERT_ONLY retval;
 	void *shader_code;
 
 	FILE *fp = fopen(filename, "rb");
@@ -1517,9 +5045,12 @@ char *demo_read_spv(const char *filename, size_t *psize) {
 
 	fseek(fp, 0L, SEEK_SET);
 
-	shader_code = malloc(size);
-	retval = fread(shader_code, size, 1, fp);
-	assert(retval == 1);
+	shader_code = size > 0 ? malloc(size) : NULL;
+	if (!shader_code || fread(shader_code, size, 1, fp) != 1) {
+		free(shader_code);
+		fclose(fp);
+		return NULL;
+	}
 
 	*psize = size;
 
@@ -1527,38 +5058,279 @@ char *demo_read_spv(const char *filename, size_t *psize) {
 	return shader_code;
 }
 
-static VkShaderModule demo_prepare_vs(struct demo *demo) {
-	void *vertShaderCode;
+/*
+ * Read the --shader_dir files of embedded shaders [first, last) while the
+ * instance is created, see demo_load_shader().
+ */
+static void demo_read_shader_job(void *ctx, uint32_t first, uint32_t last,
+				uint32_t worker UNUSED) {
+	struct demo *demo = ctx;
+	const double start = demo_time_ms();
+	char path[4096];
+
+	for (uint32_t i = first; i < last; i++) {
+		struct demo_shader_file *file = &demo->shader_files[i];
+
+		snprintf(path, sizeof(path), "%s/%s", demo->shader_dir,
+			embedded_shaders[i].name);
+		file->code = demo_read_spv(path, &file->size);
+	}
+	atomic_fetch_add(&demo->startup_shaders_us,
+			(demo_time_ms() - start) * 1000.0);
+}
+
+/*
+ * Create a module from the named SPIR-V file, as built into the binary, or
+ * read from the --shader_dir directory when developing shaders.
+ */
+static VkShaderModule demo_load_shader(struct demo *demo, const char *name) {
+	VkShaderModule module;
+	char path[4096];
+	void *code;
 	size_t size;
 
-	vertShaderCode = demo_read_spv("cube.vert.spv", &size);
+	if (!demo->shader_dir) {
+		for (size_t i = 0; i < ARRAY_SIZE(embedded_shaders); i++) {
+			if (strcmp(embedded_shaders[i].name, name) == 0)
+				return demo_prepare_shader_module(demo,
+						embedded_shaders[i].code,
+						embedded_shaders[i].size);
+		}
+		ERR_EXIT("Shader missing from the build\n",
+			"Load Shader Failure");
+	}
+
+	// Most were read already.
+	job_wait(&demo->jobs, &demo->shaders_read);
+	for (size_t i = 0; i < ARRAY_SIZE(embedded_shaders); i++) {
+		const struct demo_shader_file *file = &demo->shader_files[i];
+
+		if (file->code && strcmp(embedded_shaders[i].name, name) == 0)
+			return demo_prepare_shader_module(demo, file->code,
+							file->size);
+	}
 
-	demo->vert_shader_module =
-		demo_prepare_shader_module(demo, vertShaderCode, size);
+	snprintf(path, sizeof(path), "%s/%s", demo->shader_dir, name);
+	code = demo_read_spv(path, &size);
+	if (!code) {
+		ERR_EXIT("Failed to read a shader from --shader_dir\n",
+			"Load Shader Failure");
+	}
+	module = demo_prepare_shader_module(demo, code, size);
+	free(code);
+	return module;
+}
 
-	free(vertShaderCode);
+static VkShaderModule demo_prepare_vs(struct demo *demo) {
+	// The multiview build reads gl_ViewIndex, which needs the feature.
+	demo->vert_shader_module = demo_load_shader(demo, demo->multiview ?
+				"cube-multiview.vert.spv" : "cube.vert.spv");
 
 	return demo->vert_shader_module;
 }
 
 static VkShaderModule demo_prepare_fs(struct demo *demo) {
-	void *fragShaderCode;
-	size_t size;
+	// The bindless build indexes a runtime sized texture array.
+	demo->frag_shader_module = demo_load_shader(demo, demo->bindless ?
+				"cube-bindless.frag.spv" : "cube.frag.spv");
 
-	fragShaderCode = demo_read_spv("cube.frag.spv", &size);
+	return demo->frag_shader_module;
+}
+
+/*
+ * The pipeline cache lives in $XDG_CACHE_HOME, or ~/.cache, creating the
+ * directories on the way. Leaves the path empty if there is nowhere to put it.
+ */
+static void demo_pipeline_cache_path(struct demo *demo) {
+	const char *base = getenv("XDG_CACHE_HOME");
+	char *path = demo->pipeline_cache_path;
+	const size_t size = sizeof(demo->pipeline_cache_path);
+	int n;
+
+	path[0] = '\0';
+	if (base && base[0] == '/') {
+		n = snprintf(path, size, "%s", base);
+	} else {
+		const char *home = getenv("HOME");
 
-	demo->frag_shader_module =
-		demo_prepare_shader_module(demo, fragShaderCode, size);
+		if (!home || !home[0])
+			return;
+		n = snprintf(path, size, "%s/.cache", home);
+	}
+	if (n > 0 && (size_t)n < size)
+		n = snprintf(path + n, size - n, "/" APP_SHORT_NAME);
+	if (n <= 0 || strlen(path) + sizeof("/pipeline_cache.bin") > size) {
+		path[0] = '\0';
+		return;
+	}
+	// mkdir makes only the last directory, so make any missing parents
+	// first. Failures show up when the cache is saved.
+	for (char *p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		mkdir(path, 0700);
+		*p = '/';
+	}
+	mkdir(path, 0700);
+	strcat(path, "/pipeline_cache.bin");
+}
 
-	free(fragShaderCode);
+/*
+ * Whether data is a cache this device can use. Drivers check too, but a cache
+ * from another GPU or driver version is only wasted space, and a bad one is
+ * best not handed to a driver at all.
+ */
+static bool demo_pipeline_cache_valid(const struct demo *demo,
+				const uint8_t *data, size_t size) {
+	const size_t header_size = 16 + VK_UUID_SIZE;
+	uint32_t fields[4];
 
-	return demo->frag_shader_module;
+	if (size < header_size)
+		return false;
+	memcpy(fields, data, sizeof(fields));
+	return fields[0] >= header_size && fields[0] <= size &&
+		fields[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+		fields[2] == demo->gpu_props.vendorID &&
+		fields[3] == demo->gpu_props.deviceID &&
+		!memcmp(data + 16, demo->gpu_props.pipelineCacheUUID,
+			VK_UUID_SIZE);
 }
 
-static void demo_prepare_pipeline(struct demo *demo) {
+/*
+ * Create the pipeline cache, seeded from the previous run's if it is valid for
+ * this device. The cache outlives resizes, so rebuilt pipelines hit it too.
+ */
+static void demo_init_pipeline_cache(struct demo *demo) {
+	VkPipelineCacheCreateInfo info = {
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+	};
+	VkResult U_ASSERT_ONLY err;
+	void *data = NULL;
+	size_t size = 0;
+	long length;
+	FILE *fp;
+
+	demo_pipeline_cache_path(demo);
+	fp = demo->pipeline_cache_path[0] ?
+		fopen(demo->pipeline_cache_path, "rb") : NULL;
+	if (fp) {
+		if (!fseek(fp, 0L, SEEK_END) && (length = ftell(fp)) > 0 &&
+				!fseek(fp, 0L, SEEK_SET)) {
+			size = length;
+			data = malloc(size);
+			if (data && fread(data, size, 1, fp) != 1) {
+				free(data);
+				data = NULL;
+			}
+		}
+		fclose(fp);
+	}
+	if (data && demo_pipeline_cache_valid(demo, data, size)) {
+		info.initialDataSize = size;
+		info.pInitialData = data;
+		demo->pipeline_cache_loaded = size;
+	} else if (data) {
+		printf("Discarding pipeline cache %s made for another device "
+			"or driver\n", demo->pipeline_cache_path);
+	}
+
+	err = vkCreatePipelineCache(demo->device, &info, NULL,
+				&demo->pipelineCache);
+	assert(!err);
+	free(data);
+}
+
+/*
+ * Write the cache under a temporary name and rename it into place, so that a
+ * concurrent or interrupted run never leaves a partial file. Failure only
+ * costs the next run its hit, so it is ignored.
+ */
+static void demo_save_pipeline_cache(struct demo *demo) {
+	char tmp[sizeof(demo->pipeline_cache_path) + 32];
+	void *data;
+	size_t size = 0;
+	bool ok;
+	FILE *fp;
+
+	if (!demo->pipeline_cache_path[0] ||
+			vkGetPipelineCacheData(demo->device, demo->pipelineCache,
+					&size, NULL) != VK_SUCCESS ||
+			size == 0)
+		return;
+	data = malloc(size);
+	if (!data)
+		return;
+	if (vkGetPipelineCacheData(demo->device, demo->pipelineCache, &size,
+				data) != VK_SUCCESS) {
+		free(data);
+		return;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.%ld", demo->pipeline_cache_path,
+		(long)getpid());
+	fp = fopen(tmp, "wb");
+	if (fp) {
+		ok = fwrite(data, size, 1, fp) == 1;
+		ok = !fclose(fp) && ok;
+		if (!ok || rename(tmp, demo->pipeline_cache_path))
+			unlink(tmp);
+	}
+	free(data);
+}
+
+static uint64_t demo_pipeline_hash(const struct demo_pipeline_state *state) {
+	const uint8_t fields[] = {
+		state->polygon_mode, state->cull_mode, state->blend,
+		state->depth_write, state->textured,
+	};
+	uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a
+
+	for (size_t i = 0; i < sizeof(fields); i++) {
+		hash ^= fields[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+/*
+ * Fill in spec from data, which the shader reads as constant_id 0 onwards,
+ * and return the info to hand to the stage.
+ */
+static const VkSpecializationInfo *
+demo_specialize(struct demo_specialization *spec, const uint32_t *data,
+		uint32_t count) {
+	assert(count <= DEMO_MAX_SPEC_CONSTANTS);
+	for (uint32_t i = 0; i < count; i++) {
+		spec->entries[i].constantID = i;
+		spec->entries[i].offset = i * sizeof(uint32_t);
+		spec->entries[i].size = sizeof(uint32_t);
+		spec->data[i] = data[i];
+	}
+	spec->info.mapEntryCount = count;
+	spec->info.pMapEntries = spec->entries;
+	spec->info.dataSize = count * sizeof(uint32_t);
+	spec->info.pData = spec->data;
+	return &spec->info;
+}
+
+/*
+ * Build a graphics pipeline variant. Every variant but the first derives from
+ * the first, base, which lets the driver reuse its compiled shaders rather
+ * than starting over.
+ */
+static VkPipeline demo_build_pipeline(struct demo *demo,
+				const struct demo_pipeline_state *state,
+				VkPipeline base) {
 	VkGraphicsPipelineCreateInfo pipeline;
-	VkPipelineCacheCreateInfo pipelineCache;
+	VkPipeline result;
+	// TEXTURED and ALPHA in cube.frag. Blended variants are translucent.
+	const float alpha = state->blend == DEMO_BLEND_OPAQUE ? 1.0f : 0.5f;
+	uint32_t frag_constants[2] = {state->textured};
+	struct demo_specialization frag_spec;
 	VkPipelineVertexInputStateCreateInfo vi;
+	VkVertexInputBindingDescription vi_binding;
+	VkVertexInputAttributeDescription vi_attrs[2];
 	VkPipelineInputAssemblyStateCreateInfo ia;
 	VkPipelineRasterizationStateCreateInfo rs;
 	VkPipelineColorBlendStateCreateInfo cb;
@@ -1577,9 +5349,35 @@ static void demo_prepare_pipeline(struct demo *demo) {
 	memset(&pipeline, 0, sizeof(pipeline));
 	pipeline.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 	pipeline.layout = demo->pipeline_layout;
+	if (base) {
+		pipeline.flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+		pipeline.basePipelineHandle = base;
+	} else {
+		pipeline.flags = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
+	}
+	pipeline.basePipelineIndex = -1;
+
+	memset(&vi_binding, 0, sizeof(vi_binding));
+	vi_binding.binding = 0;
+	vi_binding.stride = sizeof(struct mesh_vertex);
+	vi_binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	memset(vi_attrs, 0, sizeof(vi_attrs));
+	vi_attrs[0].location = 0;
+	vi_attrs[0].binding = 0;
+	vi_attrs[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+	vi_attrs[0].offset = offsetof(struct mesh_vertex, position);
+	vi_attrs[1].location = 1;
+	vi_attrs[1].binding = 0;
+	vi_attrs[1].format = VK_FORMAT_R32G32_SFLOAT;
+	vi_attrs[1].offset = offsetof(struct mesh_vertex, uv);
 
 	memset(&vi, 0, sizeof(vi));
 	vi.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vi.vertexBindingDescriptionCount = 1;
+	vi.pVertexBindingDescriptions = &vi_binding;
+	vi.vertexAttributeDescriptionCount = 2;
+	vi.pVertexAttributeDescriptions = vi_attrs;
 
 	memset(&ia, 0, sizeof(ia));
 	ia.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -1587,8 +5385,8 @@ static void demo_prepare_pipeline(struct demo *demo) {
 
 	memset(&rs, 0, sizeof(rs));
 	rs.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	rs.polygonMode = VK_POLYGON_MODE_FILL;
-	rs.cullMode = VK_CULL_MODE_BACK_BIT;
+	rs.polygonMode = state->polygon_mode;
+	rs.cullMode = state->cull_mode;
 	rs.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 	rs.depthClampEnable = VK_FALSE;
 	rs.rasterizerDiscardEnable = VK_FALSE;
@@ -1600,7 +5398,14 @@ static void demo_prepare_pipeline(struct demo *demo) {
 	VkPipelineColorBlendAttachmentState att_state[1];
 	memset(att_state, 0, sizeof(att_state));
 	att_state[0].colorWriteMask = 0xf;
-	att_state[0].blendEnable = VK_FALSE;
+	att_state[0].blendEnable = state->blend != DEMO_BLEND_OPAQUE;
+	att_state[0].srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	att_state[0].dstColorBlendFactor = state->blend == DEMO_BLEND_ALPHA ?
+		VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+	att_state[0].colorBlendOp = VK_BLEND_OP_ADD;
+	att_state[0].srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	att_state[0].dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	att_state[0].alphaBlendOp = VK_BLEND_OP_ADD;
 	cb.attachmentCount = 1;
 	cb.pAttachments = att_state;
 
@@ -1616,7 +5421,7 @@ static void demo_prepare_pipeline(struct demo *demo) {
 	memset(&ds, 0, sizeof(ds));
 	ds.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
 	ds.depthTestEnable = VK_TRUE;
-	ds.depthWriteEnable = VK_TRUE;
+	ds.depthWriteEnable = state->depth_write;
 	ds.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
 	ds.depthBoundsTestEnable = VK_FALSE;
 	ds.back.failOp = VK_STENCIL_OP_KEEP;
@@ -1637,20 +5442,16 @@ static void demo_prepare_pipeline(struct demo *demo) {
 
 	shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-	shaderStages[0].module = demo_prepare_vs(demo);
+	shaderStages[0].module = demo->vert_shader_module;
 	shaderStages[0].pName = "main";
 
 	shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	shaderStages[1].module = demo_prepare_fs(demo);
+	shaderStages[1].module = demo->frag_shader_module;
 	shaderStages[1].pName = "main";
-
-	memset(&pipelineCache, 0, sizeof(pipelineCache));
-	pipelineCache.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-
-	err = vkCreatePipelineCache(demo->device, &pipelineCache, NULL,
-				&demo->pipelineCache);
-	assert(!err);
+	memcpy(&frag_constants[1], &alpha, sizeof(alpha));
+	shaderStages[1].pSpecializationInfo =
+		demo_specialize(&frag_spec, frag_constants, 2);
 
 	pipeline.pVertexInputState = &vi;
 	pipeline.pInputAssemblyState = &ia;
@@ -1666,78 +5467,360 @@ static void demo_prepare_pipeline(struct demo *demo) {
 	pipeline.renderPass = demo->render_pass;
 
 	err = vkCreateGraphicsPipelines(demo->device, demo->pipelineCache, 1,
-					&pipeline, NULL, &demo->pipeline);
+					&pipeline, NULL, &result);
 	assert(!err);
+	return result;
+}
+
+/*
+ * Find the entry for state, or the empty slot it would go in. Probing ends
+ * at an empty slot since the map is never full.
+ */
+static struct demo_pipeline_entry *
+demo_find_pipeline(struct demo_pipeline_map *map,
+		const struct demo_pipeline_state *state, uint64_t hash) {
+	for (uint32_t i = hash;; i++) {
+		struct demo_pipeline_entry *entry =
+			&map->entries[i % DEMO_PIPELINE_MAP_SIZE];
+
+		if (atomic_load_explicit(&entry->status, memory_order_acquire) ==
+				DEMO_PIPELINE_EMPTY ||
+				(entry->hash == hash &&
+				!memcmp(&entry->state, state, sizeof(*state))))
+			return entry;
+	}
+}
+
+/*
+ * Ask for the pipeline for state, queueing it to be built on first use, and
+ * return its future. Safe to call from any thread.
+ */
+static struct demo_pipeline_entry *
+demo_request_pipeline(struct demo *demo,
+		const struct demo_pipeline_state *state) {
+	struct demo_pipeline_map *map = &demo->pipelines;
+	const uint64_t hash = demo_pipeline_hash(state);
+	struct demo_pipeline_entry *entry = demo_find_pipeline(map, state, hash);
+
+	if (demo_pipeline_ready(entry))
+		return entry;
+
+	pthread_mutex_lock(&map->lock);
+	entry = demo_find_pipeline(map, state, hash);
+	if (atomic_load_explicit(&entry->status, memory_order_relaxed) ==
+			DEMO_PIPELINE_EMPTY) {
+		assert(map->count + 1 < DEMO_PIPELINE_MAP_SIZE);
+		map->count++;
+		entry->hash = hash;
+		entry->state = *state;
+		atomic_store_explicit(&entry->status, DEMO_PIPELINE_BUILDING,
+				memory_order_release);
+		map->queue[map->tail++ % DEMO_PIPELINE_MAP_SIZE] = entry;
+		pthread_cond_signal(&map->queued);
+	}
+	pthread_mutex_unlock(&map->lock);
+	return entry;
+}
+
+static VkPipeline demo_wait_pipeline(struct demo *demo,
+				struct demo_pipeline_entry *entry) {
+	struct demo_pipeline_map *map = &demo->pipelines;
+
+	if (!demo_pipeline_ready(entry)) {
+		pthread_mutex_lock(&map->lock);
+		while (!demo_pipeline_ready(entry))
+			pthread_cond_wait(&map->built, &map->lock);
+		pthread_mutex_unlock(&map->lock);
+	}
+	return entry->pipeline;
+}
+
+/*
+ * Build queued pipelines against the shared cache, which needs no locking,
+ * so the workers compile different variants at once.
+ */
+static void *demo_pipeline_worker(void *arg) {
+	struct demo *demo = arg;
+	struct demo_pipeline_map *map = &demo->pipelines;
+
+	pthread_mutex_lock(&map->lock);
+	for (;;) {
+		struct demo_pipeline_entry *entry;
+		VkPipeline pipeline, base;
+		double start;
+
+		while (!map->quit && map->head == map->tail)
+			pthread_cond_wait(&map->queued, &map->lock);
+		if (map->quit)
+			break;
+		entry = map->queue[map->head++ % DEMO_PIPELINE_MAP_SIZE];
+		map->building++;
+		// The main thread sets the base under the lock.
+		base = demo->base_pipeline;
+		pthread_mutex_unlock(&map->lock);
+
+		start = demo_time_ms();
+		pipeline = demo_build_pipeline(demo, &entry->state, base);
+		if (demo->startup_report && base)
+			printf("Pipeline variant %016llx built in %.2f ms\n",
+				(unsigned long long)entry->hash,
+				demo_time_ms() - start);
+
+		pthread_mutex_lock(&map->lock);
+		entry->pipeline = pipeline;
+		atomic_store_explicit(&entry->status, DEMO_PIPELINE_READY,
+				memory_order_release);
+		map->building--;
+		pthread_cond_broadcast(&map->built);
+	}
+	pthread_mutex_unlock(&map->lock);
+	return NULL;
+}
+
+static void demo_start_pipeline_workers(struct demo *demo) {
+	struct demo_pipeline_map *map = &demo->pipelines;
+
+	pthread_mutex_init(&map->lock, NULL);
+	pthread_cond_init(&map->built, NULL);
+	pthread_cond_init(&map->queued, NULL);
+	for (uint32_t i = 0; i < DEMO_PIPELINE_WORKERS; i++) {
+		if (pthread_create(&map->workers[i], NULL,
+				demo_pipeline_worker, demo))
+			ERR_EXIT("Failed to start a pipeline compile thread\n",
+				"pthread_create Failure");
+	}
+}
+
+static void demo_stop_pipeline_workers(struct demo *demo) {
+	struct demo_pipeline_map *map = &demo->pipelines;
+
+	pthread_mutex_lock(&map->lock);
+	map->quit = true;
+	pthread_cond_broadcast(&map->queued);
+	pthread_mutex_unlock(&map->lock);
+	for (uint32_t i = 0; i < DEMO_PIPELINE_WORKERS; i++)
+		pthread_join(map->workers[i], NULL);
+	pthread_cond_destroy(&map->queued);
+	pthread_cond_destroy(&map->built);
+	pthread_mutex_destroy(&map->lock);
+}
 
+/*
+ * Destroy every variant, dropping queued builds and waiting for those under
+ * way. The device must be idle.
+ */
+static void demo_destroy_pipelines(struct demo *demo) {
+	struct demo_pipeline_map *map = &demo->pipelines;
+
+	pthread_mutex_lock(&map->lock);
+	map->head = map->tail = 0;
+	while (map->building > 0)
+		pthread_cond_wait(&map->built, &map->lock);
+	demo->base_pipeline = VK_NULL_HANDLE;
+	pthread_mutex_unlock(&map->lock);
+
+	for (uint32_t i = 0; i < DEMO_PIPELINE_MAP_SIZE; i++) {
+		struct demo_pipeline_entry *entry = &map->entries[i];
+
+		if (atomic_load(&entry->status) == DEMO_PIPELINE_READY)
+			vkDestroyPipeline(demo->device, entry->pipeline, NULL);
+		atomic_store(&entry->status, DEMO_PIPELINE_EMPTY);
+	}
+	map->count = 0;
+	demo->pipeline_entry = NULL;
 	vkDestroyShaderModule(demo->device, demo->frag_shader_module, NULL);
 	vkDestroyShaderModule(demo->device, demo->vert_shader_module, NULL);
 }
 
-static void demo_prepare_descriptor_pool(struct demo *demo) {
-	const VkDescriptorPoolSize type_counts[2] = {
-		[0] =
-		{
-			.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-			.descriptorCount = 1,
-		},
-		[1] =
-		{
-			.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-			.descriptorCount = DEMO_TEXTURE_COUNT,
-		},
+/*
+ * Switch the pipeline variant drawn with for a key press: w toggles
+ * wireframe, t texturing, c cycles the cull mode and b the blend mode. Each
+ * image's command buffer is re-recorded the next time it comes up, once it is
+ * idle, with the base pipeline standing in until the variant is built.
+ */
+static void demo_switch_pipeline(struct demo *demo, uint8_t key) {
+	struct demo_pipeline_state *state = &demo->pipeline_state;
+
+	switch (key) {
+	case 0x19:
+		if (!demo->wireframe_supported)
+			return;
+		state->polygon_mode = state->polygon_mode == VK_POLYGON_MODE_FILL ?
+			VK_POLYGON_MODE_LINE : VK_POLYGON_MODE_FILL;
+		break;
+	case 0x36:
+		state->cull_mode = state->cull_mode == VK_CULL_MODE_BACK_BIT ?
+			VK_CULL_MODE_NONE : state->cull_mode == VK_CULL_MODE_NONE ?
+			VK_CULL_MODE_FRONT_BIT : VK_CULL_MODE_BACK_BIT;
+		break;
+	case 0x38:
+		state->blend = (state->blend + 1) % DEMO_BLEND_COUNT;
+		// Blended geometry is drawn in no particular order, so it must
+		// not hide what is behind it.
+		state->depth_write = state->blend == DEMO_BLEND_OPAQUE;
+		break;
+	case 0x1c:
+		state->textured = !state->textured;
+		break;
+	}
+	demo->pipeline_entry = demo_request_pipeline(demo, state);
+	for (uint32_t i = 0; i < demo->swapchainImageCount; i++)
+		demo->buffers[i].outdated = true;
+}
+
+/*
+ * Load the shaders every variant shares and build the simplest variant, which
+ * the others derive from and which is all the first frame waits for. The
+ * current variant, if it differs, builds in the background.
+ */
+static void demo_prepare_pipeline(struct demo *demo) {
+	const struct demo_pipeline_state base = {
+		.polygon_mode = VK_POLYGON_MODE_FILL,
+		.cull_mode = VK_CULL_MODE_BACK_BIT,
+		.blend = DEMO_BLEND_OPAQUE,
+		.depth_write = VK_TRUE,
+		.textured = VK_TRUE,
 	};
-	const VkDescriptorPoolCreateInfo descriptor_pool = {
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-		.pNext = NULL,
-		.maxSets = 1,
-		.poolSizeCount = 2,
-		.pPoolSizes = type_counts,
+
+	VkPipeline built;
+
+	demo_prepare_vs(demo);
+	demo_prepare_fs(demo);
+	built = demo_wait_pipeline(demo, demo_request_pipeline(demo, &base));
+	// The workers read the base as they take builds off the queue.
+	pthread_mutex_lock(&demo->pipelines.lock);
+	demo->base_pipeline = built;
+	pthread_mutex_unlock(&demo->pipelines.lock);
+	demo->pipeline_entry = demo_request_pipeline(demo,
+						&demo->pipeline_state);
+}
+
+/*
+ * Build a culling pipeline for each phase in use, with the phase as the PHASE
+ * specialization constant so each one compiles down to just its own test.
+ * Only the occlusion build of cull.comp has the early and late phases.
+ */
+static void demo_prepare_cull_pipeline(struct demo *demo) {
+	const char *file = demo->occlusion_cull ?
+		"cull-occlusion.comp.spv" : "cull.comp.spv";
+	const uint32_t phases[2][2] = {
+		{CULL_PHASE_FRUSTUM},
+		{CULL_PHASE_EARLY, CULL_PHASE_LATE},
 	};
+	const uint32_t count = demo->occlusion_cull ? 2 : 1;
+	VkComputePipelineCreateInfo pipelines[2];
+	struct demo_specialization specs[2];
+	VkPipeline built[2];
+	VkComputePipelineCreateInfo pipeline;
+	VkShaderModule module;
 	VkResult U_ASSERT_ONLY err;
 
-	err = vkCreateDescriptorPool(demo->device, &descriptor_pool, NULL,
-				&demo->desc_pool);
+	module = demo_load_shader(demo, file);
+
+	memset(&pipeline, 0, sizeof(pipeline));
+	pipeline.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipeline.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipeline.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipeline.stage.module = module;
+	pipeline.stage.pName = "main";
+	pipeline.layout = demo->pipeline_layout;
+
+	for (uint32_t i = 0; i < count; i++) {
+		pipelines[i] = pipeline;
+		pipelines[i].stage.pSpecializationInfo = demo_specialize(
+			&specs[i], &phases[demo->occlusion_cull][i], 1);
+	}
+	err = vkCreateComputePipelines(demo->device, demo->pipelineCache,
+				count, pipelines, NULL, built);
 	assert(!err);
-}
+	for (uint32_t i = 0; i < count; i++)
+		demo->cull_pipelines[phases[demo->occlusion_cull][i]] =
+			built[i];
 
-static void demo_prepare_descriptor_set(struct demo *demo) {
-	VkDescriptorImageInfo tex_descs[DEMO_TEXTURE_COUNT];
-	VkWriteDescriptorSet writes[2];
-	VkResult U_ASSERT_ONLY err;
-	uint32_t i;
+	vkDestroyShaderModule(demo->device, module, NULL);
 
-	VkDescriptorSetAllocateInfo alloc_info = {
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.pNext = NULL,
-		.descriptorPool = demo->desc_pool,
-		.descriptorSetCount = 1,
-		.pSetLayouts = &demo->desc_layout};
-	err = vkAllocateDescriptorSets(demo->device, &alloc_info, &demo->desc_set);
+	module = demo_load_shader(demo, "hiz.comp.spv");
+
+	pipeline.stage.module = module;
+	pipeline.layout = demo->hiz.pipeline_layout;
+
+	err = vkCreateComputePipelines(demo->device, demo->pipelineCache, 1,
+				&pipeline, NULL, &demo->hiz.pipeline);
 	assert(!err);
 
-	memset(&tex_descs, 0, sizeof(tex_descs));
-	for (i = 0; i < DEMO_TEXTURE_COUNT; i++) {
-		tex_descs[i].sampler = demo->textures[i].sampler;
-		tex_descs[i].imageView = demo->textures[i].view;
+	vkDestroyShaderModule(demo->device, module, NULL);
+}
+
+/*
+ * Point elements [first, first + count) of the set's texture array at those
+ * textures. With bindless textures this may happen while command buffers
+ * using the set are recorded or in flight.
+ */
+static void demo_update_texture_descriptors(struct demo *demo,
+					VkDescriptorSet desc_set,
+					uint32_t first, uint32_t count) {
+	VkDescriptorImageInfo *tex_descs = malloc(count * sizeof(*tex_descs));
+	VkWriteDescriptorSet write;
+
+	assert(tex_descs);
+	for (uint32_t i = 0; i < count; i++) {
+		tex_descs[i].sampler = demo->textures[first + i].sampler;
+		tex_descs[i].imageView = demo->textures[first + i].view;
 		tex_descs[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 	}
 
-	memset(&writes, 0, sizeof(writes));
+	memset(&write, 0, sizeof(write));
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = desc_set;
+	write.dstBinding = 1;
+	write.dstArrayElement = first;
+	write.descriptorCount = count;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.pImageInfo = tex_descs;
+	vkUpdateDescriptorSets(demo->device, 1, &write, 0, NULL);
+	free(tex_descs);
+}
+
+static void demo_prepare_descriptor_set(struct demo *demo) {
+	union desc_info infos[6];
+
+	// In binding order, skipping the texture array.
+	memset(infos, 0, sizeof(infos));
+	infos[0].buffer = demo->uniform_data.buffer_info;
+	infos[1].buffer = demo->instance_data.buffer_info;
+	infos[2].buffer = demo->visible_data.buffer_info;
+	infos[3].buffer = demo->indirect_data.buffer_info;
+	if (demo->gpu_cull) {
+		infos[4].buffer = demo->visibility_data.buffer_info;
+		infos[5].image.sampler = demo->hiz.sampler;
+		infos[5].image.imageView = demo->hiz.view;
+		infos[5].image.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	}
+	demo->desc_set = desc_get(&demo->desc_alloc, DESC_PERSISTENT, infos);
+
+	demo_update_texture_descriptors(demo, demo->desc_set, 0,
+					demo->texture_count);
+}
 
-	writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	writes[0].dstSet = demo->desc_set;
-	writes[0].descriptorCount = 1;
-	writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	writes[0].pBufferInfo = &demo->uniform_data.buffer_info;
+static void demo_prepare_query_pool(struct demo *demo) {
+	const VkQueryPoolCreateInfo query_pool = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+		.queryCount = demo->swapchainImageCount,
+		.pipelineStatistics =
+			VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT,
+	};
+	VkResult U_ASSERT_ONLY err;
 
-	writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	writes[1].dstSet = demo->desc_set;
-	writes[1].dstBinding = 1;
-	writes[1].descriptorCount = DEMO_TEXTURE_COUNT;
-	writes[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	writes[1].pImageInfo = tex_descs;
+	err = vkCreateQueryPool(demo->device, &query_pool, NULL,
+				&demo->query_pool);
+	assert(!err);
 
-	vkUpdateDescriptorSets(demo->device, 2, writes, 0, NULL);
+	// Queries must be reset before their results can be asked for.
+	vkCmdResetQueryPool(demo->cmd, demo->query_pool, 0,
+			demo->swapchainImageCount);
 }
 
 static void demo_prepare_framebuffers(struct demo *demo) {
@@ -1762,13 +5845,25 @@ static void demo_prepare_framebuffers(struct demo *demo) {
 	assert(demo->framebuffers);
 
 	for (i = 0; i < demo->swapchainImageCount; i++) {
-		attachments[0] = demo->buffers[i].view;
+		// Multiview renders every frame into the same layered target.
+		attachments[0] = demo->multiview ? demo->view_target.view :
+			demo->buffers[i].view;
 		err = vkCreateFramebuffer(demo->device, &fb_info, NULL,
 					&demo->framebuffers[i]);
 		assert(!err);
 	}
 }
 
+static void demo_pipeline_job(void *ctx, uint32_t first UNUSED,
+			uint32_t last UNUSED, uint32_t worker UNUSED) {
+	struct demo *demo = ctx;
+	const double start = demo_time_ms();
+
+	demo_prepare_pipeline(demo);
+	atomic_store(&demo->startup_pipelines_us,
+		(demo_time_ms() - start) * 1000.0);
+}
+
 static void demo_prepare(struct demo *demo) {
 	VkResult U_ASSERT_ONLY err;
 
@@ -1776,7 +5871,8 @@ static void demo_prepare(struct demo *demo) {
 		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
 		.pNext = NULL,
 		.queueFamilyIndex = demo->graphics_queue_family_index,
-		.flags = 0,
+		// Draw command buffers are re-recorded when the pipeline changes.
+		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
 	};
 	err = vkCreateCommandPool(demo->device, &cmd_pool_info, NULL,
 				&demo->cmd_pool);
@@ -1800,20 +5896,80 @@ static void demo_prepare(struct demo *demo) {
 	err = vkBeginCommandBuffer(demo->cmd, &cmd_buf_info);
 	assert(!err);
 
+	// The pipelines only need the render pass, so they build while the
+	// swapchain and the resources are created.
+	struct job_counter pipelines_built = {0};
+
+	demo_prepare_descriptor_layout(demo);
+	demo_prepare_render_pass(demo, demo->multiview ?
+				(1u << demo->view_count) - 1 : 0);
+	atomic_store(&demo->startup_pipelines_us, 0);
+	job_add(&demo->jobs, demo_pipeline_job, demo, 0, 1, 1,
+		&pipelines_built);
+
 	demo_prepare_buffers(demo);
+	if (demo->overdraw_stats)
+		demo_prepare_query_pool(demo);
 	demo_prepare_depth(demo);
+	if (demo->multiview)
+		demo_prepare_view_target(demo);
+	if (demo->gpu_cull)
+		demo_prepare_hiz(demo);
 	demo_prepare_textures(demo);
 	demo_prepare_cube_data_buffer(demo);
-
-	demo_prepare_descriptor_layout(demo);
-	demo_prepare_render_pass(demo);
-	demo_prepare_pipeline(demo);
+	demo_prepare_instances(demo);
+	demo_prepare_cull_buffers(demo);
+
+	job_wait(&demo->jobs, &pipelines_built);
+	const double pipeline_start = demo_time_ms();
+	if (demo->gpu_cull)
+		demo_prepare_cull_pipeline(demo);
+	if (!demo->pipeline_cache_reported) {
+		// A hit skips the driver's compiles, which dominate this.
+		// Vulkan does not say whether the driver used the cache, so
+		// hit or miss is only inferred from whether one was read.
+		printf("Pipeline cache: %zu bytes read, assumed %s; pipelines "
+			"built in %.2f ms\n", demo->pipeline_cache_loaded,
+			demo->pipeline_cache_loaded ? "hit" : "miss",
+			atomic_load(&demo->startup_pipelines_us) / 1000.0 +
+			demo_time_ms() - pipeline_start);
+		demo->pipeline_cache_reported = true;
+	}
 
 	for (uint32_t i = 0; i < demo->swapchainImageCount; i++) {
 		err =
 			vkAllocateCommandBuffers(demo->device, &cmd, &demo->buffers[i].cmd);
 		assert(!err);
 	}
+	if (demo->dynamic_record)
+		demo_prepare_record_pools(demo);
+
+	if (demo->async_compute) {
+		const VkCommandPoolCreateInfo compute_pool_info = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+			.pNext = NULL,
+			.queueFamilyIndex = demo->compute_queue_family_index,
+			// Recorded along with the draw command buffers.
+			.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+		};
+		err = vkCreateCommandPool(demo->device, &compute_pool_info, NULL,
+					&demo->compute_cmd_pool);
+		assert(!err);
+		const VkCommandBufferAllocateInfo compute_alloc_info = {
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.pNext = NULL,
+			.commandPool = demo->compute_cmd_pool,
+			.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+			.commandBufferCount = 1,
+		};
+		for (uint32_t i = 0; i < demo->swapchainImageCount; i++) {
+			err = vkAllocateCommandBuffers(demo->device,
+						&compute_alloc_info,
+						&demo->buffers[i].compute_cmd);
+			assert(!err);
+			demo->buffers[i].graphics_value = 0;
+		}
+	}
 
 	if (demo->separate_present_queue) {
 		const VkCommandPoolCreateInfo cmd_pool_info = {
@@ -1840,7 +5996,6 @@ static void demo_prepare(struct demo *demo) {
 		}
 	}
 
-	demo_prepare_descriptor_pool(demo);
 	demo_prepare_descriptor_set(demo);
 
 	demo_prepare_framebuffers(demo);
@@ -1848,6 +6003,8 @@ static void demo_prepare(struct demo *demo) {
 	for (uint32_t i = 0; i < demo->swapchainImageCount; i++) {
 		demo->current_buffer = i;
 		demo_draw_build_cmd(demo, demo->buffers[i].cmd);
+		demo->buffers[i].outdated = false;
+		demo->buffers[i].instances_stale = false;
 	}
 
 	/*
@@ -1855,14 +6012,511 @@ static void demo_prepare(struct demo *demo) {
 	 * that need to be flushed before beginning the render loop.
 	 */
 	demo_flush_init_cmd(demo);
-	if (demo->staging_texture.image) {
-		demo_destroy_texture_image(demo, &demo->staging_texture);
+	for (uint32_t i = 0; i < demo->texture_count; i++) {
+		if (demo->staging_textures[i].image)
+			demo_destroy_texture_image(demo,
+						&demo->staging_textures[i]);
 	}
+	free(demo->staging_textures);
 
 	demo->current_buffer = 0;
 	demo->prepared = true;
 }
 
+/*
+ * Prepare what the contexts share: the textures, the instanced scene, the
+ * pipelines and the render pass they draw with. Every context draws slot 0
+ * of the culling outputs, which without culling lists every instance and
+ * never changes.
+ */
+static void demo_prepare_shared(struct demo *demo) {
+	const VkCommandPoolCreateInfo cmd_pool_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.queueFamilyIndex = demo->graphics_queue_family_index,
+		.flags = 0,
+	};
+	const VkCommandBufferBeginInfo cmd_buf_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = NULL,
+		.flags = 0,
+		.pInheritanceInfo = NULL,
+	};
+	VkCommandBufferAllocateInfo cmd = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.pNext = NULL,
+		.commandPool = VK_NULL_HANDLE,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1,
+	};
+	VkResult U_ASSERT_ONLY err;
+
+	err = vkCreateCommandPool(demo->device, &cmd_pool_info, NULL,
+				&demo->cmd_pool);
+	assert(!err);
+	cmd.commandPool = demo->cmd_pool;
+	err = vkAllocateCommandBuffers(demo->device, &cmd, &demo->cmd);
+	assert(!err);
+	err = vkBeginCommandBuffer(demo->cmd, &cmd_buf_info);
+	assert(!err);
+
+	demo->swapchainImageCount = 1;
+	demo_prepare_textures(demo);
+	demo_prepare_instances(demo);
+	demo_prepare_cull_buffers(demo);
+	demo_prepare_descriptor_layout(demo);
+	demo_prepare_render_pass(demo, 0);
+	demo_prepare_pipeline(demo);
+
+	demo_flush_init_cmd(demo);
+	for (uint32_t i = 0; i < demo->texture_count; i++) {
+		if (demo->staging_textures[i].image)
+			demo_destroy_texture_image(demo,
+						&demo->staging_textures[i]);
+	}
+	free(demo->staging_textures);
+	demo->prepared = true;
+}
+
+// Big enough for the process's band of the frame.
+static void demo_prepare_context_target(struct demo *demo,
+					struct demo_context_target *target,
+					VkFormat format,
+					VkImageUsageFlags usage,
+					VkImageAspectFlags aspect) {
+	const VkImageCreateInfo image = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.pNext = NULL,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = format,
+		.extent = {demo->width, demo->band_height, 1},
+		.mipLevels = 1,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = usage,
+		.flags = 0,
+	};
+	VkImageViewCreateInfo view = {
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.pNext = NULL,
+		.image = VK_NULL_HANDLE,
+		.format = format,
+		.subresourceRange = {.aspectMask = aspect,
+				     .baseMipLevel = 0,
+				     .levelCount = 1,
+				     .baseArrayLayer = 0,
+				     .layerCount = 1},
+		.flags = 0,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+	};
+	VkMemoryAllocateInfo mem_alloc = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.pNext = NULL,
+		.allocationSize = 0,
+		.memoryTypeIndex = 0,
+	};
+	VkMemoryRequirements mem_reqs;
+	VkResult U_ASSERT_ONLY err;
+	bool U_ASSERT_ONLY pass;
+
+	err = vkCreateImage(demo->device, &image, NULL, &target->image);
+	assert(!err);
+
+	vkGetImageMemoryRequirements(demo->device, target->image, &mem_reqs);
+	mem_alloc.allocationSize = mem_reqs.size;
+	pass = memory_type_from_properties(demo, mem_reqs.memoryTypeBits, 0,
+					&mem_alloc.memoryTypeIndex);
+	assert(pass);
+
+	err = vkAllocateMemory(demo->device, &mem_alloc, NULL, &target->mem);
+	assert(!err);
+	err = vkBindImageMemory(demo->device, target->image, target->mem, 0);
+	assert(!err);
+
+	view.image = target->image;
+	err = vkCreateImageView(demo->device, &view, NULL, &target->view);
+	assert(!err);
+}
+
+static void demo_destroy_context_target(struct demo *demo,
+					struct demo_context_target *target) {
+	vkDestroyImageView(demo->device, target->view, NULL);
+	vkDestroyImage(demo->device, target->image, NULL);
+	vkFreeMemory(demo->device, target->mem, NULL);
+}
+
+/*
+ * Create a context's targets, command buffers and, per frame in flight, a
+ * uniform buffer and the descriptor set pointing at it and at the shared
+ * buffers. Called on the context's own thread.
+ */
+static void demo_prepare_context(struct demo_context *ctx) {
+	struct demo *demo = ctx->demo;
+	const VkCommandPoolCreateInfo cmd_pool_info = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.queueFamilyIndex = demo->graphics_queue_family_index,
+		// Recorded afresh every frame.
+		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+	};
+	VkCommandBufferAllocateInfo cmd = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.pNext = NULL,
+		.commandPool = VK_NULL_HANDLE,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = FRAME_LAG,
+	};
+	const VkFenceCreateInfo fence_ci = {
+		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+		.pNext = NULL,
+		.flags = VK_FENCE_CREATE_SIGNALED_BIT,
+	};
+	VkImageView attachments[2];
+	const VkFramebufferCreateInfo fb_info = {
+		.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+		.pNext = NULL,
+		.renderPass = demo->render_pass,
+		.attachmentCount = 2,
+		.pAttachments = attachments,
+		.width = demo->width,
+		.height = demo->band_height,
+		.layers = 1,
+	};
+	struct vktexcube_vs_uniform data;
+	union desc_info infos[6];
+	VkResult U_ASSERT_ONLY err;
+
+	demo_prepare_context_target(demo, &ctx->color, demo->format,
+				VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+				VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+				VK_IMAGE_ASPECT_COLOR_BIT);
+	demo_prepare_context_target(demo, &ctx->depth, demo->depth.format,
+				VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+				VK_IMAGE_ASPECT_DEPTH_BIT);
+	attachments[0] = ctx->color.view;
+	attachments[1] = ctx->depth.view;
+	err = vkCreateFramebuffer(demo->device, &fb_info, NULL,
+				&ctx->framebuffer);
+	assert(!err);
+
+	err = vkCreateCommandPool(demo->device, &cmd_pool_info, NULL,
+				&ctx->cmd_pool);
+	assert(!err);
+	cmd.commandPool = ctx->cmd_pool;
+	err = vkAllocateCommandBuffers(demo->device, &cmd, ctx->cmds);
+	assert(!err);
+
+	// Start each context at its own angle, so their images differ.
+	mat4x4_rotate(ctx->model_matrix, demo->model_matrix, 0.0f, 1.0f, 0.0f,
+		(float)degreesToRadians(360.0f * ctx->index /
+					demo->context_count));
+
+	memset(&data, 0, sizeof(data));
+	data.instance_count = demo->instance_count;
+	memset(infos, 0, sizeof(infos));
+	infos[1].buffer = demo->instance_data.buffer_info;
+	infos[2].buffer = demo->visible_data.buffer_info;
+	infos[3].buffer = demo->indirect_data.buffer_info;
+	for (uint32_t i = 0; i < FRAME_LAG; i++) {
+		err = vkCreateFence(demo->device, &fence_ci, NULL,
+				&ctx->fences[i]);
+		assert(!err);
+		demo_prepare_buffer_object(demo, &ctx->uniforms[i],
+					sizeof(data),
+					VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+					&data, false);
+		if (demo->split)
+			demo_prepare_buffer_object(demo, &ctx->readbacks[i],
+					(VkDeviceSize)demo->width *
+					demo->band_height * 4,
+					VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					NULL, false);
+
+		infos[0].buffer = ctx->uniforms[i].buffer_info;
+		pthread_mutex_lock(&demo->desc_lock);
+		ctx->desc_sets[i] = desc_get(&demo->desc_alloc,
+					DESC_PERSISTENT, infos);
+		demo_update_texture_descriptors(demo, ctx->desc_sets[i], 0,
+						demo->texture_count);
+		pthread_mutex_unlock(&demo->desc_lock);
+	}
+}
+
+// Once the context's frames are done. Its sets go with the allocator.
+static void demo_destroy_context(struct demo_context *ctx) {
+	struct demo *demo = ctx->demo;
+
+	for (uint32_t i = 0; i < FRAME_LAG; i++) {
+		vkDestroyFence(demo->device, ctx->fences[i], NULL);
+		demo_destroy_buffer_object(demo, &ctx->uniforms[i]);
+		if (demo->split)
+			demo_destroy_buffer_object(demo, &ctx->readbacks[i]);
+	}
+	vkFreeCommandBuffers(demo->device, ctx->cmd_pool, FRAME_LAG,
+			ctx->cmds);
+	vkDestroyCommandPool(demo->device, ctx->cmd_pool, NULL);
+	vkDestroyFramebuffer(demo->device, ctx->framebuffer, NULL);
+	demo_destroy_context_target(demo, &ctx->color);
+	demo_destroy_context_target(demo, &ctx->depth);
+}
+
+/*
+ * Copy the band the frame in slot f read back into its rows of the final
+ * image, then wait for the other bands to copy in theirs.
+ */
+static void demo_composite_band(struct demo_context *ctx, uint32_t f) {
+	struct demo *demo = ctx->demo;
+	const size_t row = (size_t)demo->width * 4;
+	void *pData;
+	VkResult U_ASSERT_ONLY err;
+
+	err = vkMapMemory(demo->device, ctx->readbacks[f].mem, 0,
+			ctx->readbacks[f].mem_alloc.allocationSize, 0, &pData);
+	assert(!err);
+	memcpy(demo->split->pixels + demo->band_top * row, pData,
+		demo->band_height * row);
+	vkUnmapMemory(demo->device, ctx->readbacks[f].mem);
+
+	pthread_barrier_wait(&demo->split->composited);
+}
+
+/*
+ * Spin the context's model, then record and submit its next frame into the
+ * command buffer, uniform buffer and set of the frame before last. With
+ * --split, that frame's band is composited first.
+ */
+static void demo_context_draw(struct demo_context *ctx) {
+	struct demo *demo = ctx->demo;
+	const uint32_t f = ctx->frame_index;
+	const VkCommandBuffer cmd_buf = ctx->cmds[f];
+	const VkClearValue clear_values[2] = {
+		[0] = {.color.float32 = {0.2f, 0.2f, 0.2f, 0.2f}},
+		[1] = {.depthStencil = {1.0f, 0}},
+	};
+	const VkRenderPassBeginInfo rp_begin = {
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+		.pNext = NULL,
+		.renderPass = demo->render_pass,
+		.framebuffer = ctx->framebuffer,
+		.renderArea.offset.x = 0,
+		.renderArea.offset.y = 0,
+		.renderArea.extent.width = demo->width,
+		.renderArea.extent.height = demo->band_height,
+		.clearValueCount = 2,
+		.pClearValues = clear_values,
+	};
+	const VkCommandBufferBeginInfo begin = {
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.pNext = NULL,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		.pInheritanceInfo = NULL,
+	};
+	// The band's rows of the full frame's viewport.
+	const VkViewport viewport = {
+		.x = 0.0f,
+		.y = -(float)demo->band_top,
+		.width = (float)demo->width,
+		.height = (float)demo->height,
+		.minDepth = 0.0f,
+		.maxDepth = 1.0f,
+	};
+	const VkRect2D scissor = {
+		.offset = {0, 0},
+		.extent = {demo->width, demo->band_height},
+	};
+	const VkBufferImageCopy readback = {
+		.bufferOffset = 0,
+		.bufferRowLength = 0,
+		.bufferImageHeight = 0,
+		.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+		.imageOffset = {0, 0, 0},
+		.imageExtent = {demo->width, demo->band_height, 1},
+	};
+	const VkMemoryBarrier read_back = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = NULL,
+		.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+	};
+	// The frame before may still be drawing into, or reading back from,
+	// the same targets.
+	const VkMemoryBarrier previous = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+		.pNext = NULL,
+		.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+	};
+	const VkSubmitInfo submit_info = {
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = NULL,
+		.waitSemaphoreCount = 0,
+		.pWaitSemaphores = NULL,
+		.pWaitDstStageMask = NULL,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd_buf,
+		.signalSemaphoreCount = 0,
+		.pSignalSemaphores = NULL,
+	};
+	mat4x4 MVP, Model, VP;
+	uint8_t *pData;
+	VkResult U_ASSERT_ONLY err;
+
+	vkWaitForFences(demo->device, 1, &ctx->fences[f], VK_TRUE, UINT64_MAX);
+	vkResetFences(demo->device, 1, &ctx->fences[f]);
+	if (demo->split && ctx->frames >= FRAME_LAG)
+		demo_composite_band(ctx, f);
+
+	mat4x4_mul(VP, demo->projection_matrix, demo->view_matrix);
+	mat4x4_dup(Model, ctx->model_matrix);
+	mat4x4_rotate(ctx->model_matrix, Model, 0.0f, 1.0f, 0.0f,
+		(float)degreesToRadians(demo->spin_angle));
+	mat4x4_mul(MVP, VP, ctx->model_matrix);
+
+	err = vkMapMemory(demo->device, ctx->uniforms[f].mem, 0,
+			ctx->uniforms[f].mem_alloc.allocationSize, 0,
+			(void **)&pData);
+	assert(!err);
+	memcpy(pData, MVP, sizeof(MVP));
+	memcpy(pData + offsetof(struct vktexcube_vs_uniform, view_mvp), MVP,
+		sizeof(MVP));
+	vkUnmapMemory(demo->device, ctx->uniforms[f].mem);
+
+	err = vkBeginCommandBuffer(cmd_buf, &begin);
+	assert(!err);
+	vkCmdPipelineBarrier(cmd_buf,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+			VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+			VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT, 0, 1,
+			&previous, 0, NULL, 0, NULL);
+	vkCmdBeginRenderPass(cmd_buf, &rp_begin, VK_SUBPASS_CONTENTS_INLINE);
+	demo_draw_bind_state(demo, cmd_buf,
+			demo_pipeline_ready(demo->pipeline_entry) ?
+			demo->pipeline_entry->pipeline : demo->base_pipeline,
+			ctx->desc_sets[f], 0);
+	vkCmdSetViewport(cmd_buf, 0, 1, &viewport);
+	vkCmdSetScissor(cmd_buf, 0, 1, &scissor);
+	vkCmdDrawIndexedIndirect(cmd_buf, demo->indirect_data.buf, 0, 1,
+				sizeof(struct demo_cull_slot));
+	vkCmdEndRenderPass(cmd_buf);
+	if (demo->split) {
+		vkCmdCopyImageToBuffer(cmd_buf, ctx->color.image,
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				ctx->readbacks[f].buf, 1, &readback);
+		vkCmdPipelineBarrier(cmd_buf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &read_back,
+				0, NULL, 0, NULL);
+	}
+	err = vkEndCommandBuffer(cmd_buf);
+	assert(!err);
+
+	pthread_mutex_lock(&demo->queue_lock);
+	err = vkQueueSubmit(demo->graphics_queue, 1, &submit_info,
+			ctx->fences[f]);
+	pthread_mutex_unlock(&demo->queue_lock);
+	assert(!err);
+
+	ctx->frame_index = (f + 1) % FRAME_LAG;
+	ctx->frames++;
+}
+
+static void *demo_context_thread(void *arg) {
+	struct demo_context *ctx = arg;
+	struct demo *demo = ctx->demo;
+	double start;
+
+	demo_prepare_context(ctx);
+	pthread_barrier_wait(&demo->contexts_ready);
+	if (demo->split)
+		pthread_barrier_wait(&demo->split->started);
+
+	start = demo_time_ms();
+	while (ctx->frames < (uint32_t)demo->frameCount)
+		demo_context_draw(ctx);
+	if (demo->split) {
+		// Composite the frames still in flight, oldest first.
+		const uint32_t pending = ctx->frames < FRAME_LAG ?
+			ctx->frames : FRAME_LAG;
+		const uint32_t oldest = (ctx->frame_index + FRAME_LAG -
+					pending) % FRAME_LAG;
+
+		for (uint32_t i = 0; i < pending; i++) {
+			const uint32_t f = (oldest + i) % FRAME_LAG;
+
+			vkWaitForFences(demo->device, 1, &ctx->fences[f],
+					VK_TRUE, UINT64_MAX);
+			demo_composite_band(ctx, f);
+		}
+	}
+	vkWaitForFences(demo->device, FRAME_LAG, ctx->fences, VK_TRUE,
+			UINT64_MAX);
+	ctx->time = demo_time_ms() - start;
+	if (demo->split) {
+		demo->split->starts[demo->band] = start;
+		demo->split->ends[demo->band] = start + ctx->time;
+	}
+
+	demo_destroy_context(ctx);
+	return NULL;
+}
+
+/*
+ * Run every context's frames on a thread of its own and report each one's
+ * frame rate and the total. The clock starts once all are set up.
+ */
+static void demo_run_contexts(struct demo *demo) {
+	uint64_t frames = 0;
+	double start, elapsed;
+	uint32_t i;
+
+	demo->contexts = calloc(demo->context_count, sizeof(*demo->contexts));
+	assert(demo->contexts);
+	pthread_mutex_init(&demo->queue_lock, NULL);
+	pthread_mutex_init(&demo->desc_lock, NULL);
+	pthread_barrier_init(&demo->contexts_ready, NULL,
+			demo->context_count + 1);
+
+	for (i = 0; i < demo->context_count; i++) {
+		struct demo_context *ctx = &demo->contexts[i];
+
+		ctx->demo = demo;
+		ctx->index = i;
+		if (pthread_create(&ctx->thread, NULL, demo_context_thread,
+					ctx)) {
+			fprintf(stderr, "Failed to create context %u\n", i);
+			exit(1);
+		}
+	}
+	pthread_barrier_wait(&demo->contexts_ready);
+	start = demo_time_ms();
+	for (i = 0; i < demo->context_count; i++)
+		pthread_join(demo->contexts[i].thread, NULL);
+	elapsed = demo_time_ms() - start;
+
+	// demo_run_split() reports on the bands.
+	for (i = 0; i < demo->context_count && !demo->split; i++) {
+		const struct demo_context *ctx = &demo->contexts[i];
+
+		printf("Context %u: %u frames, %.1f frames/s\n", i,
+			ctx->frames, ctx->frames * 1000.0 / ctx->time);
+		frames += ctx->frames;
+	}
+	if (!demo->split)
+		printf("Contexts: %u, %.1f frames/s in total over %.2f s\n",
+			demo->context_count, frames * 1000.0 / elapsed,
+			elapsed / 1000.0);
+
+	pthread_barrier_destroy(&demo->contexts_ready);
+	pthread_mutex_destroy(&demo->desc_lock);
+	pthread_mutex_destroy(&demo->queue_lock);
+	free(demo->contexts);
+	demo->contexts = NULL;
+}
+
 static void demo_cleanup(struct demo *demo) {
 	uint32_t i;
 
@@ -1870,7 +6524,7 @@ static void demo_cleanup(struct demo *demo) {
 	vkDeviceWaitIdle(demo->device);
 
 	// Wait for fences from present operations
-	for (i = 0; i < FRAME_LAG; i++) {
+	for (i = 0; i < FRAME_LAG && !demo->context_count; i++) {
 		vkWaitForFences(demo->device, 1, &demo->fences[i], VK_TRUE, UINT64_MAX);
 		vkDestroyFence(demo->device, demo->fences[i], NULL);
 		vkDestroySemaphore(demo->device, demo->image_acquired_semaphores[i], NULL);
@@ -1879,20 +6533,41 @@ static void demo_cleanup(struct demo *demo) {
 			vkDestroySemaphore(demo->device, demo->image_ownership_semaphores[i], NULL);
 		}
 	}
+	if (demo->async_compute) {
+		vkDestroySemaphore(demo->device, demo->compute_timeline, NULL);
+		vkDestroySemaphore(demo->device, demo->graphics_timeline, NULL);
+	}
 
-	for (i = 0; i < demo->swapchainImageCount; i++) {
+	// Contexts have no swapchain images, see demo_prepare_shared().
+	for (i = 0; i < demo->swapchainImageCount && demo->framebuffers; i++) {
 		vkDestroyFramebuffer(demo->device, demo->framebuffers[i], NULL);
 	}
 	free(demo->framebuffers);
-	vkDestroyDescriptorPool(demo->device, demo->desc_pool, NULL);
-
-	vkDestroyPipeline(demo->device, demo->pipeline, NULL);
+	desc_allocator_reset(&demo->desc_alloc);
+
+	demo_destroy_pipelines(demo);
+	if (demo->gpu_cull) {
+		for (i = 0; i < CULL_PHASE_COUNT; i++)
+			vkDestroyPipeline(demo->device, demo->cull_pipelines[i],
+					NULL);
+		demo_destroy_hiz(demo);
+		desc_allocator_destroy(&demo->hiz.desc_alloc);
+		vkDestroyDescriptorSetLayout(demo->device,
+					demo->hiz.desc_layout, NULL);
+	}
+	demo_save_pipeline_cache(demo);
 	vkDestroyPipelineCache(demo->device, demo->pipelineCache, NULL);
+	demo_stop_pipeline_workers(demo);
 	vkDestroyRenderPass(demo->device, demo->render_pass, NULL);
+	if (demo->occlusion_cull)
+		vkDestroyRenderPass(demo->device, demo->late_render_pass, NULL);
+	if (demo->overdraw_stats)
+		vkDestroyQueryPool(demo->device, demo->query_pool, NULL);
 	vkDestroyPipelineLayout(demo->device, demo->pipeline_layout, NULL);
+	desc_allocator_destroy(&demo->desc_alloc);
 	vkDestroyDescriptorSetLayout(demo->device, demo->desc_layout, NULL);
 
-	for (i = 0; i < DEMO_TEXTURE_COUNT; i++) {
+	for (i = 0; i < demo->texture_count; i++) {
 		vkDestroyImageView(demo->device, demo->textures[i].view, NULL);
 		vkDestroyImage(demo->device, demo->textures[i].image, NULL);
 		vkFreeMemory(demo->device, demo->textures[i].mem, NULL);
@@ -1903,11 +6578,20 @@ static void demo_cleanup(struct demo *demo) {
 	vkDestroyImageView(demo->device, demo->depth.view, NULL);
 	vkDestroyImage(demo->device, demo->depth.image, NULL);
 	vkFreeMemory(demo->device, demo->depth.mem, NULL);
+	if (demo->multiview)
+		demo_destroy_view_target(demo);
 
 	vkDestroyBuffer(demo->device, demo->uniform_data.buf, NULL);
-	vkFreeMemory(demo->device, demo->uniform_data.mem, NULL);
-
-	for (i = 0; i < demo->swapchainImageCount; i++) {
+	vkFreeMemory(demo->device, demo->uniform_data.mem, NULL);
+	demo_destroy_buffer_object(demo, &demo->instance_data);
+	demo_destroy_buffer_object(demo, &demo->vertex_data);
+	demo_destroy_buffer_object(demo, &demo->index_data);
+	demo_destroy_buffer_object(demo, &demo->visible_data);
+	demo_destroy_buffer_object(demo, &demo->indirect_data);
+	if (demo->gpu_cull)
+		demo_destroy_buffer_object(demo, &demo->visibility_data);
+
+	for (i = 0; i < demo->swapchainImageCount && demo->buffers; i++) {
 		vkDestroyImageView(demo->device, demo->buffers[i].view, NULL);
 		vkFreeCommandBuffers(demo->device, demo->cmd_pool, 1,
 				&demo->buffers[i].cmd);
@@ -1915,6 +6599,10 @@ static void demo_cleanup(struct demo *demo) {
 	free(demo->buffers);
 	free(demo->queue_props);
 	vkDestroyCommandPool(demo->device, demo->cmd_pool, NULL);
+	if (demo->dynamic_record)
+		demo_destroy_record_pools(demo);
+	if (demo->async_compute)
+		vkDestroyCommandPool(demo->device, demo->compute_cmd_pool, NULL);
 
 	if (demo->separate_present_queue) {
 		vkDestroyCommandPool(demo->device, demo->present_cmd_pool, NULL);
@@ -1927,9 +6615,39 @@ static void demo_cleanup(struct demo *demo) {
 	vkDestroySurfaceKHR(demo->inst, demo->surface, NULL);
 	vkDestroyInstance(demo->inst, NULL);
 
-	xcb_destroy_window(demo->connection, demo->xcb_window);
-	xcb_disconnect(demo->connection);
-	free(demo->atom_wm_delete_window);
+	if (demo->connection) {
+		xcb_destroy_window(demo->connection, demo->xcb_window);
+		xcb_disconnect(demo->connection);
+		free(demo->atom_wm_delete_window);
+	}
+
+	if (demo->overdraw_stats && demo->overdraw_frames > 0)
+		printf("Overdraw (%s): %.2f fragment shader invocations per "
+			"pixel over %u frames\n",
+			demo->sort_draws ? "sorted front to back" : "unsorted",
+			(double)demo->fragment_invocations /
+			demo->overdraw_frames / (demo->width * demo->height),
+			demo->overdraw_frames);
+
+	if (demo->dynamic_record && demo->record_frames > 0)
+		printf("Draw recording: %.3f ms/frame over %u frames, %.0f "
+			"draws/frame, %u workers\n",
+			demo->record_time / demo->record_frames,
+			demo->record_frames,
+			(double)demo->record_draws / demo->record_frames,
+			demo->jobs.worker_count);
+
+	demo_destroy_scene(demo);
+
+	for (i = 0; i < demo->jobs.worker_count && !demo->split; i++) {
+		const struct job_worker *worker = demo->jobs.workers[i];
+
+		printf("Job worker %u (cpu %d, node %d): %.1f%% busy, %u jobs, "
+			"%u stolen\n", i, demo->jobs.cpus[i], demo->jobs.nodes[i],
+			100.0 * job_utilization(&demo->jobs, i), worker->job_count,
+			worker->steal_count);
+	}
+	job_destroy(&demo->jobs);
 }
 
 static void demo_resize(struct demo *demo) {
@@ -1950,15 +6668,23 @@ static void demo_resize(struct demo *demo) {
 		vkDestroyFramebuffer(demo->device, demo->framebuffers[i], NULL);
 	}
 	free(demo->framebuffers);
-	vkDestroyDescriptorPool(demo->device, demo->desc_pool, NULL);
-
-	vkDestroyPipeline(demo->device, demo->pipeline, NULL);
-	vkDestroyPipelineCache(demo->device, demo->pipelineCache, NULL);
+	desc_allocator_reset(&demo->desc_alloc);
+
+	demo_destroy_pipelines(demo);
+	if (demo->gpu_cull) {
+		for (i = 0; i < CULL_PHASE_COUNT; i++)
+			vkDestroyPipeline(demo->device, demo->cull_pipelines[i],
+					NULL);
+		demo_destroy_hiz(demo);
+	}
 	vkDestroyRenderPass(demo->device, demo->render_pass, NULL);
+	if (demo->occlusion_cull)
+		vkDestroyRenderPass(demo->device, demo->late_render_pass, NULL);
+	if (demo->overdraw_stats)
+		vkDestroyQueryPool(demo->device, demo->query_pool, NULL);
 	vkDestroyPipelineLayout(demo->device, demo->pipeline_layout, NULL);
-	vkDestroyDescriptorSetLayout(demo->device, demo->desc_layout, NULL);
 
-	for (i = 0; i < DEMO_TEXTURE_COUNT; i++) {
+	for (i = 0; i < demo->texture_count; i++) {
 		vkDestroyImageView(demo->device, demo->textures[i].view, NULL);
 		vkDestroyImage(demo->device, demo->textures[i].image, NULL);
 		vkFreeMemory(demo->device, demo->textures[i].mem, NULL);
@@ -1968,9 +6694,18 @@ static void demo_resize(struct demo *demo) {
 	vkDestroyImageView(demo->device, demo->depth.view, NULL);
 	vkDestroyImage(demo->device, demo->depth.image, NULL);
 	vkFreeMemory(demo->device, demo->depth.mem, NULL);
+	if (demo->multiview)
+		demo_destroy_view_target(demo);
 
 	vkDestroyBuffer(demo->device, demo->uniform_data.buf, NULL);
 	vkFreeMemory(demo->device, demo->uniform_data.mem, NULL);
+	demo_destroy_buffer_object(demo, &demo->instance_data);
+	demo_destroy_buffer_object(demo, &demo->vertex_data);
+	demo_destroy_buffer_object(demo, &demo->index_data);
+	demo_destroy_buffer_object(demo, &demo->visible_data);
+	demo_destroy_buffer_object(demo, &demo->indirect_data);
+	if (demo->gpu_cull)
+		demo_destroy_buffer_object(demo, &demo->visibility_data);
 
 	for (i = 0; i < demo->swapchainImageCount; i++) {
 		vkDestroyImageView(demo->device, demo->buffers[i].view, NULL);
@@ -1978,6 +6713,10 @@ static void demo_resize(struct demo *demo) {
 				&demo->buffers[i].cmd);
 	}
 	vkDestroyCommandPool(demo->device, demo->cmd_pool, NULL);
+	if (demo->dynamic_record)
+		demo_destroy_record_pools(demo);
+	if (demo->async_compute)
+		vkDestroyCommandPool(demo->device, demo->compute_cmd_pool, NULL);
 	if (demo->separate_present_queue) {
 		vkDestroyCommandPool(demo->device, demo->present_cmd_pool, NULL);
 	}
@@ -2021,15 +6760,32 @@ static void demo_handle_xcb_event(struct demo *demo,
 		case 0x41:
 			demo->pause = !demo->pause;
 			break;
+		case 0x19: // w
+		case 0x1c: // t
+		case 0x36: // c
+		case 0x38: // b
+			demo_switch_pipeline(demo, key->detail);
+			break;
 		}
 	} break;
+	case XCB_BUTTON_PRESS: {
+		const xcb_button_press_event_t *press =
+			(const xcb_button_press_event_t *)event;
+
+		if (press->detail == XCB_BUTTON_INDEX_1)
+			demo_pick(demo, press->event_x, press->event_y);
+	} break;
 	case XCB_CONFIGURE_NOTIFY: {
 		const xcb_configure_notify_event_t *cfg =
 			(const xcb_configure_notify_event_t *)event;
 		if ((demo->width != cfg->width) || (demo->height != cfg->height)) {
 			demo->width = cfg->width;
 			demo->height = cfg->height;
-			demo_resize(demo);
+			// The present thread stops, then demo_draw() resizes.
+			if (demo->present_thread)
+				atomic_store(&demo->swapchain_outdated, true);
+			else
+				demo_resize(demo);
 		}
 	} break;
 	default:
@@ -2037,6 +6793,66 @@ static void demo_handle_xcb_event(struct demo *demo,
 	}
 }
 
+/*
+ * Print the time to the first frame, and the time spent alongside the main
+ * thread on each piece of work moved off it.
+ */
+static void demo_startup_report(struct demo *demo) {
+	demo_startup_phase(demo, "first frame");
+	printf("Startup: %-28s %8.2f ms\n", "total to first frame",
+		demo_time_ms() - demo->startup_start);
+	printf("Startup: window creation %.2f ms, shader reads %.2f ms, "
+		"texture decode %.2f ms, pipelines %.2f ms, in the background\n",
+		atomic_load(&demo->startup_window_us) / 1000.0,
+		atomic_load(&demo->startup_shaders_us) / 1000.0,
+		atomic_load(&demo->startup_textures_us) / 1000.0,
+		atomic_load(&demo->startup_pipelines_us) / 1000.0);
+}
+
+static void demo_start_present(struct demo *demo) {
+	pthread_mutex_init(&demo->present_lock, NULL);
+	pthread_cond_init(&demo->present_wake, NULL);
+	if (demo->present_thread && pthread_create(&demo->present_tid, NULL,
+					demo_present_thread, demo)) {
+		fprintf(stderr, "Failed to create the present thread\n");
+		exit(1);
+	}
+}
+
+static void demo_start_update(struct demo *demo) {
+	demo->snapshot_back = 0;
+	atomic_store(&demo->snapshot_middle, 1);
+	demo->snapshot_front = 2;
+	atomic_store(&demo->update_spin, demo->spin_angle);
+	if (demo->update_thread && pthread_create(&demo->update_tid, NULL,
+					demo_update_thread, demo)) {
+		fprintf(stderr, "Failed to create the update thread\n");
+		exit(1);
+	}
+}
+
+static void demo_stop_update(struct demo *demo) {
+	if (!demo->update_thread)
+		return;
+	atomic_store(&demo->update_quit, true);
+	pthread_join(demo->update_tid, NULL);
+	printf("Update thread: %u steps at %d Hz over %d frames\n",
+		demo->update_steps, DEMO_UPDATE_HZ, demo->curFrame);
+}
+
+// Let the present thread present what was drawn, then stop it.
+static void demo_stop_present(struct demo *demo) {
+	if (demo->present_thread) {
+		pthread_mutex_lock(&demo->present_lock);
+		atomic_store(&demo->present_quit, true);
+		pthread_cond_broadcast(&demo->present_wake);
+		pthread_mutex_unlock(&demo->present_lock);
+		pthread_join(demo->present_tid, NULL);
+	}
+	pthread_cond_destroy(&demo->present_wake);
+	pthread_mutex_destroy(&demo->present_lock);
+}
+
 static void demo_run_xcb(struct demo *demo) {
 	xcb_flush(demo->connection);
 
@@ -2054,8 +6870,12 @@ static void demo_run_xcb(struct demo *demo) {
 			}
 		}
 
-		demo_update_data_buffer(demo);
+		// Input reaches the update thread as the spin per step.
+		atomic_store(&demo->update_spin,
+			demo->pause ? 0.0f : demo->spin_angle);
 		demo_draw(demo);
+		if (demo->curFrame == 0 && demo->startup_report)
+			demo_startup_report(demo);
 		demo->curFrame++;
 		if (demo->frameCount != INT32_MAX && demo->curFrame == demo->frameCount)
 			demo->quit = true;
@@ -2070,7 +6890,7 @@ static void demo_create_xcb_window(struct demo *demo) {
 	value_mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK;
 	value_list[0] = demo->screen->black_pixel;
 	value_list[1] = XCB_EVENT_MASK_KEY_RELEASE | XCB_EVENT_MASK_EXPOSURE |
-		XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+		XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_BUTTON_PRESS;
 
 	xcb_create_window(demo->connection, XCB_COPY_FROM_PARENT, demo->xcb_window,
 			demo->screen->root, 0, 0, demo->width, demo->height, 0,
@@ -2101,6 +6921,7 @@ static void demo_create_xcb_window(struct demo *demo) {
 	xcb_configure_window(demo->connection, demo->xcb_window,
 			XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y, coords);
 }
+
 // VK_USE_PLATFORM_XCB_KHR
 
 /*
@@ -2126,12 +6947,114 @@ static VkBool32 demo_check_layers(uint32_t check_count, char **check_names,
 	return 1;
 }
 
+#ifdef VK_EXT_descriptor_indexing
+/*
+ * Check the device can index a partially bound, update after bind texture
+ * array by a non-uniform value, and size the array within its limits.
+ */
+static void demo_query_bindless(struct demo *demo) {
+	PFN_vkGetPhysicalDeviceFeatures2KHR get_features =
+		(PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(
+			demo->inst, "vkGetPhysicalDeviceFeatures2KHR");
+	PFN_vkGetPhysicalDeviceProperties2KHR get_properties =
+		(PFN_vkGetPhysicalDeviceProperties2KHR)vkGetInstanceProcAddr(
+			demo->inst, "vkGetPhysicalDeviceProperties2KHR");
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+	};
+	VkPhysicalDeviceFeatures2KHR features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR,
+		.pNext = &indexing,
+	};
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT limits = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT,
+	};
+	VkPhysicalDeviceProperties2KHR properties = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR,
+		.pNext = &limits,
+	};
+
+	demo->bindless = false;
+	if (!get_features || !get_properties)
+		return;
+	get_features(demo->gpu, &features);
+	if (!indexing.shaderSampledImageArrayNonUniformIndexing ||
+			!indexing.descriptorBindingSampledImageUpdateAfterBind ||
+			!indexing.descriptorBindingPartiallyBound ||
+			!indexing.runtimeDescriptorArray)
+		return;
+
+	get_properties(demo->gpu, &properties);
+	demo->texture_capacity = DEMO_MAX_TEXTURES;
+	if (demo->texture_capacity >
+			limits.maxPerStageDescriptorUpdateAfterBindSampledImages)
+		demo->texture_capacity =
+			limits.maxPerStageDescriptorUpdateAfterBindSampledImages;
+	// The depth pyramid's sampler is in the same set.
+	if (demo->texture_capacity + 1 >
+			limits.maxDescriptorSetUpdateAfterBindSampledImages)
+		demo->texture_capacity =
+			limits.maxDescriptorSetUpdateAfterBindSampledImages - 1;
+	demo->bindless = demo->texture_capacity > 0;
+}
+#endif
+
+#ifdef VK_KHR_synchronization2
+// The extension may be there without the feature the graphs' barriers need.
+static void demo_query_sync2(struct demo *demo) {
+	PFN_vkGetPhysicalDeviceFeatures2KHR get_features =
+		(PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(
+			demo->inst, "vkGetPhysicalDeviceFeatures2KHR");
+	VkPhysicalDeviceSynchronization2FeaturesKHR sync2 = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR,
+	};
+	VkPhysicalDeviceFeatures2KHR features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR,
+		.pNext = &sync2,
+	};
+
+	demo->sync2 = false;
+	if (!get_features)
+		return;
+	get_features(demo->gpu, &features);
+	demo->sync2 = sync2.synchronization2;
+}
+#endif
+
+#ifdef VK_KHR_timeline_semaphore
+// The queues' semaphores for async compute need the feature too.
+static void demo_query_timeline(struct demo *demo) {
+	PFN_vkGetPhysicalDeviceFeatures2KHR get_features =
+		(PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(
+			demo->inst, "vkGetPhysicalDeviceFeatures2KHR");
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+	};
+	VkPhysicalDeviceFeatures2KHR features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR,
+		.pNext = &timeline,
+	};
+
+	demo->async_compute = false;
+	if (!get_features)
+		return;
+	get_features(demo->gpu, &features);
+	demo->async_compute = timeline.timelineSemaphore;
+}
+#endif
+
 static void demo_init_vk(struct demo *demo) {
 	VkResult err;
 	uint32_t instance_extension_count = 0;
 	uint32_t instance_layer_count = 0;
 	uint32_t validation_layer_count = 0;
 	char **instance_validation_layers = NULL;
+	// VK_KHR_multiview, VK_EXT_descriptor_indexing,
+	// VK_KHR_synchronization2 and VK_KHR_timeline_semaphore depend on this
+	// instance extension.
+	bool properties2_found = false;
+	bool indexing_found = false, maintenance3_found = false;
+	bool sync2_found = false, timeline_found = false;
 	demo->enabled_extension_count = 0;
 	demo->enabled_layer_count = 0;
 
@@ -2231,6 +7154,16 @@ static void demo_init_vk(struct demo *demo) {
 						VK_EXT_DEBUG_REPORT_EXTENSION_NAME;
 				}
 			}
+#ifdef VK_KHR_get_physical_device_properties2
+			if (!strcmp(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
+					instance_extensions[i].extensionName) &&
+					(demo->view_count > 1 || demo->bindless ||
+					 demo->sync2)) {
+				properties2_found = true;
+				demo->extension_names[demo->enabled_extension_count++] =
+					VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME;
+			}
+#endif
 			assert(demo->enabled_extension_count < 64);
 		}
 
@@ -2352,12 +7285,85 @@ static void demo_init_vk(struct demo *demo) {
 				demo->extension_names[demo->enabled_extension_count++] =
 					VK_KHR_SWAPCHAIN_EXTENSION_NAME;
 			}
+#ifdef VK_KHR_draw_indirect_count
+			if (!strcmp(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME,
+					device_extensions[i].extensionName)) {
+				demo->draw_indirect_count = true;
+				demo->extension_names[demo->enabled_extension_count++] =
+					VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
+			}
+#endif
+#ifdef VK_KHR_descriptor_update_template
+			if (!strcmp(VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME,
+					device_extensions[i].extensionName)) {
+				demo->update_templates = true;
+				demo->extension_names[demo->enabled_extension_count++] =
+					VK_KHR_DESCRIPTOR_UPDATE_TEMPLATE_EXTENSION_NAME;
+			}
+#endif
+#ifdef VK_KHR_multiview
+			if (!strcmp(VK_KHR_MULTIVIEW_EXTENSION_NAME,
+					device_extensions[i].extensionName) &&
+					properties2_found && demo->view_count > 1) {
+				demo->multiview = true;
+				demo->extension_names[demo->enabled_extension_count++] =
+					VK_KHR_MULTIVIEW_EXTENSION_NAME;
+			}
+#endif
+#ifdef VK_EXT_descriptor_indexing
+			if (!strcmp(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME,
+					device_extensions[i].extensionName))
+				indexing_found = true;
+			if (!strcmp(VK_KHR_MAINTENANCE3_EXTENSION_NAME,
+					device_extensions[i].extensionName))
+				maintenance3_found = true;
+#endif
+#ifdef VK_KHR_synchronization2
+			if (!strcmp(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME,
+					device_extensions[i].extensionName))
+				sync2_found = true;
+#endif
+#ifdef VK_KHR_timeline_semaphore
+			if (!strcmp(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
+					device_extensions[i].extensionName))
+				timeline_found = true;
+#endif
 			assert(demo->enabled_extension_count < 64);
 		}
 
 		free(device_extensions);
 	}
 
+#ifdef VK_EXT_descriptor_indexing
+	demo->bindless = demo->bindless && properties2_found &&
+		indexing_found && maintenance3_found;
+	if (demo->bindless) {
+		demo->extension_names[demo->enabled_extension_count++] =
+			VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME;
+		demo->extension_names[demo->enabled_extension_count++] =
+			VK_KHR_MAINTENANCE3_EXTENSION_NAME;
+	}
+#else
+	demo->bindless = false;
+#endif
+#ifdef VK_KHR_synchronization2
+	demo->sync2 = demo->sync2 && properties2_found && sync2_found;
+	if (demo->sync2)
+		demo->extension_names[demo->enabled_extension_count++] =
+			VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME;
+#else
+	demo->sync2 = false;
+#endif
+#ifdef VK_KHR_timeline_semaphore
+	demo->async_compute = demo->async_compute && properties2_found &&
+		timeline_found;
+	if (demo->async_compute)
+		demo->extension_names[demo->enabled_extension_count++] =
+			VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME;
+#else
+	demo->async_compute = false;
+#endif
+
 	if (!swapchainExtFound) {
 		ERR_EXIT("vkEnumerateDeviceExtensionProperties failed to find "
 			"the " VK_KHR_SWAPCHAIN_EXTENSION_NAME
@@ -2435,6 +7441,34 @@ static void demo_init_vk(struct demo *demo) {
 	VkPhysicalDeviceFeatures physDevFeatures;
 	vkGetPhysicalDeviceFeatures(demo->gpu, &physDevFeatures);
 
+	if (demo->view_count > 1 && !demo->multiview) {
+		printf("VK_KHR_multiview unsupported, rendering a single view\n");
+		fflush(stdout);
+		demo->view_count = 1;
+	}
+
+	demo->wireframe_supported = physDevFeatures.fillModeNonSolid;
+
+#ifdef VK_EXT_descriptor_indexing
+	if (demo->bindless)
+		demo_query_bindless(demo);
+#endif
+#ifdef VK_KHR_synchronization2
+	if (demo->sync2)
+		demo_query_sync2(demo);
+#endif
+#ifdef VK_KHR_timeline_semaphore
+	if (demo->async_compute)
+		demo_query_timeline(demo);
+#endif
+
+	if (demo->overdraw_stats && !physDevFeatures.pipelineStatisticsQuery) {
+		printf("Pipeline statistics queries unsupported, "
+			"not reporting overdraw\n");
+		fflush(stdout);
+		demo->overdraw_stats = false;
+	}
+
 	GET_INSTANCE_PROC_ADDR(demo->inst, GetPhysicalDeviceSurfaceSupportKHR);
 	GET_INSTANCE_PROC_ADDR(demo->inst, GetPhysicalDeviceSurfaceCapabilitiesKHR);
 	GET_INSTANCE_PROC_ADDR(demo->inst, GetPhysicalDeviceSurfaceFormatsKHR);
@@ -2445,7 +7479,46 @@ static void demo_init_vk(struct demo *demo) {
 static void demo_create_device(struct demo *demo) {
 	VkResult U_ASSERT_ONLY err;
 	float queue_priorities[1] = {0.0};
-	VkDeviceQueueCreateInfo queues[2];
+	VkDeviceQueueCreateInfo queues[3];
+	VkPhysicalDeviceFeatures features;
+#ifdef VK_KHR_multiview
+	VkPhysicalDeviceMultiviewFeaturesKHR multiview_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES_KHR,
+		.pNext = NULL,
+		.multiview = VK_TRUE,
+		.multiviewGeometryShader = VK_FALSE,
+		.multiviewTessellationShader = VK_FALSE,
+	};
+#endif
+#ifdef VK_KHR_synchronization2
+	VkPhysicalDeviceSynchronization2FeaturesKHR sync2_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR,
+		.pNext = NULL,
+		.synchronization2 = VK_TRUE,
+	};
+#endif
+#ifdef VK_KHR_timeline_semaphore
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+		.pNext = NULL,
+		.timelineSemaphore = VK_TRUE,
+	};
+#endif
+#ifdef VK_EXT_descriptor_indexing
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+		.pNext = NULL,
+		.shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+		.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+		.descriptorBindingPartiallyBound = VK_TRUE,
+		.runtimeDescriptorArray = VK_TRUE,
+	};
+#endif
+
+	memset(&features, 0, sizeof(features));
+	features.pipelineStatisticsQuery = demo->overdraw_stats;
+	features.fillModeNonSolid = demo->wireframe_supported;
+
 	queues[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
 	queues[0].pNext = NULL;
 	queues[0].queueFamilyIndex = demo->graphics_queue_family_index;
@@ -2462,9 +7535,30 @@ static void demo_create_device(struct demo *demo) {
 		.ppEnabledLayerNames = NULL,
 		.enabledExtensionCount = demo->enabled_extension_count,
 		.ppEnabledExtensionNames = (const char *const *)demo->extension_names,
-		.pEnabledFeatures =
-		NULL, // If specific features are required, pass them in here
+		.pEnabledFeatures = &features,
 	};
+#ifdef VK_EXT_descriptor_indexing
+	if (demo->bindless)
+		device.pNext = &indexing_features;
+#endif
+#ifdef VK_KHR_multiview
+	if (demo->multiview) {
+		multiview_features.pNext = (void *)device.pNext;
+		device.pNext = &multiview_features;
+	}
+#endif
+#ifdef VK_KHR_synchronization2
+	if (demo->sync2) {
+		sync2_features.pNext = (void *)device.pNext;
+		device.pNext = &sync2_features;
+	}
+#endif
+#ifdef VK_KHR_timeline_semaphore
+	if (demo->async_compute) {
+		timeline_features.pNext = (void *)device.pNext;
+		device.pNext = &timeline_features;
+	}
+#endif
 	if (demo->separate_present_queue) {
 		queues[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
 		queues[1].pNext = NULL;
@@ -2474,10 +7568,99 @@ static void demo_create_device(struct demo *demo) {
 		queues[1].flags = 0;
 		device.queueCreateInfoCount = 2;
 	}
+	if (demo->async_compute) {
+		VkDeviceQueueCreateInfo *compute =
+			&queues[device.queueCreateInfoCount++];
+
+		compute->sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+		compute->pNext = NULL;
+		compute->queueFamilyIndex = demo->compute_queue_family_index;
+		compute->queueCount = 1;
+		compute->pQueuePriorities = queue_priorities;
+		compute->flags = 0;
+	}
 	err = vkCreateDevice(demo->gpu, &device, NULL, &demo->device);
 	assert(!err);
 }
 
+/*
+ * Create the device, and get its queues, once the graphics and present queue
+ * families are known.
+ */
+static void demo_init_device(struct demo *demo) {
+	uint32_t i;
+
+	demo->separate_present_queue =
+		(demo->graphics_queue_family_index != demo->present_queue_family_index);
+
+	// The culling pass runs on the graphics queue, fall back to drawing
+	// everything if it can't do compute.
+	if (!(demo->queue_props[demo->graphics_queue_family_index].queueFlags &
+			VK_QUEUE_COMPUTE_BIT))
+		demo->gpu_cull = false;
+	// Occlusion culling is a mode of the culling pass. Its depth pyramid
+	// is built from a single view.
+	if (!demo->gpu_cull || demo->multiview)
+		demo->occlusion_cull = false;
+
+	// Async compute wants a family of its own, without graphics, so that
+	// it runs alongside the graphics queue rather than in turn with it.
+	demo->async_compute = demo->async_compute && demo->gpu_cull &&
+		!demo->occlusion_cull;
+	if (demo->async_compute) {
+		demo->compute_queue_family_index = UINT32_MAX;
+		for (i = 0; i < demo->queue_family_count; i++) {
+			const VkQueueFlags flags = demo->queue_props[i].queueFlags;
+
+			if ((flags & VK_QUEUE_COMPUTE_BIT) &&
+					!(flags & VK_QUEUE_GRAPHICS_BIT) &&
+					i != demo->present_queue_family_index) {
+				demo->compute_queue_family_index = i;
+				break;
+			}
+		}
+		if (demo->compute_queue_family_index == UINT32_MAX) {
+			printf("No async compute queue family, culling on the "
+				"graphics queue\n");
+			fflush(stdout);
+			demo->async_compute = false;
+		}
+	}
+
+	demo_create_device(demo);
+	demo_init_pipeline_cache(demo);
+	demo_start_pipeline_workers(demo);
+	demo_init_descriptor_layout(demo);
+	if (demo->gpu_cull)
+		demo_init_hiz_layout(demo);
+
+	GET_DEVICE_PROC_ADDR(demo->device, CreateSwapchainKHR);
+	GET_DEVICE_PROC_ADDR(demo->device, DestroySwapchainKHR);
+	GET_DEVICE_PROC_ADDR(demo->device, GetSwapchainImagesKHR);
+	GET_DEVICE_PROC_ADDR(demo->device, AcquireNextImageKHR);
+	GET_DEVICE_PROC_ADDR(demo->device, QueuePresentKHR);
+#ifdef VK_KHR_draw_indirect_count
+	if (demo->draw_indirect_count)
+		GET_DEVICE_PROC_ADDR(demo->device, CmdDrawIndexedIndirectCountKHR);
+#endif
+
+	vkGetDeviceQueue(demo->device, demo->graphics_queue_family_index, 0,
+			&demo->graphics_queue);
+
+	if (!demo->separate_present_queue) {
+		demo->present_queue = demo->graphics_queue;
+	} else {
+		vkGetDeviceQueue(demo->device, demo->present_queue_family_index, 0,
+				&demo->present_queue);
+	}
+	if (demo->async_compute)
+		vkGetDeviceQueue(demo->device, demo->compute_queue_family_index,
+				0, &demo->compute_queue);
+
+	// Get Memory information and properties
+	vkGetPhysicalDeviceMemoryProperties(demo->gpu, &demo->memory_properties);
+}
+
 static void demo_init_vk_swapchain(struct demo *demo) {
 	VkResult U_ASSERT_ONLY err;
 	uint32_t i;
@@ -2540,27 +7723,9 @@ static void demo_init_vk_swapchain(struct demo *demo) {
 
 	demo->graphics_queue_family_index = graphicsQueueFamilyIndex;
 	demo->present_queue_family_index = presentQueueFamilyIndex;
-	demo->separate_present_queue =
-		(demo->graphics_queue_family_index != demo->present_queue_family_index);
 	free(supportsPresent);
 
-	demo_create_device(demo);
-
-	GET_DEVICE_PROC_ADDR(demo->device, CreateSwapchainKHR);
-	GET_DEVICE_PROC_ADDR(demo->device, DestroySwapchainKHR);
-	GET_DEVICE_PROC_ADDR(demo->device, GetSwapchainImagesKHR);
-	GET_DEVICE_PROC_ADDR(demo->device, AcquireNextImageKHR);
-	GET_DEVICE_PROC_ADDR(demo->device, QueuePresentKHR);
-
-	vkGetDeviceQueue(demo->device, demo->graphics_queue_family_index, 0,
-			&demo->graphics_queue);
-
-	if (!demo->separate_present_queue) {
-		demo->present_queue = demo->graphics_queue;
-	} else {
-		vkGetDeviceQueue(demo->device, demo->present_queue_family_index, 0,
-				&demo->present_queue);
-	}
+	demo_init_device(demo);
 
 	// Get the list of VkFormat's that are supported:
 	uint32_t formatCount;
@@ -2619,8 +7784,53 @@ static void demo_init_vk_swapchain(struct demo *demo) {
 	}
 	demo->frame_index = 0;
 
-	// Get Memory information and properties
-	vkGetPhysicalDeviceMemoryProperties(demo->gpu, &demo->memory_properties);
+#ifdef VK_KHR_timeline_semaphore
+	if (demo->async_compute) {
+		const VkSemaphoreTypeCreateInfoKHR timeline_type = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
+			.pNext = NULL,
+			.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR,
+			.initialValue = 0,
+		};
+		const VkSemaphoreCreateInfo timeline_info = {
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+			.pNext = &timeline_type,
+			.flags = 0,
+		};
+
+		err = vkCreateSemaphore(demo->device, &timeline_info, NULL,
+					&demo->compute_timeline);
+		assert(!err);
+		err = vkCreateSemaphore(demo->device, &timeline_info, NULL,
+					&demo->graphics_timeline);
+		assert(!err);
+	}
+#endif
+}
+
+/*
+ * Set up the device for --contexts, which have no window, on the first
+ * graphics queue family. Nothing is presented, so any color format will do.
+ */
+static void demo_init_vk_headless(struct demo *demo) {
+	demo->graphics_queue_family_index = UINT32_MAX;
+	for (uint32_t i = 0; i < demo->queue_family_count; i++) {
+		if (demo->queue_props[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+			demo->graphics_queue_family_index = i;
+			break;
+		}
+	}
+	if (demo->graphics_queue_family_index == UINT32_MAX) {
+		ERR_EXIT("Could not find a graphics queue\n",
+			"Device Initialization Failure");
+	}
+	demo->present_queue_family_index = demo->graphics_queue_family_index;
+
+	demo_init_device(demo);
+
+	demo->format = VK_FORMAT_B8G8R8A8_UNORM;
+	demo->quit = false;
+	demo->curFrame = 0;
 }
 
 static void demo_init_connection(struct demo *demo) {
@@ -2644,14 +7854,119 @@ static void demo_init_connection(struct demo *demo) {
 	demo->screen = iter.data;
 }
 
+// Connect to the X server and open the window while the instance is created.
+static void demo_window_job(void *ctx, uint32_t first UNUSED,
+			uint32_t last UNUSED, uint32_t worker UNUSED) {
+	struct demo *demo = ctx;
+	const double start = demo_time_ms();
+
+	demo_init_connection(demo);
+	demo_create_xcb_window(demo);
+	atomic_store(&demo->startup_window_us,
+		(demo_time_ms() - start) * 1000.0);
+}
+
+/*
+ * Time the frame drawn whole by one process and device, then split into
+ * bands across as many processes, each with its own device, and report how
+ * the frame rate scales. The processes are forked before any thread exists
+ * and go on to set up a single context drawing their band; only they return.
+ */
+static void demo_run_split(struct demo *demo) {
+	const uint32_t runs[2] = {1, demo->band_count};
+	const size_t size = sizeof(struct demo_split) +
+		(size_t)demo->width * demo->height * 4;
+	pid_t pids[DEMO_MAX_BANDS];
+	double rates[2];
+	struct demo_split *split;
+
+	split = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (split == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
+	for (uint32_t r = 0; r < 2; r++) {
+		const uint32_t count = runs[r];
+		pthread_barrierattr_t attr;
+		double start = 0.0, end = 0.0;
+		bool failed = false;
+
+		pthread_barrierattr_init(&attr);
+		pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		pthread_barrier_init(&split->started, &attr, count);
+		pthread_barrier_init(&split->composited, &attr, count);
+		pthread_barrierattr_destroy(&attr);
+
+		// Or the children print what is buffered too.
+		fflush(stdout);
+		for (uint32_t b = 0; b < count; b++) {
+			pids[b] = fork();
+			if (pids[b] < 0) {
+				perror("fork");
+				exit(1);
+			}
+			if (pids[b] == 0) {
+				demo->split = split;
+				demo->band_count = count;
+				demo->band = b;
+				return;
+			}
+		}
+		for (uint32_t b = 0; b < count; b++) {
+			int status;
+
+			if (waitpid(pids[b], &status, 0) < 0 ||
+					!WIFEXITED(status) ||
+					WEXITSTATUS(status) != 0)
+				failed = true;
+		}
+		pthread_barrier_destroy(&split->composited);
+		pthread_barrier_destroy(&split->started);
+		if (failed) {
+			fprintf(stderr, "A band process failed\n");
+			exit(1);
+		}
+
+		for (uint32_t b = 0; b < count; b++) {
+			if (b == 0 || split->starts[b] < start)
+				start = split->starts[b];
+			if (split->ends[b] > end)
+				end = split->ends[b];
+		}
+		rates[r] = demo->frameCount * 1000.0 / (end - start);
+		printf("Split frame, %u band%s of %ux%u: %.1f frames/s\n",
+			count, count > 1 ? "s" : "", demo->width, demo->height,
+			rates[r]);
+	}
+	printf("Split frame: %.2fx one device's frame rate with %u, %.0f%% "
+		"efficiency\n", rates[1] / rates[0], demo->band_count,
+		100.0 * rates[1] / rates[0] / demo->band_count);
+
+	munmap(split, size);
+	exit(0);
+}
+
 static void demo_init(struct demo *demo, int argc, char **argv) {
 	vec3 eye = {0.0f, 3.0f, 5.0f};
 	vec3 origin = {0, 0, 0};
 	vec3 up = {0.0f, 1.0f, 0.0};
+	uint32_t columns, rows;
 
 	memset(demo, 0, sizeof(*demo));
+	demo->startup_start = demo_time_ms();
+	demo->startup_last = demo->startup_start;
 	demo->presentMode = VK_PRESENT_MODE_FIFO_KHR;
 	demo->frameCount = INT32_MAX;
+	demo->instance_count = 1;
+	demo->gpu_cull = true;
+	demo->occlusion_cull = true;
+	demo->bindless = true;
+	demo->sync2 = true;
+	demo->present_thread = true;
+	demo->update_thread = true;
+	demo->view_count = 1;
 
 	for (int i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "--use_staging") == 0) {
@@ -2686,46 +8001,278 @@ static void demo_init(struct demo *demo, int argc, char **argv) {
 			demo->suppress_popups = true;
 			continue;
 		}
+		if (strcmp(argv[i], "--instances") == 0 && i < argc - 1 &&
+			sscanf(argv[i + 1], "%u", &demo->instance_count) == 1 &&
+			demo->instance_count > 0) {
+			i++;
+			continue;
+		}
+		if (strcmp(argv[i], "--mesh") == 0 && i < argc - 1) {
+			demo->mesh_file = argv[i + 1];
+			i++;
+			continue;
+		}
+		if (strcmp(argv[i], "--scene") == 0 && i < argc - 1) {
+			demo->scene_file = argv[i + 1];
+			i++;
+			continue;
+		}
+		if (strcmp(argv[i], "--convert_scene") == 0 && i < argc - 2) {
+			const char *error;
+
+			if (!scene_convert(argv[i + 1], argv[i + 2], &error)) {
+				fprintf(stderr, "%s: %s\n", argv[i + 1], error);
+				exit(1);
+			}
+			exit(0);
+		}
+		if (strcmp(argv[i], "--hierarchy") == 0) {
+			demo->hierarchy = true;
+			continue;
+		}
+		if (strcmp(argv[i], "--ecs") == 0) {
+			demo->ecs = true;
+			continue;
+		}
+		if (strcmp(argv[i], "--ecs_bench") == 0) {
+			demo_ecs_bench();
+			exit(0);
+		}
+		if (strcmp(argv[i], "--no_gpu_cull") == 0) {
+			demo->gpu_cull = false;
+			continue;
+		}
+		if (strcmp(argv[i], "--no_occlusion_cull") == 0) {
+			demo->occlusion_cull = false;
+			continue;
+		}
+		if (strcmp(argv[i], "--no_bindless") == 0) {
+			demo->bindless = false;
+			continue;
+		}
+		if (strcmp(argv[i], "--cpu_cull") == 0) {
+			demo->cpu_cull = true;
+			demo->gpu_cull = false;
+			continue;
+		}
+		if (strcmp(argv[i], "--sort_draws") == 0) {
+			// Sorting happens as part of CPU culling.
+			demo->sort_draws = true;
+			demo->cpu_cull = true;
+			demo->gpu_cull = false;
+			continue;
+		}
+		if (strcmp(argv[i], "--async_compute") == 0) {
+			// The early occlusion phase needs the same frame's
+			// depth, so only frustum culling can run ahead.
+			demo->async_compute = true;
+			demo->occlusion_cull = false;
+			continue;
+		}
+		if (strcmp(argv[i], "--dynamic_record") == 0) {
+			// The draws recorded are the visible list's.
+			demo->dynamic_record = true;
+			demo->cpu_cull = true;
+			demo->gpu_cull = false;
+			continue;
+		}
+		if (strcmp(argv[i], "--overdraw_stats") == 0) {
+			demo->overdraw_stats = true;
+			continue;
+		}
+		if (strcmp(argv[i], "--shader_dir") == 0 && i < argc - 1) {
+			demo->shader_dir = argv[i + 1];
+			i++;
+			continue;
+		}
+		if (strcmp(argv[i], "--no_update_thread") == 0) {
+			demo->update_thread = false;
+			continue;
+		}
+		if (strcmp(argv[i], "--no_present_thread") == 0) {
+			demo->present_thread = false;
+			continue;
+		}
+		if (strcmp(argv[i], "--startup-report") == 0) {
+			demo->startup_report = true;
+			continue;
+		}
+		if (strcmp(argv[i], "--numa") == 0) {
+			demo->numa = true;
+			continue;
+		}
+		if (strcmp(argv[i], "--contexts") == 0 && i < argc - 1 &&
+			sscanf(argv[i + 1], "%u", &demo->context_count) == 1 &&
+			demo->context_count > 0 &&
+			demo->context_count <= DEMO_MAX_CONTEXTS) {
+			i++;
+			continue;
+		}
+		if (strcmp(argv[i], "--split") == 0 && i < argc - 1 &&
+			sscanf(argv[i + 1], "%u", &demo->band_count) == 1 &&
+			demo->band_count > 0 &&
+			demo->band_count <= DEMO_MAX_BANDS) {
+			i++;
+			continue;
+		}
+		if (strcmp(argv[i], "--size") == 0 && i < argc - 2 &&
+			sscanf(argv[i + 1], "%d", &demo->width) == 1 &&
+			sscanf(argv[i + 2], "%d", &demo->height) == 1 &&
+			demo->width > 0 && demo->height > 0) {
+			i += 2;
+			continue;
+		}
+		if (strcmp(argv[i], "--views") == 0 && i < argc - 1 &&
+			sscanf(argv[i + 1], "%u", &demo->view_count) == 1 &&
+			demo->view_count > 0 && demo->view_count <= DEMO_MAX_VIEWS) {
+			i++;
+			continue;
+		}
 
 		fprintf(stderr, "Usage:\n  %s [--use_staging] [--validate] [--break] "
 			"[--c <framecount>] [--suppress_popups] [--present_mode <present mode enum>]\n"
+			"  [--instances <count>] [--no_gpu_cull] [--no_occlusion_cull] [--cpu_cull]\n"
+			"  [--sort_draws] [--overdraw_stats] [--mesh <file.obj|file.ply>]\n"
+			"  [--views <1-%d>] [--scene <file>] [--convert_scene <in.txt> <out>]\n"
+			"  [--hierarchy] [--ecs] [--ecs_bench] [--shader_dir <dir>] [--no_bindless]\n"
+			"  [--numa] [--dynamic_record] [--async_compute] [--contexts <1-%d>]\n"
+			"  [--split <1-%d>] [--size <width> <height>] [--startup-report]\n"
+			"  [--no_present_thread] [--no_update_thread]\n"
 			"VK_PRESENT_MODE_IMMEDIATE_KHR = %d\n"
 			"VK_PRESENT_MODE_MAILBOX_KHR = %d\n"
 			"VK_PRESENT_MODE_FIFO_KHR = %d\n"
 			"VK_PRESENT_MODE_FIFO_RELAXED_KHR = %d\n",
-			APP_SHORT_NAME, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR,
+			APP_SHORT_NAME, DEMO_MAX_VIEWS, DEMO_MAX_CONTEXTS,
+			DEMO_MAX_BANDS,
+			VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR,
 			VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR);
 		fflush(stderr);
 		exit(1);
 	}
 
-	demo_init_connection(demo);
+	// A band is drawn by the one context of its process.
+	if (demo->band_count > 0)
+		demo->context_count = 1;
+	if (demo->width == 0) {
+		demo->width = 500;
+		demo->height = 500;
+	}
+	// Every band needs at least one row.
+	if (demo->band_count > (uint32_t)demo->height) {
+		fprintf(stderr, "--split %u needs a height of at least %u\n",
+			demo->band_count, demo->band_count);
+		exit(1);
+	}
+
+	if (demo->context_count > 0) {
+		// Contexts draw every instance, with none of the per frame
+		// culling or recording the single renderer can do.
+		demo->gpu_cull = false;
+		demo->occlusion_cull = false;
+		demo->cpu_cull = false;
+		demo->sort_draws = false;
+		demo->dynamic_record = false;
+		demo->async_compute = false;
+		demo->overdraw_stats = false;
+		demo->view_count = 1;
+		if (demo->frameCount == INT32_MAX)
+			demo->frameCount = DEMO_CONTEXT_FRAMES;
+	}
+
+	if (demo->band_count > 0)
+		demo_run_split(demo);
+
+	// Before any other thread exists, as worker 0 is this one. Band
+	// processes leave the cores to each other's drivers.
+	job_init(&demo->jobs, demo->split ? 1 : 0,
+		JOB_PIN | (demo->numa ? JOB_NUMA : 0));
+	demo_startup_phase(demo, "options and job system");
+
+	// Whatever does not need the instance or device runs alongside them.
+	if (demo->context_count == 0)
+		job_add(&demo->jobs, demo_window_job, demo, 0, 1, 1,
+			&demo->window_ready);
+	if (demo->shader_dir) {
+		demo->shader_files = calloc(ARRAY_SIZE(embedded_shaders),
+					sizeof(*demo->shader_files));
+		job_add(&demo->jobs, demo_read_shader_job, demo, 0,
+			ARRAY_SIZE(embedded_shaders), 1, &demo->shaders_read);
+	}
+	demo->depth.format = VK_FORMAT_D16_UNORM;
 
 	demo_init_vk(demo);
+	demo_startup_phase(demo, "instance");
 
-	demo->width = 500;
-	demo->height = 500;
+	if (demo->split) {
+		demo->band_top = demo->height * demo->band / demo->band_count;
+		demo->band_height = demo->height * (demo->band + 1) /
+			demo->band_count - demo->band_top;
+	} else {
+		demo->band_top = 0;
+		demo->band_height = demo->height;
+	}
 
 	demo->spin_angle = 4.0f;
 	demo->spin_increment = 0.2f;
 	demo->pause = false;
 
+	demo->pipeline_state.polygon_mode = VK_POLYGON_MODE_FILL;
+	demo->pipeline_state.cull_mode = VK_CULL_MODE_BACK_BIT;
+	demo->pipeline_state.blend = DEMO_BLEND_OPAQUE;
+	demo->pipeline_state.depth_write = VK_TRUE;
+	demo->pipeline_state.textured = VK_TRUE;
+
+	// Each view is rendered at the full window size and then squeezed into
+	// its tile, so widen or narrow it to come out with square pixels.
+	columns = demo_view_columns(demo);
+	rows = (demo->view_count + columns - 1) / columns;
 	mat4x4_perspective(demo->projection_matrix, (float)degreesToRadians(45.0f),
-			1.0f, 0.1f, 100.0f);
+			(float)rows / columns, 0.1f, 100.0f);
 	mat4x4_look_at(demo->view_matrix, eye, origin, up);
 	mat4x4_identity(demo->model_matrix);
 
 	demo->projection_matrix[1][1]*=-1;  //Flip projection matrix from GL to Vulkan orientation.
+
+	for (uint32_t i = 0; i < demo->view_count; i++) {
+		const float offset = (i - (demo->view_count - 1) * 0.5f) *
+			DEMO_VIEW_BASELINE;
+		mat4x4 shift;
+
+		// Slide the camera along its own x axis.
+		mat4x4_translate(shift, -offset, 0.0f, 0.0f);
+		mat4x4_mul(demo->view_matrices[i], shift, demo->view_matrix);
+	}
+
+	demo_init_scene(demo);
+	// How many textures there are depends on the device's limits.
+	demo->decoded_textures = calloc(demo->texture_count,
+					sizeof(*demo->decoded_textures));
+	job_add(&demo->jobs, demo_decode_texture_job, demo, 0,
+		demo->texture_count, 1, &demo->textures_decoded);
+	demo_startup_phase(demo, "scene");
 }
 
 int main(int argc, char **argv) {
 	struct demo demo;
 
 	demo_init(&demo, argc, argv);
-	demo_create_xcb_window(&demo);
-	demo_init_vk_swapchain(&demo);
-	demo_prepare(&demo);
-	demo_run_xcb(&demo);
+	if (demo.context_count > 0) {
+		demo_init_vk_headless(&demo);
+		demo_prepare_shared(&demo);
+		demo_run_contexts(&demo);
+	} else {
+		job_wait(&demo.jobs, &demo.window_ready);
+		demo_startup_phase(&demo, "window wait");
+		demo_init_vk_swapchain(&demo);
+		demo_startup_phase(&demo, "device and swapchain");
+		demo_prepare(&demo);
+		demo_startup_phase(&demo, "prepare");
+		demo_start_present(&demo);
+		demo_start_update(&demo);
+		demo_run_xcb(&demo);
+		demo_stop_update(&demo);
+		demo_stop_present(&demo);
+	}
 	demo_cleanup(&demo);
 
 	return validation_error;
@@ -18,13 +18,30 @@
 /*
  * Fragment shader for cube demo
  */
-#version 400
+#version 450
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
+
+// Built a second time with BINDLESS defined, picking each instance's texture
+// out of an array, which needs VK_EXT_descriptor_indexing.
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : enable
+layout (binding = 1) uniform sampler2D textures[];
+#define tex textures[nonuniformEXT(texture_index)]
+#else
 layout (binding = 1) uniform sampler2D tex;
+#endif
+
+// Fixed per pipeline variant, see demo_build_pipeline() in cube.c.
+layout (constant_id = 0) const bool TEXTURED = true;
+layout (constant_id = 1) const float ALPHA = 1.0;
 
 layout (location = 0) in vec4 texcoord;
+layout (location = 1) flat in uint texture_index;
 layout (location = 0) out vec4 uFragColor;
 void main() {
-   uFragColor = texture(tex, texcoord.xy);
+   vec4 color = TEXTURED ? texture(tex, texcoord.xy) :
+                           vec4(texcoord.xy, 0.5, 1.0);
+
+   uFragColor = vec4(color.rgb, color.a * ALPHA);
 }
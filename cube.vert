@@ -18,16 +18,52 @@
 /*
  * Vertex shader used by Cube demo.
  */
-#version 400
+#version 450
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
+
+// Built a second time with MULTIVIEW defined for VK_KHR_multiview render
+// passes, which need the multiview device feature.
+#ifdef MULTIVIEW
+#extension GL_EXT_multiview : enable
+#define VIEW_INDEX gl_ViewIndex
+#else
+#define VIEW_INDEX 0
+#endif
+
+// DEMO_MAX_VIEWS in cube.c
+#define MAX_VIEWS 6
+
 layout(std140, binding = 0) uniform buf {
         mat4 MVP;
-        vec4 position[12*3];
-        vec4 attr[12*3];
+        vec4 planes[6];
+        uint instance_count;
+        mat4 view_mvp[MAX_VIEWS];
 } ubuf;
 
+struct Instance {
+        mat4 model;
+        vec4 sphere;
+        uint texture;
+};
+
+layout(std430, binding = 2) readonly buffer Instances {
+        Instance instances[];
+};
+
+// Compacted by cull.comp, one list of instance_count entries per slot.
+layout(std430, binding = 3) readonly buffer Visible {
+        uint visible[];
+};
+
+layout(push_constant) uniform Slot {
+        uint slot;
+} pc;
+
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec2 uv;
 layout (location = 0) out vec4 texcoord;
+layout (location = 1) flat out uint texture_index;
 
 out gl_PerVertex {
         vec4 gl_Position;
@@ -35,6 +71,10 @@ out gl_PerVertex {
 
 void main() 
 {
-   texcoord = ubuf.attr[gl_VertexIndex];
-   gl_Position = ubuf.MVP * ubuf.position[gl_VertexIndex];
+   uint id = visible[pc.slot * ubuf.instance_count + gl_InstanceIndex];
+
+   texcoord = vec4(uv, 0.0, 0.0);
+   texture_index = instances[id].texture;
+   gl_Position = ubuf.view_mvp[VIEW_INDEX] * instances[id].model *
+                 vec4(position, 1.0);
 }
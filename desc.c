@@ -0,0 +1,369 @@
+/*
+ * Descriptor set allocator, see desc.h.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "desc.h"
+
+// Chains double their pools up to this many times the first one's sets.
+#define DESC_MAX_POOL_SHIFT 8
+
+static uint64_t desc_hash(const union desc_info *infos, uint32_t count) {
+	const unsigned char *bytes = (const unsigned char *)infos;
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	for (size_t i = 0; i < count * sizeof(*infos); i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static struct desc_chain *desc_chain(struct desc_allocator *alloc,
+				uint32_t frame) {
+	if (frame == DESC_PERSISTENT)
+		return &alloc->persistent;
+	if (frame >= alloc->frame_count) {
+		alloc->frames = realloc(alloc->frames,
+					(frame + 1) * sizeof(*alloc->frames));
+		assert(alloc->frames);
+		memset(alloc->frames + alloc->frame_count, 0,
+			(frame + 1 - alloc->frame_count) *
+			sizeof(*alloc->frames));
+		alloc->frame_count = frame + 1;
+	}
+	return &alloc->frames[frame];
+}
+
+static uint32_t desc_pool_sets(const struct desc_allocator *alloc,
+			uint32_t pool) {
+	return alloc->pool_sets << (pool < DESC_MAX_POOL_SHIFT ?
+				pool : DESC_MAX_POOL_SHIFT);
+}
+
+static void desc_chain_grow(struct desc_allocator *alloc,
+			struct desc_chain *chain) {
+	const uint32_t sets = desc_pool_sets(alloc, chain->pool_count);
+	VkDescriptorPoolSize sizes[DESC_MAX_BINDINGS];
+	VkResult err;
+
+	for (uint32_t i = 0; i < alloc->size_count; i++) {
+		sizes[i].type = alloc->sizes[i].type;
+		sizes[i].descriptorCount = alloc->sizes[i].descriptorCount * sets;
+	}
+
+	const VkDescriptorPoolCreateInfo pool_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.pNext = NULL,
+		.flags = alloc->flags,
+		.maxSets = sets,
+		.poolSizeCount = alloc->size_count,
+		.pPoolSizes = sizes,
+	};
+
+	if (chain->pool_count == chain->pool_capacity) {
+		uint32_t n = chain->pool_capacity ? chain->pool_capacity * 2 : 4;
+
+		chain->pools = realloc(chain->pools, n * sizeof(*chain->pools));
+		assert(chain->pools);
+		chain->pool_capacity = n;
+	}
+	err = vkCreateDescriptorPool(alloc->device, &pool_info, NULL,
+				&chain->pools[chain->pool_count++]);
+	assert(!err);
+}
+
+static VkDescriptorSet desc_chain_allocate(struct desc_allocator *alloc,
+					struct desc_chain *chain) {
+	VkDescriptorSet set;
+	VkResult err;
+
+	if (chain->pool_count > 0 &&
+			chain->current_sets == desc_pool_sets(alloc, chain->current)) {
+		chain->current++;
+		chain->current_sets = 0;
+	}
+	if (chain->current == chain->pool_count)
+		desc_chain_grow(alloc, chain);
+
+	const VkDescriptorSetAllocateInfo alloc_info = {
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.pNext = NULL,
+		.descriptorPool = chain->pools[chain->current],
+		.descriptorSetCount = 1,
+		.pSetLayouts = &alloc->layout,
+	};
+	err = vkAllocateDescriptorSets(alloc->device, &alloc_info, &set);
+	assert(!err);
+	chain->current_sets++;
+	chain->set_count++;
+	return set;
+}
+
+static void desc_chain_reset(struct desc_allocator *alloc,
+			struct desc_chain *chain) {
+	if (chain->set_count == 0)
+		return;
+	for (uint32_t i = 0; i <= chain->current && i < chain->pool_count; i++)
+		vkResetDescriptorPool(alloc->device, chain->pools[i], 0);
+	chain->current = 0;
+	chain->current_sets = 0;
+	chain->set_count = 0;
+	if (chain->cache_count > 0) {
+		memset(chain->cache, 0,
+			chain->cache_capacity * sizeof(*chain->cache));
+		chain->cache_count = 0;
+	}
+}
+
+static void desc_chain_destroy(struct desc_allocator *alloc,
+			struct desc_chain *chain) {
+	for (uint32_t i = 0; i < chain->pool_count; i++)
+		vkDestroyDescriptorPool(alloc->device, chain->pools[i], NULL);
+	free(chain->pools);
+	free(chain->cache);
+	free(chain->keys);
+	memset(chain, 0, sizeof(*chain));
+}
+
+// Keep the table at most half full, along with room for the keys.
+static void desc_cache_grow(struct desc_allocator *alloc,
+			struct desc_chain *chain) {
+	const uint32_t n = chain->cache_capacity ?
+		chain->cache_capacity * 2 : 64;
+	struct desc_cache_entry *cache = calloc(n, sizeof(*cache));
+
+	assert(cache);
+	for (uint32_t i = 0; i < chain->cache_capacity; i++) {
+		const struct desc_cache_entry *entry = &chain->cache[i];
+		uint32_t slot = (uint32_t)entry->hash & (n - 1);
+
+		if (!entry->set)
+			continue;
+		while (cache[slot].set)
+			slot = (slot + 1) & (n - 1);
+		cache[slot] = *entry;
+	}
+	free(chain->cache);
+	chain->cache = cache;
+	chain->cache_capacity = n;
+
+	chain->keys = realloc(chain->keys, n / 2 * alloc->info_count *
+			sizeof(*chain->keys));
+	assert(chain->keys);
+}
+
+void desc_allocator_init(struct desc_allocator *alloc, VkDevice device,
+			VkDescriptorSetLayout layout,
+			const VkDescriptorSetLayoutBinding *bindings,
+			uint32_t binding_count, uint32_t written,
+			VkDescriptorPoolCreateFlags flags, uint32_t pool_sets,
+			bool templates) {
+	uint32_t i, j;
+
+	assert(binding_count <= DESC_MAX_BINDINGS && pool_sets > 0);
+	memset(alloc, 0, sizeof(*alloc));
+	alloc->device = device;
+	alloc->layout = layout;
+	alloc->flags = flags;
+	alloc->pool_sets = pool_sets;
+
+	for (i = 0; i < binding_count; i++) {
+		for (j = 0; j < alloc->size_count; j++) {
+			if (alloc->sizes[j].type == bindings[i].descriptorType)
+				break;
+		}
+		if (j == alloc->size_count) {
+			alloc->sizes[j].type = bindings[i].descriptorType;
+			alloc->size_count++;
+		}
+		alloc->sizes[j].descriptorCount += bindings[i].descriptorCount;
+
+		if (!(written & (1u << i)))
+			continue;
+		alloc->writes[alloc->write_count].binding = bindings[i].binding;
+		alloc->writes[alloc->write_count].count =
+			bindings[i].descriptorCount;
+		alloc->writes[alloc->write_count].type =
+			bindings[i].descriptorType;
+		alloc->write_count++;
+		alloc->info_count += bindings[i].descriptorCount;
+	}
+
+#ifdef VK_KHR_descriptor_update_template
+	PFN_vkCreateDescriptorUpdateTemplateKHR create_template = NULL;
+
+	if (templates) {
+		create_template = (PFN_vkCreateDescriptorUpdateTemplateKHR)
+			vkGetDeviceProcAddr(device,
+					"vkCreateDescriptorUpdateTemplateKHR");
+		alloc->update_with_template =
+			(PFN_vkUpdateDescriptorSetWithTemplateKHR)
+			vkGetDeviceProcAddr(device,
+					"vkUpdateDescriptorSetWithTemplateKHR");
+		alloc->destroy_template =
+			(PFN_vkDestroyDescriptorUpdateTemplateKHR)
+			vkGetDeviceProcAddr(device,
+					"vkDestroyDescriptorUpdateTemplateKHR");
+	}
+	if (create_template && alloc->update_with_template &&
+			alloc->destroy_template && alloc->write_count > 0) {
+		VkDescriptorUpdateTemplateEntryKHR entries[DESC_MAX_BINDINGS];
+		size_t offset = 0;
+		VkResult err;
+
+		for (i = 0; i < alloc->write_count; i++) {
+			entries[i].dstBinding = alloc->writes[i].binding;
+			entries[i].dstArrayElement = 0;
+			entries[i].descriptorCount = alloc->writes[i].count;
+			entries[i].descriptorType = alloc->writes[i].type;
+			entries[i].offset = offset;
+			entries[i].stride = sizeof(union desc_info);
+			offset += alloc->writes[i].count *
+				sizeof(union desc_info);
+		}
+
+		const VkDescriptorUpdateTemplateCreateInfoKHR template_info = {
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO_KHR,
+			.pNext = NULL,
+			.flags = 0,
+			.descriptorUpdateEntryCount = alloc->write_count,
+			.pDescriptorUpdateEntries = entries,
+			.templateType =
+				VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET_KHR,
+			.descriptorSetLayout = layout,
+		};
+		err = create_template(device, &template_info, NULL,
+				&alloc->update_template);
+		assert(!err);
+		return;
+	}
+	alloc->update_with_template = NULL;
+#else
+	(void)templates;
+#endif
+
+	// Without a template, write each descriptor from its own info.
+	alloc->fallback = calloc(alloc->info_count ? alloc->info_count : 1,
+				sizeof(*alloc->fallback));
+	assert(alloc->fallback);
+	for (i = 0, j = 0; i < alloc->write_count; i++) {
+		for (uint32_t k = 0; k < alloc->writes[i].count; k++, j++) {
+			VkWriteDescriptorSet *write = &alloc->fallback[j];
+
+			write->sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			write->dstBinding = alloc->writes[i].binding;
+			write->dstArrayElement = k;
+			write->descriptorCount = 1;
+			write->descriptorType = alloc->writes[i].type;
+		}
+	}
+}
+
+void desc_allocator_destroy(struct desc_allocator *alloc) {
+	desc_chain_destroy(alloc, &alloc->persistent);
+	for (uint32_t i = 0; i < alloc->frame_count; i++)
+		desc_chain_destroy(alloc, &alloc->frames[i]);
+	free(alloc->frames);
+#ifdef VK_KHR_descriptor_update_template
+	if (alloc->update_template)
+		alloc->destroy_template(alloc->device, alloc->update_template,
+					NULL);
+#endif
+	free(alloc->fallback);
+	memset(alloc, 0, sizeof(*alloc));
+}
+
+void desc_allocator_reset(struct desc_allocator *alloc) {
+	desc_chain_reset(alloc, &alloc->persistent);
+	for (uint32_t i = 0; i < alloc->frame_count; i++)
+		desc_chain_reset(alloc, &alloc->frames[i]);
+}
+
+bool desc_allocator_frame_used(const struct desc_allocator *alloc,
+			uint32_t frame) {
+	return frame < alloc->frame_count && alloc->frames[frame].set_count > 0;
+}
+
+void desc_allocator_begin_frame(struct desc_allocator *alloc, uint32_t frame) {
+	if (frame < alloc->frame_count)
+		desc_chain_reset(alloc, &alloc->frames[frame]);
+}
+
+VkDescriptorSet desc_allocate(struct desc_allocator *alloc, uint32_t frame) {
+	return desc_chain_allocate(alloc, desc_chain(alloc, frame));
+}
+
+void desc_write(struct desc_allocator *alloc, VkDescriptorSet set,
+		const union desc_info *infos) {
+#ifdef VK_KHR_descriptor_update_template
+	if (alloc->update_template) {
+		alloc->update_with_template(alloc->device, set,
+					alloc->update_template, infos);
+		return;
+	}
+#endif
+	for (uint32_t i = 0; i < alloc->info_count; i++) {
+		VkWriteDescriptorSet *write = &alloc->fallback[i];
+
+		write->dstSet = set;
+		switch (write->descriptorType) {
+		case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
+		case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
+			write->pTexelBufferView = &infos[i].texel_buffer;
+			break;
+		case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+		case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
+		case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
+		case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
+			write->pBufferInfo = &infos[i].buffer;
+			break;
+		default:
+			write->pImageInfo = &infos[i].image;
+			break;
+		}
+	}
+	vkUpdateDescriptorSets(alloc->device, alloc->info_count,
+			alloc->fallback, 0, NULL);
+}
+
+VkDescriptorSet desc_get(struct desc_allocator *alloc, uint32_t frame,
+			const union desc_info *infos) {
+	struct desc_chain *chain = desc_chain(alloc, frame);
+	const size_t size = alloc->info_count * sizeof(*infos);
+	const uint64_t hash = desc_hash(infos, alloc->info_count);
+	uint32_t slot;
+
+	assert(alloc->info_count > 0);
+	if (chain->cache_capacity > 0) {
+		slot = (uint32_t)hash & (chain->cache_capacity - 1);
+		for (; chain->cache[slot].set;
+				slot = (slot + 1) & (chain->cache_capacity - 1)) {
+			const struct desc_cache_entry *entry =
+				&chain->cache[slot];
+
+			if (entry->hash == hash && !memcmp(chain->keys +
+					entry->key * alloc->info_count, infos,
+					size))
+				return entry->set;
+		}
+	}
+
+	if ((chain->cache_count + 1) * 2 > chain->cache_capacity)
+		desc_cache_grow(alloc, chain);
+	slot = (uint32_t)hash & (chain->cache_capacity - 1);
+	while (chain->cache[slot].set)
+		slot = (slot + 1) & (chain->cache_capacity - 1);
+
+	chain->cache[slot].hash = hash;
+	chain->cache[slot].set = desc_chain_allocate(alloc, chain);
+	chain->cache[slot].key = chain->cache_count;
+	memcpy(chain->keys + chain->cache_count * alloc->info_count, infos,
+		size);
+	chain->cache_count++;
+	desc_write(alloc, chain->cache[slot].set, infos);
+	return chain->cache[slot].set;
+}
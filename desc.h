@@ -0,0 +1,139 @@
+/*
+ * Descriptor set allocator.
+ *
+ * An allocator hands out sets of one layout from a chain of pools, each sized
+ * for a number of those sets and twice the size of the one before, so running
+ * out of a pool just moves on to the next. Sets come from either the
+ * persistent chain, which lives until desc_allocator_reset(), or the chain of
+ * a frame in flight, whose pools are reset wholesale when the frame comes
+ * round again rather than freeing sets one by one.
+ *
+ * The contents of a set are given as one union desc_info per descriptor of
+ * the bindings the allocator writes, in binding order. desc_get() hashes them
+ * and returns the chain's set already holding the same contents if there is
+ * one, so a set per material or per buffer range is written once. Writes go
+ * through a descriptor update template where the device has
+ * VK_KHR_descriptor_update_template, and vkUpdateDescriptorSets() otherwise.
+ *
+ * An allocator is not thread safe.
+ */
+
+#ifndef DESC_H
+#define DESC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+#define DESC_MAX_BINDINGS 16
+// The chain of sets which outlive any one frame.
+#define DESC_PERSISTENT UINT32_MAX
+
+/*
+ * Entries are hashed and compared bytewise, so zero them before filling
+ * them in.
+ */
+union desc_info {
+	VkDescriptorImageInfo image;
+	VkDescriptorBufferInfo buffer;
+	VkBufferView texel_buffer;
+};
+
+struct desc_cache_entry {
+	uint64_t hash;
+	VkDescriptorSet set;
+	// Index of the set's infos in the chain's keys.
+	uint32_t key;
+};
+
+struct desc_chain {
+	VkDescriptorPool *pools;
+	uint32_t pool_count;
+	uint32_t pool_capacity;
+	// Pool sets are being allocated from, and how many it has handed out.
+	// Pools never free single sets, so one is full after exactly the sets
+	// it was sized for.
+	uint32_t current;
+	uint32_t current_sets;
+	uint32_t set_count;
+	// Open addressed, with a power of two capacity.
+	struct desc_cache_entry *cache;
+	uint32_t cache_capacity;
+	uint32_t cache_count;
+	union desc_info *keys;
+};
+
+struct desc_write {
+	uint32_t binding;
+	uint32_t count;
+	VkDescriptorType type;
+};
+
+struct desc_allocator {
+	VkDevice device;
+	VkDescriptorSetLayout layout;
+	VkDescriptorPoolCreateFlags flags;
+	// Descriptors of each type in one set.
+	VkDescriptorPoolSize sizes[DESC_MAX_BINDINGS];
+	uint32_t size_count;
+	// Sets in the first pool of a chain.
+	uint32_t pool_sets;
+
+	// The bindings written, and the infos that takes.
+	struct desc_write writes[DESC_MAX_BINDINGS];
+	uint32_t write_count;
+	uint32_t info_count;
+	// One per descriptor, for writing without a template.
+	VkWriteDescriptorSet *fallback;
+#ifdef VK_KHR_descriptor_update_template
+	VkDescriptorUpdateTemplateKHR update_template;
+	PFN_vkUpdateDescriptorSetWithTemplateKHR update_with_template;
+	PFN_vkDestroyDescriptorUpdateTemplateKHR destroy_template;
+#endif
+
+	struct desc_chain persistent;
+	// Grown as frames are first used.
+	struct desc_chain *frames;
+	uint32_t frame_count;
+};
+
+/*
+ * Serve sets of layout, made of the given bindings. Bit i of written selects
+ * bindings[i] as one desc_write() and desc_get() fill in; the others are left
+ * to the caller. flags are those the pools need, such as update after bind.
+ * Update templates are only used if templates is set, meaning the device
+ * extension is enabled.
+ */
+void desc_allocator_init(struct desc_allocator *alloc, VkDevice device,
+			VkDescriptorSetLayout layout,
+			const VkDescriptorSetLayoutBinding *bindings,
+			uint32_t binding_count, uint32_t written,
+			VkDescriptorPoolCreateFlags flags, uint32_t pool_sets,
+			bool templates);
+void desc_allocator_destroy(struct desc_allocator *alloc);
+
+// Free every set, keeping the pools. No set may still be in use.
+void desc_allocator_reset(struct desc_allocator *alloc);
+
+// Whether the frame's chain holds any sets.
+bool desc_allocator_frame_used(const struct desc_allocator *alloc,
+			uint32_t frame);
+
+/*
+ * Free the sets of a frame, which the GPU must be done with, so the frame can
+ * allocate again.
+ */
+void desc_allocator_begin_frame(struct desc_allocator *alloc, uint32_t frame);
+
+// Allocate an unwritten set from a frame's chain, or DESC_PERSISTENT.
+VkDescriptorSet desc_allocate(struct desc_allocator *alloc, uint32_t frame);
+
+void desc_write(struct desc_allocator *alloc, VkDescriptorSet set,
+		const union desc_info *infos);
+
+// A set of the frame's chain holding infos, written if it is new.
+VkDescriptorSet desc_get(struct desc_allocator *alloc, uint32_t frame,
+			const union desc_info *infos);
+
+#endif
@@ -0,0 +1,309 @@
+/*
+ * Entity component store, see ecs.h.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ecs.h"
+
+static uint32_t ecs_align(uint32_t offset) {
+	return (offset + ECS_ALIGN - 1) / ECS_ALIGN * ECS_ALIGN;
+}
+
+// Lay out a chunk for capacity entities, returning its size.
+static uint32_t ecs_layout(const struct ecs_world *world,
+			struct ecs_archetype *archetype, uint32_t capacity) {
+	uint32_t offset = ecs_align(sizeof(struct ecs_chunk));
+
+	archetype->entity_offset = offset;
+	offset = ecs_align(offset + capacity * sizeof(ecs_entity));
+	for (uint32_t c = 0; c < world->component_count; c++) {
+		if (!(archetype->mask & ECS_BIT(c)))
+			continue;
+		archetype->offsets[c] = offset;
+		offset = ecs_align(offset + capacity * world->sizes[c]);
+	}
+	return offset;
+}
+
+static struct ecs_archetype *ecs_archetype(struct ecs_world *world,
+					ecs_mask mask) {
+	struct ecs_archetype *archetype;
+	size_t entity_size = sizeof(ecs_entity);
+	uint32_t i, capacity;
+
+	for (i = 0; i < world->archetype_count; i++) {
+		if (world->archetypes[i]->mask == mask)
+			return world->archetypes[i];
+	}
+
+	assert(world->archetype_count < ECS_MAX_ARCHETYPES);
+	archetype = calloc(1, sizeof(*archetype));
+	assert(archetype);
+	archetype->mask = mask;
+
+	// Start from the size ignoring padding and back off until it fits.
+	for (i = 0; i < world->component_count; i++) {
+		if (mask & ECS_BIT(i))
+			entity_size += world->sizes[i];
+	}
+	capacity = (ECS_CHUNK_SIZE - sizeof(struct ecs_chunk)) / entity_size;
+	while (capacity > 1 && ecs_layout(world, archetype, capacity) >
+			ECS_CHUNK_SIZE)
+		capacity--;
+	assert(ecs_layout(world, archetype, capacity) <= ECS_CHUNK_SIZE);
+	archetype->capacity = capacity;
+
+	world->archetypes[world->archetype_count++] = archetype;
+	return archetype;
+}
+
+// Append a row to the archetype's last chunk, adding a chunk if it is full.
+static struct ecs_location ecs_append(struct ecs_archetype *archetype) {
+	struct ecs_chunk *chunk = archetype->chunk_count ?
+		archetype->chunks[archetype->chunk_count - 1] : NULL;
+	struct ecs_location location;
+
+	if (!chunk || chunk->count == archetype->capacity) {
+		if (archetype->chunk_count == archetype->chunk_capacity) {
+			uint32_t n = archetype->chunk_capacity ?
+				archetype->chunk_capacity * 2 : 16;
+
+			archetype->chunks = realloc(archetype->chunks,
+						n * sizeof(*archetype->chunks));
+			assert(archetype->chunks);
+			archetype->chunk_capacity = n;
+		}
+		chunk = aligned_alloc(ECS_ALIGN, ECS_CHUNK_SIZE);
+		assert(chunk);
+		memset(chunk, 0, ECS_CHUNK_SIZE);
+		chunk->archetype = archetype;
+		archetype->chunks[archetype->chunk_count++] = chunk;
+	}
+
+	location.chunk = chunk;
+	location.row = chunk->count++;
+	return location;
+}
+
+/*
+ * Remove a row by moving the archetype's last entity into it, keeping the
+ * chunks dense.
+ */
+static void ecs_remove(struct ecs_world *world, struct ecs_location location) {
+	struct ecs_archetype *archetype = location.chunk->archetype;
+	struct ecs_chunk *last = archetype->chunks[archetype->chunk_count - 1];
+	const uint32_t row = last->count - 1;
+
+	if (last != location.chunk || row != location.row) {
+		const ecs_entity moved = ecs_entities(last)[row];
+
+		for (uint32_t c = 0; c < world->component_count; c++) {
+			const size_t size = world->sizes[c];
+
+			if (!(archetype->mask & ECS_BIT(c)))
+				continue;
+			memcpy((char *)ecs_column(location.chunk, c) +
+				location.row * size,
+				(char *)ecs_column(last, c) + row * size, size);
+		}
+		ecs_entities(location.chunk)[location.row] = moved;
+		world->locations[moved] = location;
+	}
+
+	if (--last->count == 0) {
+		free(last);
+		archetype->chunk_count--;
+	} else {
+		// Leave the row zeroed for its next entity.
+		for (uint32_t c = 0; c < world->component_count; c++) {
+			if (archetype->mask & ECS_BIT(c))
+				memset((char *)ecs_column(last, c) +
+					row * world->sizes[c], 0,
+					world->sizes[c]);
+		}
+	}
+}
+
+void ecs_init(struct ecs_world *world) {
+	memset(world, 0, sizeof(*world));
+}
+
+void ecs_destroy(struct ecs_world *world) {
+	for (uint32_t i = 0; i < world->archetype_count; i++) {
+		struct ecs_archetype *archetype = world->archetypes[i];
+
+		for (uint32_t j = 0; j < archetype->chunk_count; j++)
+			free(archetype->chunks[j]);
+		free(archetype->chunks);
+		free(archetype);
+	}
+	free(world->locations);
+	free(world->free_ids);
+	memset(world, 0, sizeof(*world));
+}
+
+uint32_t ecs_register(struct ecs_world *world, size_t size) {
+	// Archetypes are laid out for the components known when created.
+	assert(world->component_count < ECS_MAX_COMPONENTS &&
+		world->archetype_count == 0);
+	world->sizes[world->component_count] = size;
+	return world->component_count++;
+}
+
+ecs_entity ecs_create(struct ecs_world *world, ecs_mask mask) {
+	ecs_entity entity;
+
+	if (world->free_count > 0) {
+		entity = world->free_ids[--world->free_count];
+	} else {
+		if (world->entity_count == world->entity_capacity) {
+			uint32_t n = world->entity_capacity ?
+				world->entity_capacity * 2 : 1024;
+
+			world->locations = realloc(world->locations,
+						n * sizeof(*world->locations));
+			world->free_ids = realloc(world->free_ids,
+						n * sizeof(*world->free_ids));
+			assert(world->locations && world->free_ids);
+			world->entity_capacity = n;
+		}
+		entity = world->entity_count++;
+	}
+
+	world->locations[entity] = ecs_append(ecs_archetype(world, mask));
+	ecs_entities(world->locations[entity].chunk)[
+		world->locations[entity].row] = entity;
+	return entity;
+}
+
+void ecs_delete(struct ecs_world *world, ecs_entity entity) {
+	ecs_remove(world, world->locations[entity]);
+	world->locations[entity].chunk = NULL;
+	world->free_ids[world->free_count++] = entity;
+}
+
+void ecs_set_mask(struct ecs_world *world, ecs_entity entity, ecs_mask mask) {
+	const struct ecs_location from = world->locations[entity];
+	const ecs_mask kept = from.chunk->archetype->mask & mask;
+	struct ecs_location to;
+
+	if (from.chunk->archetype->mask == mask)
+		return;
+
+	to = ecs_append(ecs_archetype(world, mask));
+	for (uint32_t c = 0; c < world->component_count; c++) {
+		const size_t size = world->sizes[c];
+
+		if (kept & ECS_BIT(c))
+			memcpy((char *)ecs_column(to.chunk, c) + to.row * size,
+				(char *)ecs_column(from.chunk, c) +
+				from.row * size, size);
+	}
+	ecs_entities(to.chunk)[to.row] = entity;
+	ecs_remove(world, from);
+	world->locations[entity] = to;
+}
+
+void *ecs_get(const struct ecs_world *world, ecs_entity entity,
+	uint32_t component) {
+	const struct ecs_location *location = &world->locations[entity];
+
+	if (!location->chunk ||
+			!(location->chunk->archetype->mask & ECS_BIT(component)))
+		return NULL;
+	return (char *)ecs_column(location->chunk, component) +
+		location->row * world->sizes[component];
+}
+
+uint32_t ecs_query(const struct ecs_world *world, ecs_mask mask,
+		struct ecs_chunk **chunks, uint32_t max) {
+	uint32_t count = 0;
+
+	for (uint32_t i = 0; i < world->archetype_count; i++) {
+		const struct ecs_archetype *archetype = world->archetypes[i];
+
+		if ((archetype->mask & mask) != mask)
+			continue;
+		for (uint32_t j = 0; j < archetype->chunk_count; j++, count++) {
+			if (count < max)
+				chunks[count] = archetype->chunks[j];
+		}
+	}
+	return count;
+}
+
+static bool ecs_conflict(const struct ecs_system *a,
+			const struct ecs_system *b) {
+	return (a->writes & (b->reads | b->writes)) ||
+		(b->writes & a->reads);
+}
+
+uint32_t ecs_schedule(const struct ecs_system *systems, uint32_t count,
+		uint32_t *phases) {
+	uint32_t phase_count = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		phases[i] = 0;
+		for (uint32_t j = 0; j < i; j++) {
+			if (ecs_conflict(&systems[i], &systems[j]) &&
+					phases[j] + 1 > phases[i])
+				phases[i] = phases[j] + 1;
+		}
+		if (phases[i] + 1 > phase_count)
+			phase_count = phases[i] + 1;
+	}
+	return phase_count;
+}
+
+uint32_t ecs_phase_jobs(const struct ecs_world *world,
+			const struct ecs_system *systems, const uint32_t *phases,
+			uint32_t count, uint32_t phase, struct ecs_job *jobs,
+			uint32_t max) {
+	uint32_t job_count = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
+		const ecs_mask mask = systems[i].reads | systems[i].writes;
+		uint32_t index = 0;
+
+		if (phases[i] != phase)
+			continue;
+		for (uint32_t a = 0; a < world->archetype_count; a++) {
+			const struct ecs_archetype *archetype =
+				world->archetypes[a];
+
+			if ((archetype->mask & mask) != mask)
+				continue;
+			for (uint32_t j = 0; j < archetype->chunk_count;
+					j++, job_count++, index++) {
+				if (job_count >= max)
+					continue;
+				jobs[job_count].system = &systems[i];
+				jobs[job_count].chunk = archetype->chunks[j];
+				jobs[job_count].index = index;
+			}
+		}
+	}
+	return job_count;
+}
+
+void ecs_run(const struct ecs_world *world, const struct ecs_system *systems,
+	uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		const ecs_mask mask = systems[i].reads | systems[i].writes;
+		uint32_t index = 0;
+
+		for (uint32_t a = 0; a < world->archetype_count; a++) {
+			const struct ecs_archetype *archetype =
+				world->archetypes[a];
+
+			if ((archetype->mask & mask) != mask)
+				continue;
+			for (uint32_t j = 0; j < archetype->chunk_count; j++)
+				systems[i].run(archetype->chunks[j], index++,
+					systems[i].ctx);
+		}
+	}
+}
@@ -0,0 +1,151 @@
+/*
+ * Archetype based entity component store.
+ *
+ * Components are plain fixed size structs, registered once and named by the
+ * index returned. Every entity belongs to the archetype of its exact set of
+ * components. An archetype stores its entities in ECS_CHUNK_SIZE blocks,
+ * each holding a cache line aligned array per component, so a system working
+ * on a few components streams through exactly those arrays.
+ *
+ * Systems declare the components they read and write. ecs_schedule() groups
+ * them into phases of systems which do not conflict, keeping conflicting
+ * systems in the order given, and each phase breaks down into one job per
+ * system and matching chunk which may all run concurrently.
+ */
+
+#ifndef ECS_H
+#define ECS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ECS_CHUNK_SIZE (16 * 1024)
+#define ECS_MAX_COMPONENTS 32
+#define ECS_MAX_ARCHETYPES 64
+// Alignment of each component array within a chunk.
+#define ECS_ALIGN 64
+
+typedef uint32_t ecs_entity;
+typedef uint32_t ecs_mask;
+
+#define ECS_BIT(component) ((ecs_mask)1 << (component))
+
+struct ecs_archetype;
+
+/*
+ * A block of entities of one archetype. The entity IDs and the component
+ * arrays follow the header within the same allocation.
+ */
+struct ecs_chunk {
+	struct ecs_archetype *archetype;
+	uint32_t count;
+};
+
+struct ecs_archetype {
+	ecs_mask mask;
+	// Entities per chunk.
+	uint32_t capacity;
+	// Byte offset of each component's array within a chunk, and of the
+	// entity IDs.
+	uint32_t offsets[ECS_MAX_COMPONENTS];
+	uint32_t entity_offset;
+	struct ecs_chunk **chunks;
+	uint32_t chunk_count;
+	uint32_t chunk_capacity;
+};
+
+struct ecs_location {
+	struct ecs_chunk *chunk;
+	uint32_t row;
+};
+
+struct ecs_world {
+	size_t sizes[ECS_MAX_COMPONENTS];
+	uint32_t component_count;
+	struct ecs_archetype *archetypes[ECS_MAX_ARCHETYPES];
+	uint32_t archetype_count;
+	// Indexed by entity, with a NULL chunk for unused IDs.
+	struct ecs_location *locations;
+	uint32_t entity_count;
+	uint32_t entity_capacity;
+	ecs_entity *free_ids;
+	uint32_t free_count;
+};
+
+/*
+ * Runs on one chunk. index is the chunk's position among those the system
+ * matches, which stays put until entities are created, deleted or moved.
+ */
+struct ecs_system {
+	const char *name;
+	ecs_mask reads;
+	ecs_mask writes;
+	void (*run)(struct ecs_chunk *chunk, uint32_t index, void *ctx);
+	void *ctx;
+};
+
+struct ecs_job {
+	const struct ecs_system *system;
+	struct ecs_chunk *chunk;
+	uint32_t index;
+};
+
+void ecs_init(struct ecs_world *world);
+void ecs_destroy(struct ecs_world *world);
+
+// Register a component of size bytes, returning its index.
+uint32_t ecs_register(struct ecs_world *world, size_t size);
+
+// Create an entity with the given components, zero filled.
+ecs_entity ecs_create(struct ecs_world *world, ecs_mask mask);
+void ecs_delete(struct ecs_world *world, ecs_entity entity);
+
+// Move an entity to another set of components, keeping those in both.
+void ecs_set_mask(struct ecs_world *world, ecs_entity entity, ecs_mask mask);
+
+// The entity's component, or NULL if it does not have it.
+void *ecs_get(const struct ecs_world *world, ecs_entity entity,
+	uint32_t component);
+
+static inline void *ecs_column(struct ecs_chunk *chunk, uint32_t component) {
+	return (char *)chunk + chunk->archetype->offsets[component];
+}
+
+static inline ecs_entity *ecs_entities(struct ecs_chunk *chunk) {
+	return (ecs_entity *)((char *)chunk + chunk->archetype->entity_offset);
+}
+
+/*
+ * Store the chunks holding every component in mask, up to max of them, and
+ * return how many there are in total.
+ */
+uint32_t ecs_query(const struct ecs_world *world, ecs_mask mask,
+		struct ecs_chunk **chunks, uint32_t max);
+
+/*
+ * Assign each system a phase, returning the number of phases. A system runs
+ * after every earlier system it conflicts with, where one writes a component
+ * the other uses.
+ */
+uint32_t ecs_schedule(const struct ecs_system *systems, uint32_t count,
+		uint32_t *phases);
+
+/*
+ * Store the jobs of the given phase, up to max of them, and return how many
+ * there are in total.
+ */
+uint32_t ecs_phase_jobs(const struct ecs_world *world,
+			const struct ecs_system *systems, const uint32_t *phases,
+			uint32_t count, uint32_t phase, struct ecs_job *jobs,
+			uint32_t max);
+
+static inline void ecs_job_run(const struct ecs_job *job) {
+	job->system->run(job->chunk, job->index, job->system->ctx);
+}
+
+// Run every system over every chunk it matches on the calling thread.
+void ecs_run(const struct ecs_world *world, const struct ecs_system *systems,
+	uint32_t count);
+
+#endif
@@ -0,0 +1,622 @@
+/*
+ * Frame graph, see graph.h.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "graph.h"
+
+#define GRAPH_WRITE_ACCESS (VK_ACCESS_SHADER_WRITE_BIT | \
+	VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | \
+	VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | \
+	VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | \
+	VK_ACCESS_MEMORY_WRITE_BIT)
+
+static void *graph_grow(void *array, uint32_t count, uint32_t *capacity,
+			size_t size) {
+	if (count < *capacity)
+		return array;
+	*capacity = *capacity ? *capacity * 2 : 16;
+	array = realloc(array, *capacity * size);
+	assert(array);
+	return array;
+}
+
+static uint32_t graph_add_resource(struct graph *graph) {
+	struct graph_resource *r;
+
+	graph->resources = graph_grow(graph->resources, graph->resource_count,
+				&graph->resource_capacity,
+				sizeof(*graph->resources));
+	r = &graph->resources[graph->resource_count];
+	memset(r, 0, sizeof(*r));
+	r->aliased = UINT32_MAX;
+	return graph->resource_count++;
+}
+
+static bool graph_is_image(const struct graph_resource *r) {
+	return r->buffer == VK_NULL_HANDLE;
+}
+
+void graph_init(struct graph *graph, VkDevice device,
+		const VkPhysicalDeviceMemoryProperties *memory_properties,
+		bool sync2) {
+	memset(graph, 0, sizeof(*graph));
+	graph->device = device;
+	graph->memory_properties = memory_properties;
+#ifdef VK_KHR_synchronization2
+	if (sync2)
+		graph->fpCmdPipelineBarrier2KHR = (PFN_vkCmdPipelineBarrier2KHR)
+			vkGetDeviceProcAddr(device, "vkCmdPipelineBarrier2KHR");
+#else
+	(void)sync2;
+#endif
+}
+
+void graph_destroy(struct graph *graph) {
+	for (uint32_t i = 0; i < graph->resource_count; i++) {
+		if (graph->resources[i].transient)
+			vkDestroyImage(graph->device, graph->resources[i].image,
+				NULL);
+	}
+	if (graph->memory)
+		vkFreeMemory(graph->device, graph->memory, NULL);
+	free(graph->resources);
+	free(graph->passes);
+	free(graph->accesses);
+	free(graph->barriers);
+	memset(graph, 0, sizeof(*graph));
+}
+
+uint32_t graph_import_image(struct graph *graph, VkImage image,
+			const VkImageSubresourceRange *range,
+			const struct graph_state *initial, bool persistent) {
+	const uint32_t id = graph_add_resource(graph);
+	struct graph_resource *r = &graph->resources[id];
+
+	r->image = image;
+	r->range = *range;
+	r->initial = *initial;
+	r->persistent = persistent;
+	return id;
+}
+
+uint32_t graph_import_buffer(struct graph *graph, VkBuffer buffer,
+			VkDeviceSize offset, VkDeviceSize size,
+			const struct graph_state *initial, bool persistent) {
+	const uint32_t id = graph_add_resource(graph);
+	struct graph_resource *r = &graph->resources[id];
+
+	r->buffer = buffer;
+	r->offset = offset;
+	r->size = size;
+	r->initial = *initial;
+	r->persistent = persistent;
+	return id;
+}
+
+uint32_t graph_create_image(struct graph *graph, const VkImageCreateInfo *info,
+			VkImageAspectFlags aspect) {
+	const uint32_t id = graph_add_resource(graph);
+	struct graph_resource *r = &graph->resources[id];
+
+	r->transient = true;
+	r->info = *info;
+	r->range.aspectMask = aspect;
+	r->range.levelCount = info->mipLevels;
+	r->range.layerCount = info->arrayLayers;
+	r->initial.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	r->initial.queue_family = VK_QUEUE_FAMILY_IGNORED;
+	return id;
+}
+
+uint32_t graph_add_pass(struct graph *graph, uint32_t queue_family,
+			void (*record)(VkCommandBuffer cmd, void *ctx),
+			void *ctx) {
+	struct graph_pass *pass;
+
+	graph->passes = graph_grow(graph->passes, graph->pass_count,
+				&graph->pass_capacity, sizeof(*graph->passes));
+	pass = &graph->passes[graph->pass_count];
+	memset(pass, 0, sizeof(*pass));
+	pass->queue_family = queue_family;
+	pass->record = record;
+	pass->ctx = ctx;
+	pass->first_access = graph->access_count;
+	return graph->pass_count++;
+}
+
+void graph_use(struct graph *graph, uint32_t pass,
+	const struct graph_access *access) {
+	assert(pass + 1 == graph->pass_count &&
+		access->resource < graph->resource_count);
+	graph->accesses = graph_grow(graph->accesses, graph->access_count,
+				&graph->access_capacity,
+				sizeof(*graph->accesses));
+	graph->accesses[graph->access_count++] = *access;
+	graph->passes[pass].access_count++;
+}
+
+/*
+ * Drop passes which only write transient images no later pass reads. Passes
+ * writing anything else, or only reading, have effects outside the graph.
+ */
+static void graph_cull(struct graph *graph) {
+	bool *needed = calloc(graph->resource_count, sizeof(*needed));
+
+	assert(needed);
+	for (uint32_t p = graph->pass_count; p-- > 0;) {
+		struct graph_pass *pass = &graph->passes[p];
+		const struct graph_access *accesses =
+			&graph->accesses[pass->first_access];
+		bool writes = false, live = false;
+
+		for (uint32_t i = 0; i < pass->access_count; i++) {
+			const uint32_t id = accesses[i].resource;
+
+			if (!(accesses[i].access & GRAPH_WRITE_ACCESS))
+				continue;
+			writes = true;
+			if (!graph->resources[id].transient || needed[id])
+				live = true;
+		}
+		pass->culled = writes && !live;
+		if (pass->culled)
+			continue;
+		for (uint32_t i = 0; i < pass->access_count; i++) {
+			if (!accesses[i].discard)
+				needed[accesses[i].resource] = true;
+		}
+	}
+	free(needed);
+}
+
+static uint32_t graph_memory_type(const struct graph *graph, uint32_t bits) {
+	const VkPhysicalDeviceMemoryProperties *props = graph->memory_properties;
+
+	for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
+		if ((bits & (1u << i)) && (props->memoryTypes[i].propertyFlags &
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+			return i;
+	}
+	for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
+		if (bits & (1u << i))
+			return i;
+	}
+	assert(!"No memory type for the transient images");
+	return 0;
+}
+
+/*
+ * Create the transient images and place them in one allocation. Each goes
+ * into the first slot whose images are all done before it starts, growing it
+ * if need be, so images used by disjoint runs of passes share memory.
+ */
+static void graph_allocate(struct graph *graph) {
+	struct {
+		VkDeviceSize size;
+		VkDeviceSize offset;
+		uint32_t last_pass;
+		uint32_t occupant;
+	} *slots = calloc(graph->resource_count, sizeof(*slots));
+	VkMemoryRequirements *reqs = calloc(graph->resource_count,
+					sizeof(*reqs));
+	uint32_t slot_count = 0, bits = ~0u, i, p;
+	VkDeviceSize alignment = 1, size = 0;
+	VkResult err;
+
+	assert(slots && reqs);
+	for (i = 0; i < graph->resource_count; i++) {
+		struct graph_resource *r = &graph->resources[i];
+
+		r->first_pass = UINT32_MAX;
+		r->last_pass = 0;
+	}
+	for (p = 0; p < graph->pass_count; p++) {
+		const struct graph_pass *pass = &graph->passes[p];
+
+		if (pass->culled)
+			continue;
+		for (i = 0; i < pass->access_count; i++) {
+			struct graph_resource *r = &graph->resources[
+				graph->accesses[pass->first_access + i].resource];
+
+			if (r->first_pass == UINT32_MAX)
+				r->first_pass = p;
+			r->last_pass = p;
+		}
+	}
+
+	// Resources are visited by first use, as passes are in order.
+	for (p = 0; p < graph->pass_count; p++) {
+		for (i = 0; i < graph->resource_count; i++) {
+			struct graph_resource *r = &graph->resources[i];
+			uint32_t s;
+
+			if (!r->transient || r->first_pass != p)
+				continue;
+			err = vkCreateImage(graph->device, &r->info, NULL,
+					&r->image);
+			assert(!err);
+			vkGetImageMemoryRequirements(graph->device, r->image,
+						&reqs[i]);
+			bits &= reqs[i].memoryTypeBits;
+			if (reqs[i].alignment > alignment)
+				alignment = reqs[i].alignment;
+
+			for (s = 0; s < slot_count; s++) {
+				if (slots[s].last_pass < p)
+					break;
+			}
+			if (s == slot_count) {
+				slots[slot_count].occupant = UINT32_MAX;
+				slot_count++;
+			}
+			if (reqs[i].size > slots[s].size)
+				slots[s].size = reqs[i].size;
+			r->aliased = slots[s].occupant;
+			// The slot, until the slots are laid out.
+			r->memory_offset = s;
+			slots[s].occupant = i;
+			slots[s].last_pass = r->last_pass;
+		}
+	}
+
+	for (i = 0; i < slot_count; i++) {
+		slots[i].offset = size;
+		size += (slots[i].size + alignment - 1) / alignment * alignment;
+	}
+	if (size > 0) {
+		const VkMemoryAllocateInfo alloc_info = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.pNext = NULL,
+			.allocationSize = size,
+			.memoryTypeIndex = graph_memory_type(graph, bits),
+		};
+
+		err = vkAllocateMemory(graph->device, &alloc_info, NULL,
+				&graph->memory);
+		assert(!err);
+		graph->memory_size = size;
+	}
+	for (i = 0; i < graph->resource_count; i++) {
+		struct graph_resource *r = &graph->resources[i];
+
+		if (!r->transient || !r->image)
+			continue;
+		r->memory_offset = slots[r->memory_offset].offset;
+		err = vkBindImageMemory(graph->device, r->image, graph->memory,
+					r->memory_offset);
+		assert(!err);
+	}
+	(void)err;
+	free(reqs);
+	free(slots);
+}
+
+static struct graph_barrier *graph_add_barrier(struct graph *graph,
+					uint32_t resource,
+					uint32_t queue_family) {
+	struct graph_barrier *barrier;
+
+	graph->barriers = graph_grow(graph->barriers, graph->barrier_count,
+				&graph->barrier_capacity,
+				sizeof(*graph->barriers));
+	barrier = &graph->barriers[graph->barrier_count++];
+	memset(barrier, 0, sizeof(*barrier));
+	barrier->resource = resource;
+	barrier->queue_family = queue_family;
+	barrier->src_family = VK_QUEUE_FAMILY_IGNORED;
+	barrier->dst_family = VK_QUEUE_FAMILY_IGNORED;
+	return barrier;
+}
+
+// Add the barriers one use needs, then move the resource's state past it.
+static void graph_access(struct graph *graph, uint32_t p,
+			const struct graph_access *a) {
+	struct graph_resource *r = &graph->resources[a->resource];
+	struct graph_state *s = &r->state;
+	const uint32_t family = graph->passes[p].queue_family;
+	const VkAccessFlags writes = a->access & GRAPH_WRITE_ACCESS;
+	const bool discard = a->discard || (r->transient && p == r->first_pass);
+	const bool image = graph_is_image(r);
+	const bool relayout = image && a->layout != VK_IMAGE_LAYOUT_UNDEFINED &&
+		s->layout != a->layout;
+	const VkImageLayout layout = relayout ? a->layout : s->layout;
+	const bool transfer = !discard &&
+		s->queue_family != VK_QUEUE_FAMILY_IGNORED &&
+		s->queue_family != family;
+	bool hazard;
+
+	// Another queue family's uses are ordered by the semaphores between
+	// the submits, and with the contents discarded nothing has to move
+	// between the families either.
+	if (discard && s->queue_family != VK_QUEUE_FAMILY_IGNORED &&
+			s->queue_family != family) {
+		s->write_stages = 0;
+		s->write_access = 0;
+		s->read_stages = 0;
+	}
+
+	// Memory which was someone else's has to wait for them.
+	if (r->transient && p == r->first_pass &&
+			r->aliased != UINT32_MAX) {
+		const struct graph_state *prev =
+			&graph->resources[r->aliased].state;
+
+		s->write_stages = prev->write_stages | prev->read_stages;
+		s->write_access = prev->write_access;
+	}
+
+	if (writes || relayout)
+		hazard = s->write_stages || s->read_stages;
+	else
+		hazard = s->write_stages && a->access &&
+			((a->stages & ~s->visible_stages) ||
+			 (a->access & ~s->visible_access));
+
+	if (transfer) {
+		struct graph_barrier *release = graph_add_barrier(graph,
+						a->resource, s->queue_family);
+		struct graph_barrier *acquire;
+
+		release->src_stages = s->write_stages | s->read_stages;
+		release->src_access = s->write_access;
+		release->old_layout = s->layout;
+		release->new_layout = layout;
+		release->src_family = s->queue_family;
+		release->dst_family = family;
+
+		// Whatever the new queue waited for before this pass, such as
+		// a semaphore, is in the acquire's first scope.
+		acquire = graph_add_barrier(graph, a->resource, family);
+		*acquire = *release;
+		acquire->queue_family = family;
+		acquire->src_stages = a->stages;
+		acquire->src_access = 0;
+		acquire->dst_stages = a->stages;
+		acquire->dst_access = a->access;
+	} else if (relayout || hazard) {
+		struct graph_barrier *barrier = graph_add_barrier(graph,
+						a->resource, family);
+
+		barrier->src_stages = s->write_stages;
+		if (writes || relayout)
+			barrier->src_stages |= s->read_stages;
+		barrier->src_access = s->write_access;
+		barrier->dst_stages = a->stages;
+		barrier->dst_access = a->access;
+		barrier->old_layout = discard && relayout ?
+			VK_IMAGE_LAYOUT_UNDEFINED : s->layout;
+		barrier->new_layout = layout;
+	}
+
+	if (writes || relayout || transfer ||
+			(a->final_layout && a->final_layout != layout)) {
+		// A layout change alone is visible to the stages it was for.
+		const bool visible = !writes && a->final_layout == 0;
+
+		s->write_stages = a->stages;
+		s->write_access = writes;
+		s->read_stages = 0;
+		s->visible_stages = visible ? a->stages : 0;
+		s->visible_access = visible ? a->access : 0;
+	} else {
+		s->read_stages |= a->stages;
+		if (hazard) {
+			s->visible_stages |= a->stages;
+			s->visible_access |= a->access;
+		}
+	}
+	if (image)
+		s->layout = a->final_layout ? a->final_layout : layout;
+	s->queue_family = family;
+}
+
+static void graph_plan(struct graph *graph) {
+	graph->barrier_count = 0;
+	for (uint32_t i = 0; i < graph->resource_count; i++)
+		graph->resources[i].state = graph->resources[i].initial;
+
+	for (uint32_t p = 0; p < graph->pass_count; p++) {
+		struct graph_pass *pass = &graph->passes[p];
+
+		pass->first_barrier = graph->barrier_count;
+		if (!pass->culled) {
+			for (uint32_t i = 0; i < pass->access_count; i++)
+				graph_access(graph, p, &graph->accesses[
+						pass->first_access + i]);
+		}
+		pass->barrier_count = graph->barrier_count -
+			pass->first_barrier;
+	}
+}
+
+void graph_compile(struct graph *graph) {
+	bool transients = false;
+
+	graph_cull(graph);
+	for (uint32_t i = 0; i < graph->resource_count; i++)
+		transients = transients || graph->resources[i].transient;
+	if (transients && !graph->memory)
+		graph_allocate(graph);
+
+	// Once to find where the frame leaves persistent resources, and again
+	// starting from there.
+	graph_plan(graph);
+	for (uint32_t i = 0; i < graph->resource_count; i++) {
+		struct graph_resource *r = &graph->resources[i];
+
+		if (r->persistent)
+			r->initial = r->state;
+	}
+	graph_plan(graph);
+}
+
+/*
+ * A barrier which neither changes the layout nor moves between queues only
+ * orders memory, which a global barrier does at least as cheaply.
+ */
+static bool graph_is_global(const struct graph_barrier *b) {
+	return b->old_layout == b->new_layout && b->src_family == b->dst_family;
+}
+
+static void graph_emit(const struct graph *graph, uint32_t queue_family,
+		const struct graph_barrier *barriers, uint32_t count,
+		VkCommandBuffer cmd) {
+	VkMemoryBarrier *memory;
+	VkBufferMemoryBarrier *buffers;
+	VkImageMemoryBarrier *images;
+	VkPipelineStageFlags src_stages = 0, dst_stages = 0;
+	uint32_t memory_count = 0, buffer_count = 0, image_count = 0, i;
+
+	for (i = 0; i < count; i++) {
+		if (barriers[i].queue_family == queue_family)
+			break;
+	}
+	if (i == count)
+		return;
+
+#ifdef VK_KHR_synchronization2
+	if (graph->fpCmdPipelineBarrier2KHR) {
+		VkMemoryBarrier2KHR *memory2 = calloc(count, sizeof(*memory2));
+		VkBufferMemoryBarrier2KHR *buffers2 =
+			calloc(count, sizeof(*buffers2));
+		VkImageMemoryBarrier2KHR *images2 =
+			calloc(count, sizeof(*images2));
+		VkDependencyInfoKHR dependency = {
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR,
+			.pNext = NULL,
+		};
+
+		assert(memory2 && buffers2 && images2);
+		for (i = 0; i < count; i++) {
+			const struct graph_barrier *b = &barriers[i];
+			const struct graph_resource *r =
+				&graph->resources[b->resource];
+
+			if (b->queue_family != queue_family)
+				continue;
+			if (graph_is_global(b)) {
+				VkMemoryBarrier2KHR *mb = &memory2[memory_count++];
+
+				mb->sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR;
+				mb->srcStageMask = b->src_stages;
+				mb->srcAccessMask = b->src_access;
+				mb->dstStageMask = b->dst_stages;
+				mb->dstAccessMask = b->dst_access;
+			} else if (graph_is_image(r)) {
+				VkImageMemoryBarrier2KHR *ib =
+					&images2[image_count++];
+
+				ib->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+				ib->srcStageMask = b->src_stages;
+				ib->srcAccessMask = b->src_access;
+				ib->dstStageMask = b->dst_stages;
+				ib->dstAccessMask = b->dst_access;
+				ib->oldLayout = b->old_layout;
+				ib->newLayout = b->new_layout;
+				ib->srcQueueFamilyIndex = b->src_family;
+				ib->dstQueueFamilyIndex = b->dst_family;
+				ib->image = r->image;
+				ib->subresourceRange = r->range;
+			} else {
+				VkBufferMemoryBarrier2KHR *bb =
+					&buffers2[buffer_count++];
+
+				bb->sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR;
+				bb->srcStageMask = b->src_stages;
+				bb->srcAccessMask = b->src_access;
+				bb->dstStageMask = b->dst_stages;
+				bb->dstAccessMask = b->dst_access;
+				bb->srcQueueFamilyIndex = b->src_family;
+				bb->dstQueueFamilyIndex = b->dst_family;
+				bb->buffer = r->buffer;
+				bb->offset = r->offset;
+				bb->size = r->size;
+			}
+		}
+		dependency.memoryBarrierCount = memory_count;
+		dependency.pMemoryBarriers = memory2;
+		dependency.bufferMemoryBarrierCount = buffer_count;
+		dependency.pBufferMemoryBarriers = buffers2;
+		dependency.imageMemoryBarrierCount = image_count;
+		dependency.pImageMemoryBarriers = images2;
+		graph->fpCmdPipelineBarrier2KHR(cmd, &dependency);
+		free(memory2);
+		free(buffers2);
+		free(images2);
+		return;
+	}
+#endif
+
+	// One call has one pair of stage masks for all its barriers.
+	memory = calloc(count, sizeof(*memory));
+	buffers = calloc(count, sizeof(*buffers));
+	images = calloc(count, sizeof(*images));
+	assert(memory && buffers && images);
+	for (i = 0; i < count; i++) {
+		const struct graph_barrier *b = &barriers[i];
+		const struct graph_resource *r = &graph->resources[b->resource];
+
+		if (b->queue_family != queue_family)
+			continue;
+		src_stages |= b->src_stages;
+		dst_stages |= b->dst_stages;
+		if (graph_is_global(b)) {
+			VkMemoryBarrier *mb = &memory[memory_count++];
+
+			mb->sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+			mb->srcAccessMask = b->src_access;
+			mb->dstAccessMask = b->dst_access;
+		} else if (graph_is_image(r)) {
+			VkImageMemoryBarrier *ib = &images[image_count++];
+
+			ib->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			ib->srcAccessMask = b->src_access;
+			ib->dstAccessMask = b->dst_access;
+			ib->oldLayout = b->old_layout;
+			ib->newLayout = b->new_layout;
+			ib->srcQueueFamilyIndex = b->src_family;
+			ib->dstQueueFamilyIndex = b->dst_family;
+			ib->image = r->image;
+			ib->subresourceRange = r->range;
+		} else {
+			VkBufferMemoryBarrier *bb = &buffers[buffer_count++];
+
+			bb->sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			bb->srcAccessMask = b->src_access;
+			bb->dstAccessMask = b->dst_access;
+			bb->srcQueueFamilyIndex = b->src_family;
+			bb->dstQueueFamilyIndex = b->dst_family;
+			bb->buffer = r->buffer;
+			bb->offset = r->offset;
+			bb->size = r->size;
+		}
+	}
+	vkCmdPipelineBarrier(cmd, src_stages ? src_stages :
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			dst_stages ? dst_stages :
+			VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, memory_count,
+			memory, buffer_count, buffers, image_count, images);
+	free(memory);
+	free(buffers);
+	free(images);
+}
+
+void graph_record(const struct graph *graph, uint32_t queue_family,
+		VkCommandBuffer cmd) {
+	for (uint32_t p = 0; p < graph->pass_count; p++) {
+		const struct graph_pass *pass = &graph->passes[p];
+
+		if (pass->culled)
+			continue;
+		graph_emit(graph, queue_family,
+			&graph->barriers[pass->first_barrier],
+			pass->barrier_count, cmd);
+		if (pass->queue_family == queue_family && pass->record)
+			pass->record(cmd, pass->ctx);
+	}
+}
@@ -0,0 +1,184 @@
+/*
+ * Frame graph.
+ *
+ * Passes declare every resource they touch, each with the pipeline stages,
+ * accesses and, for images, layout of that use, and the queue family they
+ * run on. Passes run in the order they are added. graph_compile() drops
+ * those whose results nothing uses, and tracks each resource from pass to
+ * pass to work out the barriers in between:
+ *
+ *  - a write waits for every earlier access, a read only for the last write,
+ *    and reads which an earlier barrier already covers need nothing
+ *  - a layout change is folded into the barrier its use needs anyway, and
+ *    barriers with neither a layout change nor a queue transfer are global
+ *  - a resource moving between queue families gets a release on the old
+ *    queue after its last use there and an acquire before its first use on
+ *    the new one, unless its contents are discarded, in which case the
+ *    semaphores between the queues' submits are all it needs
+ *  - transient images whose passes do not overlap share memory
+ *
+ * Every barrier needed before a pass goes out in one call, as a single
+ * vkCmdPipelineBarrier2KHR() with exact stages per barrier where
+ * VK_KHR_synchronization2 is enabled. Dependencies within a pass are the
+ * pass's own business.
+ *
+ * A persistent resource starts each frame in the state the frame leaves it
+ * in, so the graph also covers the previous frame's use of it.
+ */
+
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+struct graph_state {
+	VkImageLayout layout;
+	// VK_QUEUE_FAMILY_IGNORED until some queue owns it.
+	uint32_t queue_family;
+	// The last write, or layout change, and the reads since. Stages the
+	// write was made visible to need no further barrier to read.
+	VkPipelineStageFlags write_stages;
+	VkAccessFlags write_access;
+	VkPipelineStageFlags read_stages;
+	VkPipelineStageFlags visible_stages;
+	VkAccessFlags visible_access;
+};
+
+struct graph_resource {
+	VkImage image;
+	VkImageSubresourceRange range;
+	VkBuffer buffer;
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	bool persistent;
+	struct graph_state initial;
+	struct graph_state state;
+
+	// Transient images only, created by graph_compile().
+	bool transient;
+	VkImageCreateInfo info;
+	VkDeviceSize memory_offset;
+	// Range of passes using it, and the transient in the same memory
+	// before it, or UINT32_MAX.
+	uint32_t first_pass;
+	uint32_t last_pass;
+	uint32_t aliased;
+};
+
+struct graph_access {
+	uint32_t resource;
+	VkPipelineStageFlags stages;
+	VkAccessFlags access;
+	// Layout the pass needs, or UNDEFINED if it takes the image as it is,
+	// and the layout it leaves the image in if it changes it itself, as a
+	// render pass does, or UNDEFINED if not.
+	VkImageLayout layout;
+	VkImageLayout final_layout;
+	// The pass overwrites all of it without reading it.
+	bool discard;
+};
+
+struct graph_pass {
+	uint32_t queue_family;
+	// May be NULL for a pass standing for work outside the graph, such as
+	// presentation.
+	void (*record)(VkCommandBuffer cmd, void *ctx);
+	void *ctx;
+	uint32_t first_access;
+	uint32_t access_count;
+	bool culled;
+	// Barriers recorded before the pass.
+	uint32_t first_barrier;
+	uint32_t barrier_count;
+};
+
+struct graph_barrier {
+	uint32_t resource;
+	// Queue family whose command buffer records it.
+	uint32_t queue_family;
+	VkPipelineStageFlags src_stages;
+	VkPipelineStageFlags dst_stages;
+	VkAccessFlags src_access;
+	VkAccessFlags dst_access;
+	VkImageLayout old_layout;
+	VkImageLayout new_layout;
+	uint32_t src_family;
+	uint32_t dst_family;
+};
+
+struct graph {
+	VkDevice device;
+	const VkPhysicalDeviceMemoryProperties *memory_properties;
+#ifdef VK_KHR_synchronization2
+	PFN_vkCmdPipelineBarrier2KHR fpCmdPipelineBarrier2KHR;
+#endif
+
+	struct graph_resource *resources;
+	uint32_t resource_count;
+	uint32_t resource_capacity;
+	struct graph_pass *passes;
+	uint32_t pass_count;
+	uint32_t pass_capacity;
+	struct graph_access *accesses;
+	uint32_t access_count;
+	uint32_t access_capacity;
+	// In recording order, see graph_pass.
+	struct graph_barrier *barriers;
+	uint32_t barrier_count;
+	uint32_t barrier_capacity;
+
+	// Backs every transient image.
+	VkDeviceMemory memory;
+	VkDeviceSize memory_size;
+};
+
+/*
+ * sync2 says VK_KHR_synchronization2 is enabled on device. Memory for
+ * transient images is picked from memory_properties, which must outlive the
+ * graph.
+ */
+void graph_init(struct graph *graph, VkDevice device,
+		const VkPhysicalDeviceMemoryProperties *memory_properties,
+		bool sync2);
+// Destroys the transient images too.
+void graph_destroy(struct graph *graph);
+
+/*
+ * Add an existing image or buffer range in the given state. For a persistent
+ * resource the state only seeds a first run through the passes, which finds
+ * the state each frame leaves it in.
+ */
+uint32_t graph_import_image(struct graph *graph, VkImage image,
+			const VkImageSubresourceRange *range,
+			const struct graph_state *initial, bool persistent);
+uint32_t graph_import_buffer(struct graph *graph, VkBuffer buffer,
+			VkDeviceSize offset, VkDeviceSize size,
+			const struct graph_state *initial, bool persistent);
+
+// Add an image created and destroyed with the graph, see graph_image().
+uint32_t graph_create_image(struct graph *graph, const VkImageCreateInfo *info,
+			VkImageAspectFlags aspect);
+
+static inline VkImage graph_image(const struct graph *graph,
+				uint32_t resource) {
+	return graph->resources[resource].image;
+}
+
+uint32_t graph_add_pass(struct graph *graph, uint32_t queue_family,
+			void (*record)(VkCommandBuffer cmd, void *ctx),
+			void *ctx);
+// Declare a use of a resource by the pass last added.
+void graph_use(struct graph *graph, uint32_t pass,
+	const struct graph_access *access);
+
+// Work out the barriers, creating the transient images the first time.
+void graph_compile(struct graph *graph);
+
+// Record the passes and barriers belonging to queue_family into cmd.
+void graph_record(const struct graph *graph, uint32_t queue_family,
+		VkCommandBuffer cmd);
+
+#endif
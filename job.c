@@ -0,0 +1,384 @@
+/*
+ * Work stealing job system, see job.h.
+ */
+
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "job.h"
+
+#define JOB_MASK (JOB_DEQUE_SIZE - 1)
+// Rounds of failed steals before an idle worker sleeps.
+#define JOB_SPINS 64
+// Node IDs sysfs may list, Linux's own limit. IDs can be sparse, so this
+// is not the node count.
+#define JOB_MAX_NODES 1024
+
+// The worker the calling thread is, if any.
+static _Thread_local struct job_worker *job_self;
+
+static uint64_t job_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void job_push(struct job_worker *worker, const struct job *job) {
+	const long b = atomic_load_explicit(&worker->bottom,
+					memory_order_relaxed);
+	const long t = atomic_load_explicit(&worker->top, memory_order_acquire);
+
+	assert(b - t < JOB_DEQUE_SIZE);
+	(void)t;
+	worker->jobs[b & JOB_MASK] = *job;
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&worker->bottom, b + 1, memory_order_relaxed);
+}
+
+static bool job_pop(struct job_worker *worker, struct job *job) {
+	const long b = atomic_load_explicit(&worker->bottom,
+					memory_order_relaxed) - 1;
+	long t;
+	bool found = true;
+
+	atomic_store_explicit(&worker->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	t = atomic_load_explicit(&worker->top, memory_order_relaxed);
+	if (t > b) {
+		atomic_store_explicit(&worker->bottom, b + 1,
+				memory_order_relaxed);
+		return false;
+	}
+
+	*job = worker->jobs[b & JOB_MASK];
+	if (t == b) {
+		// The last job, which a thief may be taking at the same time.
+		found = atomic_compare_exchange_strong_explicit(&worker->top,
+					&t, t + 1, memory_order_seq_cst,
+					memory_order_relaxed);
+		atomic_store_explicit(&worker->bottom, b + 1,
+				memory_order_relaxed);
+	}
+	return found;
+}
+
+static bool job_steal(struct job_worker *victim, struct job *job) {
+	long t = atomic_load_explicit(&victim->top, memory_order_acquire);
+	long b;
+
+	atomic_thread_fence(memory_order_seq_cst);
+	b = atomic_load_explicit(&victim->bottom, memory_order_acquire);
+	if (t >= b)
+		return false;
+
+	// If the slot was rewritten meanwhile, top has moved and this fails.
+	*job = victim->jobs[t & JOB_MASK];
+	return atomic_compare_exchange_strong_explicit(&victim->top, &t, t + 1,
+						memory_order_seq_cst,
+						memory_order_relaxed);
+}
+
+// Whether any worker has a job queued.
+static bool job_any(const struct job_system *system) {
+	for (uint32_t i = 0; i < system->worker_count; i++) {
+		const struct job_worker *worker = system->workers[i];
+
+		if (atomic_load(&worker->bottom) > atomic_load(&worker->top))
+			return true;
+	}
+	return false;
+}
+
+static bool job_find(struct job_worker *self, struct job *job) {
+	const uint32_t victim_count = self->system->worker_count - 1;
+
+	if (job_pop(self, job))
+		return true;
+	for (uint32_t i = 0; i < victim_count; i++) {
+		if (job_steal(self->system->workers[self->victims[i]], job)) {
+			self->steal_count++;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void job_wake(struct job_system *system) {
+	// Pairs with the sleeper counting itself before looking for jobs.
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&system->sleeping) == 0)
+		return;
+	pthread_mutex_lock(&system->lock);
+	pthread_cond_signal(&system->wake);
+	pthread_mutex_unlock(&system->lock);
+}
+
+static void job_execute(struct job_worker *self, struct job *job) {
+	const uint64_t start = self->depth == 0 ? job_now() : 0;
+
+	// Leave the upper halves for whoever is idle.
+	while (job->last - job->first > job->grain) {
+		const uint32_t mid = job->first + (job->last - job->first) / 2;
+
+		job_add(self->system, job->fn, job->ctx, mid, job->last,
+			job->grain, job->counter);
+		job->last = mid;
+	}
+
+	self->depth++;
+	job->fn(job->ctx, job->first, job->last, self->index);
+	self->depth--;
+	self->job_count++;
+	if (self->depth == 0)
+		self->busy_ns += job_now() - start;
+	if (job->counter)
+		atomic_fetch_sub_explicit(&job->counter->pending, 1,
+					memory_order_release);
+}
+
+// Try same node victims first with JOB_NUMA, each list starting after self.
+static void job_order_victims(struct job_worker *self) {
+	const struct job_system *system = self->system;
+	const uint32_t count = system->worker_count;
+	const int node = system->nodes[self->index];
+	uint32_t n = 0, pass, i;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 1; i < count; i++) {
+			const uint32_t victim = (self->index + i) % count;
+			const bool local = system->nodes[victim] == node;
+
+			if ((system->flags & JOB_NUMA) ? local == (pass == 0) :
+					pass == 0)
+				self->victims[n++] = victim;
+		}
+	}
+	assert(n == count - 1);
+}
+
+/*
+ * Set up the calling thread as a worker. The worker is allocated and cleared
+ * here, after pinning, so its pages are first touched from its own node.
+ */
+static struct job_worker *job_start_worker(struct job_system *system,
+					uint32_t index) {
+	struct job_worker *worker;
+
+	if ((system->flags & JOB_PIN) && index > 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(system->cpus[index], &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	worker = aligned_alloc(64, sizeof(*worker));
+	assert(worker);
+	memset(worker, 0, sizeof(*worker));
+	worker->system = system;
+	worker->index = index;
+	system->workers[index] = worker;
+	job_self = worker;
+	return worker;
+}
+
+static void *job_thread(void *arg) {
+	struct job_system *system = *(struct job_system **)arg;
+	struct job_worker *self = job_start_worker(system,
+				(struct job_system **)arg - system->args);
+	struct job job;
+	uint32_t idle = 0;
+
+	pthread_barrier_wait(&system->started);
+	job_order_victims(self);
+
+	while (!atomic_load(&system->quit)) {
+		if (job_find(self, &job)) {
+			job_execute(self, &job);
+			idle = 0;
+			continue;
+		}
+		if (++idle < JOB_SPINS) {
+			sched_yield();
+			continue;
+		}
+
+		pthread_mutex_lock(&system->lock);
+		atomic_fetch_add(&system->sleeping, 1);
+		if (!job_any(system) && !atomic_load(&system->quit))
+			pthread_cond_wait(&system->wake, &system->lock);
+		atomic_fetch_sub(&system->sleeping, 1);
+		pthread_mutex_unlock(&system->lock);
+		idle = 0;
+	}
+	return NULL;
+}
+
+// Parse a cpulist such as "0-3,8-11", marking the listed cpus' node. Node
+// lists take the same form.
+static void job_read_cpulist(const char *path, int node, int *cpu_nodes,
+			int max_cpus) {
+	FILE *file = fopen(path, "r");
+	int first, last;
+	char sep;
+
+	if (!file)
+		return;
+	while (fscanf(file, "%d", &first) == 1) {
+		last = first;
+		sep = '\n';
+		if (fscanf(file, "%c", &sep) == 1 && sep == '-') {
+			if (fscanf(file, "%d", &last) != 1)
+				break;
+			if (fscanf(file, "%c", &sep) != 1)
+				sep = '\n';
+		}
+		for (int cpu = first; cpu <= last && cpu < max_cpus; cpu++)
+			cpu_nodes[cpu] = node;
+		if (sep != ',')
+			break;
+	}
+	fclose(file);
+}
+
+/*
+ * Give the workers the cores the process may run on, in order, along with the
+ * node of each from sysfs. Without sysfs everything is on node 0.
+ */
+static void job_assign_cpus(struct job_system *system, uint32_t max_workers) {
+	int cpu_nodes[CPU_SETSIZE], online[JOB_MAX_NODES];
+	char path[64];
+	cpu_set_t set;
+	uint32_t count = 0;
+
+	memset(cpu_nodes, 0, sizeof(cpu_nodes));
+	memset(online, 0, sizeof(online));
+	job_read_cpulist("/sys/devices/system/node/online", 1, online,
+			JOB_MAX_NODES);
+	for (int node = 0; node < JOB_MAX_NODES; node++) {
+		if (!online[node])
+			continue;
+		snprintf(path, sizeof(path),
+			"/sys/devices/system/node/node%d/cpulist", node);
+		job_read_cpulist(path, node, cpu_nodes, CPU_SETSIZE);
+	}
+
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set))
+		CPU_SET(0, &set);
+	for (int cpu = 0; cpu < CPU_SETSIZE && count < max_workers; cpu++) {
+		if (!CPU_ISSET(cpu, &set))
+			continue;
+		system->cpus[count] = cpu;
+		system->nodes[count] = cpu_nodes[cpu];
+		count++;
+	}
+	system->worker_count = count > 0 ? count : 1;
+}
+
+void job_init(struct job_system *system, uint32_t max_workers, uint32_t flags) {
+	struct job_worker *self;
+
+	memset(system, 0, sizeof(*system));
+	system->flags = flags;
+	if (max_workers == 0 || max_workers > JOB_MAX_WORKERS)
+		max_workers = JOB_MAX_WORKERS;
+	job_assign_cpus(system, max_workers);
+
+	pthread_mutex_init(&system->lock, NULL);
+	pthread_cond_init(&system->wake, NULL);
+	pthread_barrier_init(&system->started, NULL, system->worker_count);
+
+	self = job_start_worker(system, 0);
+	for (uint32_t i = 1; i < system->worker_count; i++) {
+		system->args[i] = system;
+		if (pthread_create(&system->threads[i], NULL, job_thread,
+					&system->args[i])) {
+			fprintf(stderr, "Failed to create job worker %u\n", i);
+			exit(1);
+		}
+	}
+	// Victims can only be looked at once they all exist.
+	pthread_barrier_wait(&system->started);
+	job_order_victims(self);
+	system->start_ns = job_now();
+}
+
+void job_destroy(struct job_system *system) {
+	assert(job_self == system->workers[0]);
+	pthread_mutex_lock(&system->lock);
+	atomic_store(&system->quit, true);
+	pthread_cond_broadcast(&system->wake);
+	pthread_mutex_unlock(&system->lock);
+	for (uint32_t i = 1; i < system->worker_count; i++)
+		pthread_join(system->threads[i], NULL);
+	pthread_barrier_destroy(&system->started);
+
+	for (uint32_t i = 0; i < system->worker_count; i++)
+		free(system->workers[i]);
+	pthread_cond_destroy(&system->wake);
+	pthread_mutex_destroy(&system->lock);
+	job_self = NULL;
+	memset(system, 0, sizeof(*system));
+}
+
+uint32_t job_worker(const struct job_system *system) {
+	assert(job_self && job_self->system == system);
+	(void)system;
+	return job_self->index;
+}
+
+void job_add(struct job_system *system, job_fn fn, void *ctx, uint32_t first,
+	uint32_t last, uint32_t grain, struct job_counter *counter) {
+	const struct job job = {
+		.fn = fn,
+		.ctx = ctx,
+		.first = first,
+		.last = last,
+		.grain = grain > 0 ? grain : 1,
+		.counter = counter,
+	};
+
+	assert(job_self && job_self->system == system);
+	if (counter)
+		atomic_fetch_add_explicit(&counter->pending, 1,
+					memory_order_relaxed);
+	job_push(job_self, &job);
+	job_wake(system);
+}
+
+void job_wait(struct job_system *system, struct job_counter *counter) {
+	struct job_worker *self = job_self;
+	struct job job;
+
+	assert(self && self->system == system);
+	(void)system;
+	while (atomic_load_explicit(&counter->pending, memory_order_acquire)) {
+		if (job_find(self, &job))
+			job_execute(self, &job);
+		else
+			sched_yield();
+	}
+}
+
+void job_parallel_for(struct job_system *system, job_fn fn, void *ctx,
+		uint32_t first, uint32_t last, uint32_t grain) {
+	struct job_counter counter = {0};
+
+	if (first >= last)
+		return;
+	job_add(system, fn, ctx, first, last, grain, &counter);
+	job_wait(system, &counter);
+}
+
+double job_utilization(const struct job_system *system, uint32_t worker) {
+	const uint64_t elapsed = job_now() - system->start_ns;
+
+	return elapsed > 0 ?
+		(double)system->workers[worker]->busy_ns / elapsed : 0.0;
+}
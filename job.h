@@ -0,0 +1,131 @@
+/*
+ * Work stealing job system.
+ *
+ * One worker per core: the thread calling job_init() is worker 0 and the
+ * others get a thread each, pinned to their core with JOB_PIN. Worker 0 is
+ * left alone, as the threads it goes on to create would inherit a single core.
+ * Every worker owns a Chase-Lev deque of jobs. It pushes and pops jobs at the
+ * bottom, so it works depth first through what it spawned, while idle workers
+ * steal from the top of the others' deques, taking the oldest and largest
+ * pieces of work. With JOB_NUMA, workers try victims on their own NUMA node
+ * before the rest, and each worker's deque and jobs are first touched by the
+ * worker itself so they live on its node.
+ *
+ * A job covers a range of indices. Ranges bigger than the job's grain are
+ * split in half as the job runs, the upper half going back on the deque for
+ * someone to steal, so a job_parallel_for() over any range starts out as one
+ * job and only spreads as far as there are idle workers.
+ *
+ * Dependencies are expressed with counters. Adding a job bumps its counter
+ * and finishing it drops it again; job_wait() runs jobs, its own first and
+ * then stolen ones, until the counter is zero, so a worker waiting on others
+ * never sits idle and waits may nest inside jobs. Workers with nothing to do
+ * for a while sleep until the next job is added.
+ *
+ * Only the workers of a system may add or wait for its jobs.
+ */
+
+#ifndef JOB_H
+#define JOB_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#define JOB_MAX_WORKERS 64
+// Jobs each worker may have queued or running at once, a power of two.
+#define JOB_DEQUE_SIZE 4096
+
+// Pin workers to cores. Without it they may run anywhere.
+#define JOB_PIN 0x1
+// Prefer stealing from workers on the same NUMA node.
+#define JOB_NUMA 0x2
+
+typedef void (*job_fn)(void *ctx, uint32_t first, uint32_t last,
+		uint32_t worker);
+
+struct job_counter {
+	atomic_uint pending;
+};
+
+struct job {
+	job_fn fn;
+	void *ctx;
+	uint32_t first;
+	uint32_t last;
+	uint32_t grain;
+	struct job_counter *counter;
+};
+
+struct job_worker {
+	// The Chase-Lev deque, indices growing without wrapping. Jobs are held
+	// by value: a slot is only written again once top has moved past it,
+	// and a job is copied out before it is claimed. Thieves move top and
+	// only the owner moves bottom, so each has a cache line of its own.
+	_Alignas(64) atomic_long top;
+	_Alignas(64) atomic_long bottom;
+	struct job jobs[JOB_DEQUE_SIZE];
+
+	struct job_system *system;
+	uint32_t index;
+	// Workers to steal from, in the order tried.
+	uint32_t victims[JOB_MAX_WORKERS - 1];
+	// Nesting of the job running, see job_wait().
+	uint32_t depth;
+
+	// Time spent in jobs, including any waits within them, and how many
+	// jobs, since job_init().
+	uint64_t busy_ns;
+	uint32_t job_count;
+	uint32_t steal_count;
+};
+
+struct job_system {
+	struct job_worker *workers[JOB_MAX_WORKERS];
+	uint32_t worker_count;
+	uint32_t flags;
+	uint64_t start_ns;
+	// Core and NUMA node of each worker. Worker 0 only nominally has one.
+	int cpus[JOB_MAX_WORKERS];
+	int nodes[JOB_MAX_WORKERS];
+	pthread_t threads[JOB_MAX_WORKERS];
+	// Each thread's argument, its index is the worker's.
+	struct job_system *args[JOB_MAX_WORKERS];
+	// Holds job_init() until every worker has set itself up.
+	pthread_barrier_t started;
+
+	// Workers asleep, and what wakes them.
+	atomic_uint sleeping;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	atomic_bool quit;
+};
+
+// Up to max_workers workers, or one per core if 0.
+void job_init(struct job_system *system, uint32_t max_workers, uint32_t flags);
+// Call from worker 0 once no job is pending.
+void job_destroy(struct job_system *system);
+
+// The calling thread's worker index.
+uint32_t job_worker(const struct job_system *system);
+
+/*
+ * Queue fn over [first, last), split into pieces of at most grain indices.
+ * counter may be NULL if nothing waits for it.
+ */
+void job_add(struct job_system *system, job_fn fn, void *ctx, uint32_t first,
+	uint32_t last, uint32_t grain, struct job_counter *counter);
+
+// Run jobs until the counter drops to zero.
+void job_wait(struct job_system *system, struct job_counter *counter);
+
+// Run fn over [first, last) across the workers and wait for it.
+void job_parallel_for(struct job_system *system, job_fn fn, void *ctx,
+		uint32_t first, uint32_t last, uint32_t grain);
+
+// Fraction of the time since job_init() the worker spent running jobs.
+double job_utilization(const struct job_system *system, uint32_t worker);
+
+#endif
@@ -0,0 +1,1820 @@
+/*
+ * Mesh loading and optimisation, see mesh.h.
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mesh.h"
+
+// Upper bound on the threads used to parse one file.
+#define MESH_MAX_THREADS 16
+// Each parsing thread gets at least this much of the file.
+#define MESH_MIN_CHUNK (1 << 20)
+// Size of the FIFO post-transform vertex cache that Tipsify optimises for.
+#define MESH_CACHE_SIZE 16
+// Marks a corner without texture coordinates.
+#define MESH_NO_UV UINT32_MAX
+
+#define MESH_CACHE_MAGIC "MESHBIN"
+#define MESH_CACHE_VERSION 1
+
+#define PLY_MAX_ELEMENTS 8
+#define PLY_MAX_PROPERTIES 32
+
+/*
+ * A triangle corner as it appears in the source file, indexing the position
+ * and texture coordinate arrays separately.
+ */
+struct mesh_corner {
+	uint32_t position;
+	uint32_t uv;
+};
+
+struct corner_list {
+	struct mesh_corner *data;
+	size_t count;
+	size_t capacity;
+};
+
+// The unprocessed contents of a file.
+struct mesh_source {
+	float *positions;
+	uint32_t position_count;
+	float *uvs;
+	uint32_t uv_count;
+	struct mesh_corner *corners;
+	size_t corner_count;
+};
+
+struct mesh_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t vertex_size;
+	// Identify the source file the cache was built from.
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint32_t vertex_count;
+	uint32_t index_count;
+	float min[3];
+	float max[3];
+};
+
+/*
+ * Parallel jobs
+ */
+
+typedef void (*mesh_job_fn)(void *ctx, uint32_t index);
+
+struct mesh_job {
+	mesh_job_fn fn;
+	void *ctx;
+	uint32_t index;
+};
+
+static void *mesh_job_thread(void *arg) {
+	struct mesh_job *job = arg;
+
+	job->fn(job->ctx, job->index);
+	return NULL;
+}
+
+// Run fn for every index below count, each on its own thread.
+static void mesh_parallel(mesh_job_fn fn, void *ctx, uint32_t count) {
+	pthread_t threads[MESH_MAX_THREADS];
+	struct mesh_job jobs[MESH_MAX_THREADS];
+	bool started[MESH_MAX_THREADS] = {false};
+
+	for (uint32_t i = 1; i < count; i++) {
+		jobs[i].fn = fn;
+		jobs[i].ctx = ctx;
+		jobs[i].index = i;
+		started[i] = pthread_create(&threads[i], NULL, mesh_job_thread,
+					&jobs[i]) == 0;
+		if (!started[i])
+			fn(ctx, i);
+	}
+	fn(ctx, 0);
+	for (uint32_t i = 1; i < count; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+	}
+}
+
+static uint32_t mesh_thread_count(size_t work) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t count = work / MESH_MIN_CHUNK + 1;
+
+	if (cpus < 1)
+		cpus = 1;
+	if (count > (size_t)cpus)
+		count = cpus;
+	if (count > MESH_MAX_THREADS)
+		count = MESH_MAX_THREADS;
+	return count;
+}
+
+/*
+ * Text parsing
+ */
+
+static const char *next_line(const char *p, const char *end) {
+	const char *nl = memchr(p, '\n', end - p);
+
+	return nl ? nl + 1 : end;
+}
+
+// The end of the line starting at p, excluding the newline.
+static const char *line_end(const char *p, const char *end) {
+	const char *nl = memchr(p, '\n', end - p);
+
+	return nl ? nl : end;
+}
+
+static const char *skip_space(const char *p, const char *end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		p++;
+	return p;
+}
+
+/*
+ * Cut [begin, end) into chunks of whole lines, one per thread. Writes count + 1
+ * boundaries to starts and returns count.
+ */
+static uint32_t split_lines(const char *begin, const char *end,
+		const char **starts) {
+	const size_t size = end - begin;
+	const uint32_t count = mesh_thread_count(size);
+
+	starts[0] = begin;
+	for (uint32_t i = 1; i < count; i++) {
+		const char *p = begin + size * i / count;
+
+		if (p < starts[i - 1])
+			p = starts[i - 1];
+		starts[i] = next_line(p, end);
+	}
+	starts[count] = end;
+	return count;
+}
+
+static const double pow10_table[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/*
+ * Parse a decimal number. Up to 19 significant digits are accumulated in an
+ * integer, which is then scaled by a single multiply or divide with an exact
+ * power of ten. That is far cheaper than strtod and, once rounded to float,
+ * agrees with it for any number a mesh exporter writes. Returns NULL if there
+ * is no number at p.
+ */
+static const char *parse_float(const char *p, const char *end, float *out) {
+	uint64_t mantissa = 0;
+	int exponent = 0, digits = 0;
+	bool negative = false, any = false;
+	double value;
+
+	p = skip_space(p, end);
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+	for (; p < end && *p >= '0' && *p <= '9'; p++) {
+		any = true;
+		if (digits < 19) {
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa)
+				digits++;
+		} else {
+			exponent++;
+		}
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+			any = true;
+			if (digits < 19) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa)
+					digits++;
+				exponent--;
+			}
+		}
+	}
+	if (!any)
+		return NULL;
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1, *first;
+		bool exponent_negative = false;
+		int e = 0;
+
+		if (q < end && (*q == '-' || *q == '+')) {
+			exponent_negative = *q == '-';
+			q++;
+		}
+		for (first = q; q < end && *q >= '0' && *q <= '9'; q++) {
+			if (e < 10000)
+				e = e * 10 + (*q - '0');
+		}
+		if (q > first) {
+			exponent += exponent_negative ? -e : e;
+			p = q;
+		}
+	}
+
+	value = (double)mantissa;
+	if (exponent < -22)
+		value *= pow(10.0, exponent);
+	else if (exponent < 0)
+		value /= pow10_table[-exponent];
+	else if (exponent > 22)
+		value *= pow(10.0, exponent);
+	else if (exponent > 0)
+		value *= pow10_table[exponent];
+	*out = (float)(negative ? -value : value);
+	return p;
+}
+
+static const char *parse_int(const char *p, const char *end, int64_t *out) {
+	bool negative = false;
+	int64_t value = 0;
+	const char *first;
+
+	p = skip_space(p, end);
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		p++;
+	}
+	for (first = p; p < end && *p >= '0' && *p <= '9'; p++) {
+		if (value < INT64_C(1) << 40)
+			value = value * 10 + (*p - '0');
+	}
+	if (p == first)
+		return NULL;
+	*out = negative ? -value : value;
+	return p;
+}
+
+static bool corner_list_push(struct corner_list *list,
+		const struct mesh_corner *a, const struct mesh_corner *b,
+		const struct mesh_corner *c) {
+	if (list->count + 3 > list->capacity) {
+		size_t capacity = list->capacity ? list->capacity * 2 : 3 * 4096;
+		struct mesh_corner *data;
+
+		data = realloc(list->data, capacity * sizeof(*data));
+		if (!data)
+			return false;
+		list->data = data;
+		list->capacity = capacity;
+	}
+	list->data[list->count++] = *a;
+	list->data[list->count++] = *b;
+	list->data[list->count++] = *c;
+	return true;
+}
+
+// Concatenate the corners found by each thread into src.
+static bool gather_corners(struct mesh_source *src, struct corner_list *lists,
+		uint32_t count) {
+	size_t total = 0;
+
+	for (uint32_t i = 0; i < count; i++)
+		total += lists[i].count;
+	src->corners = malloc((total ? total : 1) * sizeof(*src->corners));
+	if (!src->corners)
+		return false;
+	for (uint32_t i = 0; i < count; i++) {
+		memcpy(src->corners + src->corner_count, lists[i].data,
+			lists[i].count * sizeof(*src->corners));
+		src->corner_count += lists[i].count;
+	}
+	return true;
+}
+
+/*
+ * OBJ
+ *
+ * Negative indices are relative to the vertices seen so far, so each chunk
+ * first counts its v and vt lines. The prefix sums then give every chunk the
+ * absolute index of its first vertex and the place in the shared arrays to
+ * parse it into.
+ */
+
+enum obj_line {
+	OBJ_OTHER,
+	OBJ_POSITION,
+	OBJ_UV,
+	OBJ_FACE,
+};
+
+struct obj_chunk {
+	const char *begin;
+	const char *end;
+	uint32_t position_count;
+	uint32_t uv_count;
+	uint32_t position_base;
+	uint32_t uv_base;
+	struct corner_list corners;
+	const char *error;
+};
+
+struct obj_parse {
+	struct obj_chunk chunks[MESH_MAX_THREADS];
+	float *positions;
+	float *uvs;
+};
+
+// Classify the line at p and point p past its keyword.
+static enum obj_line obj_line_type(const char **p, const char *end) {
+	const char *s = skip_space(*p, end);
+	enum obj_line type = OBJ_OTHER;
+	size_t length = 0;
+
+	if (end - s >= 2 && s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+		type = OBJ_POSITION;
+		length = 1;
+	} else if (end - s >= 3 && s[0] == 'v' && s[1] == 't' &&
+			(s[2] == ' ' || s[2] == '\t')) {
+		type = OBJ_UV;
+		length = 2;
+	} else if (end - s >= 2 && s[0] == 'f' &&
+			(s[1] == ' ' || s[1] == '\t')) {
+		type = OBJ_FACE;
+		length = 1;
+	}
+	*p = s + length;
+	return type;
+}
+
+static void obj_count_job(void *ctx, uint32_t index) {
+	struct obj_chunk *chunk = &((struct obj_parse *)ctx)->chunks[index];
+
+	for (const char *p = chunk->begin; p < chunk->end;
+			p = next_line(p, chunk->end)) {
+		const char *s = p;
+
+		switch (obj_line_type(&s, chunk->end)) {
+		case OBJ_POSITION:
+			chunk->position_count++;
+			break;
+		case OBJ_UV:
+			chunk->uv_count++;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// Turn a one based or negative relative OBJ index into a zero based one.
+static bool obj_index(int64_t index, uint32_t seen, uint32_t *out) {
+	if (index > 0 && index <= UINT32_MAX) {
+		*out = index - 1;
+		return true;
+	}
+	if (index < 0 && -index <= seen) {
+		*out = seen + index;
+		return true;
+	}
+	return false;
+}
+
+static const char *obj_parse_face(struct obj_chunk *chunk, const char *p,
+		const char *end, uint32_t positions_seen, uint32_t uvs_seen) {
+	struct mesh_corner first, previous;
+	uint32_t count = 0;
+
+	for (;;) {
+		struct mesh_corner corner = {0, MESH_NO_UV};
+		int64_t value;
+
+		p = skip_space(p, end);
+		if (p == end || *p == '#')
+			break;
+
+		p = parse_int(p, end, &value);
+		if (!p || !obj_index(value, positions_seen, &corner.position))
+			return "bad position index in face";
+		if (p < end && *p == '/') {
+			p++;
+			if (p < end && *p != '/') {
+				p = parse_int(p, end, &value);
+				if (!p || !obj_index(value, uvs_seen, &corner.uv))
+					return "bad texture coordinate index in face";
+			}
+			if (p < end && *p == '/') {
+				// Normals are not used.
+				p = parse_int(p + 1, end, &value);
+				if (!p)
+					return "bad normal index in face";
+			}
+		}
+		if (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+			return "malformed face";
+
+		// Fan triangulate polygons.
+		if (count == 0)
+			first = corner;
+		else if (count >= 2 &&
+				!corner_list_push(&chunk->corners, &first,
+					&previous, &corner))
+			return "out of memory";
+		previous = corner;
+		count++;
+	}
+	if (count < 3)
+		return "face with fewer than three corners";
+	return NULL;
+}
+
+static void obj_parse_job(void *ctx, uint32_t index) {
+	struct obj_parse *parse = ctx;
+	struct obj_chunk *chunk = &parse->chunks[index];
+	uint32_t positions_seen = chunk->position_base;
+	uint32_t uvs_seen = chunk->uv_base;
+
+	for (const char *p = chunk->begin; p < chunk->end && !chunk->error;
+			p = next_line(p, chunk->end)) {
+		const char *end = line_end(p, chunk->end);
+		const char *s = p;
+		float *position, *uv;
+
+		switch (obj_line_type(&s, end)) {
+		case OBJ_POSITION:
+			position = parse->positions + 3 * (size_t)positions_seen++;
+			for (int i = 0; i < 3 && s; i++)
+				s = parse_float(s, end, &position[i]);
+			if (!s)
+				chunk->error = "malformed vertex position";
+			break;
+		case OBJ_UV:
+			uv = parse->uvs + 2 * (size_t)uvs_seen++;
+			s = parse_float(s, end, &uv[0]);
+			if (!s)
+				chunk->error = "malformed texture coordinate";
+			else if (!parse_float(s, end, &uv[1]))
+				uv[1] = 0.0f;
+			break;
+		case OBJ_FACE:
+			chunk->error = obj_parse_face(chunk, s, end,
+					positions_seen, uvs_seen);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static bool obj_load(struct mesh_source *src, const char *begin,
+		const char *end, const char **error) {
+	struct obj_parse *parse = calloc(1, sizeof(*parse));
+	struct corner_list lists[MESH_MAX_THREADS];
+	const char *starts[MESH_MAX_THREADS + 1];
+	uint64_t positions = 0, uvs = 0;
+	uint32_t count;
+	bool ok = false;
+
+	if (!parse) {
+		*error = "out of memory";
+		return false;
+	}
+
+	count = split_lines(begin, end, starts);
+	for (uint32_t i = 0; i < count; i++) {
+		parse->chunks[i].begin = starts[i];
+		parse->chunks[i].end = starts[i + 1];
+	}
+	mesh_parallel(obj_count_job, parse, count);
+
+	for (uint32_t i = 0; i < count; i++) {
+		parse->chunks[i].position_base = positions;
+		parse->chunks[i].uv_base = uvs;
+		positions += parse->chunks[i].position_count;
+		uvs += parse->chunks[i].uv_count;
+	}
+	if (positions >= UINT32_MAX || uvs >= UINT32_MAX) {
+		*error = "too many vertices";
+		goto out;
+	}
+	src->position_count = positions;
+	src->uv_count = uvs;
+	src->positions = malloc((3 * positions + 1) * sizeof(float));
+	src->uvs = malloc((2 * uvs + 1) * sizeof(float));
+	if (!src->positions || !src->uvs) {
+		*error = "out of memory";
+		goto out;
+	}
+	parse->positions = src->positions;
+	parse->uvs = src->uvs;
+	mesh_parallel(obj_parse_job, parse, count);
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (parse->chunks[i].error) {
+			*error = parse->chunks[i].error;
+			goto out;
+		}
+	}
+	for (uint32_t i = 0; i < count; i++)
+		lists[i] = parse->chunks[i].corners;
+	ok = gather_corners(src, lists, count);
+	if (!ok)
+		*error = "out of memory";
+out:
+	for (uint32_t i = 0; i < count; i++)
+		free(parse->chunks[i].corners.data);
+	free(parse);
+	return ok;
+}
+
+/*
+ * PLY
+ *
+ * Only the vertex and face elements are used; anything else is skipped. ASCII
+ * bodies are split into chunks of whole lines like OBJ files. Binary vertices
+ * have a fixed stride so they are split by index, while binary faces are read
+ * in a single pass since their lists make the records variable length.
+ */
+
+enum ply_type {
+	PLY_NONE,
+	PLY_INT8,
+	PLY_UINT8,
+	PLY_INT16,
+	PLY_UINT16,
+	PLY_INT32,
+	PLY_UINT32,
+	PLY_FLOAT32,
+	PLY_FLOAT64,
+};
+
+static const struct {
+	const char *name;
+	enum ply_type type;
+} ply_type_names[] = {
+	{"char", PLY_INT8}, {"int8", PLY_INT8},
+	{"uchar", PLY_UINT8}, {"uint8", PLY_UINT8},
+	{"short", PLY_INT16}, {"int16", PLY_INT16},
+	{"ushort", PLY_UINT16}, {"uint16", PLY_UINT16},
+	{"int", PLY_INT32}, {"int32", PLY_INT32},
+	{"uint", PLY_UINT32}, {"uint32", PLY_UINT32},
+	{"float", PLY_FLOAT32}, {"float32", PLY_FLOAT32},
+	{"double", PLY_FLOAT64}, {"float64", PLY_FLOAT64},
+};
+
+static const uint32_t ply_type_size[] = {0, 1, 1, 2, 2, 4, 4, 4, 8};
+
+enum ply_role {
+	PLY_IGNORE,
+	PLY_X,
+	PLY_Y,
+	PLY_Z,
+	PLY_U,
+	PLY_V,
+	PLY_INDICES,
+};
+
+static const struct {
+	const char *name;
+	enum ply_role role;
+} ply_role_names[] = {
+	{"x", PLY_X}, {"y", PLY_Y}, {"z", PLY_Z},
+	{"u", PLY_U}, {"s", PLY_U}, {"texture_u", PLY_U},
+	{"texture_s", PLY_U},
+	{"v", PLY_V}, {"t", PLY_V}, {"texture_v", PLY_V},
+	{"texture_t", PLY_V},
+	{"vertex_indices", PLY_INDICES}, {"vertex_index", PLY_INDICES},
+};
+
+struct ply_property {
+	enum ply_type type;
+	// Lists have a count type, scalars PLY_NONE.
+	enum ply_type count_type;
+	enum ply_role role;
+	// Byte offset within a binary vertex.
+	uint32_t offset;
+};
+
+enum ply_kind {
+	PLY_OTHER,
+	PLY_VERTEX,
+	PLY_FACE,
+};
+
+struct ply_element {
+	enum ply_kind kind;
+	uint64_t count;
+	struct ply_property properties[PLY_MAX_PROPERTIES];
+	uint32_t property_count;
+	// Size of a binary record, or zero if it contains a list.
+	uint32_t stride;
+};
+
+struct ply_header {
+	bool binary;
+	struct ply_element elements[PLY_MAX_ELEMENTS];
+	uint32_t element_count;
+	const char *body;
+};
+
+struct ply_chunk {
+	const char *begin;
+	const char *end;
+	uint32_t line_count;
+	uint32_t first_line;
+	struct corner_list corners;
+	const char *error;
+};
+
+struct ply_parse {
+	const struct ply_element *element;
+	struct mesh_source *src;
+	struct ply_chunk chunks[MESH_MAX_THREADS];
+	uint32_t chunk_count;
+};
+
+static bool ply_token(const char **p, const char *end, char *token,
+		size_t size) {
+	const char *s = skip_space(*p, end), *e = s;
+
+	while (e < end && !isspace((unsigned char)*e))
+		e++;
+	if (e == s || (size_t)(e - s) >= size)
+		return false;
+	memcpy(token, s, e - s);
+	token[e - s] = '\0';
+	*p = e;
+	return true;
+}
+
+static enum ply_type ply_parse_type(const char *name) {
+	for (size_t i = 0;
+			i < sizeof(ply_type_names) / sizeof(ply_type_names[0]);
+			i++) {
+		if (!strcmp(name, ply_type_names[i].name))
+			return ply_type_names[i].type;
+	}
+	return PLY_NONE;
+}
+
+static const char *ply_parse_header(struct ply_header *header,
+		const char *begin, const char *end) {
+	struct ply_element *element = NULL;
+	bool format = false;
+	const char *p = next_line(begin, end);
+
+	memset(header, 0, sizeof(*header));
+	for (; p < end; p = next_line(p, end)) {
+		const char *eol = line_end(p, end), *s = p;
+		char keyword[32], a[32], b[32], c[64];
+
+		if (!ply_token(&s, eol, keyword, sizeof(keyword)))
+			continue;
+
+		if (!strcmp(keyword, "end_header")) {
+			header->body = next_line(p, end);
+			break;
+		} else if (!strcmp(keyword, "format")) {
+			if (!ply_token(&s, eol, a, sizeof(a)))
+				return "malformed PLY format";
+			if (!strcmp(a, "binary_little_endian"))
+				header->binary = true;
+			else if (strcmp(a, "ascii"))
+				return "unsupported PLY format";
+			format = true;
+		} else if (!strcmp(keyword, "element")) {
+			int64_t count;
+
+			if (header->element_count == PLY_MAX_ELEMENTS)
+				return "too many PLY elements";
+			element = &header->elements[header->element_count++];
+			if (!ply_token(&s, eol, a, sizeof(a)) ||
+					!parse_int(s, eol, &count) || count < 0)
+				return "malformed PLY element";
+			element->count = count;
+			if (!strcmp(a, "vertex"))
+				element->kind = PLY_VERTEX;
+			else if (!strcmp(a, "face"))
+				element->kind = PLY_FACE;
+		} else if (!strcmp(keyword, "property")) {
+			struct ply_property *property;
+
+			if (!element ||
+					element->property_count == PLY_MAX_PROPERTIES)
+				return "unexpected PLY property";
+			property = &element->properties[element->property_count++];
+			if (!ply_token(&s, eol, a, sizeof(a)))
+				return "malformed PLY property";
+			if (!strcmp(a, "list")) {
+				if (!ply_token(&s, eol, b, sizeof(b)) ||
+						!ply_token(&s, eol, a, sizeof(a)))
+					return "malformed PLY property";
+				property->count_type = ply_parse_type(b);
+				if (property->count_type == PLY_NONE)
+					return "unknown PLY type";
+			}
+			property->type = ply_parse_type(a);
+			if (property->type == PLY_NONE ||
+					!ply_token(&s, eol, c, sizeof(c)))
+				return "malformed PLY property";
+			for (size_t i = 0; i < sizeof(ply_role_names) /
+					sizeof(ply_role_names[0]); i++) {
+				if (!strcmp(c, ply_role_names[i].name))
+					property->role = ply_role_names[i].role;
+			}
+			// Lists only make sense as face indices, scalars as
+			// vertex attributes.
+			if ((property->count_type != PLY_NONE) !=
+					(property->role == PLY_INDICES))
+				property->role = PLY_IGNORE;
+		}
+	}
+	if (!header->body)
+		return "missing PLY end_header";
+	if (!format)
+		return "missing PLY format";
+
+	for (uint32_t i = 0; i < header->element_count; i++) {
+		struct ply_element *e = &header->elements[i];
+		uint32_t offset = 0;
+
+		for (uint32_t j = 0; j < e->property_count; j++) {
+			if (e->properties[j].count_type != PLY_NONE) {
+				offset = 0;
+				break;
+			}
+			e->properties[j].offset = offset;
+			offset += ply_type_size[e->properties[j].type];
+		}
+		e->stride = offset;
+	}
+	return NULL;
+}
+
+static double ply_read(const char *p, enum ply_type type) {
+	int8_t i8;
+	uint8_t u8;
+	int16_t i16;
+	uint16_t u16;
+	int32_t i32;
+	uint32_t u32;
+	float f32;
+	double f64;
+
+	// Binary files are little endian, like every host this runs on.
+	switch (type) {
+	case PLY_INT8:
+		memcpy(&i8, p, 1);
+		return i8;
+	case PLY_UINT8:
+		memcpy(&u8, p, 1);
+		return u8;
+	case PLY_INT16:
+		memcpy(&i16, p, 2);
+		return i16;
+	case PLY_UINT16:
+		memcpy(&u16, p, 2);
+		return u16;
+	case PLY_INT32:
+		memcpy(&i32, p, 4);
+		return i32;
+	case PLY_UINT32:
+		memcpy(&u32, p, 4);
+		return u32;
+	case PLY_FLOAT32:
+		memcpy(&f32, p, 4);
+		return f32;
+	case PLY_FLOAT64:
+		memcpy(&f64, p, 8);
+		return f64;
+	default:
+		return 0.0;
+	}
+}
+
+static bool ply_has_uvs(const struct ply_element *element) {
+	bool u = false, v = false;
+
+	for (uint32_t i = 0; i < element->property_count; i++) {
+		u |= element->properties[i].role == PLY_U;
+		v |= element->properties[i].role == PLY_V;
+	}
+	return u && v;
+}
+
+static void ply_store(struct mesh_source *src, uint32_t vertex,
+		enum ply_role role, float value) {
+	switch (role) {
+	case PLY_X:
+	case PLY_Y:
+	case PLY_Z:
+		src->positions[3 * (size_t)vertex + role - PLY_X] = value;
+		break;
+	case PLY_U:
+	case PLY_V:
+		if (src->uvs)
+			src->uvs[2 * (size_t)vertex + role - PLY_U] = value;
+		break;
+	default:
+		break;
+	}
+}
+
+static bool ply_face_corner(struct mesh_source *src, int64_t index,
+		struct mesh_corner *corner) {
+	if (index < 0 || index >= src->position_count)
+		return false;
+	corner->position = index;
+	corner->uv = src->uvs ? (uint32_t)index : MESH_NO_UV;
+	return true;
+}
+
+static void ply_count_job(void *ctx, uint32_t index) {
+	struct ply_chunk *chunk = &((struct ply_parse *)ctx)->chunks[index];
+
+	for (const char *p = chunk->begin; p < chunk->end;
+			p = next_line(p, chunk->end))
+		chunk->line_count++;
+}
+
+static void ply_ascii_vertex_job(void *ctx, uint32_t index) {
+	struct ply_parse *parse = ctx;
+	struct ply_chunk *chunk = &parse->chunks[index];
+	const struct ply_element *element = parse->element;
+	uint32_t vertex = chunk->first_line;
+
+	for (const char *p = chunk->begin; p < chunk->end;
+			p = next_line(p, chunk->end), vertex++) {
+		const char *end = line_end(p, chunk->end), *s = p;
+
+		for (uint32_t i = 0; i < element->property_count; i++) {
+			float value;
+
+			s = parse_float(s, end, &value);
+			if (!s) {
+				chunk->error = "malformed PLY vertex";
+				return;
+			}
+			ply_store(parse->src, vertex,
+				element->properties[i].role, value);
+		}
+	}
+}
+
+static void ply_ascii_face_job(void *ctx, uint32_t index) {
+	struct ply_parse *parse = ctx;
+	struct ply_chunk *chunk = &parse->chunks[index];
+	const struct ply_element *element = parse->element;
+
+	for (const char *p = chunk->begin; p < chunk->end;
+			p = next_line(p, chunk->end)) {
+		const char *end = line_end(p, chunk->end), *s = p;
+
+		for (uint32_t i = 0; i < element->property_count; i++) {
+			const struct ply_property *property =
+				&element->properties[i];
+			struct mesh_corner first, previous, corner;
+			int64_t count, value;
+			float ignored;
+
+			if (property->count_type == PLY_NONE) {
+				s = parse_float(s, end, &ignored);
+				if (!s)
+					goto malformed;
+				continue;
+			}
+
+			s = parse_int(s, end, &count);
+			if (!s || count < 0)
+				goto malformed;
+			if (property->role == PLY_INDICES && count < 3) {
+				chunk->error = "face with fewer than three corners";
+				return;
+			}
+			for (int64_t j = 0; j < count; j++) {
+				s = parse_int(s, end, &value);
+				if (!s)
+					goto malformed;
+				if (property->role != PLY_INDICES)
+					continue;
+				if (!ply_face_corner(parse->src, value, &corner)) {
+					chunk->error = "bad index in PLY face";
+					return;
+				}
+				if (j == 0)
+					first = corner;
+				else if (j >= 2 && !corner_list_push(&chunk->corners,
+							&first, &previous, &corner)) {
+					chunk->error = "out of memory";
+					return;
+				}
+				previous = corner;
+			}
+		}
+	}
+	return;
+
+malformed:
+	chunk->error = "malformed PLY face";
+}
+
+static void ply_binary_vertex_job(void *ctx, uint32_t index) {
+	struct ply_parse *parse = ctx;
+	const struct ply_element *element = parse->element;
+	const char *body = parse->chunks[0].begin;
+	const uint32_t first = element->count * index / parse->chunk_count;
+	const uint32_t last = element->count * (index + 1) / parse->chunk_count;
+
+	for (uint32_t vertex = first; vertex < last; vertex++) {
+		const char *record = body + (size_t)vertex * element->stride;
+
+		for (uint32_t i = 0; i < element->property_count; i++) {
+			const struct ply_property *property =
+				&element->properties[i];
+
+			if (property->role != PLY_IGNORE)
+				ply_store(parse->src, vertex, property->role,
+					ply_read(record + property->offset,
+						property->type));
+		}
+	}
+}
+
+/*
+ * Walk the binary records of an element, collecting triangles into corners
+ * unless it is NULL. Returns the end of the element or NULL if the file is cut
+ * short.
+ */
+static const char *ply_binary_walk(struct mesh_source *src,
+		const struct ply_element *element, const char *p,
+		const char *end, struct corner_list *corners,
+		const char **error) {
+	for (uint64_t n = 0; n < element->count; n++) {
+		for (uint32_t i = 0; i < element->property_count; i++) {
+			const struct ply_property *property =
+				&element->properties[i];
+			const uint32_t size = ply_type_size[property->type];
+			struct mesh_corner first, previous, corner;
+			double count;
+
+			if (property->count_type == PLY_NONE) {
+				if ((size_t)(end - p) < size)
+					goto truncated;
+				p += size;
+				continue;
+			}
+
+			if ((size_t)(end - p) < ply_type_size[property->count_type])
+				goto truncated;
+			count = ply_read(p, property->count_type);
+			p += ply_type_size[property->count_type];
+			if (count < 0 || (size_t)(end - p) < count * size)
+				goto truncated;
+			if (property->role != PLY_INDICES || !corners) {
+				p += (size_t)count * size;
+				continue;
+			}
+			if (count < 3) {
+				*error = "face with fewer than three corners";
+				return NULL;
+			}
+			for (uint32_t j = 0; j < count; j++, p += size) {
+				if (!ply_face_corner(src, ply_read(p, property->type),
+						&corner)) {
+					*error = "bad index in PLY face";
+					return NULL;
+				}
+				if (j == 0)
+					first = corner;
+				else if (j >= 2 && !corner_list_push(corners,
+							&first, &previous, &corner)) {
+					*error = "out of memory";
+					return NULL;
+				}
+				previous = corner;
+			}
+		}
+	}
+	return p;
+
+truncated:
+	*error = "truncated PLY file";
+	return NULL;
+}
+
+// Split count lines starting at p into chunks and count the lines in each.
+static const char *ply_ascii_split(struct ply_parse *parse, const char *p,
+		const char *end, uint64_t count) {
+	const char *starts[MESH_MAX_THREADS + 1], *block_end = p;
+	uint32_t line = 0;
+
+	for (uint64_t n = 0; n < count && block_end < end; n++)
+		block_end = next_line(block_end, end);
+
+	memset(parse->chunks, 0, sizeof(parse->chunks));
+	parse->chunk_count = split_lines(p, block_end, starts);
+	for (uint32_t i = 0; i < parse->chunk_count; i++) {
+		parse->chunks[i].begin = starts[i];
+		parse->chunks[i].end = starts[i + 1];
+	}
+	mesh_parallel(ply_count_job, parse, parse->chunk_count);
+	for (uint32_t i = 0; i < parse->chunk_count; i++) {
+		parse->chunks[i].first_line = line;
+		line += parse->chunks[i].line_count;
+	}
+	return line == count ? block_end : NULL;
+}
+
+static const char *ply_ascii_chunk_error(const struct ply_parse *parse) {
+	for (uint32_t i = 0; i < parse->chunk_count; i++) {
+		if (parse->chunks[i].error)
+			return parse->chunks[i].error;
+	}
+	return NULL;
+}
+
+static bool ply_load(struct mesh_source *src, const char *begin,
+		const char *end, const char **error) {
+	struct ply_parse *parse = calloc(1, sizeof(*parse));
+	struct ply_header header;
+	struct corner_list corners[MESH_MAX_THREADS] = {{0}};
+	uint32_t corner_lists = 0;
+	bool have_vertices = false, ok = false;
+	const char *p;
+
+	if (!parse) {
+		*error = "out of memory";
+		return false;
+	}
+	parse->src = src;
+
+	*error = ply_parse_header(&header, begin, end);
+	if (*error)
+		goto out;
+
+	p = header.body;
+	for (uint32_t i = 0; i < header.element_count; i++) {
+		const struct ply_element *element = &header.elements[i];
+
+		parse->element = element;
+		if (element->kind == PLY_VERTEX) {
+			if (have_vertices || element->count >= UINT32_MAX) {
+				*error = "unsupported PLY vertex element";
+				goto out;
+			}
+			have_vertices = true;
+			src->position_count = element->count;
+			src->positions = calloc(3 * (size_t)element->count + 1,
+						sizeof(float));
+			if (ply_has_uvs(element)) {
+				src->uv_count = element->count;
+				src->uvs = calloc(2 * (size_t)element->count + 1,
+						sizeof(float));
+			}
+			if (!src->positions || (src->uv_count && !src->uvs)) {
+				*error = "out of memory";
+				goto out;
+			}
+		} else if (element->kind == PLY_FACE &&
+				(!have_vertices || corner_lists)) {
+			*error = "unsupported PLY face element";
+			goto out;
+		}
+
+		if (!header.binary) {
+			const char *next = ply_ascii_split(parse, p, end,
+						element->count);
+
+			if (!next) {
+				*error = "truncated PLY file";
+				goto out;
+			}
+			if (element->kind == PLY_VERTEX)
+				mesh_parallel(ply_ascii_vertex_job, parse,
+					parse->chunk_count);
+			else if (element->kind == PLY_FACE)
+				mesh_parallel(ply_ascii_face_job, parse,
+					parse->chunk_count);
+			*error = ply_ascii_chunk_error(parse);
+			for (uint32_t j = 0; j < parse->chunk_count &&
+					element->kind == PLY_FACE; j++)
+				corners[corner_lists++] = parse->chunks[j].corners;
+			if (*error)
+				goto out;
+			p = next;
+		} else if (element->kind == PLY_VERTEX) {
+			if (!element->stride) {
+				*error = "unsupported PLY vertex element";
+				goto out;
+			}
+			if ((size_t)(end - p) / element->stride < element->count) {
+				*error = "truncated PLY file";
+				goto out;
+			}
+			parse->chunks[0].begin = p;
+			parse->chunk_count = mesh_thread_count(element->count *
+						element->stride);
+			mesh_parallel(ply_binary_vertex_job, parse,
+				parse->chunk_count);
+			p += element->count * element->stride;
+		} else {
+			p = ply_binary_walk(src, element, p, end,
+					element->kind == PLY_FACE ?
+					&corners[corner_lists++] : NULL, error);
+			if (!p)
+				goto out;
+		}
+	}
+	if (!have_vertices) {
+		*error = "PLY file without vertices";
+		goto out;
+	}
+
+	ok = gather_corners(src, corners, corner_lists);
+	if (!ok)
+		*error = "out of memory";
+out:
+	for (uint32_t i = 0; i < corner_lists; i++)
+		free(corners[i].data);
+	free(parse);
+	return ok;
+}
+
+/*
+ * Optimisation
+ */
+
+// Open addressed set of vertex indices, keyed by vertex contents.
+struct vertex_table {
+	uint32_t *slots;
+	uint32_t mask;
+};
+
+static uint32_t vertex_hash(const struct mesh_vertex *v) {
+	uint32_t words[sizeof(*v) / sizeof(uint32_t)];
+	uint64_t h = UINT64_C(0x9e3779b97f4a7c15);
+
+	memcpy(words, v, sizeof(words));
+	for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+		h = (h ^ words[i]) * UINT64_C(0xff51afd7ed558ccd);
+		h ^= h >> 32;
+	}
+	return (uint32_t)h;
+}
+
+static bool vertex_table_init(struct vertex_table *table, size_t expected) {
+	size_t size = 64;
+
+	while (size < 2 * expected)
+		size *= 2;
+	table->slots = malloc(size * sizeof(*table->slots));
+	if (!table->slots)
+		return false;
+	memset(table->slots, 0xff, size * sizeof(*table->slots));
+	table->mask = size - 1;
+	return true;
+}
+
+/*
+ * Merge v into the mesh's vertices. Returns its index, or UINT32_MAX if memory
+ * runs out.
+ */
+static uint32_t vertex_table_insert(struct vertex_table *table,
+		struct mesh *mesh, uint32_t *capacity,
+		const struct mesh_vertex *v) {
+	uint32_t slot;
+
+	for (slot = vertex_hash(v) & table->mask;
+			table->slots[slot] != UINT32_MAX;
+			slot = (slot + 1) & table->mask) {
+		if (!memcmp(&mesh->vertices[table->slots[slot]], v, sizeof(*v)))
+			return table->slots[slot];
+	}
+
+	if (mesh->vertex_count == *capacity) {
+		uint32_t grown = *capacity ? *capacity * 2 : 1024;
+		struct mesh_vertex *vertices;
+
+		vertices = realloc(mesh->vertices, grown * sizeof(*vertices));
+		if (!vertices)
+			return UINT32_MAX;
+		mesh->vertices = vertices;
+		*capacity = grown;
+	}
+	mesh->vertices[mesh->vertex_count] = *v;
+	table->slots[slot] = mesh->vertex_count;
+
+	// Keep the load factor under a half.
+	if (2 * (mesh->vertex_count + 1) > table->mask) {
+		struct vertex_table bigger;
+
+		if (!vertex_table_init(&bigger, (size_t)table->mask + 1))
+			return UINT32_MAX;
+		for (uint32_t i = 0; i <= mesh->vertex_count; i++) {
+			uint32_t s = vertex_hash(&mesh->vertices[i]) & bigger.mask;
+
+			while (bigger.slots[s] != UINT32_MAX)
+				s = (s + 1) & bigger.mask;
+			bigger.slots[s] = i;
+		}
+		free(table->slots);
+		*table = bigger;
+	}
+	return mesh->vertex_count++;
+}
+
+/*
+ * Tipsify, from Sander et al, "Fast Triangle Reordering for Vertex Locality
+ * and Reduced Overdraw". Triangles are emitted as fans around a sequence of
+ * vertices, each chosen from the last fan's vertices by how likely it is
+ * still in the cache. Where that fails the walk jumps to an unrelated part of
+ * the mesh, and those jumps are recorded in clusters as the cut points for
+ * the overdraw pass. Returns the number of clusters.
+ */
+static uint32_t mesh_tipsify(const uint32_t *in, uint32_t *out,
+		uint32_t vertex_count, uint32_t triangle_count,
+		uint32_t *clusters) {
+	const int cache_size = MESH_CACHE_SIZE;
+	const uint32_t index_count = 3 * triangle_count;
+	uint32_t *offsets = calloc(vertex_count + 1, sizeof(uint32_t));
+	uint32_t *adjacency = malloc(index_count * sizeof(uint32_t));
+	uint32_t *live = calloc(vertex_count, sizeof(uint32_t));
+	int *cache_time = calloc(vertex_count, sizeof(int));
+	uint32_t *dead_ends = malloc(index_count * sizeof(uint32_t));
+	uint8_t *emitted = calloc(triangle_count, 1);
+	uint32_t *candidates = NULL;
+	uint32_t max_valence = 0, dead_end_count = 0, cursor = 0;
+	uint32_t cluster_count = 0, written = 0;
+	int time = cache_size + 1;
+	int64_t fan = 0;
+
+	if (!offsets || !adjacency || !live || !cache_time || !dead_ends ||
+			!emitted)
+		goto fallback;
+
+	for (uint32_t i = 0; i < index_count; i++)
+		live[in[i]]++;
+	for (uint32_t v = 0; v < vertex_count; v++) {
+		offsets[v + 1] = offsets[v] + live[v];
+		if (live[v] > max_valence)
+			max_valence = live[v];
+	}
+	for (uint32_t i = 0; i < index_count; i++)
+		adjacency[offsets[in[i]]++] = i / 3;
+	for (uint32_t v = vertex_count; v > 0; v--)
+		offsets[v] = offsets[v - 1];
+	offsets[0] = 0;
+
+	candidates = malloc(3 * (size_t)max_valence * sizeof(uint32_t));
+	if (!candidates)
+		goto fallback;
+
+	clusters[cluster_count++] = 0;
+	while (fan >= 0) {
+		uint32_t candidate_count = 0;
+		int best_priority = -1;
+		int64_t next = -1;
+
+		for (uint32_t a = offsets[fan]; a < offsets[fan + 1]; a++) {
+			const uint32_t t = adjacency[a];
+
+			if (emitted[t])
+				continue;
+			emitted[t] = 1;
+			for (int k = 0; k < 3; k++) {
+				const uint32_t v = in[3 * t + k];
+
+				out[written++] = v;
+				dead_ends[dead_end_count++] = v;
+				candidates[candidate_count++] = v;
+				live[v]--;
+				if (time - cache_time[v] > cache_size)
+					cache_time[v] = time++;
+			}
+		}
+
+		// Prefer the candidate that has been in the cache longest and
+		// will not be evicted by its own remaining triangles.
+		for (uint32_t c = 0; c < candidate_count; c++) {
+			const uint32_t v = candidates[c];
+			int priority = 0;
+
+			if (!live[v])
+				continue;
+			if (time - cache_time[v] + 2 * (int)live[v] <= cache_size)
+				priority = time - cache_time[v];
+			if (priority > best_priority) {
+				best_priority = priority;
+				next = v;
+			}
+		}
+		if (next >= 0) {
+			fan = next;
+			continue;
+		}
+
+		// Dead end: back up to a recently used vertex with triangles
+		// left, or failing that scan for any.
+		while (dead_end_count) {
+			const uint32_t v = dead_ends[--dead_end_count];
+
+			if (live[v]) {
+				next = v;
+				break;
+			}
+		}
+		while (next < 0 && cursor < vertex_count) {
+			if (live[cursor])
+				next = cursor;
+			cursor++;
+		}
+		fan = next;
+		if (fan >= 0 && written / 3 > clusters[cluster_count - 1])
+			clusters[cluster_count++] = written / 3;
+	}
+	goto out;
+
+fallback:
+	memcpy(out, in, index_count * sizeof(uint32_t));
+	clusters[cluster_count++] = 0;
+out:
+	free(candidates);
+	free(emitted);
+	free(dead_ends);
+	free(cache_time);
+	free(live);
+	free(adjacency);
+	free(offsets);
+	return cluster_count;
+}
+
+struct mesh_cluster {
+	float key;
+	uint32_t first;
+	uint32_t count;
+};
+
+static int mesh_cluster_compare(const void *a, const void *b) {
+	const struct mesh_cluster *ca = a, *cb = b;
+
+	if (ca->key != cb->key)
+		return ca->key > cb->key ? -1 : 1;
+	return ca->first < cb->first ? -1 : ca->first > cb->first;
+}
+
+static void triangle_geometry(const struct mesh *mesh, const uint32_t *tri,
+		float centroid[3], float normal[3]) {
+	const float *a = mesh->vertices[tri[0]].position;
+	const float *b = mesh->vertices[tri[1]].position;
+	const float *c = mesh->vertices[tri[2]].position;
+	float e1[3], e2[3];
+
+	for (int i = 0; i < 3; i++) {
+		centroid[i] = (a[i] + b[i] + c[i]) / 3.0f;
+		e1[i] = b[i] - a[i];
+		e2[i] = c[i] - a[i];
+	}
+	// Twice the area times the unit normal.
+	normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+/*
+ * Sort clusters so that those facing away from the middle of the mesh, which
+ * tend to occlude the rest, are drawn first. Each cluster is keyed by how far
+ * its area weighted centroid lies along its average normal, measured from the
+ * mesh centroid.
+ */
+static void mesh_sort_clusters(struct mesh *mesh, const uint32_t *in,
+		const uint32_t *starts, uint32_t cluster_count) {
+	const uint32_t triangle_count = mesh->index_count / 3;
+	struct mesh_cluster *clusters;
+	double mesh_centroid[3] = {0.0}, mesh_area = 0.0;
+	uint32_t written = 0;
+
+	clusters = malloc(cluster_count * sizeof(*clusters));
+	if (!clusters) {
+		memcpy(mesh->indices, in, mesh->index_count * sizeof(uint32_t));
+		return;
+	}
+
+	for (uint32_t t = 0; t < triangle_count; t++) {
+		float centroid[3], normal[3], area;
+
+		triangle_geometry(mesh, &in[3 * t], centroid, normal);
+		area = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] +
+			normal[2] * normal[2]);
+		for (int i = 0; i < 3; i++)
+			mesh_centroid[i] += (double)centroid[i] * area;
+		mesh_area += area;
+	}
+	for (int i = 0; i < 3; i++)
+		mesh_centroid[i] = mesh_area > 0.0 ?
+			mesh_centroid[i] / mesh_area : 0.0;
+
+	for (uint32_t c = 0; c < cluster_count; c++) {
+		const uint32_t first = starts[c];
+		const uint32_t last = c + 1 < cluster_count ? starts[c + 1] :
+			triangle_count;
+		double centroid[3] = {0.0}, normal[3] = {0.0}, area = 0.0;
+		double length;
+
+		for (uint32_t t = first; t < last; t++) {
+			float tc[3], tn[3], ta;
+
+			triangle_geometry(mesh, &in[3 * t], tc, tn);
+			ta = sqrtf(tn[0] * tn[0] + tn[1] * tn[1] + tn[2] * tn[2]);
+			for (int i = 0; i < 3; i++) {
+				centroid[i] += (double)tc[i] * ta;
+				normal[i] += tn[i];
+			}
+			area += ta;
+		}
+		length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] +
+			normal[2] * normal[2]);
+
+		clusters[c].key = 0.0f;
+		if (area > 0.0 && length > 0.0) {
+			for (int i = 0; i < 3; i++)
+				clusters[c].key += (centroid[i] / area -
+					mesh_centroid[i]) * normal[i] / length;
+		}
+		clusters[c].first = first;
+		clusters[c].count = last - first;
+	}
+
+	qsort(clusters, cluster_count, sizeof(*clusters), mesh_cluster_compare);
+	for (uint32_t c = 0; c < cluster_count; c++) {
+		memcpy(&mesh->indices[written], &in[3 * clusters[c].first],
+			3 * clusters[c].count * sizeof(uint32_t));
+		written += 3 * clusters[c].count;
+	}
+	free(clusters);
+}
+
+/*
+ * Reorder the triangles of a mesh with freshly merged vertices, then lay the
+ * vertices out in the order the triangles first use them and compute bounds.
+ */
+static bool mesh_optimize(struct mesh *mesh) {
+	const uint32_t triangle_count = mesh->index_count / 3;
+	uint32_t *ordered = malloc((mesh->index_count + 1) * sizeof(uint32_t));
+	uint32_t *clusters = malloc((triangle_count + 1) * sizeof(uint32_t));
+	uint32_t *remap = malloc((mesh->vertex_count + 1) * sizeof(uint32_t));
+	struct mesh_vertex *vertices = malloc((mesh->vertex_count + 1) *
+					sizeof(*vertices));
+	uint32_t cluster_count, next = 0;
+
+	if (!ordered || !clusters || !remap || !vertices) {
+		free(vertices);
+		free(remap);
+		free(clusters);
+		free(ordered);
+		return false;
+	}
+
+	cluster_count = mesh_tipsify(mesh->indices, ordered, mesh->vertex_count,
+			triangle_count, clusters);
+	mesh_sort_clusters(mesh, ordered, clusters, cluster_count);
+
+	memset(remap, 0xff, mesh->vertex_count * sizeof(uint32_t));
+	for (uint32_t i = 0; i < mesh->index_count; i++) {
+		uint32_t v = mesh->indices[i];
+
+		if (remap[v] == UINT32_MAX) {
+			remap[v] = next;
+			vertices[next++] = mesh->vertices[v];
+		}
+		mesh->indices[i] = remap[v];
+	}
+	free(mesh->vertices);
+	mesh->vertices = vertices;
+	mesh->vertex_count = next;
+
+	for (int i = 0; i < 3; i++) {
+		mesh->min[i] = next ? FLT_MAX : 0.0f;
+		mesh->max[i] = next ? -FLT_MAX : 0.0f;
+	}
+	for (uint32_t v = 0; v < next; v++) {
+		for (int i = 0; i < 3; i++) {
+			if (vertices[v].position[i] < mesh->min[i])
+				mesh->min[i] = vertices[v].position[i];
+			if (vertices[v].position[i] > mesh->max[i])
+				mesh->max[i] = vertices[v].position[i];
+		}
+	}
+
+	free(remap);
+	free(clusters);
+	free(ordered);
+	return true;
+}
+
+/*
+ * Merge the corners of a parsed file into indexed vertices, dropping
+ * triangles that collapse to a line, then optimise.
+ */
+static bool mesh_from_source(struct mesh *mesh, const struct mesh_source *src,
+		const char **error) {
+	struct vertex_table table;
+	uint32_t capacity = 0;
+	size_t expected = src->position_count > src->uv_count ?
+		src->position_count : src->uv_count;
+
+	if (src->corner_count >= UINT32_MAX) {
+		*error = "too many triangles";
+		return false;
+	}
+	if (!vertex_table_init(&table, expected) ||
+			!(mesh->indices = malloc((src->corner_count + 1) *
+						sizeof(uint32_t))))
+		goto oom;
+
+	for (size_t i = 0; i < src->corner_count; i += 3) {
+		uint32_t tri[3];
+
+		for (int k = 0; k < 3; k++) {
+			const struct mesh_corner *corner = &src->corners[i + k];
+			struct mesh_vertex v = {{0.0f}, {0.0f}};
+
+			if (corner->position >= src->position_count ||
+					(corner->uv != MESH_NO_UV &&
+					 corner->uv >= src->uv_count)) {
+				free(table.slots);
+				*error = "index out of range";
+				return false;
+			}
+			memcpy(v.position, &src->positions[3 *
+				(size_t)corner->position], sizeof(v.position));
+			// Both formats put the texture origin at the bottom.
+			if (corner->uv != MESH_NO_UV) {
+				v.uv[0] = src->uvs[2 * (size_t)corner->uv];
+				v.uv[1] = 1.0f - src->uvs[2 *
+					(size_t)corner->uv + 1];
+			}
+			tri[k] = vertex_table_insert(&table, mesh, &capacity, &v);
+			if (tri[k] == UINT32_MAX)
+				goto oom;
+		}
+		if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0])
+			continue;
+		memcpy(&mesh->indices[mesh->index_count], tri, sizeof(tri));
+		mesh->index_count += 3;
+	}
+	free(table.slots);
+	table.slots = NULL;
+
+	if (mesh->index_count == 0) {
+		*error = "mesh has no triangles";
+		return false;
+	}
+	if (mesh_optimize(mesh))
+		return true;
+
+oom:
+	free(table.slots);
+	*error = "out of memory";
+	return false;
+}
+
+/*
+ * Cache
+ */
+
+static bool read_full(int fd, void *data, size_t size) {
+	char *p = data;
+
+	while (size) {
+		ssize_t n = read(fd, p, size);
+
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool write_full(int fd, const void *data, size_t size) {
+	const char *p = data;
+
+	while (size) {
+		ssize_t n = write(fd, p, size);
+
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static int64_t stat_mtime(const struct stat *st) {
+	return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static bool cache_read(struct mesh *mesh, const char *path,
+		const struct stat *source) {
+	struct mesh_cache_header header;
+	struct stat st;
+	bool ok = false;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) || !read_full(fd, &header, sizeof(header)))
+		goto out;
+	if (memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) ||
+			header.version != MESH_CACHE_VERSION ||
+			header.vertex_size != sizeof(struct mesh_vertex) ||
+			header.source_size != (uint64_t)source->st_size ||
+			header.source_mtime != stat_mtime(source) ||
+			(uint64_t)st.st_size != sizeof(header) +
+			(uint64_t)header.vertex_count * sizeof(struct mesh_vertex) +
+			(uint64_t)header.index_count * sizeof(uint32_t))
+		goto out;
+
+	mesh->vertex_count = header.vertex_count;
+	mesh->index_count = header.index_count;
+	memcpy(mesh->min, header.min, sizeof(mesh->min));
+	memcpy(mesh->max, header.max, sizeof(mesh->max));
+	mesh->vertices = malloc((mesh->vertex_count + 1) *
+				sizeof(*mesh->vertices));
+	mesh->indices = malloc((mesh->index_count + 1) * sizeof(uint32_t));
+	if (!mesh->vertices || !mesh->indices ||
+			!read_full(fd, mesh->vertices,
+				mesh->vertex_count * sizeof(*mesh->vertices)) ||
+			!read_full(fd, mesh->indices,
+				mesh->index_count * sizeof(uint32_t)))
+		goto out;
+
+	ok = mesh->index_count > 0;
+	for (uint32_t i = 0; i < mesh->index_count && ok; i++)
+		ok = mesh->indices[i] < mesh->vertex_count;
+out:
+	if (!ok)
+		mesh_destroy(mesh);
+	close(fd);
+	return ok;
+}
+
+/*
+ * Write the cache under a temporary name and rename it into place, so that a
+ * concurrent or interrupted run never sees a partial file. Failure only costs
+ * the next load its speed, so it is ignored.
+ */
+static void cache_write(const struct mesh *mesh, const char *path,
+		const struct stat *source) {
+	struct mesh_cache_header header;
+	size_t length = strlen(path) + 32;
+	char *tmp = malloc(length);
+	int fd;
+	bool ok;
+
+	if (!tmp)
+		return;
+	snprintf(tmp, length, "%s.%ld", path, (long)getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		free(tmp);
+		return;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+	header.version = MESH_CACHE_VERSION;
+	header.vertex_size = sizeof(struct mesh_vertex);
+	header.source_size = source->st_size;
+	header.source_mtime = stat_mtime(source);
+	header.vertex_count = mesh->vertex_count;
+	header.index_count = mesh->index_count;
+	memcpy(header.min, mesh->min, sizeof(header.min));
+	memcpy(header.max, mesh->max, sizeof(header.max));
+
+	ok = write_full(fd, &header, sizeof(header)) &&
+		write_full(fd, mesh->vertices,
+			mesh->vertex_count * sizeof(*mesh->vertices)) &&
+		write_full(fd, mesh->indices,
+			mesh->index_count * sizeof(uint32_t));
+	ok = !close(fd) && ok;
+	if (!ok || rename(tmp, path))
+		unlink(tmp);
+	free(tmp);
+}
+
+/*
+ * Public API
+ */
+
+bool mesh_load(struct mesh *mesh, const char *path, const char **error) {
+	struct mesh_source src;
+	struct stat st;
+	char *cache_path;
+	void *data;
+	bool ok;
+	int fd;
+
+	memset(mesh, 0, sizeof(*mesh));
+	memset(&src, 0, sizeof(src));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		*error = "cannot open mesh file";
+		return false;
+	}
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		*error = "cannot read mesh file";
+		return false;
+	}
+
+	cache_path = malloc(strlen(path) + sizeof(".cache"));
+	if (!cache_path) {
+		close(fd);
+		*error = "out of memory";
+		return false;
+	}
+	strcpy(cache_path, path);
+	strcat(cache_path, ".cache");
+	if (cache_read(mesh, cache_path, &st)) {
+		free(cache_path);
+		close(fd);
+		return true;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		free(cache_path);
+		*error = "cannot map mesh file";
+		return false;
+	}
+	madvise(data, st.st_size, MADV_WILLNEED);
+
+	if (st.st_size >= 4 && !memcmp(data, "ply", 3) &&
+			(((char *)data)[3] == '\n' || ((char *)data)[3] == '\r'))
+		ok = ply_load(&src, data, (char *)data + st.st_size, error);
+	else
+		ok = obj_load(&src, data, (char *)data + st.st_size, error);
+	munmap(data, st.st_size);
+
+	if (ok)
+		ok = mesh_from_source(mesh, &src, error);
+	free(src.corners);
+	free(src.uvs);
+	free(src.positions);
+
+	if (ok)
+		cache_write(mesh, cache_path, &st);
+	else
+		mesh_destroy(mesh);
+	free(cache_path);
+	return ok;
+}
+
+void mesh_build(struct mesh *mesh, const struct mesh_vertex *corners,
+		uint32_t count) {
+	struct vertex_table table;
+	uint32_t capacity = 0;
+
+	memset(mesh, 0, sizeof(*mesh));
+	mesh->indices = malloc((count + 1) * sizeof(uint32_t));
+	if (!mesh->indices || !vertex_table_init(&table, count))
+		abort();
+
+	for (uint32_t i = 0; i + 3 <= count; i += 3) {
+		uint32_t tri[3];
+
+		for (int k = 0; k < 3; k++) {
+			tri[k] = vertex_table_insert(&table, mesh, &capacity,
+						&corners[i + k]);
+			if (tri[k] == UINT32_MAX)
+				abort();
+		}
+		if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0])
+			continue;
+		memcpy(&mesh->indices[mesh->index_count], tri, sizeof(tri));
+		mesh->index_count += 3;
+	}
+	free(table.slots);
+
+	if (!mesh_optimize(mesh))
+		abort();
+}
+
+void mesh_destroy(struct mesh *mesh) {
+	free(mesh->vertices);
+	free(mesh->indices);
+	memset(mesh, 0, sizeof(*mesh));
+}
@@ -0,0 +1,49 @@
+/*
+ * Indexed triangle meshes, loaded from OBJ or PLY files.
+ *
+ * Source files are mmapped and parsed in parallel chunks. Identical vertices
+ * are merged, triangles are reordered for the post-transform vertex cache and
+ * then for overdraw, and vertices are stored in the order they are first used.
+ * The processed mesh is cached next to the source file, so loading it again
+ * is a single read.
+ */
+
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct mesh_vertex {
+	float position[3];
+	float uv[2];
+};
+
+struct mesh {
+	struct mesh_vertex *vertices;
+	uint32_t vertex_count;
+	// Triangle list.
+	uint32_t *indices;
+	uint32_t index_count;
+	// Bounds of the vertex positions.
+	float min[3];
+	float max[3];
+};
+
+/*
+ * Load an .obj or .ply file, going through the cache at path + ".cache" and
+ * refreshing it if the source has changed. On failure returns false and points
+ * error at a description of the problem.
+ */
+bool mesh_load(struct mesh *mesh, const char *path, const char **error);
+
+/*
+ * Build a mesh from count unindexed triangle corners, count being a multiple
+ * of three.
+ */
+void mesh_build(struct mesh *mesh, const struct mesh_vertex *corners,
+		uint32_t count);
+
+void mesh_destroy(struct mesh *mesh);
+
+#endif
@@ -0,0 +1,457 @@
+/*
+ * Binary scene files, see scene.h.
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "scene.h"
+
+// Size of one element of each section, zero for STRINGS.
+static const size_t scene_element_size[SCENE_SECTION_COUNT] = {
+	[SCENE_TRANSFORMS] = 16 * sizeof(float),
+	[SCENE_BOUNDS] = sizeof(struct bvh_aabb),
+	[SCENE_MESH_IDS] = sizeof(uint32_t),
+	[SCENE_MATERIAL_IDS] = sizeof(uint32_t),
+	[SCENE_MESHES] = sizeof(uint32_t),
+	[SCENE_MATERIALS] = sizeof(uint32_t),
+	[SCENE_TEXTURES] = sizeof(uint32_t),
+	[SCENE_STRINGS] = 0,
+};
+
+static uint32_t scene_section_count(const struct scene_header *header,
+				enum scene_section section) {
+	switch (section) {
+	case SCENE_TRANSFORMS:
+	case SCENE_BOUNDS:
+	case SCENE_MESH_IDS:
+	case SCENE_MATERIAL_IDS:
+		return header->instance_count;
+	case SCENE_MESHES:
+		return header->mesh_count;
+	case SCENE_MATERIALS:
+		return header->material_count;
+	case SCENE_TEXTURES:
+		return header->texture_count;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Check every index in ids is below count. An empty table still accepts index
+ * zero, which stands for the demo's default mesh, material or texture.
+ */
+static bool scene_check_ids(const uint32_t *ids, uint32_t id_count,
+			uint32_t count) {
+	uint32_t limit = count ? count : 1, bad = 0;
+
+	// Accumulate rather than branch so the loop vectorises.
+	for (uint32_t i = 0; i < id_count; i++)
+		bad |= ids[i] >= limit;
+	return !bad;
+}
+
+static bool scene_check_paths(const uint32_t *paths, uint32_t count,
+			uint64_t strings_size) {
+	for (uint32_t i = 0; i < count; i++) {
+		if (paths[i] >= strings_size)
+			return false;
+	}
+	return true;
+}
+
+static const char *scene_validate(const struct scene_header *header,
+				const char *base, uint64_t file_size) {
+	const uint64_t strings_size = header->sections[SCENE_STRINGS].size;
+
+	if (memcmp(header->magic, SCENE_MAGIC, sizeof(header->magic)))
+		return "not a scene file";
+	if (header->version != SCENE_VERSION ||
+			header->header_size != sizeof(*header))
+		return "unsupported scene file version";
+	if (header->file_size != file_size)
+		return "truncated scene file";
+
+	for (int i = 0; i < SCENE_SECTION_COUNT; i++) {
+		const uint64_t offset = header->sections[i].offset;
+		const uint64_t size = header->sections[i].size;
+
+		if (offset % SCENE_ALIGN || offset < sizeof(*header) ||
+				offset > file_size || size > file_size - offset)
+			return "scene section out of bounds";
+		if (scene_element_size[i] &&
+				size != (uint64_t)scene_section_count(header, i) *
+				scene_element_size[i])
+			return "scene section has the wrong size";
+	}
+	if (strings_size && base[header->sections[SCENE_STRINGS].offset +
+				strings_size - 1])
+		return "unterminated scene string";
+	return NULL;
+}
+
+bool scene_open(struct scene *scene, const char *path, const char **error) {
+	const struct scene_header *header;
+	struct stat st;
+	char *base;
+	int fd;
+
+	memset(scene, 0, sizeof(*scene));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		*error = "cannot open scene file";
+		return false;
+	}
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*header)) {
+		close(fd);
+		*error = "cannot read scene file";
+		return false;
+	}
+
+	// Private and writable: pages are only copied if something, like a BVH
+	// refit, writes to them.
+	base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+		0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		*error = "cannot map scene file";
+		return false;
+	}
+	madvise(base, st.st_size, MADV_WILLNEED);
+	scene->map = base;
+	scene->map_size = st.st_size;
+
+	header = (const struct scene_header *)base;
+	*error = scene_validate(header, base, st.st_size);
+	if (*error)
+		goto fail;
+
+	scene->instance_count = header->instance_count;
+	scene->mesh_count = header->mesh_count;
+	scene->material_count = header->material_count;
+	scene->texture_count = header->texture_count;
+	scene->transforms = (const float (*)[16])(base +
+			header->sections[SCENE_TRANSFORMS].offset);
+	scene->bounds = (struct bvh_aabb *)(base +
+			header->sections[SCENE_BOUNDS].offset);
+	scene->mesh_ids = (const uint32_t *)(base +
+			header->sections[SCENE_MESH_IDS].offset);
+	scene->material_ids = (const uint32_t *)(base +
+			header->sections[SCENE_MATERIAL_IDS].offset);
+	scene->mesh_paths = (const uint32_t *)(base +
+			header->sections[SCENE_MESHES].offset);
+	scene->material_textures = (const uint32_t *)(base +
+			header->sections[SCENE_MATERIALS].offset);
+	scene->texture_paths = (const uint32_t *)(base +
+			header->sections[SCENE_TEXTURES].offset);
+	scene->strings = base + header->sections[SCENE_STRINGS].offset;
+
+	if (!scene_check_ids(scene->mesh_ids, scene->instance_count,
+				scene->mesh_count) ||
+			!scene_check_ids(scene->material_ids,
+				scene->instance_count, scene->material_count) ||
+			!scene_check_ids(scene->material_textures,
+				scene->material_count, scene->texture_count)) {
+		*error = "scene index out of range";
+		goto fail;
+	}
+	if (!scene_check_paths(scene->mesh_paths, scene->mesh_count,
+				header->sections[SCENE_STRINGS].size) ||
+			!scene_check_paths(scene->texture_paths,
+				scene->texture_count,
+				header->sections[SCENE_STRINGS].size)) {
+		*error = "scene path out of range";
+		goto fail;
+	}
+	return true;
+
+fail:
+	scene_close(scene);
+	return false;
+}
+
+void scene_close(struct scene *scene) {
+	if (scene->map)
+		munmap(scene->map, scene->map_size);
+	memset(scene, 0, sizeof(*scene));
+}
+
+/*
+ * Conversion
+ */
+
+struct scene_array {
+	void *data;
+	size_t count;
+	size_t capacity;
+	size_t element_size;
+};
+
+static void *scene_array_push(struct scene_array *array) {
+	if (array->count == array->capacity) {
+		size_t capacity = array->capacity ? array->capacity * 2 : 256;
+		void *data = realloc(array->data, capacity * array->element_size);
+
+		if (!data)
+			return NULL;
+		array->data = data;
+		array->capacity = capacity;
+	}
+	return (char *)array->data + array->count++ * array->element_size;
+}
+
+struct scene_builder {
+	struct scene_array transforms;
+	struct scene_array bounds;
+	struct scene_array mesh_ids;
+	struct scene_array material_ids;
+	struct scene_array meshes;
+	struct scene_array materials;
+	struct scene_array textures;
+	struct scene_array strings;
+};
+
+// Append a path to the string table, returning its offset.
+static bool scene_add_string(struct scene_builder *builder, const char *s,
+			uint32_t *offset) {
+	size_t length = strlen(s) + 1;
+
+	*offset = builder->strings.count;
+	for (size_t i = 0; i < length; i++) {
+		char *c = scene_array_push(&builder->strings);
+
+		if (!c)
+			return false;
+		*c = s[i];
+	}
+	return true;
+}
+
+static bool scene_add_instance(struct scene_builder *builder, uint32_t mesh,
+			uint32_t material, const float position[3],
+			float scale, float yaw) {
+	float *m = scene_array_push(&builder->transforms);
+	struct bvh_aabb *bounds = scene_array_push(&builder->bounds);
+	uint32_t *mesh_id = scene_array_push(&builder->mesh_ids);
+	uint32_t *material_id = scene_array_push(&builder->material_ids);
+	const float c = cosf(yaw) * scale, s = sinf(yaw) * scale;
+
+	if (!m || !bounds || !mesh_id || !material_id)
+		return false;
+
+	// Translate * rotate about Y * scale, column by column.
+	memset(m, 0, 16 * sizeof(float));
+	m[0] = c;
+	m[2] = -s;
+	m[5] = scale;
+	m[8] = s;
+	m[10] = c;
+	memcpy(&m[12], position, 3 * sizeof(float));
+	m[15] = 1.0f;
+
+	// Bounds of the transformed [-1, 1] box.
+	for (int i = 0; i < 3; i++) {
+		float extent = fabsf(m[i]) + fabsf(m[4 + i]) + fabsf(m[8 + i]);
+
+		bounds->min[i] = position[i] - extent;
+		bounds->max[i] = position[i] + extent;
+	}
+
+	*mesh_id = mesh;
+	*material_id = material;
+	return true;
+}
+
+// Whether nothing but white space follows the first end characters.
+static bool scene_line_done(const char *line, int end) {
+	for (line += end; *line; line++) {
+		if (!isspace((unsigned char)*line))
+			return false;
+	}
+	return true;
+}
+
+static const char *scene_parse_line(struct scene_builder *builder,
+				char *line) {
+	char keyword[16], path[4096];
+	unsigned mesh, material, texture;
+	float position[3], scale = 1.0f, yaw = 0.0f;
+	uint32_t *entry;
+	int n, end = 0;
+
+	if (sscanf(line, "%15s", keyword) != 1 || keyword[0] == '#')
+		return NULL;
+
+	if (!strcmp(keyword, "mesh") || !strcmp(keyword, "texture")) {
+		struct scene_array *table = keyword[0] == 'm' ?
+			&builder->meshes : &builder->textures;
+
+		if (sscanf(line, "%*s %4095s%n", path, &end) != 1)
+			return "scene line needs a path";
+		if (!scene_line_done(line, end))
+			return "scene line has more than a path";
+		entry = scene_array_push(table);
+		if (!entry || !scene_add_string(builder, path, entry))
+			return "out of memory";
+	} else if (!strcmp(keyword, "material")) {
+		if (sscanf(line, "%*s %u%n", &texture, &end) != 1)
+			return "material needs a texture index";
+		if (!scene_line_done(line, end))
+			return "material has more than a texture index";
+		if (texture >= builder->textures.count)
+			return "material refers to an undeclared texture";
+		entry = scene_array_push(&builder->materials);
+		if (!entry)
+			return "out of memory";
+		*entry = texture;
+	} else if (!strcmp(keyword, "instance")) {
+		n = sscanf(line, "%*s %u %u %f %f %f %f %f", &mesh, &material,
+			&position[0], &position[1], &position[2], &scale,
+			&yaw);
+		if (n < 5)
+			return "instance needs a mesh, material and position";
+		// Again, to find where the values given end.
+		if (n == 5)
+			sscanf(line, "%*s %*u %*u %*f %*f %*f%n", &end);
+		else if (n == 6)
+			sscanf(line, "%*s %*u %*u %*f %*f %*f %*f%n", &end);
+		else
+			sscanf(line, "%*s %*u %*u %*f %*f %*f %*f %*f%n", &end);
+		if (!scene_line_done(line, end))
+			return "instance has more than a mesh, material, "
+				"position, scale and yaw";
+		if (mesh >= (builder->meshes.count ? builder->meshes.count : 1))
+			return "instance refers to an undeclared mesh";
+		if (material >= (builder->materials.count ?
+					builder->materials.count : 1))
+			return "instance refers to an undeclared material";
+		if (!scene_add_instance(builder, mesh, material, position,
+					scale, yaw * (float)M_PI / 180.0f))
+			return "out of memory";
+	} else {
+		return "unknown scene keyword";
+	}
+	return NULL;
+}
+
+static bool scene_write_section(FILE *out, const void *data, size_t size) {
+	static const char zeros[SCENE_ALIGN];
+	long pad = (SCENE_ALIGN - ftell(out) % SCENE_ALIGN) % SCENE_ALIGN;
+
+	return fwrite(zeros, 1, pad, out) == (size_t)pad &&
+		(!size || fwrite(data, 1, size, out) == size);
+}
+
+static bool scene_write(const struct scene_builder *builder, FILE *out) {
+	const struct scene_array *arrays[SCENE_SECTION_COUNT] = {
+		[SCENE_TRANSFORMS] = &builder->transforms,
+		[SCENE_BOUNDS] = &builder->bounds,
+		[SCENE_MESH_IDS] = &builder->mesh_ids,
+		[SCENE_MATERIAL_IDS] = &builder->material_ids,
+		[SCENE_MESHES] = &builder->meshes,
+		[SCENE_MATERIALS] = &builder->materials,
+		[SCENE_TEXTURES] = &builder->textures,
+		[SCENE_STRINGS] = &builder->strings,
+	};
+	struct scene_header header;
+	uint64_t offset = sizeof(header);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SCENE_MAGIC, sizeof(header.magic));
+	header.version = SCENE_VERSION;
+	header.header_size = sizeof(header);
+	header.instance_count = builder->transforms.count;
+	header.mesh_count = builder->meshes.count;
+	header.material_count = builder->materials.count;
+	header.texture_count = builder->textures.count;
+	for (int i = 0; i < SCENE_SECTION_COUNT; i++) {
+		offset = (offset + SCENE_ALIGN - 1) / SCENE_ALIGN * SCENE_ALIGN;
+		header.sections[i].offset = offset;
+		header.sections[i].size =
+			arrays[i]->count * arrays[i]->element_size;
+		offset += header.sections[i].size;
+	}
+	header.file_size = offset;
+
+	if (fwrite(&header, sizeof(header), 1, out) != 1)
+		return false;
+	for (int i = 0; i < SCENE_SECTION_COUNT; i++) {
+		if (!scene_write_section(out, arrays[i]->data,
+					header.sections[i].size))
+			return false;
+	}
+	return true;
+}
+
+bool scene_convert(const char *text_path, const char *out_path,
+		const char **error) {
+	struct scene_builder builder = {
+		.transforms = {.element_size = 16 * sizeof(float)},
+		.bounds = {.element_size = sizeof(struct bvh_aabb)},
+		.mesh_ids = {.element_size = sizeof(uint32_t)},
+		.material_ids = {.element_size = sizeof(uint32_t)},
+		.meshes = {.element_size = sizeof(uint32_t)},
+		.materials = {.element_size = sizeof(uint32_t)},
+		.textures = {.element_size = sizeof(uint32_t)},
+		.strings = {.element_size = 1},
+	};
+	struct scene_array *arrays[] = {
+		&builder.transforms, &builder.bounds, &builder.mesh_ids,
+		&builder.material_ids, &builder.meshes, &builder.materials,
+		&builder.textures, &builder.strings,
+	};
+	FILE *in = fopen(text_path, "r"), *out = NULL;
+	size_t length = strlen(out_path) + 32;
+	char *tmp = malloc(length), *line = NULL;
+	size_t line_size = 0;
+	bool ok = false;
+
+	*error = NULL;
+	if (!in || !tmp) {
+		*error = "cannot open scene description";
+		goto out;
+	}
+	while (getline(&line, &line_size, in) > 0 && !*error)
+		*error = scene_parse_line(&builder, line);
+	if (*error)
+		goto out;
+	if (builder.transforms.count >= UINT32_MAX) {
+		*error = "too many instances";
+		goto out;
+	}
+
+	// Write under a temporary name so a failed conversion leaves any
+	// existing scene alone.
+	snprintf(tmp, length, "%s.%ld", out_path, (long)getpid());
+	out = fopen(tmp, "wb");
+	if (!out) {
+		*error = "cannot create scene file";
+		goto out;
+	}
+	ok = scene_write(&builder, out);
+	ok = !fclose(out) && ok;
+	if (ok && rename(tmp, out_path))
+		ok = false;
+	if (!ok) {
+		unlink(tmp);
+		*error = "cannot write scene file";
+	}
+
+out:
+	if (in)
+		fclose(in);
+	free(line);
+	free(tmp);
+	for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++)
+		free(arrays[i]->data);
+	return ok;
+}
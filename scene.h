@@ -0,0 +1,119 @@
+/*
+ * Binary scene files.
+ *
+ * A scene is a set of instances, each placing a mesh with a material, plus the
+ * mesh and texture files they refer to. The file is made to be mmapped and
+ * used as is: a header locates structure-of-arrays sections, each aligned to
+ * SCENE_ALIGN bytes and laid out exactly as the demo consumes it, so opening
+ * even a very large scene only validates the header and the IDs.
+ *
+ * All values are little endian. Sections, in file order:
+ *
+ *   TRANSFORMS    float[16] per instance, a column-major mat4x4 applied to
+ *                 the mesh once it has been fitted to the [-1, 1] box
+ *   BOUNDS        struct bvh_aabb per instance, the world space bounds of the
+ *                 transformed [-1, 1] box
+ *   MESH_IDS      uint32_t per instance
+ *   MATERIAL_IDS  uint32_t per instance
+ *   MESHES        uint32_t per mesh, offset of its path within STRINGS
+ *   MATERIALS     uint32_t per material, the index of its texture
+ *   TEXTURES      uint32_t per texture, offset of its path within STRINGS
+ *   STRINGS       NUL terminated paths
+ *
+ * scene_convert() produces the format from a line based text description:
+ *
+ *   mesh <path>
+ *   texture <path>
+ *   material <texture index>
+ *   instance <mesh> <material> <x> <y> <z> [<scale> [<yaw degrees>]]
+ *
+ * with blank lines and lines starting with '#' ignored. A scene with no meshes
+ * or no materials still uses ID 0 for them, meaning the demo's default.
+ */
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bvh.h"
+
+#define SCENE_MAGIC "VKSCENE"
+#define SCENE_VERSION 1
+#define SCENE_ALIGN 64
+
+enum scene_section {
+	SCENE_TRANSFORMS,
+	SCENE_BOUNDS,
+	SCENE_MESH_IDS,
+	SCENE_MATERIAL_IDS,
+	SCENE_MESHES,
+	SCENE_MATERIALS,
+	SCENE_TEXTURES,
+	SCENE_STRINGS,
+	SCENE_SECTION_COUNT,
+};
+
+struct scene_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint64_t file_size;
+	uint32_t instance_count;
+	uint32_t mesh_count;
+	uint32_t material_count;
+	uint32_t texture_count;
+	struct {
+		uint64_t offset;
+		uint64_t size;
+	} sections[SCENE_SECTION_COUNT];
+};
+
+/*
+ * An open scene. Every array points into the file's mapping. The mapping is
+ * private and writable, so bounds can be refitted in place without the file
+ * ever changing.
+ */
+struct scene {
+	void *map;
+	size_t map_size;
+
+	uint32_t instance_count;
+	const float (*transforms)[16];
+	struct bvh_aabb *bounds;
+	const uint32_t *mesh_ids;
+	const uint32_t *material_ids;
+
+	uint32_t mesh_count;
+	uint32_t material_count;
+	uint32_t texture_count;
+	const uint32_t *material_textures;
+	const uint32_t *mesh_paths;
+	const uint32_t *texture_paths;
+	const char *strings;
+};
+
+/*
+ * Map and validate a scene file. On failure returns false and points error at
+ * a description of the problem.
+ */
+bool scene_open(struct scene *scene, const char *path, const char **error);
+void scene_close(struct scene *scene);
+
+static inline const char *scene_mesh_path(const struct scene *scene,
+					uint32_t mesh) {
+	return scene->strings + scene->mesh_paths[mesh];
+}
+
+static inline const char *scene_texture_path(const struct scene *scene,
+					uint32_t texture) {
+	return scene->strings + scene->texture_paths[texture];
+}
+
+// Convert the text description at text_path into a scene file at out_path.
+bool scene_convert(const char *text_path, const char *out_path,
+		const char **error);
+
+#endif
@@ -0,0 +1,366 @@
+/*
+ * Transform hierarchy, see xform.h.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xform.h"
+
+// One node per lane, through GCC's generic vectors so it maps to whatever
+// SIMD the target has.
+typedef float xform_vec __attribute__((vector_size(XFORM_BATCH * sizeof(float))));
+typedef int32_t xform_ivec __attribute__((vector_size(XFORM_BATCH * sizeof(int32_t))));
+
+static const float xform_identity[16] = {
+	1.0f, 0.0f, 0.0f, 0.0f,
+	0.0f, 1.0f, 0.0f, 0.0f,
+	0.0f, 0.0f, 1.0f, 0.0f,
+	0.0f, 0.0f, 0.0f, 1.0f,
+};
+
+static xform_vec xform_load(const float *p) {
+	xform_vec v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static xform_vec xform_abs(xform_vec v) {
+	return (xform_vec)((xform_ivec)v & 0x7fffffff);
+}
+
+void xform_build(struct xform *xform, const uint32_t *parents, uint32_t count) {
+	// Padded so a batch can always load XFORM_BATCH lanes.
+	const size_t padded = count + XFORM_BATCH;
+	uint32_t *child_first = calloc(count + 1, sizeof(uint32_t));
+	uint32_t *children = malloc((count + 1) * sizeof(uint32_t));
+	uint32_t *depths = malloc((count + 1) * sizeof(uint32_t));
+	uint32_t i, slot, tail = 0;
+	int c;
+
+	memset(xform, 0, sizeof(*xform));
+	xform->count = count;
+	for (c = 0; c < 3; c++)
+		xform->translation[c] = calloc(padded, sizeof(float));
+	for (c = 0; c < 4; c++)
+		xform->rotation[c] = calloc(padded, sizeof(float));
+	xform->scale = malloc(padded * sizeof(float));
+	xform->parents = malloc(padded * sizeof(uint32_t));
+	xform->children = malloc((count + 1) * sizeof(uint32_t));
+	xform->dirty = malloc(padded);
+	xform->world = malloc(padded * sizeof(*xform->world));
+	xform->nodes = malloc(padded * sizeof(uint32_t));
+	xform->slots = malloc(padded * sizeof(uint32_t));
+	xform->levels = malloc((count + 2) * sizeof(uint32_t));
+	xform->dirty_spans = malloc((count + 1) * sizeof(*xform->dirty_spans));
+	assert(child_first && children && depths && xform->scale &&
+		xform->parents && xform->children && xform->dirty &&
+		xform->world && xform->nodes && xform->slots &&
+		xform->levels && xform->dirty_spans);
+	for (c = 0; c < 3; c++)
+		assert(xform->translation[c]);
+	for (c = 0; c < 4; c++)
+		assert(xform->rotation[c]);
+
+	// Children of each node, grouped by parent.
+	for (i = 0; i < count; i++) {
+		if (parents[i] != XFORM_ROOT) {
+			assert(parents[i] < count);
+			child_first[parents[i]]++;
+		}
+	}
+	for (i = 0, slot = 0; i <= count; i++) {
+		uint32_t n = i < count ? child_first[i] : 0;
+
+		child_first[i] = slot;
+		slot += n;
+	}
+	for (i = 0; i < count; i++) {
+		if (parents[i] != XFORM_ROOT)
+			children[child_first[parents[i]]++] = i;
+	}
+	// The fill left each entry at the next node's first child.
+	memmove(child_first + 1, child_first, count * sizeof(uint32_t));
+	child_first[0] = 0;
+
+	// Breadth-first: the roots, then the children of each slot in turn.
+	for (i = 0; i < count; i++) {
+		if (parents[i] == XFORM_ROOT) {
+			depths[tail] = 0;
+			xform->parents[tail] = XFORM_ROOT;
+			xform->nodes[tail++] = i;
+		}
+	}
+	for (slot = 0; slot < tail; slot++) {
+		const uint32_t node = xform->nodes[slot];
+
+		xform->children[slot] = tail;
+		for (i = child_first[node]; i < child_first[node + 1]; i++) {
+			depths[tail] = depths[slot] + 1;
+			xform->parents[tail] = slot;
+			xform->nodes[tail++] = children[i];
+		}
+	}
+	// Anything unreached is part of a cycle.
+	assert(tail == count);
+	xform->children[count] = count;
+
+	for (slot = 0; slot < count; slot++) {
+		xform->slots[xform->nodes[slot]] = slot;
+		if (slot == 0 || depths[slot] != depths[slot - 1])
+			xform->levels[xform->level_count++] = slot;
+	}
+	xform->levels[xform->level_count] = count;
+	for (i = 0; i < xform->level_count; i++) {
+		xform->dirty_spans[i][0] = xform->levels[i];
+		xform->dirty_spans[i][1] = xform->levels[i + 1];
+	}
+
+	for (i = 0; i < padded; i++) {
+		xform->rotation[3][i] = 1.0f;
+		xform->scale[i] = 1.0f;
+	}
+	memset(xform->dirty, 1, count);
+	memset(xform->dirty + count, 0, XFORM_BATCH);
+
+	free(child_first);
+	free(children);
+	free(depths);
+}
+
+void xform_destroy(struct xform *xform) {
+	int c;
+
+	for (c = 0; c < 3; c++)
+		free(xform->translation[c]);
+	for (c = 0; c < 4; c++)
+		free(xform->rotation[c]);
+	free(xform->scale);
+	free(xform->parents);
+	free(xform->children);
+	free(xform->dirty);
+	free(xform->world);
+	free(xform->nodes);
+	free(xform->slots);
+	free(xform->levels);
+	free(xform->dirty_spans);
+	memset(xform, 0, sizeof(*xform));
+}
+
+void xform_set_local(struct xform *xform, uint32_t node,
+		const float translation[3], const float rotation[4],
+		float scale) {
+	const uint32_t slot = xform->slots[node];
+	uint32_t lo = 0, hi = xform->level_count, *span;
+	int c;
+
+	for (c = 0; c < 3; c++)
+		xform->translation[c][slot] = translation[c];
+	for (c = 0; c < 4; c++)
+		xform->rotation[c][slot] = rotation[c];
+	xform->scale[slot] = scale;
+	xform->dirty[slot] = 1;
+
+	// The level holding the slot.
+	while (hi - lo > 1) {
+		uint32_t mid = (lo + hi) / 2;
+
+		if (xform->levels[mid] <= slot)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	span = xform->dirty_spans[lo];
+	if (span[0] >= span[1]) {
+		span[0] = slot;
+		span[1] = slot + 1;
+	} else if (slot < span[0]) {
+		span[0] = slot;
+	} else if (slot >= span[1]) {
+		span[1] = slot + 1;
+	}
+}
+
+void xform_update_begin(struct xform *xform) {
+	for (uint32_t l = 1; l < xform->level_count; l++) {
+		const uint32_t *above = xform->dirty_spans[l - 1];
+		uint32_t *span = xform->dirty_spans[l], first, last;
+
+		if (above[0] >= above[1])
+			continue;
+		// The children of the span above.
+		first = xform->children[above[0]];
+		last = xform->children[above[1]];
+		if (first >= last)
+			continue;
+		if (span[0] >= span[1]) {
+			span[0] = first;
+			span[1] = last;
+		} else {
+			if (first < span[0])
+				span[0] = first;
+			if (last > span[1])
+				span[1] = last;
+		}
+	}
+}
+
+/*
+ * Compute the world matrices of the XFORM_BATCH slots from base, writing those
+ * of the lanes marked in dirty.
+ */
+static void xform_batch(struct xform *xform, uint32_t base,
+			const uint8_t *dirty, const struct xform_output *out) {
+	const xform_vec s = xform_load(&xform->scale[base]);
+	const xform_vec qx = xform_load(&xform->rotation[0][base]);
+	const xform_vec qy = xform_load(&xform->rotation[1][base]);
+	const xform_vec qz = xform_load(&xform->rotation[2][base]);
+	const xform_vec qw = xform_load(&xform->rotation[3][base]);
+	const xform_vec x2 = qx + qx, y2 = qy + qy, z2 = qz + qz;
+	const xform_vec xx = qx * x2, yy = qy * y2, zz = qz * z2;
+	const xform_vec xy = qx * y2, xz = qx * z2, yz = qy * z2;
+	const xform_vec wx = qw * x2, wy = qw * y2, wz = qw * z2;
+	// Columns of the local and parent matrices, the bottom row being
+	// implicitly (0, 0, 0, 1).
+	xform_vec local[4][3], parent[4][3], world[4][3], model[4][3];
+	int c, r, k;
+
+	local[0][0] = (1.0f - (yy + zz)) * s;
+	local[0][1] = (xy + wz) * s;
+	local[0][2] = (xz - wy) * s;
+	local[1][0] = (xy - wz) * s;
+	local[1][1] = (1.0f - (xx + zz)) * s;
+	local[1][2] = (yz + wx) * s;
+	local[2][0] = (xz + wy) * s;
+	local[2][1] = (yz - wx) * s;
+	local[2][2] = (1.0f - (xx + yy)) * s;
+	for (r = 0; r < 3; r++)
+		local[3][r] = xform_load(&xform->translation[r][base]);
+
+	// Transpose the parents' world matrices into lanes.
+	for (k = 0; k < XFORM_BATCH; k++) {
+		const uint32_t p = dirty[k] ? xform->parents[base + k] : XFORM_ROOT;
+		const float *m = p != XFORM_ROOT ? xform->world[p] :
+			xform_identity;
+
+		for (c = 0; c < 4; c++) {
+			for (r = 0; r < 3; r++)
+				parent[c][r][k] = m[c * 4 + r];
+		}
+	}
+
+	for (c = 0; c < 4; c++) {
+		for (r = 0; r < 3; r++) {
+			world[c][r] = parent[0][r] * local[c][0] +
+				parent[1][r] * local[c][1] +
+				parent[2][r] * local[c][2];
+			if (c == 3)
+				world[c][r] += parent[3][r];
+		}
+	}
+
+	for (k = 0; k < XFORM_BATCH; k++) {
+		float *m = xform->world[base + k];
+
+		if (!dirty[k])
+			continue;
+		for (c = 0; c < 4; c++) {
+			for (r = 0; r < 3; r++)
+				m[c * 4 + r] = world[c][r][k];
+			m[c * 4 + 3] = c == 3 ? 1.0f : 0.0f;
+		}
+	}
+
+	if (out->models) {
+		for (c = 0; c < 4; c++) {
+			for (r = 0; r < 3; r++) {
+				model[c][r] = world[0][r] * out->post[c * 4] +
+					world[1][r] * out->post[c * 4 + 1] +
+					world[2][r] * out->post[c * 4 + 2];
+				if (c == 3)
+					model[c][r] += world[3][r];
+			}
+		}
+		for (k = 0; k < XFORM_BATCH; k++) {
+			float m[16];
+
+			if (!dirty[k])
+				continue;
+			for (c = 0; c < 4; c++) {
+				for (r = 0; r < 3; r++)
+					m[c * 4 + r] = model[c][r][k];
+				m[c * 4 + 3] = c == 3 ? 1.0f : 0.0f;
+			}
+			memcpy((char *)out->models +
+				xform->nodes[base + k] * out->stride, m,
+				sizeof(m));
+		}
+	}
+
+	if (out->bounds) {
+		xform_vec extent[3];
+
+		for (r = 0; r < 3; r++)
+			extent[r] = xform_abs(world[0][r]) +
+				xform_abs(world[1][r]) + xform_abs(world[2][r]);
+		for (k = 0; k < XFORM_BATCH; k++) {
+			struct bvh_aabb *bounds;
+
+			if (!dirty[k])
+				continue;
+			bounds = &out->bounds[xform->nodes[base + k]];
+			for (r = 0; r < 3; r++) {
+				bounds->min[r] = world[3][r][k] - extent[r][k];
+				bounds->max[r] = world[3][r][k] + extent[r][k];
+			}
+		}
+	}
+}
+
+void xform_update_batches(struct xform *xform, uint32_t level, uint32_t first,
+			uint32_t last, const struct xform_output *out) {
+	const uint32_t end = xform->levels[level + 1];
+	uint32_t b;
+
+	for (b = first; b < last; b++) {
+		const uint32_t base = xform->levels[level] + b * XFORM_BATCH;
+		uint8_t dirty[XFORM_BATCH] = {0};
+		bool any = false;
+
+		// A node is dirty if it or its parent changed. The lanes past
+		// the level belong to the next one and are left alone.
+		for (uint32_t k = 0; k < XFORM_BATCH && base + k < end; k++) {
+			const uint32_t p = xform->parents[base + k];
+
+			dirty[k] = xform->dirty[base + k] |
+				(p != XFORM_ROOT && xform->dirty[p]);
+			xform->dirty[base + k] = dirty[k];
+			any |= dirty[k];
+		}
+		if (any)
+			xform_batch(xform, base, dirty, out);
+	}
+}
+
+void xform_update_done(struct xform *xform) {
+	for (uint32_t l = 0; l < xform->level_count; l++) {
+		uint32_t *span = xform->dirty_spans[l];
+
+		if (span[0] < span[1])
+			memset(xform->dirty + span[0], 0, span[1] - span[0]);
+		span[0] = span[1] = 0;
+	}
+}
+
+void xform_update(struct xform *xform, const struct xform_output *out) {
+	uint32_t first, last;
+
+	xform_update_begin(xform);
+	for (uint32_t l = 0; l < xform->level_count; l++) {
+		xform_dirty_batches(xform, l, &first, &last);
+		xform_update_batches(xform, l, first, last, out);
+	}
+	xform_update_done(xform);
+}
@@ -0,0 +1,112 @@
+/*
+ * Transform hierarchy.
+ *
+ * Nodes are stored in breadth-first order as structure-of-arrays local
+ * translation, rotation and uniform scale, so each depth of the forest is a
+ * contiguous level whose parents all sit in the level before it. An update
+ * walks the levels in order. Within a level every node is independent, so a
+ * level can be split into batches of XFORM_BATCH nodes across threads, and
+ * each batch is computed with one node per SIMD lane.
+ *
+ * Changing a node marks it dirty. Since the children of consecutive slots are
+ * themselves consecutive, each level tracks the span of slots that may be
+ * dirty and an update only visits the spans below the changed nodes, skipping
+ * clean batches within them. Each updated world matrix can be streamed
+ * straight to an output such as a mapped GPU buffer.
+ *
+ * Matrices are column-major float[16], like linmath's mat4x4, and assumed to
+ * be affine.
+ */
+
+#ifndef XFORM_H
+#define XFORM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bvh.h"
+
+#define XFORM_ROOT UINT32_MAX
+#define XFORM_BATCH 4
+
+/*
+ * Where an update writes the nodes it changes, indexed by node. Either
+ * pointer may be NULL.
+ */
+struct xform_output {
+	// world * post for each node, stride bytes apart.
+	void *models;
+	size_t stride;
+	float post[16];
+	// World space bounds of the [-1, 1] box under each world matrix.
+	struct bvh_aabb *bounds;
+};
+
+struct xform {
+	uint32_t count;
+	// Local transform of each slot: translation, unit quaternion (x, y, z,
+	// w) and uniform scale.
+	float *translation[3];
+	float *rotation[4];
+	float *scale;
+	// Slot of each slot's parent, or XFORM_ROOT, and of its first child,
+	// with count + 1 entries.
+	uint32_t *parents;
+	uint32_t *children;
+	uint8_t *dirty;
+	float (*world)[16];
+	// Node of each slot, and slot of each node.
+	uint32_t *nodes;
+	uint32_t *slots;
+	// First slot of each level, with level_count + 1 entries.
+	uint32_t *levels;
+	uint32_t level_count;
+	// Slots [first, last) of each level which may be dirty.
+	uint32_t (*dirty_spans)[2];
+};
+
+/*
+ * Build a hierarchy of count nodes from the parent of each node, or
+ * XFORM_ROOT, which must form a forest. Every node starts as an identity
+ * transform and dirty.
+ */
+void xform_build(struct xform *xform, const uint32_t *parents, uint32_t count);
+void xform_destroy(struct xform *xform);
+
+void xform_set_local(struct xform *xform, uint32_t node,
+		const float translation[3], const float rotation[4],
+		float scale);
+
+/*
+ * Start an update by spreading the dirty spans down the levels. Batches
+ * [*first, *last) of each level then need updating, see xform_dirty_batches().
+ */
+void xform_update_begin(struct xform *xform);
+
+static inline void xform_dirty_batches(const struct xform *xform,
+				uint32_t level, uint32_t *first,
+				uint32_t *last) {
+	const uint32_t base = xform->levels[level];
+	const uint32_t *span = xform->dirty_spans[level];
+
+	*first = span[0] < span[1] ? (span[0] - base) / XFORM_BATCH : 0;
+	*last = span[0] < span[1] ?
+		(span[1] - base + XFORM_BATCH - 1) / XFORM_BATCH : 0;
+}
+
+/*
+ * Update batches [first, last) of a level. Levels must be updated in order,
+ * and every batch of a level must be done before the next level starts.
+ * Batches of one level may run concurrently.
+ */
+void xform_update_batches(struct xform *xform, uint32_t level, uint32_t first,
+			uint32_t last, const struct xform_output *out);
+
+// Mark everything clean once all levels are updated.
+void xform_update_done(struct xform *xform);
+
+// Update every dirty node on the calling thread.
+void xform_update(struct xform *xform, const struct xform_output *out);
+
+#endif